@@ -9,17 +9,19 @@
  * 
  */
 #include <e1000.h>
+#include <kconfig.h>
 #include <arch/interrupts.h>
 #include <pci.h>
 #include <net/net.h>
 #include <net/netdev.h>
+#include <net/skb.h>
 #include <memory.h>
 #include <serial.h>
 #include <kutils.h>
 
 #define PACKET_SIZE   2048
-#define TX_SIZE 16
-#define RX_SIZE 16
+#define TX_SIZE E1000_TX_RING_SIZE
+#define RX_SIZE E1000_RX_RING_SIZE
 #define TX_BUFF_SIZE (sizeof(struct e1000_tx_desc) * TX_SIZE)
 #define RX_BUFF_SIZE (sizeof(struct e1000_rx_desc) * RX_SIZE)
 
@@ -29,12 +31,17 @@ static volatile uint32_t *e1000;
 
 uint8_t mac[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
 
-/* Allocate space for transmit and recieve buffers. */
-static struct e1000_tx_desc tx_desc_list[TX_SIZE];
-static char* tx_buf[TX_SIZE];
+/* Allocate space for transmit and recieve buffers, rings must be 16 byte aligned. */
+static struct e1000_tx_desc tx_desc_list[TX_SIZE] __attribute__((aligned(16)));
+/* sk_buff referenced by the last descriptor of each queued packet */
+static struct sk_buff* tx_skb[TX_SIZE];
+/* Next descriptor to fill, and oldest descriptor not yet reclaimed */
+static int tx_tail = 0;
+static int tx_clean = 0;
 
-static struct e1000_rx_desc rx_desc_list[RX_SIZE];
-static char* rx_buf[RX_SIZE];
+static struct e1000_rx_desc rx_desc_list[RX_SIZE] __attribute__((aligned(16)));
+/* The NIC receives directly into sk_buff data buffers */
+static struct sk_buff* rx_skb[RX_SIZE];
 
 static int interrupts = 0;
 
@@ -49,10 +56,13 @@ static void _e1000_reset_tx_desc()
     for (int i = 0; i < TX_SIZE; i++)
     { 
 		/* Initialize transmit buffers  */
-		tx_desc_list[i].buffer_addr = (uint32_t)tx_buf[i];
+		tx_desc_list[i].buffer_addr = 0;
 		tx_desc_list[i].status  = E1000_TXD_STAT_DD;
 		tx_desc_list[i].cmd = (E1000_TXD_CMD_RS >> 24) | (E1000_TXD_CMD_EOP >> 24);
+		tx_skb[i] = NULL;
     }
+    tx_tail = 0;
+    tx_clean = 0;
 }
 /**
  * @brief Clears the recieve buffers for the e1000
@@ -63,7 +73,7 @@ static void _e1000_reset_rx_desc()
     for (int i = 0; i < RX_SIZE; i++)
     {
 		/* Initialize recv buffers  */
-		rx_desc_list[i].buffer_addr = (uint32_t)rx_buf[i];
+		rx_desc_list[i].buffer_addr = (uint32_t)rx_skb[i]->head;
     }
 }
 /**
@@ -129,8 +139,9 @@ void _e1000_rx_init()
 	E1000_DEVICE_SET(E1000_RDBAH) = 0;
 
 	E1000_DEVICE_SET(E1000_RDLEN) = RX_BUFF_SIZE;
-	E1000_DEVICE_SET(E1000_RDT) = 128-1;
+	/* Hand all but one descriptor to the NIC, head == tail means the ring is empty. */
 	E1000_DEVICE_SET(E1000_RDH) = 0;
+	E1000_DEVICE_SET(E1000_RDT) = RX_SIZE - 1;
 	
 	/* Enable RX, for more options check e1000.h */
 								   /* enable */	   /* Strip Ethernet CRC */  /* broadcast enable */  /* rx buffer size 2048 */
@@ -140,13 +151,13 @@ void _e1000_rx_init()
 static int next = 0;
 int e1000_receive(char* buffer, uint32_t size)
 {
-	int tail = E1000_DEVICE_SET(E1000_RDT);
-	if(!(rx_desc_list[next].status & E1000_RXD_STAT_DD)) /* Descriptor Done */
+	int index = next;
+	if(!(rx_desc_list[index].status & E1000_RXD_STAT_DD)) /* Descriptor Done */
 	{
 		return -1;
 	}
 
-	uint32_t length = rx_desc_list[next].length;
+	uint32_t length = rx_desc_list[index].length;
 	if(length >= PACKET_SIZE || length > size)
 	{
 		dbgprintf("[e1000] Dropping packet with length %d\n", length);
@@ -154,57 +165,204 @@ int e1000_receive(char* buffer, uint32_t size)
 		goto drop;
 	}
 
-	memcpy(buffer, rx_buf[next], length);
+	memcpy(buffer, rx_skb[index]->head, length);
 
 drop:
-	rx_desc_list[next].status = 0;
+	rx_desc_list[index].status = 0;
 	next = (next + 1) % RX_SIZE;
-	E1000_DEVICE_SET(E1000_RDT) = (tail + 1 ) % RX_SIZE;
+	/* Give the descriptor back to the NIC */
+	E1000_DEVICE_SET(E1000_RDT) = index;
 	//dbgprintf("[e1000] received %d bytes! (tail: %d) (\n", length, next);
 	return length;
 }
 
+/**
+ * @brief Hands the received sk_buff up the stack and gives the descriptor
+ * a fresh buffer from the pool, the frame is never copied.
+ * If the pool is empty the frame is dropped and the buffer is reused.
+ * @param dev e1000 netdev.
+ * @return struct sk_buff* received packet, NULL if there is none.
+ */
+static struct sk_buff* e1000_receive_skb(struct netdev* dev)
+{
+	struct sk_buff* skb = NULL;
+	int index = next;
+
+	if(!(rx_desc_list[index].status & E1000_RXD_STAT_DD)){
+		return NULL;
+	}
+
+	/* Frames above 1522 bytes are discarded by the NIC (no long packet enable), so they fit SKB_DATA_SIZE. */
+	uint32_t length = rx_desc_list[index].length;
+	if(length > SKB_DATA_SIZE){
+		dbgprintf("[e1000] Dropping packet with length %d\n", length);
+		dev->dropped++;
+		goto recycle;
+	}
+
+	struct sk_buff* fresh = skb_alloc(dev);
+	if(fresh == NULL){
+		dev->dropped++;
+		goto recycle;
+	}
+
+	skb = rx_skb[index];
+	skb->len = length;
+
+	rx_skb[index] = fresh;
+	rx_desc_list[index].buffer_addr = (uint32_t)fresh->head;
+
+recycle:
+	rx_desc_list[index].status = 0;
+	next = (next + 1) % RX_SIZE;
+	/* Give the descriptor back to the NIC */
+	E1000_DEVICE_SET(E1000_RDT) = index;
+
+	return skb;
+}
+
+/**
+ * @brief Reclaims transmit descriptors the NIC is done with,
+ * dropping the sk_buff references held for them.
+ * @return int number of reclaimed descriptors.
+ */
+static int e1000_tx_reclaim()
+{
+	int reclaimed = 0;
+
+	while(tx_clean != tx_tail && (tx_desc_list[tx_clean].status & E1000_TXD_STAT_DD)){
+		if(tx_skb[tx_clean] != NULL){
+			skb_free(tx_skb[tx_clean]);
+			tx_skb[tx_clean] = NULL;
+		}
+		tx_clean = (tx_clean + 1) % TX_SIZE;
+		reclaimed++;
+	}
+
+	return reclaimed;
+}
+
+static inline int e1000_tx_free()
+{
+	return (tx_clean - tx_tail - 1 + TX_SIZE) % TX_SIZE;
+}
+
+/**
+ * @brief Fills the next transmit descriptor.
+ * @param eop last descriptor of the packet.
+ */
+static void e1000_tx_fill(uint32_t addr, uint16_t length, int eop)
+{
+	struct e1000_tx_desc* txdesc = &tx_desc_list[tx_tail];
+
+	txdesc->buffer_addr = addr;
+	txdesc->length = length;
+	txdesc->cmd = (E1000_TXD_CMD_RS >> 24) | (eop ? (E1000_TXD_CMD_EOP >> 24) : 0);
+	txdesc->status = 0;
+
+	tx_tail = (tx_tail + 1) % TX_SIZE;
+}
+
+/**
+ * @brief Queues a sk_buff for transmit without copying.
+ * Headers and the payload fragment get a descriptor each, pointing at
+ * the sk_buff memory. A reference is held until the descriptors are reclaimed.
+ * @return int size of the frame, -ERROR_DEVICE_BUSY if the ring is full.
+ */
+static int e1000_transmit_skb(struct netdev* dev, struct sk_buff* skb)
+{
+	int descriptors = skb->frag.len > 0 ? 2 : 1;
+	int size = skb->len + skb->frag.len;
+
+	if(size >= PACKET_SIZE){
+		dbgprintf("[e1000] Size %d is too large!\n", size);
+		return -1;
+	}
+
+	ENTER_CRITICAL();
+	if(e1000_tx_free() < descriptors){
+		e1000_tx_reclaim();
+		if(e1000_tx_free() < descriptors){
+			LEAVE_CRITICAL();
+			return -ERROR_DEVICE_BUSY;
+		}
+	}
+
+	e1000_tx_fill((uint32_t)skb->head, skb->len, descriptors == 1);
+	if(descriptors == 2){
+		e1000_tx_fill((uint32_t)skb->frag.data, skb->frag.len, 1);
+	}
+	tx_skb[(tx_tail - 1 + TX_SIZE) % TX_SIZE] = skb_get(skb);
+
+	E1000_DEVICE_SET(E1000_TDT) = tx_tail;
+	LEAVE_CRITICAL();
+
+	return size;
+}
+
 /**
  * @brief Put data into correct transmit buffer for e1000
  * card to transmit. Updates tail pointer.
+ * The data is copied into a sk_buff and sent like any other.
  * 
  * @param buffer data to transmit
  * @param size of data to transmit
- * @return int size of data, returns -1 on error.
+ * @return int size of data, returns less than 0 on error.
  */
 int e1000_transmit(char* buffer, uint32_t size)
 {
-	if(size >= PACKET_SIZE){
+	if(size > SKB_DATA_SIZE){
 		dbgprintf("[e1000] Size %d is too large!\n", size);
 		return -1;
 	}
 
-	char* ptr = (char*) buffer;
-	uint16_t tail = E1000_DEVICE_GET(E1000_TDT);
+	struct sk_buff* skb = skb_alloc(&e1000_netdev);
+	if(skb == NULL) return -ERROR_ALLOC;
 
-	struct e1000_tx_desc* txdesc = &tx_desc_list[tail];
-	if(!(txdesc->status & E1000_TXD_STAT_DD)){
-		dbgprintf("[e1000] DD status is not done!\n");
-		return -1;
-	} /* Check if status is DD (Descriptor Done) */
+	memcpy(skb->head, buffer, size);
+	skb->len = size;
 
-	memcpy(tx_buf[tail], ptr, size);
-	txdesc->length = size;
-	txdesc->status &= ~E1000_TXD_STAT_DD;
-	txdesc->cmd |= E1000_TXD_CMD_EOP;
+	int ret = e1000_transmit_skb(&e1000_netdev, skb);
+	skb_free(skb);
 
-	E1000_DEVICE_SET(E1000_TDT) = (tail+1) % TX_SIZE;
+	dbgprintf("[e1000] Sending %d bytes! (tail: %d)\n", size, tx_tail);
+	return ret;
+}
 
-	dbgprintf("[e1000] Sending %d bytes! (tail: %d)\n", size, (tail+1) % TX_SIZE);
-	return size;
+#ifdef E1000_POLLING
+/**
+ * @brief Masks or unmasks the RX interrupt, used for polling.
+ * A cause raised while masked is delivered when unmasked, so no packet is missed.
+ */
+static void e1000_rx_irq(struct netdev* dev, int enable)
+{
+	if(enable){
+		E1000_DEVICE_SET(E1000_IMS) = E1000_ICR_RXT0;
+	} else {
+		E1000_DEVICE_SET(E1000_IMC) = E1000_ICR_RXT0;
+	}
 }
+#endif
 
 void __int_handler e1000_callback()
 {
-	interrupts++;
-	net_incoming_packet(&e1000_netdev);
+	uint32_t icr = E1000_DEVICE_GET(E1000_ICR);
 
-	E1000_DEVICE_GET(E1000_ICR);
+	interrupts++;
+#ifdef E1000_POLLING
+	if(icr & E1000_ICR_RXT0){
+		e1000_rx_irq(&e1000_netdev, 0);
+		net_schedule_poll(&e1000_netdev);
+	}
+#else
+	/* One interrupt can cover several packets, empty the ring */
+	for (int i = 0; i < RX_SIZE && net_incoming_packet(&e1000_netdev); i++);
+#endif
+
+	if(icr & E1000_ICR_TXDW){
+		e1000_tx_reclaim();
+		net_transmit_complete(&e1000_netdev);
+	}
 }
 
 void e1000_attach(struct pci_device* dev)
@@ -216,37 +374,45 @@ void e1000_attach(struct pci_device* dev)
 
     pci_enable_device_busmaster(dev->bus, dev->slot, dev->function);
 
-	for (int i = 0; i < TX_SIZE; i++)
-		tx_buf[i] = palloc(PACKET_SIZE);
-	
-	for (int i = 0; i < RX_SIZE; i++)
-		rx_buf[i] = palloc(PACKET_SIZE);
-
-	_e1000_tx_init();
-	_e1000_rx_init();
-
-	_e1000_mac();
-
-    /* For now.. hard code irq to 11 */
-    interrupt_install_handler(32+dev->irq, &e1000_callback);
-
-	E1000_DEVICE_SET(E1000_RDTR) = 0;
-	E1000_DEVICE_SET(E1000_RADV) = 0;
-	E1000_DEVICE_SET(E1000_IMS) = (1 << 7);
-
 	e1000_netdev = (struct netdev) {
 		.name = "E1000",
 		.driver = *dev,
 		.read = &e1000_receive,
 		.write = &e1000_transmit,
+		.read_skb = &e1000_receive_skb,
+		.write_skb = &e1000_transmit_skb,
+#ifdef E1000_POLLING
+		.rx_irq = &e1000_rx_irq,
+#endif
 		.sent = 0,
 		.received = 0,
 		.dropped = 0
 	};
 	memcpy(e1000_netdev.mac, &mac, 6);
 
-	/* very ugly temporary fix */
+	/* RX buffers come from the devices sk_buff pool */
+	skb_pool_init(&e1000_netdev.pool, NETDEV_SKB_POOL_SIZE + RX_SIZE);
+	for (int i = 0; i < RX_SIZE; i++)
+		rx_skb[i] = skb_alloc(&e1000_netdev);
+
+	_e1000_tx_init();
+	_e1000_rx_init();
+
+	_e1000_mac();
+
+    /* For now.. hard code irq to 11 */
+    interrupt_install_handler(32+dev->irq, &e1000_callback);
+
+	/* Interrupt moderation, ITR is in 256ns units. RADV bounds the delay RDTR adds. */
+	E1000_DEVICE_SET(E1000_ITR) = E1000_MAX_IRQ_RATE > 0 ? 1000000000 / (E1000_MAX_IRQ_RATE * 256) : 0;
+	E1000_DEVICE_SET(E1000_RDTR) = E1000_RX_DELAY;
+	E1000_DEVICE_SET(E1000_RADV) = E1000_RX_DELAY * 4;
+	E1000_DEVICE_SET(E1000_IMS) = E1000_ICR_RXT0 | E1000_ICR_TXDW;
+
+	/* very ugly temporary fix, current_netdev keeps its own pool */
+	struct skb_pool pool = current_netdev.pool;
 	current_netdev = e1000_netdev;
+	current_netdev.pool = pool;
 
 	net_register_netdev("eth0", &e1000_netdev);
 
@@ -5,6 +5,10 @@
  * @version 0.1
  * @date 2023-12-12
  * 
+ * Packets can be dropped and delayed to test the network stack
+ * on a bad link, see net_loopback_impair. Drops are picked by a
+ * seeded generator so runs can be repeated exactly.
+ * 
  * @copyright Copyright (c) 2023
  * 
  */
@@ -14,6 +18,9 @@
 #include <net/net.h>
 #include <memory.h>
 #include <math.h>
+#include <ktimer.h>
+#include <timer.h>
+#include <errors.h>
 
 //#undef dbgprintf
 //#define dbgprintf(...)
@@ -22,12 +29,21 @@ static struct __queue {
     struct queue_entry {
         void* data;
         int size;
+        uint32_t due;   /* tick the packet is delivered at */
     } entries[32];
     int head;
     int tail;
     unsigned int size;
 } loopback_queue = {0};
 
+/* Impairments applied to written packets */
+static struct loopback_impairment {
+    int loss;           /* packets dropped per 1000 */
+    uint32_t delay;     /* ticks each packet is held back */
+    uint32_t seed;      /* state of the loss generator */
+    struct ktimer timer;
+} impairment = {0};
+
 static int iface_loopback_read(char* buffer, uint32_t size);
 static int iface_loopback_write(char* buffer, uint32_t size);
 
@@ -41,13 +57,45 @@ static struct netdev loopback_device = {
     .mac = {0x69, 0x00, 0x00, 0x00, 0x00, 0x00}
 };
 
-/* emulating a interrupt to deliver packet */
+static int __loopback_due()
+{
+    return loopback_queue.size > 0 && (int32_t)(timer_get_tick() - loopback_queue.entries[loopback_queue.head].due) >= 0;
+}
+
+/**
+ * @brief emulating a interrupt to deliver packets
+ * Delivers every packet that is due, a single interrupt
+ * can cover several writes.
+ */
 static int iface_loopback_interrupt(void* _)
 {   
-    net_incoming_packet(&loopback_device);
+    while(__loopback_due()){
+        net_incoming_packet(&loopback_device);
+    }
+
+    if(loopback_queue.size > 0 && !impairment.timer.pending){
+        ktimer_mod(&impairment.timer, loopback_queue.entries[loopback_queue.head].due);
+    }
     return 0;
 }
 
+/* Timer callback for delayed packets, runs in the timer interrupt. */
+static void __loopback_timer(struct ktimer* timer)
+{
+    work_queue_add(&iface_loopback_interrupt, NULL, NULL);
+}
+
+/* xorshift32, deterministic for a given seed */
+static uint32_t __loopback_random()
+{
+    uint32_t x = impairment.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    impairment.seed = x;
+    return x;
+}
+
 static int iface_loopback_read(char* buffer, uint32_t size)
 {
     if(loopback_queue.size == 0)
@@ -81,24 +129,57 @@ static int iface_loopback_write(char* buffer, uint32_t size)
     if(loopback_queue.entries[loopback_queue.tail].size != 0)
         return -3;
 
+    /* Lost on the "wire", the sender sees a successful write */
+    if(impairment.loss > 0 && (int)(__loopback_random() % 1000) < impairment.loss){
+        loopback_device.dropped++;
+        return 0;
+    }
+
     char* data = (char*) kalloc(size);
     memcpy(data, buffer, size);
 
     loopback_queue.entries[loopback_queue.tail].data = data;
     loopback_queue.entries[loopback_queue.tail].size = size;
+    loopback_queue.entries[loopback_queue.tail].due = timer_get_tick() + impairment.delay;
 
     loopback_queue.tail = (loopback_queue.tail + 1) % 32;
     loopback_queue.size++;
 
     dbgprintf("Added packet to loopback queue.\n");
 
-    work_queue_add(&iface_loopback_interrupt, NULL, NULL);
+    if(impairment.delay == 0){
+        work_queue_add(&iface_loopback_interrupt, NULL, NULL);
+    } else if(!impairment.timer.pending){
+        ktimer_mod(&impairment.timer, loopback_queue.entries[loopback_queue.head].due);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Drops and delays packets written to the loopback device.
+ * All zero restores a perfect link.
+ * @param loss packets dropped per 1000.
+ * @param delay_ms time each packet is held back.
+ * @param seed seed for picking dropped packets, same seed gives the same drops.
+ * @return int 0 on success, less than 0 on invalid arguments.
+ */
+int net_loopback_impair(int loss, int delay_ms, uint32_t seed)
+{
+    if(loss < 0 || loss > 1000 || delay_ms < 0)
+        return -ERROR_INVALID_ARGUMENTS;
+
+    impairment.loss = loss;
+    impairment.delay = timer_ms_to_ticks(delay_ms);
+    impairment.seed = seed != 0 ? seed : 0x2545F491;
 
+    dbgprintf("Loopback impairment: %d/1000 loss, %d ms delay, seed 0x%x\n", loss, delay_ms, impairment.seed);
     return 0;
 }
 
 int net_init_loopback()
 {
+    ktimer_init(&impairment.timer, __loopback_timer, NULL);
     return net_register_netdev("lo0", &loopback_device);
 }
 
@@ -16,13 +16,18 @@
 #include <pcb.h>
 #include <arch/io.h>
 #include <kutils.h>
+#include <timepage.h>
+#include <ktimer.h>
 
 #define PIT_IRQ		32
 
 static unsigned long tick = 0;
+static uint32_t hz = 0;
 static void __int_handler timer_callback()
 {
 	tick++;
+	timepage_tick();
+	ktimer_run(tick);
 	$process->current->preempts++;
 	EOI(32);
 	if($process->current != NULL)
@@ -36,6 +41,16 @@ int timer_get_tick()
 	return tick;
 }
 
+/**
+ * @brief Converts milliseconds to timer ticks, rounding up.
+ * Uses 1000 Hz until the PIT has been initialized.
+ */
+int timer_ms_to_ticks(int ms)
+{
+	uint32_t frequency = hz == 0 ? 1000 : hz;
+	return (ms * frequency + 999) / 1000;
+}
+
 int time_get_difference(struct time* t1, struct time* t2)
 {
 	uint32_t time1 = (t1->hour*3600) + (t1->minute*60) + t1->second;
@@ -53,6 +68,7 @@ void init_pit(uint32_t frequency)
 	/* The value we send to the PIT is the value to divide it's input clock */
 	/* (1193180 Hz) by, to get our required frequency. */
 	
+	hz = frequency;
 	uint32_t divisor = (1193180) / frequency;
 	//uint32_t divisor = (1193180) / frequency;
 
@@ -67,5 +83,7 @@ void init_pit(uint32_t frequency)
 	outportb(0x40, l);
 	outportb(0x40, h);
 
+	timepage_start(frequency);
+
 	dbgprintf("PIT initialized.\n");
 }
\ No newline at end of file
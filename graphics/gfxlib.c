@@ -38,8 +38,7 @@ int gfx_push_event(struct window* w, struct gfx_event* e)
 		w->events.head = (w->events.head + 1) % GFX_MAX_EVENTS;
 	});
 
-	/* TODO: Check for a block reason */
-	if(w->owner->state == BLOCKED) w->owner->state = RUNNING;
+	waitqueue_wake(&w->events.wq);
 
 	return 0;
 }
@@ -115,6 +114,12 @@ int gfx_put_icon32(unsigned char icon[], int x, int y)
 	return 0;
 }
 
+static int __gfx_has_event(void* arg)
+{
+	struct window* w = arg;
+	return w->events.tail != w->events.head;
+}
+
 int gfx_event_loop(struct gfx_event* event, gfx_event_flag_t flags)
 {
 
@@ -128,9 +133,7 @@ int gfx_event_loop(struct gfx_event* event, gfx_event_flag_t flags)
 		if($process->current->gfx_window->events.tail == $process->current->gfx_window->events.head){
 			
 			if(flags & GFX_EVENT_BLOCKING){
-				/* FIXME: Should not global block, perhaps window manager block queue? */
-				$process->current->state = BLOCKED;
-				kernel_yield();
+				waitqueue_wait(&$process->current->gfx_window->events.wq, __gfx_has_event, $process->current->gfx_window, WAITQUEUE_FOREVER);
 			} else {
 				return -1;
 			}
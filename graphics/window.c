@@ -456,6 +456,7 @@ struct window* gfx_new_window(int width, int height, window_flag_t flags)
     
     w->events.head = 0;
     w->events.tail = 0;
+    waitqueue_init(&w->events.wq);
 
     w->is_maximized.state = 0;
     w->is_maximized.width = 0;
@@ -19,6 +19,7 @@
 #include <vbe.h>
 #include <colors.h>
 #include <math.h>
+#include <timepage.h>
 
 static int ws_init(struct windowserver* ws);
 static int ws_add(struct windowserver* ws, struct window* window);
@@ -317,7 +318,7 @@ static int ws_draw(struct windowserver* ws)
     
     /* get state variables */
     int mouse_changed = mouse_get_event(&ws->m);
-    get_current_time(&ws->time);
+    timepage_get_time(&ws->time);
     ws->window_changes = ws->_wm->ops->changes(ws->_wm);
     unsigned char key = kb_get_char(0);
 
@@ -51,6 +51,8 @@
 /* Recieve */
 #define E1000_ICS      0x000C8  /* Interrupt Cause Set - WO */
 #define E1000_IMS      0x000D0  /* Interrupt Mask Set - RW */
+#define E1000_IMC      0x000D8  /* Interrupt Mask Clear - WO */
+#define E1000_ITR      0x000C4  /* Interrupt Throttling Rate - RW */
 #define E1000_RDBAL    0x02800  /* RX Descriptor Base Address Low - RW */
 #define E1000_RDBAH    0x02804  /* RX Descriptor Base Address High - RW */
 #define E1000_RDLEN    0x02808  /* RX Descriptor Length - RW */
@@ -72,6 +74,10 @@
 #define E1000_RXD_STAT_DD       0x01    /* Descriptor Done */
 #define E1000_ICR      0x000C0	/* Interrupt Cause Read - R/clr */
 
+/* Interrupt causes */
+#define E1000_ICR_TXDW  0x00000001  /* Transmit desc written back */
+#define E1000_ICR_RXT0  0x00000080  /* rx timer intr (ring 0) */
+
 
 /* transmit descriptor */
 struct e1000_tx_desc
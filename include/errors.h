@@ -34,6 +34,10 @@ enum errors {
     ERROR_OPS_CORRUPTED,
     ERROR_OUT_OF_MEMORY,
     ERROR_ACCESS_DENIED,
+    ERROR_TIMEOUT,
+    ERROR_DEVICE_BUSY,
+    ERROR_HOST_NOT_FOUND,
+    ERROR_NO_ROUTE,
 };
 
 char* error_get_string(error_t err);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <gfx/events.h>
+#include <waitqueue.h>
 struct window;
 #include <gfx/component.h>
 #include <terminal.h>
@@ -81,6 +82,7 @@ struct window {
         struct gfx_event list[GFX_MAX_EVENTS];
         uint8_t head;
         uint8_t tail;
+        struct waitqueue wq;    /* processes waiting for events */
     } events;
 
     struct {
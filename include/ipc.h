@@ -4,6 +4,10 @@
 
 #include <stdint.h>
 #include <rbuffer.h>
+#include <ipc_shm.h>
+#include <waitqueue.h>
+
+struct pcb;
 
 /* IPC Message structure */
 struct ipc_message {
@@ -11,15 +15,47 @@ struct ipc_message {
     int length;          // Length of the message
 };
 
+#define IPC_CHANNEL_USERS 8
+
+/* Process using a channel, threads are accounted to their process */
+struct ipc_user {
+    int16_t pid;              // -1 if the slot is free
+    uint32_t addr;            // Address the region is mapped at, 0 if not mapped
+};
+
 /* IPC Channel structure */
 struct ipc_channel {
-    struct ring_buffer* rbuf; // Ring buffer for the IPC channel
+    struct ring_buffer* rbuf; // Ring buffer for copy channels
+
+    struct ipc_shm* shm;      // Shared region, the header is writable by userspace
+    void* memory;             // Allocation backing the shared region
+    uint8_t* ring;            // Start of the message ring
+    uint32_t size;            // Ring size, never read back from the header
+    uint32_t xfer;            // Offset of the first transfer page
+    int pages;                // Pages in the shared region
+    uint64_t xfer_used;       // Bitmap of transfer pages in use
+
+    struct ipc_user users[IPC_CHANNEL_USERS];
+    int refs;                 // Users of the channel
+    int closed;               // Closed while processes were waiting
+    struct waitqueue wq;
 };
 
 int sys_ipc_open();
+int sys_ipc_shm_open(int pages, int xfer_pages);
+int sys_ipc_shm_map(int channel);
 int sys_ipc_close(int channel);
 int sys_ipc_send(int channel, void* data, int length);
-int sys_ipc_send(int channel, void* data, int length);
 int sys_ipc_receive(int channel, void* data, int length);
+int sys_ipc_wait(int channel);
+int sys_ipc_notify(int channel);
+int sys_ipc_page_alloc(int channel, int pages);
+int sys_ipc_page_free(int channel, int offset, int pages);
+
+int ipc_poll(int channel);
+struct waitqueue* ipc_waitqueue(int channel);
+void ipc_waitqueue_release(struct waitqueue* wq);
+void ipc_poll_block(int channel);
+void ipc_release_process(struct pcb* pcb);
 
-#endif /* IPC_INTERFACE_H */
\ No newline at end of file
+#endif /* IPC_INTERFACE_H */
@@ -0,0 +1,139 @@
+#ifndef __IPC_SHM_H
+#define __IPC_SHM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Shared memory IPC ring.
+ * The region is mapped into every process using the channel, the first
+ * page holds this header, followed by the message ring and optionally
+ * pages used for page transfers. All offsets are from the start of
+ * the region, so the ring works at any mapped address.
+ *
+ * Messages are 8 byte aligned and written contiguously, a padding
+ * message is inserted when a message does not fit before the end of the ring.
+ * Single producer and single consumer, no locks, positions are
+ * published with release and observed with acquire like struct spsc_ring.
+ */
+
+#define IPC_SHM_DEFAULT_PAGES 4
+#define IPC_SHM_MAX_PAGES 64
+
+#define IPC_SHM_MSG_PAD   (1 << 0)   /* Skip to start of ring */
+#define IPC_SHM_MSG_PAGES (1 << 1)   /* Payload is a struct ipc_shm_pages */
+
+struct ipc_shm {
+    volatile uint32_t head;     /* producer position, free running */
+    volatile uint32_t tail;     /* consumer position, free running */
+    uint32_t size;              /* ring size in bytes, power of two */
+    uint32_t data;              /* offset of the ring */
+    uint32_t pages;             /* total pages in the region */
+    uint32_t xfer;              /* offset of the first transfer page */
+    volatile uint32_t waiting;  /* receiver is blocked, producer must notify */
+};
+
+struct ipc_shm_msg {
+    uint32_t length;
+    uint32_t flags;
+};
+
+/* Descriptor for payloads moved through transfer pages */
+struct ipc_shm_pages {
+    uint32_t offset;
+    uint32_t length;
+};
+
+#define IPC_SHM_ALIGN(len) (((len) + 7) & ~7)
+#define IPC_SHM_BASE(shm) ((uint8_t*)(shm) + (shm)->data)
+#define IPC_SHM_PTR(shm, offset) ((void*)((uint8_t*)(shm) + (offset)))
+
+static inline int ipc_shm_empty(struct ipc_shm* shm)
+{
+    return __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) == shm->tail;
+}
+
+/**
+ * @brief Reserves space for a message directly in the ring.
+ * @return void* pointer to write the payload to, NULL if the ring is full.
+ */
+static inline void* ipc_shm_reserve(struct ipc_shm* shm, uint32_t length)
+{
+    uint32_t total = sizeof(struct ipc_shm_msg) + IPC_SHM_ALIGN(length);
+    uint32_t head = shm->head;
+    uint32_t tail = __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE);
+    uint32_t index = head & (shm->size - 1);
+    uint32_t contiguous = shm->size - index;
+    struct ipc_shm_msg* msg;
+
+    if(total > shm->size / 2) return (void*)0;
+
+    if(contiguous < total){
+        /* Pad to the end of the ring and start over. */
+        if(shm->size - (head - tail) < contiguous + total) return (void*)0;
+
+        msg = (struct ipc_shm_msg*)(IPC_SHM_BASE(shm) + index);
+        msg->length = contiguous - sizeof(struct ipc_shm_msg);
+        msg->flags = IPC_SHM_MSG_PAD;
+        head += contiguous;
+        __atomic_store_n(&shm->head, head, __ATOMIC_RELEASE);
+        index = 0;
+    } else if(shm->size - (head - tail) < total){
+        return (void*)0;
+    }
+
+    msg = (struct ipc_shm_msg*)(IPC_SHM_BASE(shm) + index);
+    msg->length = length;
+    msg->flags = 0;
+    return msg + 1;
+}
+
+/**
+ * @brief Publishes the last reserved message.
+ * @return int 1 if the receiver is waiting and needs to be notified.
+ */
+static inline int ipc_shm_commit(struct ipc_shm* shm, uint32_t flags)
+{
+    struct ipc_shm_msg* msg = (struct ipc_shm_msg*)(IPC_SHM_BASE(shm) + (shm->head & (shm->size - 1)));
+    msg->flags = flags;
+
+    __atomic_store_n(&shm->head, shm->head + sizeof(struct ipc_shm_msg) + IPC_SHM_ALIGN(msg->length), __ATOMIC_RELEASE);
+    /* Order the head store before reading the waiting flag. */
+    __sync_synchronize();
+
+    return shm->waiting;
+}
+
+/**
+ * @brief Returns the next message in place without consuming it.
+ * @return void* payload, NULL if the ring is empty.
+ */
+static inline void* ipc_shm_peek(struct ipc_shm* shm, uint32_t* length, uint32_t* flags)
+{
+    struct ipc_shm_msg* msg;
+
+    while(!ipc_shm_empty(shm)){
+        msg = (struct ipc_shm_msg*)(IPC_SHM_BASE(shm) + (shm->tail & (shm->size - 1)));
+        if(msg->flags & IPC_SHM_MSG_PAD){
+            __atomic_store_n(&shm->tail, shm->tail + sizeof(struct ipc_shm_msg) + msg->length, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if(length) *length = msg->length;
+        if(flags) *flags = msg->flags;
+        return msg + 1;
+    }
+
+    return (void*)0;
+}
+
+/**
+ * @brief Consumes the message returned by ipc_shm_peek.
+ */
+static inline void ipc_shm_consume(struct ipc_shm* shm)
+{
+    struct ipc_shm_msg* msg = (struct ipc_shm_msg*)(IPC_SHM_BASE(shm) + (shm->tail & (shm->size - 1)));
+
+    __atomic_store_n(&shm->tail, shm->tail + sizeof(struct ipc_shm_msg) + IPC_SHM_ALIGN(msg->length), __ATOMIC_RELEASE);
+}
+
+#endif /* __IPC_SHM_H */
@@ -37,6 +37,11 @@
 #define KDEBUG_NET_UDP
 
 /* devices */
+#define E1000_RX_RING_SIZE 256      /* descriptors, multiple of 8 */
+#define E1000_TX_RING_SIZE 256      /* descriptors, multiple of 8 */
+#define E1000_MAX_IRQ_RATE 8000     /* interrupts per second, 0 disables throttling */
+#define E1000_RX_DELAY     32       /* RX interrupt delay in 1.024us units */
+#define E1000_POLLING               /* Poll the RX ring from the networking thread under load */
 
 /* fs */
 
@@ -0,0 +1,29 @@
+#ifndef __KTIMER_H
+#define __KTIMER_H
+
+#include <stdint.h>
+
+/**
+ * @brief One shot kernel timer.
+ * The callback is run from the timer interrupt once the expiry tick
+ * has passed, so it must not block. Work that can block should
+ * be handed to a kernel thread by the callback.
+ * The struct is owned by the caller, usually embedded in a larger object,
+ * and must be removed with ktimer_del before it is freed.
+ */
+struct ktimer {
+    uint32_t expires;   /* timer tick */
+    void (*callback)(struct ktimer* timer);
+    void* data;
+
+    struct ktimer* next;
+    uint8_t pending;
+};
+
+void ktimer_init(struct ktimer* timer, void (*callback)(struct ktimer* timer), void* data);
+void ktimer_mod(struct ktimer* timer, uint32_t expires);
+void ktimer_del(struct ktimer* timer);
+
+void ktimer_run(uint32_t tick);
+
+#endif /* __KTIMER_H */
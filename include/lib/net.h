@@ -24,6 +24,18 @@ extern "C" {
 
 #define INADDR_ANY 1
 
+/* Option levels, setsockopt() / getsockopt() */
+#define SOL_SOCKET  1
+
+/* Socket level options */
+#define SO_RCVBUF   8   /* int, receive buffer size in bytes */
+
+#define IPPROTO_TCP 6
+
+/* TCP level options */
+#define TCP_NODELAY 1   /* int, disables Nagle's algorithm */
+#define TCP_CORK    3   /* int, only send full segments while set */
+
 typedef unsigned short socket_t;
 typedef unsigned int socklen_t;
 typedef unsigned short sa_family_t;
@@ -55,6 +67,14 @@ struct net_buffer {
     int flags;
 };
 
+/* Arguments of the setsockopt and getsockopt system calls */
+struct net_sockopt {
+    int level;
+    int name;
+    void* value;
+    socklen_t* length;
+};
+
 struct network_info {
     unsigned short dhcp; /* state */
     unsigned int my_ip;
@@ -73,6 +93,8 @@ int recv_timeout(int socket, void *buffer, int length, int flags, int timeout);
 int send(int socket, void *message, int length, int flags);
 int sendto(int socket, void *message, int length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
 int socket(int domain, int type, int protocol);
+int setsockopt(int socket, int level, int option_name, const void *option_value, socklen_t option_len);
+int getsockopt(int socket, int level, int option_name, void *option_value, socklen_t *option_len);
 void close(int socket);
 int gethostname(char *name);
 
@@ -1,6 +1,11 @@
 #ifndef __SYSCALL_H
 #define __SYSCALL_H
 
+#include <syscall_helper.h>
+#include <timepage.h>
+#include <ipc_shm.h>
+#include <poll.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -30,6 +35,26 @@ void free(void* ptr);
 int thread_create(void* entry, void* arg, int flags);
 void yield();
 
+int syscall_stats(int op, int index, struct syscall_stat* stat);
+
+/* IPC, shared memory channels use the ipc_shm.h ring in place. */
+int ipc_open();
+int ipc_shm_open(int pages, int xfer_pages);
+struct ipc_shm* ipc_shm_map(int channel);
+int ipc_close(int channel);
+int ipc_send(int channel, void* data, int length);
+int ipc_receive(int channel, void* data, int length);
+int ipc_wait(int channel);
+int ipc_notify(int channel);
+int ipc_page_alloc(int channel, int pages);
+int ipc_page_free(int channel, int offset, int pages);
+
+int poll(struct pollfd* fds, int nfds, int timeout);
+
+/* Time helpers reading the shared time page, never trap. */
+unsigned int time_ticks();
+int clock_gettime(int clock, struct timespec* ts);
+
 
 #ifdef __cplusplus
 }
@@ -24,6 +24,10 @@ extern int kernel_size;
 #define VMEM_HEAP           0xE0000000
 #define VMEM_DATA           0x1000000
 
+/* Memory below VMEM_DATA is identity mapped in every page directory, usable for DMA. */
+#define IS_IDENTITY_MAPPED(addr, len) ((uint32_t)(addr) + (uint32_t)(len) <= VMEM_DATA)
+#define VMEM_IPC            0xC0000000
+
 #define SUPERVISOR          0
 #define PRESENT             1
 #define READ_WRITE          2
@@ -133,6 +137,9 @@ void enable_paging();
 
 /* Virtual memory API */
 void vmem_map_driver_region(uint32_t addr, int size);
+uint32_t* vmem_map_shared_page(uint32_t vaddr);
+void* vmem_map_ipc(struct pcb* pcb, uint32_t paddr, int num);
+void vmem_unmap_ipc(struct pcb* pcb, uint32_t paddr, int num);
 void vmem_init_kernel();
 
 void vmem_cleanup_process(struct pcb* pcb);
@@ -45,18 +45,68 @@ struct arp_content
     uint32_t dip;
 } __attribute__((packed));
 
+/* Neighbour cache */
+#define ARP_CACHE_SIZE      64
+#define ARP_HASH_SIZE       32      /* power of two */
+#define ARP_QUEUE_MAX       4       /* packets waiting for a reply, per neighbour */
+#define ARP_PROBE_BATCH     8       /* requests sent per aging pass */
+#define ARP_REACHABLE_MS    30000   /* confirmed entries are used without probing */
+#define ARP_GC_MS           60000   /* unused stale entries are removed */
+#define ARP_RETRANS_MS      1000
+#define ARP_MAX_PROBES      3
+#define ARP_TIMER_MS        1000
+
+typedef enum {
+	ARP_FREE,
+	ARP_INCOMPLETE,		/* request sent, packets are queued */
+	ARP_REACHABLE,
+	ARP_STALE,			/* usable, probed again when used */
+	ARP_PERMANENT
+} arp_state_t;
+
+/**
+ * @brief Neighbour cache entry, IPs are stored in network order.
+ */
 struct arp_entry
 {
 	uint8_t smac[6];
 	uint32_t sip;
-}__attribute__((packed));
+	uint8_t state;
+	uint8_t probes;
+
+	uint32_t confirmed;		/* tick of the last reply */
+	uint32_t used;			/* tick of the last lookup */
+	uint32_t probed;		/* tick of the last request */
+
+	struct net_interface* interface;
+	struct sk_buff* queue;	/* waiting for the reply, oldest first */
+	uint8_t queued;
+
+	struct arp_entry* next;	/* hash chain */
+};
+
+struct arp_stats {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t queued;
+	uint32_t dropped;
+	uint32_t requests;
+	uint32_t replies;
+	uint32_t evictions;
+};
 
 int8_t arp_parse(struct sk_buff* skb);
 int net_arp_find_entry(uint32_t ip, uint8_t* mac);
+int net_arp_queue(struct sk_buff* skb);
+int net_arp_add_permanent(uint32_t ip, uint8_t* mac);
 void net_init_arp();
 
+int net_arp_get_entries(struct arp_entry* entries, int max);
+void net_arp_get_stats(struct arp_stats* stats);
+const char* arp_state_to_str(arp_state_t state);
+
 /* For testing. */
-void net_net_arp_request();
+void net_arp_request(struct net_interface* interface, uint32_t ip);
 int net_arp_add_entry(struct arp_content* arp);
 
 #define ARP_FILL_HEADER(header, type) \
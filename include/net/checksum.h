@@ -0,0 +1,50 @@
+#ifndef __NET_CHECKSUM_H
+#define __NET_CHECKSUM_H
+
+#include <stdint.h>
+
+/**
+ * @brief Internet checksum (RFC 1071).
+ * Partial sums are kept unfolded in 32 bits and in the byte order of
+ * the data, so they can be combined before folding into the final
+ * 16 bit one's complement. Partial sums over buffers that start at an
+ * odd offset of a packet can not be combined directly.
+ */
+
+uint32_t csum_partial(const void* buf, int len, uint32_t sum);
+uint32_t csum_partial_copy(void* dst, const void* src, int len, uint32_t sum);
+uint32_t csum_pseudo(uint32_t saddr, uint32_t daddr, uint8_t proto, uint16_t len);
+
+/**
+ * @brief Adds two partial sums with end around carry.
+ */
+static inline uint32_t csum_add(uint32_t sum, uint32_t addend)
+{
+    sum += addend;
+    return sum + (sum < addend);
+}
+
+/**
+ * @brief Folds a partial sum into the final 16 bit checksum.
+ */
+static inline uint16_t csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief Updates a checksum after a 16 bit field changed (RFC 1624, eqn. 3).
+ * Values are in the same byte order as they are in the packet.
+ */
+static inline uint16_t csum_replace2(uint16_t check, uint16_t old, uint16_t new)
+{
+    uint32_t sum = (uint16_t)~check;
+
+    sum += (uint16_t)~old;
+    sum += new;
+    return csum_fold(sum);
+}
+
+#endif /* __NET_CHECKSUM_H */
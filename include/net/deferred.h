@@ -0,0 +1,29 @@
+#ifndef __NET_DEFERRED_H
+#define __NET_DEFERRED_H
+
+#include <stdint.h>
+
+/**
+ * @brief Work run on the networking thread.
+ * Queued from interrupt context, like timer callbacks, for work that
+ * transmits packets and therefore can not run in the interrupt.
+ * Embedded in the object it works on, queueing it twice runs it once.
+ */
+struct net_deferred {
+    void (*fn)(void* arg);
+    void* arg;
+
+    struct net_deferred* next;
+    uint8_t queued;
+};
+
+#define NET_DEFERRED_INIT(work, func, data) \
+    (work)->fn = (func);                    \
+    (work)->arg = (data);                   \
+    (work)->next = NULL;                    \
+    (work)->queued = 0;
+
+void net_defer(struct net_deferred* work);
+void net_defer_cancel(struct net_deferred* work);
+
+#endif /* __NET_DEFERRED_H */
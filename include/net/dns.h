@@ -11,7 +11,19 @@
 #define DNS_T_PTR 12        // domain name pointer
 #define DNS_T_MX 15         // mail server
 
-#define DNS_CACHE_ENTRIES 10
+/* Resolver cache */
+#define DNS_CACHE_SIZE      64
+#define DNS_HASH_SIZE       32      /* power of two */
+#define DNS_NAME_MAX        64
+#define DNS_MSG_MAX         512     /* UDP message size without EDNS */
+#define DNS_TTL_MIN         5       /* seconds */
+#define DNS_TTL_MAX         86400
+#define DNS_NEGATIVE_TTL    30      /* NXDOMAIN and empty answers */
+#define DNS_RETRANS_MS      1000
+#define DNS_RETRIES         3
+#define DNS_TICK_MS         250
+
+#define DNS_RCODE_NXDOMAIN  3
 
 struct dns_header
 {
@@ -58,11 +70,59 @@ struct dns_query
     struct dns_question question;
 };
 
-struct dns_cache
-{
-    char name[40];
-    uint32_t lease;
+typedef enum {
+    DNS_FREE,
+    DNS_PENDING,        /* query sent, requests wait on the entry */
+    DNS_RESOLVED,
+    DNS_NEGATIVE        /* name does not exist */
+} dns_state_t;
+
+#define DNS_REQUEST_PENDING 1
+
+/**
+ * @brief Asynchronous lookup, owned by the caller until it completes or is cancelled.
+ * status is DNS_REQUEST_PENDING until the answer arrives, then 0 with ip set
+ * in network order, or less than 0 on failure. The callback, if any, runs
+ * on the resolver thread and must not block.
+ */
+struct dns_request {
+    char name[DNS_NAME_MAX];
+    volatile int status;
+    uint32_t ip;
+
+    void (*callback)(struct dns_request* request);
+    void* arg;
+
+    struct dns_request* next;
+};
+
+struct dns_entry {
+    char name[DNS_NAME_MAX];
     uint32_t ip;
+    uint8_t state;
+    uint8_t retries;
+    uint16_t id;
+
+    uint32_t expires;       /* tick */
+    uint32_t started;       /* tick the first query was sent */
+    uint32_t sent;          /* tick of the last query */
+
+    struct dns_request* waiters;
+    struct dns_entry* next; /* hash chain */
+};
+
+struct dns_stats {
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t coalesced;     /* lookups that waited on a query already sent */
+    uint32_t queries;
+    uint32_t retransmits;
+    uint32_t answers;
+    uint32_t timeouts;
+    uint32_t failures;
+    uint32_t latency_total; /* ms, over all answers */
+    uint32_t latency_max;
 };
 
 #define DNS_REQUEST(dns) \
@@ -85,5 +145,13 @@ struct dns_cache
 void net_init_dns();
 int gethostname(char* hostname);
 
+int dns_resolve(struct dns_request* request, const char* hostname, void (*callback)(struct dns_request* request), void* arg);
+int dns_request_poll(struct dns_request* request);
+void dns_request_cancel(struct dns_request* request);
+
+int dns_get_entries(struct dns_entry* entries, int max);
+void dns_get_stats(struct dns_stats* stats);
+const char* dns_state_to_str(dns_state_t state);
+
 
 #endif /* DNS_H */
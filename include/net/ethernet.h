@@ -5,6 +5,7 @@
 
 #define ETHER_HDR_LENGTH 14
 #define MAC_SIZE 6
+#define ETHERNET_MTU 1500
 #define IP 0x0800
 #define ARP 0x0806
 #define RARP 0x8035
@@ -0,0 +1,114 @@
+#ifndef __NET_FIREWALL_H
+#define __NET_FIREWALL_H
+
+#include <stdint.h>
+#include <errors.h>
+
+struct sk_buff;
+
+#define FIREWALL_MAX_RULES          32
+#define FIREWALL_PORT_HASH          16      /* power of two */
+#define FIREWALL_CONNTRACK_SIZE     128
+#define FIREWALL_CONNTRACK_HASH     64      /* power of two */
+
+/* Connection tracking timeouts */
+#define FIREWALL_TIMEOUT_NEW_MS         30000
+#define FIREWALL_TIMEOUT_TCP_MS         300000
+#define FIREWALL_TIMEOUT_UDP_MS         60000
+#define FIREWALL_TIMEOUT_ICMP_MS        10000
+#define FIREWALL_TIMEOUT_CLOSING_MS     10000
+
+/**
+ * Rejected incoming packets are answered with a TCP RST, or an ICMP port
+ * unreachable for other protocols. Rejected outgoing packets fail with
+ * -ERROR_ACCESS_DENIED, like dropped ones.
+ */
+typedef enum __firewall_policy_t {
+    FIREWALL_POLICY_ACCEPT,
+    FIREWALL_POLICY_DROP,
+    FIREWALL_POLICY_REJECT,
+} firewall_policy_t;
+
+typedef enum __firewall_direction_t {
+    FIREWALL_IN = 1 << 0,
+    FIREWALL_OUT = 1 << 1,
+    FIREWALL_ANY = FIREWALL_IN | FIREWALL_OUT
+} firewall_direction_t;
+
+/**
+ * @brief A filter rule, addresses and ports in host order.
+ * A mask, port or protocol of 0 matches anything.
+ * Rules are evaluated in order and the first match decides.
+ */
+struct net_firewall_rule {
+    firewall_policy_t policy;
+    firewall_direction_t direction;
+
+    uint32_t src_ip;
+    uint32_t src_mask;
+
+    uint32_t dst_ip;
+    uint32_t dst_mask;
+
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;
+
+    uint32_t hits;
+};
+
+typedef enum {
+    FIREWALL_CONN_FREE,
+    FIREWALL_CONN_NEW,          /* only seen in the direction it was opened */
+    FIREWALL_CONN_ESTABLISHED,  /* seen in both directions */
+    FIREWALL_CONN_CLOSING       /* TCP FIN or RST seen */
+} firewall_conn_state_t;
+
+/**
+ * @brief Tracked flow, in the direction of its first packet.
+ */
+struct firewall_conn {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t protocol;
+    uint8_t direction;
+    uint8_t state;
+
+    uint32_t expires;
+    uint32_t packets;
+    struct firewall_conn* next;
+};
+
+struct firewall_stats {
+    int accepted;
+    int dropped;
+    int rejected;
+    int evaluated;      /* packets that went through the rules */
+    int tracked;        /* packets accepted by connection tracking */
+    int conns;
+    int conns_evicted;
+};
+
+struct net_firewall;
+
+struct net_firewall* net_firewall_create();
+void net_init_firewall();
+
+firewall_policy_t net_firewall_filter(struct sk_buff* skb, firewall_direction_t direction);
+
+error_t net_firewall_add_rule(struct net_firewall_rule* rule, int position);
+error_t net_firewall_del_rule(int index);
+error_t net_firewall_set_policy(firewall_direction_t direction, firewall_policy_t policy);
+firewall_policy_t net_firewall_get_policy(firewall_direction_t direction);
+void net_firewall_flush();
+
+int net_firewall_get_rules(struct net_firewall_rule* rules, int max);
+int net_firewall_get_conns(struct firewall_conn* conns, int max);
+void net_firewall_get_stats(struct firewall_stats* stats);
+
+const char* firewall_policy_to_str(firewall_policy_t policy);
+const char* firewall_conn_state_to_str(firewall_conn_state_t state);
+
+#endif /* __NET_FIREWALL_H */
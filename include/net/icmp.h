@@ -5,8 +5,12 @@
 #include <net/skb.h>
 
 #define ICMP_REPLY 0x00
+#define ICMP_DEST_UNREACHABLE 0x03
 #define ICMP_V4_ECHO 0x08
 
+/* Destination unreachable codes */
+#define ICMP_PORT_UNREACHABLE 0x03
+
 struct icmp {
     uint8_t type;
     uint8_t code;
@@ -12,9 +12,11 @@ typedef enum {
 } net_iface_state_t;
 
 struct net_interface;
+struct sk_buff;
 
 struct net_interface_ops {
     int (*send)(struct net_interface* interface, void* buffer, uint32_t size);
+    int (*send_skb)(struct net_interface* interface, struct sk_buff* skb);
     int (*recieve)(struct net_interface* interface, void* buffer, uint32_t size);
     int (*assign)(struct net_interface* interface, uint32_t ip);
     int (*attach)(struct net_interface* interface, struct netdev* device);
@@ -35,6 +37,7 @@ struct net_interface {
     uint32_t gateway;
     char name[16];
     uint32_t ip;
+    uint16_t mtu;
 };
 
 struct net_interface* net_interface_create();
@@ -65,22 +65,48 @@ void net_destroy(struct net* net);
 
 /* legacy  */
 
+#define NET_BATCH_HIST 7
+
 struct net_info {
     int dropped;
     int sent;
     int recvd;
+
+    /* sk_buff pool, summed over all devices */
+    int pool_hits;
+    int pool_misses;
+    int pool_free;
+
+    /* Networking loop iterations that did work, and packets handled per iteration */
+    int batches;
+    int rx_batched;
+    int tx_batched;
+    int rx_batch_max;
+    int tx_batch_max;
+    /* Iterations by packets handled: 0, 1, 2-3, 4-7, ... NET_BATCH_HIST-1 buckets and more */
+    int rx_batch_hist[NET_BATCH_HIST];
+    int tx_batch_hist[NET_BATCH_HIST];
+
+    /* TCP acknowledgements, see struct tcp_stats */
+    int tcp_data_segs_in;
+    int tcp_acks_out;
+    int tcp_acks_delayed;
 };
 error_t net_get_info(struct net_info* info);
 
-void __callback net_incoming_packet(struct netdev* dev);
+int __callback net_incoming_packet(struct netdev* dev);
+void __callback net_transmit_complete(struct netdev* dev);
+void __callback net_schedule_poll(struct netdev* dev);
 int net_register_interface(struct net_interface* interface);
 int net_send_skb(struct sk_buff* skb);
 
 int net_configure_iface(char* dev, uint32_t ip, uint32_t netmask, uint32_t gateway);
 struct net_interface* net_get_iface(uint32_t ip);
+struct net_interface* net_get_iface_by_name(char* name);
 struct net_interface** net_get_interfaces();
 /* defined in loopback.c */
 int net_init_loopback();
+int net_loopback_impair(int loss, int delay_ms, uint32_t seed);
 int net_list_ifaces();
 
 void kernel_sock_cleanup(struct sock* socket);
@@ -96,5 +122,8 @@ error_t kernel_send(struct sock* socket, void *message, int length, int flags);
 error_t kernel_sendto(struct sock* socket, const void *message, int length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
 struct sock* kernel_socket_create(int domain, int type, int protocol);
 void kernel_sock_close(struct sock* socket);
+error_t kernel_sock_shutdown(struct sock* socket, int how);
+error_t kernel_setsockopt(struct sock* socket, int level, int name, const void* value, socklen_t length);
+error_t kernel_getsockopt(struct sock* socket, int level, int name, void* value, socklen_t* length);
 
 #endif /* __NET_H */
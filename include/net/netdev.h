@@ -5,6 +5,23 @@
 #include <pci.h>
 
 #define MAX_NETDEV_NAME_SIZE 20
+#define NETDEV_SKB_POOL_SIZE 32
+
+struct sk_buff;
+
+/**
+ * @brief Free list of preallocated sk_buffs with data buffers.
+ * Allocations fall back to kalloc when the pool is empty (a miss),
+ * freed sk_buffs are returned to the pool until it is full again.
+ */
+struct skb_pool {
+    struct sk_buff* free;
+    int count;
+    int size;
+
+    uint32_t hits;
+    uint32_t misses;
+};
 
 /**
  * @brief Main struct that keeps track of a network interface card, especially its stats and read / write functions.
@@ -19,10 +36,27 @@ struct netdev {
 
     uint8_t mac[6];
 
+    struct skb_pool pool;
+
     struct pci_device driver;
 
     int32_t (*read)(char* buffer, uint32_t size);
     int32_t (*write)(char* buffer, uint32_t size);
+
+    /* Optional, returns a filled sk_buff without copying, NULL if no packet */
+    struct sk_buff* (*read_skb)(struct netdev* dev);
+    /* Optional, transmits from the sk_buff memory, holds a reference until sent.
+     * Returns -ERROR_DEVICE_BUSY when the transmit ring is full. */
+    int (*write_skb)(struct netdev* dev, struct sk_buff* skb);
+
+    /**
+     * Optional NAPI style polling, the interrupt handler masks RX interrupts
+     * and calls net_schedule_poll(). The networking thread drains the ring
+     * with read_skb and re-enables interrupts once it is empty.
+     */
+    void (*rx_irq)(struct netdev* dev, int enable);
+    volatile uint8_t poll_scheduled;
+    uint32_t polls;
 };
 extern struct netdev current_netdev;  
 
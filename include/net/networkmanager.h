@@ -9,6 +9,16 @@
 #include <net/skb.h>
 #include <net/ethernet.h>
 #include <pcb.h>
+#include <waitqueue.h>
+#include <net/deferred.h>
+
+/* Senders block when this many sk_buffs are waiting to be transmitted */
+#define NETD_TX_QUEUE_MAX 64
+/* Packets drained from a polled device before other work is done */
+#define NETD_POLL_BUDGET 64
+/* Packets parsed and transmitted per loop iteration */
+#define NETD_RX_BATCH 32
+#define NETD_TX_BATCH 32
 
 enum NETD_STATES {
     NETD_UNINITIALIZED,
@@ -32,6 +42,13 @@ struct networkmanager {
     struct skb_queue* skb_tx_queue;
     struct skb_queue* skb_rx_queue;
 
+    /* sk_buff the device had no room for, retried after TX completion */
+    struct sk_buff* tx_pending;
+    struct waitqueue tx_wq;
+
+    /* Work queued by net_defer() */
+    struct net_deferred* deferred;
+
     struct net_info stats;
 
     struct network_manager_ops* ops;
@@ -2,7 +2,58 @@
 #define ROUTING_H
 
 #include <stdint.h>
+#include <errors.h>
 
-uint32_t route(uint32_t destination);
+struct net_interface;
+
+#define ROUTE_MAX           64
+#define ROUTE_CACHE_SIZE    32      /* power of two */
+
+/* Default metrics, lower is preferred for the same prefix */
+#define ROUTE_METRIC_CONNECTED  0
+#define ROUTE_METRIC_STATIC     1
+#define ROUTE_METRIC_DHCP       100
+
+/* Route flags */
+#define ROUTE_CONNECTED     (1 << 0)  /* network of a configured interface */
+#define ROUTE_GATEWAY       (1 << 1)  /* next hop is the gateway, not the destination */
+#define ROUTE_STATIC        (1 << 2)  /* added with route add */
+#define ROUTE_DHCP          (1 << 3)  /* default route learned by DHCP */
+
+/**
+ * @brief A route to prefix/len, all addresses in host order.
+ * Routes with the same prefix are kept sorted by metric.
+ */
+struct route {
+    uint32_t prefix;
+    uint32_t gateway;
+    uint32_t metric;
+    uint32_t uses;
+    uint8_t len;
+    uint8_t flags;
+    struct net_interface* interface;
+    struct route* next;
+};
+
+struct route_stats {
+    int lookups;
+    int cache_hits;
+    int unreachable;
+    int routes;
+    int nodes;
+};
+
+struct net_interface* route_lookup(uint32_t destination, uint32_t* next_hop);
+int route_is_onlink(struct net_interface* interface, uint32_t ip);
+
+error_t route_add(uint32_t prefix, uint8_t len, uint32_t gateway, struct net_interface* interface, uint32_t metric, uint8_t flags);
+error_t route_del(uint32_t prefix, uint8_t len, uint32_t gateway);
+int route_flush(struct net_interface* interface, uint8_t flags);
+void route_invalidate();
+
+int route_get_entries(struct route* routes, int max);
+void route_get_stats(struct route_stats* stats);
+uint32_t route_len_to_mask(uint8_t len);
+uint8_t route_mask_to_len(uint32_t mask);
 
 #endif /* ROUTING_H */
@@ -34,6 +34,32 @@ struct sk_buff {
     uint8_t* end;
 
     struct net_interface* interface;
+    uint32_t arp_ip;        /* Next hop without a MAC yet, the packet waits in the ARP cache */
+
+    /* Payload outside the buffer, transmitted as its own descriptor */
+    struct {
+        uint8_t* data;
+        uint16_t len;
+        struct sk_buff* owner;  /* Referenced while the fragment is in use, may be NULL */
+    } frag;
+
+    /* Sequence space of a segment on a TCP retransmission queue */
+    struct {
+        uint32_t seq;
+        uint32_t end_seq;
+        uint32_t sent;          /* Timer tick of the first transmission */
+        uint8_t push;
+        uint8_t syn;            /* SYN and FIN take a sequence number each, without payload */
+        uint8_t fin;
+        uint8_t retransmitted;  /* Not used for RTT samples, Karn's algorithm */
+        uint8_t sacked;         /* Selectively acknowledged by the receiver */
+    } seg;
+
+    /* Buffer management, not touched by the protocols */
+    uint8_t* buffer;        /* Start of the data buffer, head - SKB_HEADROOM */
+    struct skb_pool* pool;  /* Pool the skb is returned to, NULL if not pooled */
+    struct sk_buff* shared; /* Clones point to the skb owning the buffer */
+    int refs;
 };
 
 struct skb_queue;
@@ -53,28 +79,45 @@ struct skb_queue {
 	int size; /***/
 };
 
-#define SKB_QUEUE_READY(queue) queue->size > 0
+#define SKB_QUEUE_READY(queue) ((queue)->size > 0)
 
 struct skb_queue* skb_new_queue();
 void skb_free_queue(struct skb_queue* queue);
 
+/* Data buffer size and space reserved in front of it for prepending headers. */
+#define SKB_DATA_SIZE 0x600
+#define SKB_HEADROOM 64
+
 struct sk_buff* skb_new();
+struct sk_buff* skb_alloc(struct netdev* dev);
+struct sk_buff* skb_get(struct sk_buff* skb);
+struct sk_buff* skb_clone(struct sk_buff* skb);
+struct sk_buff* skb_consume(struct sk_buff* skb);
 void skb_free(struct sk_buff* skb);
-
-#define ALLOCATE_SKB(skb)               \
-    (skb)->data = kalloc(0x600);         \
-    memset((skb)->data, 0, 0x600);       \
-    (skb)->head = skb->data;            \
-    (skb)->tail = skb->head;            \
-    (skb)->end = skb->head+0x600;       \
+int skb_linearize(struct sk_buff* skb);
+
+int skb_pool_init(struct skb_pool* pool, int size);
+
+/**
+ * @brief Prepends len bytes in the headroom.
+ * @return uint8_t* start of the prepended space, NULL if there is no headroom left.
+ */
+static inline uint8_t* skb_push(struct sk_buff* skb, int len)
+{
+    if(skb->head - len < skb->buffer) return NULL;
+
+    skb->head -= len;
+    skb->len += len;
+    return skb->head;
+}
+
+#define ALLOCATE_SKB(skb)                       \
+    (skb)->head = (skb)->buffer + SKB_HEADROOM; \
+    (skb)->data = (skb)->head;                  \
+    (skb)->tail = (skb)->head;                  \
+    (skb)->end = (skb)->head + SKB_DATA_SIZE;   \
     (skb)->len = 0;
 
-#define FREE_SKB(skb)           \
-    if((skb)->head != NULL)     \
-        kfree((skb)->head);      \
-    (skb)->len = -1;            \
-    (skb)->head = NULL;
-
 #include <net/arp.h>
 #include <net/ipv4.h>
 #include <net/icmp.h>
@@ -6,6 +6,8 @@ struct sock;
 #include <libc.h>
 #include <errors.h>
 #include <sync.h>
+#include <rbuffer.h>
+#include <waitqueue.h>
 #include <net/skb.h>
 #include <lib/net.h>
 #include <pcb.h>
@@ -32,15 +34,34 @@ struct sock {
     uint16_t bound_ip;
 
     struct skb_queue* skb_queue;
+
+    /* Listening TCP sockets, connections are chained through queue_next */
     volatile struct _backlog {
-        struct skb_queue* queue;
+        struct sock* syn_queue;     /* SYN received, handshake not completed */
+        int syn_count;
+        struct sock* accept_head;   /* Established, waiting for accept */
+        struct sock* accept_tail;
         int count;
-        int size;
+        int size;                   /* accept queue limit, set by listen */
+        uint32_t syn_overflows;     /* SYNs dropped, SYN queue full */
+        uint32_t accept_overflows;  /* handshakes not completed, accept queue full */
     } backlog;
+    struct sock* parent;            /* listener of a connection not yet accepted */
+    struct sock* queue_next;
 
-    struct ring_buffer* recv_buffer;
+    /* Datagrams are copied into recv_buffer, streams queue their skbs in skb_queue */
+    struct spsc_ring* recv_buffer;
 	signal_value_t data_ready;
 	uint32_t recvd;
+    struct sockaddr_in recv_from;   /* sender of the datagram in recv_buffer */
+
+    /* Stream receive buffer size, grown while the reader keeps up unless set with SO_RCVBUF */
+    uint32_t rcvbuf;
+    uint8_t rcvbuf_locked;
+    struct {
+        uint32_t copied;    /* bytes read during the current round trip */
+        uint32_t start;     /* tick the round started */
+    } rcvbuf_tune;
 
     /* address info of remote socket */
     struct sockaddr_in recv_addr;
@@ -48,22 +69,37 @@ struct sock {
     /* if tcp socket */
     struct tcp_connection* tcp;
 
-    /* Should be a queue? Can multiple pcbs read from same socket? */
-    volatile struct pcb* waiting;
+    /* Processes waiting for data, connections or close (read, accept, poll) */
+    struct waitqueue wq;
     struct pcb* owner;
 
-    struct sock* accept_sock;
+    /* Demultiplexing hash chain, see net_sock_hash */
+    struct sock* hash_next;
+    struct sock** hash_bucket;
 };
 
 #include <net/tcp.h>
 
+/* The socket table starts at NET_NUMBER_OF_SOCKETS entries and doubles up to NET_SOCKETS_MAX */
 #define NET_NUMBER_OF_SOCKETS 128
+#define NET_SOCKETS_MAX 4096
+
+/* Buckets of the demultiplexing tables, powers of two */
+#define NET_SOCK_HASH_SIZE 1024     /* TCP connections by local port, remote ip and port */
+#define NET_SOCK_PORT_HASH_SIZE 64  /* Listening TCP and UDP sockets by local port */
 #define NET_DYNAMIC_PORT_START 49152
 #define NET_NUMBER_OF_DYMANIC_PORTS 16383
 
 #define NET_MAX_BUFFER_SIZE 4096*4
 
+/* Stream receive buffer limits */
+#define NET_SOCK_RCVBUF_DEFAULT NET_MAX_BUFFER_SIZE
+#define NET_SOCK_RCVBUF_MIN 2048
+#define NET_SOCK_RCVBUF_MAX (256*1024)
+
 void net_sock_bind(struct sock* socket, unsigned short port, unsigned int ip);
+void net_sock_hash(struct sock* sock);
+void net_sock_unhash(struct sock* sock);
 int net_sock_read_skb(struct sock* socket);
 
 int net_get_sockets(struct sockets* sockets);
@@ -72,17 +108,22 @@ void net_init_sockets();
 int get_total_sockets();
 
 error_t net_sock_is_established(struct sock* sk);
-error_t net_sock_awaiting_ack(struct sock* sk);
 error_t net_sock_data_ready(struct sock* sk, unsigned int length);
 error_t net_sock_add_data(struct sock* sock, struct sk_buff* skb);
+void net_sock_add_stream(struct sock* sock, struct sk_buff* skb);
+uint32_t net_sock_rcvbuf_space(struct sock* sock);
+error_t net_sock_set_rcvbuf(struct sock* sock, int size);
 
 struct sock* sock_get(socket_t id);
 
 error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length);
+error_t net_sock_read_from(struct sock* sock, uint8_t* buffer, unsigned int length, struct sockaddr_in* from);
+error_t net_sock_wait_data(struct sock* sock, unsigned int length, int ticks);
+int net_sock_poll(struct sock* sock);
 
 struct sock* sock_find_listen_tcp(uint16_t d_port);
 
-int net_sock_accept(struct sock* sock, struct sock* new);
+struct sock* net_sock_accept(struct sock* sock);
 int net_prepare_tcp_sock(struct sock* sock, uint16_t port, struct sockaddr_in* addr);
 struct sock* net_sock_find_tcp(uint16_t s_port, uint16_t d_port, uint32_t ip);
 struct sock* net_socket_find_udp(uint32_t ip, uint16_t port);
@@ -5,13 +5,15 @@
 #include <libc.h>
 #include <sync.h>
 #include <rbuffer.h>
+#include <ktimer.h>
+#include <net/deferred.h>
+#include <net/tcp_cong.h>
 
 /* TCP STATES */
 typedef enum {
 	TCP_CREATED,
 	TCP_CLOSED,	    /* represents no connection state at all. */
 	TCP_LISTEN,    	/* represents waiting for a connection request from any remote TCP and port. */
-	TCP_WAIT_ACK,
 	TCP_SYN_RCVD, 	/* represents waiting for a confirming connection request acknowledgment after having both received and sent a connection request. */
 	TCP_SYN_SENT, 	/* represents waiting for a matching connection request after having sent a connection request. */
 	/* Between SYN_SENT and ESTABLISHED a new socket is created. */
@@ -27,16 +29,25 @@ typedef enum {
 	
 } tcp_state_t;
 
+struct tcb;
+
 struct tcp_connection {
 	volatile tcp_state_t state;
 
-	uint32_t sequence;
-	uint32_t acknowledgement;
+	/* Sequence variables, send window and retransmission queue */
+	struct tcb* tcb;
 
-	uint32_t retransmits;
+	uint32_t retransmits;	/* total segments retransmitted */
+	uint32_t retries;		/* timeouts since the last acknowledged data */
 	uint32_t tcpi_snd_mss;
 	uint32_t tcpi_rcv_mss;
 
+	/* Send options, TCP_NODELAY and TCP_CORK */
+	uint8_t nodelay;	/* send small segments while data is unacknowledged */
+	uint8_t cork;		/* only send full segments until uncorked */
+
+	uint32_t syn_received;	/* tick the SYN arrived, expires from the SYN queue */
+
 	uint32_t* last_data_sent;
 	uint32_t* last_ack_sent;
 
@@ -53,7 +64,93 @@ struct tcp_connection {
 
 #include <net/socket.h>
 
-#define TCP_MSS        512
+/* MSS assumed when the peer sends no MSS option, RFC 1122 */
+#define TCP_DEFAULT_MSS 536
+/* IP and TCP headers without options */
+#define TCP_IP_HEADERS 40
+
+/* Option kinds */
+#define TCP_OPT_END       0
+#define TCP_OPT_NOP       1
+#define TCP_OPT_MSS       2
+#define TCP_OPT_WSCALE    3
+#define TCP_OPT_SACK_PERM 4
+#define TCP_OPT_SACK      5
+#define TCP_OPT_TIMESTAMP 8
+
+#define TCP_OPT_MAX_LEN   40
+#define TCP_OPT_TIMESTAMP_LEN 12 /* aligned with two NOPs */
+#define TCP_WSCALE_MAX    14
+
+/* Options negotiated on the SYN, struct tcb options */
+#define TCP_OPTION_WSCALE     (1 << 0)
+#define TCP_OPTION_TIMESTAMPS (1 << 1)
+#define TCP_OPTION_SACK       (1 << 2)
+
+/* Selective acknowledgements, RFC 2018 */
+#define TCP_SACK_MAX_BLOCKS 4
+struct tcp_sack_block {
+	uint32_t start;
+	uint32_t end;		/* first sequence number after the block */
+};
+
+/* Options found in an incoming segment */
+struct tcp_options {
+	uint8_t flags;		/* TCP_OPTION_* present, TCP_OPTION_MSS if the MSS was given */
+	uint16_t mss;
+	uint8_t wscale;
+	uint32_t ts_val;
+	uint32_t ts_ecr;
+	uint8_t sack_count;
+	struct tcp_sack_block sack[TCP_SACK_MAX_BLOCKS];
+};
+#define TCP_OPTION_MSS (1 << 7)
+
+/* Segments kept for retransmission, bounds the data in flight */
+#define TCP_RETRANSMIT_QUEUE_MAX 32
+/* Data written by the application and not yet sent */
+#define TCP_SNDBUF_SIZE (16*1024)
+/* Segments received ahead of RCV.NXT kept for reassembly */
+#define TCP_OOO_MAX 32
+/**
+ * Retransmission timeout bounds, RFC 6298.
+ * The minimum is lower than the RFCs 1 second, like most stacks, as
+ * our links are mostly local.
+ */
+#define TCP_RTO_INITIAL_MS 1000
+#define TCP_RTO_MIN_MS 200
+#define TCP_RTO_MAX_MS 60000
+/* Timeouts without progress before the connection is dropped */
+#define TCP_MAX_RETRIES 8
+/* A connect waits this long for the handshake, the SYN is resent 3 times */
+#define TCP_CONNECT_TIMEOUT_MS 10000
+/* A close waits at most this long for the peer to close its side */
+#define TCP_CLOSE_TIMEOUT_MS 10000
+/**
+ * Listen queues. The accept queue limit is the listen backlog, the SYN
+ * queue limit is shared by all listeners, see tcp_set_syn_backlog.
+ * Handshakes not completed within TCP_SYN_RCVD_TIMEOUT_MS are dropped.
+ */
+#define TCP_BACKLOG_MAX 128
+#define TCP_SYN_BACKLOG_DEFAULT 64
+#define TCP_SYN_BACKLOG_MAX 1024
+#define TCP_SYN_RCVD_TIMEOUT_MS 3000
+/**
+ * Delayed acknowledgements, RFC 1122 4.2.3.2 and RFC 5681 4.2.
+ * Every second full sized segment is acknowledged at once, otherwise the
+ * acknowledgement goes out with the next data segment or when the timer expires.
+ * The first segments of a connection are acknowledged immediately so
+ * slow start at the sender is not held back.
+ */
+#define TCP_DELACK_MS 40
+#define TCP_DELACK_SEGMENTS 2
+#define TCP_QUICKACK_SEGMENTS 8
+
+/* Sequence number comparisons, handle wrap around */
+#define TCP_SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define TCP_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define TCP_SEQ_GT(a, b)  ((int32_t)((a) - (b)) > 0)
+#define TCP_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
 
 
 #define TCP_HTONS(hdr) \
@@ -121,8 +218,9 @@ struct tcb {
 	uint16_t sport;
 	uint32_t sip;
 
-	struct ring_buffer* rbuf;
-	struct ring_buffer* sbuf;
+	struct spsc_ring* sbuf;		/* send buffer, written by the application, sent by the networking thread */
+	struct net_deferred output_work;
+	uint8_t fin_pending;		/* closed by the application, the FIN follows the buffered data */
 
 	struct skb_queue* retransmit;
 	
@@ -154,22 +252,92 @@ struct tcb {
 	uint32_t seq_wnd;	/* segment sequence number + segment length */
 	uint32_t seq_up;
 	uint32_t seq_prc;
+
+	/* Retransmission timer, RFC 6298 */
+	struct ktimer rto_timer;
+	struct net_deferred rto_work; /* Retransmits on the networking thread */
+	uint32_t srtt;		/* smoothed round trip time, ticks scaled by 8 */
+	uint32_t rttvar;	/* round trip time variation, ticks scaled by 4 */
+	uint32_t rto;		/* retransmission timeout in ticks */
+
+	/* Options, RFC 7323 */
+	uint8_t options;	/* TCP_OPTION_* agreed on by both sides */
+	uint8_t snd_wscale;	/* shift applied to windows received */
+	uint8_t rcv_wscale;	/* shift applied to windows sent */
+	uint32_t ts_recent;	/* last timestamp received, echoed back */
+
+	/* Congestion control, RFC 5681, windows in bytes */
+	struct tcp_congestion_ops* cong;
+	tcp_ca_state_t ca_state;
+	uint32_t cwnd;		/* congestion window */
+	uint32_t ssthresh;	/* slow start threshold */
+	uint32_t dupacks;	/* duplicate acknowledgements in a row */
+	uint32_t recover;	/* SND.NXT when recovery started, RFC 6582 */
+
+	/* SACK scoreboard of the retransmission queue, RFC 6675 */
+	uint32_t sacked_out;	/* bytes SACKed above SND.UNA */
+	uint32_t lost_out;		/* bytes considered lost and not yet resent */
+	uint32_t high_sacked;	/* end of the highest SACKed segment */
+	uint32_t high_rxt;		/* end of the last segment resent during recovery */
+
+	/* Out-of-order segments sorted by sequence number, linked by skb->next */
+	struct sk_buff* ooo;
+	uint32_t ooo_count;
+	uint32_t sack_last;		/* sequence number of the last out-of-order segment */
+	uint8_t sack_count;
+	struct tcp_sack_block sack[TCP_SACK_MAX_BLOCKS];	/* blocks reported to the peer */
+
+	/* Delayed acknowledgements */
+	struct ktimer delack_timer;
+	struct net_deferred delack_work;	/* Sends the acknowledgement on the networking thread */
+	uint32_t rcv_acked;		/* RCV.NXT sent in the last acknowledgement */
+	uint32_t quickack;		/* segments left to acknowledge immediately */
+};
+
+/* Connection statistics, see tcp_get_info */
+struct tcp_info {
+	uint32_t tcpi_rtt;			/* smoothed round trip time in ms */
+	uint32_t tcpi_rttvar;		/* round trip time variation in ms */
+	uint32_t tcpi_rto;			/* retransmission timeout in ms */
+	uint32_t tcpi_retransmits;
+	uint32_t tcpi_snd_mss;
+	uint32_t tcpi_snd_wnd;
+	uint32_t tcpi_unacked;		/* segments waiting for an acknowledgement */
+	uint32_t tcpi_snd_cwnd;		/* congestion window in bytes */
+	uint32_t tcpi_snd_ssthresh;
+	tcp_ca_state_t tcpi_ca_state;
+	uint32_t tcpi_sacked;		/* bytes SACKed by the peer */
+	uint32_t tcpi_ooo;			/* segments waiting for reassembly */
+	char* tcpi_cong;			/* congestion control algorithm */
+};
+
+/* Counters over all connections, see tcp_get_stats */
+struct tcp_stats {
+	uint32_t data_segs_in;		/* segments received with payload */
+	uint32_t acks_out;			/* acknowledgements sent without payload */
+	uint32_t acks_delayed;		/* of those, sent by the delayed ACK timer */
 };
 
 char* tcp_state_to_str(tcp_state_t state);
 int tcp_is_listening(struct sock* sock);
 int tcp_set_listening(struct sock* sock, int backlog);
+int tcp_set_syn_backlog(int size);
+int tcp_get_syn_backlog();
 
 int tcp_new_connection(struct sock* sock, uint16_t dst_port, uint16_t src_port);
 int tcp_free_connection(struct sock* sock);
 
 int tcp_connect(struct sock* sock);
-int tcp_send_segment(struct sock* sock, uint8_t* data, uint32_t len, uint8_t push);
+int tcp_send(struct sock* sock, uint8_t* data, uint32_t len);
 int tcp_parse(struct sk_buff* skb);
+int tcp_get_info(struct sock* sock, struct tcp_info* info);
+error_t tcp_setsockopt(struct sock* sock, int name, int value);
+error_t tcp_getsockopt(struct sock* sock, int name, int* value);
+void tcp_get_stats(struct tcp_stats* stats);
 
-int tcp_read(struct sock* sock, uint8_t* buffer, unsigned int length);
+void tcp_read_done(struct sock* sock, uint32_t copied);
 
-int tcp_accept_connection(struct sock* sock, struct sock* new);
+struct sock* tcp_accept_connection(struct sock* sock);
 int tcp_close_connection(struct sock* sock);
 
 #endif
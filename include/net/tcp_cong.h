@@ -0,0 +1,55 @@
+#ifndef __TCP_CONG_H
+#define __TCP_CONG_H
+
+#include <stdint.h>
+
+struct tcb;
+
+/* Congestion control states */
+typedef enum {
+	TCP_CA_OPEN,		/* no loss detected */
+	TCP_CA_RECOVERY,	/* fast recovery after duplicate acknowledgements */
+	TCP_CA_LOSS			/* after a retransmission timeout, resending from SND.UNA */
+} tcp_ca_state_t;
+
+/* Duplicate acknowledgements before a segment is considered lost */
+#define TCP_DUPACK_THRESHOLD 3
+#define TCP_INFINITE_SSTHRESH 0x7FFFFFFF
+/* Initial window, RFC 3390 */
+#define TCP_INIT_CWND(mss) (MIN(4 * (mss), MAX(2 * (mss), 4380)))
+
+#define TCP_CONGESTION_MAX 4
+
+/**
+ * @brief Congestion control algorithm.
+ * Loss detection and recovery (RFC 5681, RFC 6582) are handled by
+ * the core, the algorithm decides how the congestion window grows
+ * and how much it is reduced after a loss.
+ * All windows are in bytes.
+ */
+struct tcp_congestion_ops {
+	char* name;
+
+	/* Sets up the initial window, optional */
+	void (*init)(struct tcb* tcb, uint32_t mss);
+	/* New data was acknowledged outside of recovery */
+	void (*cong_avoid)(struct tcb* tcb, uint32_t acked, uint32_t mss);
+	/* Slow start threshold after a loss */
+	uint32_t (*ssthresh)(struct tcb* tcb, uint32_t mss);
+	/* Notified when the state changes, optional */
+	void (*set_state)(struct tcb* tcb, tcp_ca_state_t state);
+};
+
+int tcp_congestion_register(struct tcp_congestion_ops* ops);
+struct tcp_congestion_ops* tcp_congestion_find(char* name);
+struct tcp_congestion_ops* tcp_congestion_default();
+int tcp_congestion_set_default(char* name);
+int tcp_congestion_list(char** names, int max);
+char* tcp_ca_state_to_str(tcp_ca_state_t state);
+
+void tcp_cong_init(struct tcb* tcb, uint32_t mss);
+int tcp_cong_on_ack(struct tcb* tcb, uint32_t ack, uint32_t acked, uint32_t mss);
+int tcp_cong_on_dupack(struct tcb* tcb, uint32_t mss);
+void tcp_cong_on_timeout(struct tcb* tcb, uint32_t mss);
+
+#endif /* __TCP_CONG_H */
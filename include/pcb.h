@@ -78,7 +78,7 @@ struct pcb {
     char name[PCB_MAX_NAME_LENGTH];
     volatile pcb_state_t state;
     int16_t pid;
-    uint16_t sleep;
+    uint32_t sleep;
     uint32_t stackptr;
     uint32_t* page_dir;
     uint32_t data_size;
@@ -0,0 +1,32 @@
+#ifndef __POLL_H
+#define __POLL_H
+
+/**
+ * @brief Waits for readiness on sockets, IPC channels and window events.
+ * Shared between the kernel and userspace.
+ */
+
+#define POLLIN  (1 << 0)
+#define POLLOUT (1 << 1)
+#define POLLHUP (1 << 2)
+#define POLLERR (1 << 3)
+
+#define POLL_MAX_FDS 256
+
+typedef enum poll_types {
+    POLL_SOCKET,    /* fd is a socket */
+    POLL_IPC,       /* fd is an IPC channel */
+    POLL_WINDOW     /* events of the callers window, fd is ignored */
+} poll_type_t;
+
+struct pollfd {
+    int fd;
+    short type;
+    short events;
+    short revents;
+};
+
+/* Kernel side */
+int sys_poll(struct pollfd* fds, int nfds, int timeout);
+
+#endif /* __POLL_H */
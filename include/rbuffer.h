@@ -1,6 +1,8 @@
 #ifndef ADE2F814_93C0_48D5_8ADD_9DBB9B975A18
 #define ADE2F814_93C0_48D5_8ADD_9DBB9B975A18
 
+#include <stdint.h>
+#include <libc.h>
 #include <sync.h>
 #include <errors.h>
 
@@ -24,4 +26,89 @@ struct ring_buffer {
 struct ring_buffer* rbuffer_new(int size);
 void rbuffer_free(struct ring_buffer* rbuf);
 
+/**
+ * @brief Lock-free single producer, single consumer byte ring.
+ * Size is a power of two, head and tail run freely and are masked on access.
+ * Only the producer writes head and only the consumer writes tail,
+ * each publishes with release and observes the other with acquire.
+ */
+struct spsc_ring {
+    volatile uint32_t head;  /* Producer position */
+    volatile uint32_t tail;  /* Consumer position */
+    uint32_t mask;           /* size - 1 */
+    unsigned char* buffer;
+};
+
+struct spsc_ring* spsc_new(int size);
+void spsc_free(struct spsc_ring* ring);
+int spsc_write(struct spsc_ring* ring, const unsigned char* data, int len);
+int spsc_read(struct spsc_ring* ring, unsigned char* data, int len);
+
+#define SPSC_ACQUIRE(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define SPSC_RELEASE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+static inline uint32_t spsc_size(struct spsc_ring* ring)
+{
+    return ring->mask + 1;
+}
+
+/* Bytes ready to be consumed, consumer side. */
+static inline uint32_t spsc_used(struct spsc_ring* ring)
+{
+    return SPSC_ACQUIRE(&ring->head) - ring->tail;
+}
+
+/* Bytes that can be produced, producer side. */
+static inline uint32_t spsc_space(struct spsc_ring* ring)
+{
+    return spsc_size(ring) - (ring->head - SPSC_ACQUIRE(&ring->tail));
+}
+
+/**
+ * @brief Reserves contiguous space to write into.
+ * @param len in: wanted bytes, out: contiguous bytes available (may be less).
+ * @return unsigned char* write pointer, NULL if the ring is full.
+ */
+static inline unsigned char* spsc_reserve(struct spsc_ring* ring, uint32_t* len)
+{
+    uint32_t space = spsc_space(ring);
+    uint32_t index = ring->head & ring->mask;
+    uint32_t contiguous = spsc_size(ring) - index;
+
+    if(space == 0) return NULL;
+    if(contiguous > space) contiguous = space;
+    if(*len > contiguous) *len = contiguous;
+
+    return ring->buffer + index;
+}
+
+/* Publishes len bytes written after spsc_reserve. */
+static inline void spsc_commit(struct spsc_ring* ring, uint32_t len)
+{
+    SPSC_RELEASE(&ring->head, ring->head + len);
+}
+
+/**
+ * @brief Returns contiguous readable data in place.
+ * @param len out: contiguous bytes readable.
+ * @return unsigned char* read pointer, NULL if the ring is empty.
+ */
+static inline unsigned char* spsc_peek(struct spsc_ring* ring, uint32_t* len)
+{
+    uint32_t used = spsc_used(ring);
+    uint32_t index = ring->tail & ring->mask;
+    uint32_t contiguous = spsc_size(ring) - index;
+
+    if(used == 0) return NULL;
+    *len = contiguous < used ? contiguous : used;
+
+    return ring->buffer + index;
+}
+
+/* Releases len bytes returned by spsc_peek back to the producer. */
+static inline void spsc_consume(struct spsc_ring* ring, uint32_t len)
+{
+    SPSC_RELEASE(&ring->tail, ring->tail + len);
+}
+
 #endif /* ADE2F814_93C0_48D5_8ADD_9DBB9B975A18 */
@@ -47,7 +47,48 @@ enum {
     SYSCALL_SYSTEM,
     SYSCALL_SCREEN_PUT,
     SYSCALL_SCREEN_GET,
-    SYSCALL_SET_CURSOR
+    SYSCALL_SET_CURSOR,
+
+    /* Statistics system calls */
+    SYSCALL_STATS,
+
+    /* Shared memory IPC system calls */
+    SYSCALL_IPC_SHM_OPEN,
+    SYSCALL_IPC_SHM_MAP,
+    SYSCALL_IPC_WAIT,
+    SYSCALL_IPC_NOTIFY,
+    SYSCALL_IPC_PAGE_ALLOC,
+    SYSCALL_IPC_PAGE_FREE,
+    SYSCALL_POLL,
+
+    /* Socket options */
+    SYSCALL_NET_SOCK_SETOPT,
+    SYSCALL_NET_SOCK_GETOPT
+};
+
+/* Number of log2 latency buckets kept per system call */
+#define SYSCALL_HIST_BUCKETS 24
+
+/* Operations for SYSCALL_STATS */
+typedef enum {
+    SYSCALL_STATS_GET,      /* Copy stats for a system call index */
+    SYSCALL_STATS_GET_PID,  /* Copy stats for a pid (all system calls) */
+    SYSCALL_STATS_ENABLE,   /* Start collecting, index != 0 also tracks per pid */
+    SYSCALL_STATS_DISABLE,  /* Stop collecting */
+    SYSCALL_STATS_RESET     /* Clear all counters */
+} syscall_stats_op_t;
+
+/**
+ * @brief Counters for a system call index or a pid.
+ * hist[i] counts calls that took [2^i, 2^(i+1)) cycles,
+ * the last bucket also collects everything slower.
+ */
+struct syscall_stat {
+    unsigned int calls;
+    unsigned int errors;
+    unsigned int cycles;     /* total cycles, saturates at 0xFFFFFFFF */
+    unsigned int max_cycles;
+    unsigned int hist[SYSCALL_HIST_BUCKETS];
 };
 
 #endif /* __SYSCALL_HELPER_H */
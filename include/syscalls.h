@@ -2,11 +2,18 @@
 #define __SYSCALLS_H
 
 #include <ksyms.h>
+#include <syscall_helper.h>
+
+#define SYSCALL_MAX 255
 
 typedef int (*syscall_t) ();
 void add_system_call(int index, syscall_t fn);
 int system_call(int index, int arg1, int arg2, int arg3);
 
+const char* syscall_to_str(int index);
+int sys_syscall_stats(int op, int index, struct syscall_stat* stat);
+int syscall_stats_enabled();
+
 #define testsd #
 
 #define EXPORT_SYSCALL(index, fn) \
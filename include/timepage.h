@@ -0,0 +1,40 @@
+#ifndef __TIMEPAGE_H
+#define __TIMEPAGE_H
+
+#include <stdint.h>
+#include <rtc.h>
+
+/**
+ * @brief Read-only page mapped into every process at VMEM_TIME_PAGE.
+ * Updated by the timer interrupt, read by userspace without a system call.
+ * Readers must retry while seq is odd or changed during the read.
+ */
+#define VMEM_TIME_PAGE 0xD0000000
+
+struct time_page {
+    volatile uint32_t seq;  /* odd while the kernel is updating the page */
+    uint32_t hz;            /* timer frequency, 0 until the timer is started */
+    uint32_t ticks;         /* timer ticks since the timer was started */
+    uint32_t tsc_tick;      /* low 32 bits of the TSC at the last tick */
+    uint32_t tsc_per_us;    /* calibrated TSC cycles per microsecond, 0 until calibrated */
+    uint32_t wall_tick;     /* tick when the wall clock last changed second */
+    uint32_t wall_seconds;  /* seconds since midnight */
+    struct time wall;       /* cached wall clock */
+};
+
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+/* Kernel side */
+void timepage_init();
+void timepage_start(uint32_t hz);
+void timepage_tick();
+int timepage_get_time(struct time* time);
+int timepage_get_seconds();
+
+#endif /* __TIMEPAGE_H */
@@ -10,6 +10,7 @@
 void init_pit(uint32_t frequency);
 struct time* get_datetime();
 int timer_get_tick();
+int timer_ms_to_ticks(int ms);
 int time_get_difference();
 
 #endif // !TIMER_H
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef __WAITQUEUE_H
+#define __WAITQUEUE_H
+
+#include <stdint.h>
+
+struct pcb;
+
+/**
+ * @brief Wait queue, list of processes waiting for an event.
+ * Entries live on the waiters stack, so a process can wait
+ * on several queues at once (see poll).
+ */
+struct waitqueue_entry {
+    struct pcb* pcb;
+    struct waitqueue* wq;   /* queue the entry is on, NULL once removed or detached */
+    struct waitqueue_entry* next;
+};
+
+struct waitqueue {
+    struct waitqueue_entry* head;
+};
+
+#define WAITQUEUE_FOREVER -1
+
+void waitqueue_init(struct waitqueue* wq);
+void waitqueue_add(struct waitqueue* wq, struct waitqueue_entry* entry);
+void waitqueue_remove(struct waitqueue* wq, struct waitqueue_entry* entry);
+void waitqueue_wake(struct waitqueue* wq);
+void waitqueue_detach(struct waitqueue* wq);
+
+void waitqueue_prepare(uint32_t deadline);
+int waitqueue_wait(struct waitqueue* wq, int (*ready)(void* arg), void* arg, int ticks);
+
+#endif /* __WAITQUEUE_H */
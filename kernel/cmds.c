@@ -150,6 +150,9 @@ static int help(int argc, char* argv[])
     twritef(" ifconfig         services     cc\n");
     twritef(" dns              admin        color\n");
     twritef(" tcp              clear        \n");
+    twritef(" arp              syscalls     \n");
+    twritef(" route                         \n");
+    twritef(" firewall                      \n");
     return 0;
 }
 EXPORT_KSYMBOL(help);
@@ -254,6 +257,11 @@ EXPORT_KSYMBOL(file);
 #include <net/net.h>
 #include <net/ipv4.h>
 #include <net/utils.h>
+#include <net/arp.h>
+#include <net/routing.h>
+#include <net/firewall.h>
+#include <net/interface.h>
+#include <timer.h>
 
 /**
  * @brief Part of the TCP client
@@ -295,10 +303,253 @@ static int __kthread_entry __tcp_reader(int argc, char *argv[])
     return 0;
 }
 
+/**
+ * @brief Lists round trip time, retransmission timeout and retransmits of TCP connections.
+ */
+static int __tcp_stat()
+{
+    struct sockets socks;
+    struct tcp_info info;
+    struct tcp_stats stats;
+
+    net_get_sockets(&socks);
+    tcp_get_stats(&stats);
+
+    twritef("  port   remote          state            rtt  rttvar   rto  retrans  unacked  cwnd  ssthresh  ca\n");
+    for (int i = 0; i < socks.total_sockets; i++){
+        struct sock* sock = socks.sockets[i];
+        if(sock == NULL || sock->tcp == NULL || tcp_get_info(sock, &info) < 0) continue;
+
+        twritef("  %d  %i:%d  %s  %dms  %dms  %dms  %d  %d  %d  %d  %s\n",
+            ntohs(sock->bound_port), ntohl(sock->recv_addr.sin_addr.s_addr), ntohs(sock->recv_addr.sin_port),
+            tcp_state_to_str(sock->tcp->state), info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_rto,
+            info.tcpi_retransmits, info.tcpi_unacked, info.tcpi_snd_cwnd,
+            info.tcpi_snd_ssthresh == TCP_INFINITE_SSTHRESH ? 0 : info.tcpi_snd_ssthresh,
+            tcp_ca_state_to_str(info.tcpi_ca_state));
+    }
+
+    twritef("  %d data segments received, %d acks sent (%d delayed), %d acks per 100 segments\n",
+        stats.data_segs_in, stats.acks_out, stats.acks_delayed,
+        stats.data_segs_in > 0 ? (stats.acks_out * 100) / stats.data_segs_in : 0);
+
+    twritef("  listen  syn queue  accept queue  syn drops  accept drops\n");
+    for (int i = 0; i < socks.total_sockets; i++){
+        struct sock* sock = socks.sockets[i];
+        if(sock == NULL || sock->tcp == NULL || sock->tcp->state != TCP_LISTEN) continue;
+
+        twritef("  %d  %d/%d  %d/%d  %d  %d\n", ntohs(sock->bound_port),
+            sock->backlog.syn_count, tcp_get_syn_backlog(), sock->backlog.count, sock->backlog.size,
+            sock->backlog.syn_overflows, sock->backlog.accept_overflows);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Shows or sets the SYN queue limit of listening sockets.
+ */
+static int __tcp_synq(int argc, char *argv[])
+{
+    if(argc == 3 && tcp_set_syn_backlog(atoi(argv[2])) < 0){
+        twritef("SYN queue limit must be between 1 and %d\n", TCP_SYN_BACKLOG_MAX);
+        return 1;
+    }
+
+    twritef("SYN queue limit: %d\n", tcp_get_syn_backlog());
+    return 0;
+}
+
+/**
+ * @brief Shows or selects the congestion control used by new connections.
+ */
+static int __tcp_cc(int argc, char *argv[])
+{
+    char* names[TCP_CONGESTION_MAX];
+    int count;
+
+    if(argc == 3){
+        if(tcp_congestion_set_default(argv[2]) < 0){
+            twritef("Unknown congestion control %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    count = tcp_congestion_list(names, TCP_CONGESTION_MAX);
+    twritef("Congestion control: %s\nAvailable:", tcp_congestion_default()->name);
+    for (int i = 0; i < count; i++){
+        twritef(" %s", names[i]);
+    }
+    twritef("\n");
+
+    return 0;
+}
+
+#define TCP_BENCH_PORT 5001
+#define TCP_BENCH_MAX_KB 1024
+#define TCP_BENCH_TIMEOUT_MS 120000
+
+static struct tcp_bench {
+    struct sock* listener;
+    struct sock* client;
+    volatile int received;
+    volatile int done;
+    volatile int closed;
+} tcp_bench_state;
+
+/**
+ * @brief Receiving side of tcp bench, accepts one connection and reads until the expected bytes arrived.
+ * Closes its side afterwards, so the senders close completes.
+ * @param argv Contains the number of bytes to read.
+ */
+static void __kthread_entry __tcp_bench_sink(int argc, char *argv[])
+{
+    int expected = argc == 1 ? atoi(argv[0]) : 0;
+    int ret;
+
+    tcp_bench_state.client = kernel_accept(tcp_bench_state.listener, NULL, NULL);
+
+    char* buffer = kalloc(4096);
+    while(tcp_bench_state.client != NULL && buffer != NULL && tcp_bench_state.received < expected){
+        ret = kernel_recv(tcp_bench_state.client, buffer, 4096, 0);
+        if(ret <= 0) break;
+
+        tcp_bench_state.received += ret;
+    }
+
+    if(buffer != NULL) kfree(buffer);
+    tcp_bench_state.done = 1;
+
+    if(tcp_bench_state.client != NULL){
+        kernel_sock_shutdown(tcp_bench_state.client, 0);
+    }
+    tcp_bench_state.closed = 1;
+}
+
+/**
+ * @brief Measures TCP throughput over the loopback interface.
+ * The loopback device drops and delays segments as given, with a fixed
+ * seed so runs with the same arguments are reproducible. The handshake
+ * and close run over the same link as the data.
+ */
+static int __tcp_bench(int argc, char *argv[])
+{
+    struct sockaddr_in addr;
+    struct tcp_info info;
+    int start, elapsed, ret;
+    char expected[12] = {0};
+    char* sink_argv[] = { expected };
+
+    int kb = argc > 2 ? atoi(argv[2]) : 256;
+    int loss = argc > 3 ? atoi(argv[3]) : 0;
+    int delay = argc > 4 ? atoi(argv[4]) : 0;
+
+    if(kb <= 0 || kb > TCP_BENCH_MAX_KB || loss < 0 || loss > 1000 || delay < 0){
+        twritef("Usage: tcp bench [KB (max %d)] [loss per 1000] [delay ms]\n", TCP_BENCH_MAX_KB);
+        return 1;
+    }
+
+    char* data = kalloc(kb * 1024);
+    if(data == NULL){
+        twritef("Unable to allocate %d KB\n", kb);
+        return 1;
+    }
+    for (int i = 0; i < kb * 1024; i++) data[i] = (char) i;
+
+    memset(&tcp_bench_state, 0, sizeof(tcp_bench_state));
+    tcp_bench_state.listener = kernel_socket_create(AF_INET, SOCK_STREAM, 0);
+    struct sock* sender = kernel_socket_create(AF_INET, SOCK_STREAM, 0);
+    if(tcp_bench_state.listener == NULL || sender == NULL){
+        twritef("Failed to create sockets\n");
+        kfree(data);
+        return 1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(TCP_BENCH_PORT);
+    kernel_bind(tcp_bench_state.listener, (struct sockaddr*) &addr, sizeof(addr));
+    kernel_listen(tcp_bench_state.listener, 1);
+
+    net_loopback_impair(loss, delay, 0);
+
+    /* The connection waits in the backlog until the sink accepts it */
+    addr.sin_addr.s_addr = htonl(LOOPBACK_IP);
+    if(kernel_connect(sender, (struct sockaddr*) &addr, sizeof(addr)) < 0){
+        twritef("Unable to connect to loopback:%d\n", TCP_BENCH_PORT);
+        net_loopback_impair(0, 0, 0);
+        kernel_sock_cleanup(sender);
+        kernel_sock_cleanup(tcp_bench_state.listener);
+        kfree(data);
+        return 1;
+    }
+
+    itoa(kb * 1024, expected);
+    pcb_create_kthread(__tcp_bench_sink, "tcp_bench", 1, sink_argv);
+
+    twritef("Sending %d KB, %d/1000 loss, %d ms delay (%s)\n", kb, loss, delay, tcp_congestion_default()->name);
+    $process->current->term->ops->commit($process->current->term);
+
+    start = timer_get_tick();
+
+    ret = kernel_send(sender, data, kb * 1024, 0);
+    while(ret > 0 && !tcp_bench_state.done && timer_get_tick() - start < timer_ms_to_ticks(TCP_BENCH_TIMEOUT_MS)){
+        kernel_yield();
+    }
+
+    elapsed = ((timer_get_tick() - start) * 1000) / timer_ms_to_ticks(1000);
+    tcp_get_info(sender, &info);
+
+    if(!tcp_bench_state.done){
+        twritef("Transfer failed after %d of %d bytes\n", tcp_bench_state.received, kb * 1024);
+    } else {
+        twritef("%d KB in %d ms, %d KB/s\n", kb, elapsed, elapsed > 0 ? (kb * 1000) / elapsed : kb * 1000);
+    }
+    twritef("retransmits %d, cwnd %d, ssthresh %d, rtt %dms, rto %dms\n",
+        info.tcpi_retransmits, info.tcpi_snd_cwnd,
+        info.tcpi_snd_ssthresh == TCP_INFINITE_SSTHRESH ? 0 : info.tcpi_snd_ssthresh,
+        info.tcpi_rtt, info.tcpi_rto);
+    if(tcp_bench_state.client != NULL){
+        twritef("receive buffer %d bytes\n", tcp_bench_state.client->rcvbuf);
+    }
+
+    kernel_sock_close(sender);
+    if(tcp_bench_state.client != NULL){
+        /* The sink still uses the client until its close returns */
+        start = timer_get_tick();
+        while(!tcp_bench_state.closed && timer_get_tick() - start < timer_ms_to_ticks(1000)){
+            kernel_yield();
+        }
+        kernel_sock_cleanup(tcp_bench_state.client);
+    }
+    net_loopback_impair(0, 0, 0);
+
+    /* Never connected, nothing to shut down */
+    kernel_sock_cleanup(tcp_bench_state.listener);
+    kfree(data);
+
+    return 0;
+}
+
 static int tcp(int argc, char *argv[])
 {
+    if(argc == 2 && strcmp(argv[1], "stat") == 0) {
+        return __tcp_stat();
+    }
+
+    if(argc >= 2 && strcmp(argv[1], "cc") == 0) {
+        return __tcp_cc(argc, argv);
+    }
+
+    if(argc >= 2 && strcmp(argv[1], "synq") == 0) {
+        return __tcp_synq(argc, argv);
+    }
+
+    if(argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return __tcp_bench(argc, argv);
+    }
+
     if(argc < 3) {
-        twritef("Usage: tcp <ip,domain> <port>\n");
+        twritef("Usage: tcp <ip,domain> <port>\n       tcp stat\n       tcp cc [algorithm]\n       tcp synq [limit]\n       tcp bench [KB] [loss per 1000] [delay ms]\n");
         return 1;
     }
 
@@ -354,6 +605,302 @@ static int tcp(int argc, char *argv[])
 }
 EXPORT_KSYMBOL(tcp);
 
+static int arp(int argc, char *argv[])
+{
+    struct arp_stats stats;
+    struct arp_entry* entries = kalloc(sizeof(struct arp_entry) * ARP_CACHE_SIZE);
+    if(entries == NULL){
+        twritef("Unable to allocate ARP table\n");
+        return 1;
+    }
+
+    int count = net_arp_get_entries(entries, ARP_CACHE_SIZE);
+    net_arp_get_stats(&stats);
+
+    twritef("  ip  mac  state  queued  probes\n");
+    for (int i = 0; i < count; i++){
+        struct arp_entry* entry = &entries[i];
+        twritef("  %i  %x:%x:%x:%x:%x:%x  %s  %d  %d\n", entry->sip,
+            entry->smac[0], entry->smac[1], entry->smac[2], entry->smac[3], entry->smac[4], entry->smac[5],
+            arp_state_to_str(entry->state), entry->queued, entry->probes);
+    }
+
+    twritef("  %d hits, %d misses, %d queued, %d dropped, %d requests, %d replies, %d evicted\n",
+        stats.hits, stats.misses, stats.queued, stats.dropped, stats.requests, stats.replies, stats.evictions);
+
+    kfree(entries);
+    return 0;
+}
+EXPORT_KSYMBOL(arp);
+
+static void __route_show()
+{
+    struct route_stats stats;
+    struct route* routes = kalloc(sizeof(struct route) * ROUTE_MAX);
+    if(routes == NULL){
+        twritef("Unable to allocate routing table\n");
+        return;
+    }
+
+    int count = route_get_entries(routes, ROUTE_MAX);
+    route_get_stats(&stats);
+
+    twritef("  destination  gateway  dev  metric  uses  type\n");
+    for (int i = 0; i < count; i++){
+        struct route* r = &routes[i];
+        twritef("  %i/%d  %i  %s  %d  %d  %s\n", htonl(r->prefix), r->len, htonl(r->gateway), r->interface->name, r->metric, r->uses,
+            r->flags & ROUTE_CONNECTED ? "connected" : r->flags & ROUTE_DHCP ? "dhcp" : "static");
+    }
+
+    twritef("  %d routes, %d nodes, %d lookups, %d cache hits, %d unreachable\n",
+        stats.routes, stats.nodes, stats.lookups, stats.cache_hits, stats.unreachable);
+
+    kfree(routes);
+}
+
+/* Parses <ip>/<len> or default */
+static int __route_parse_prefix(char* str, uint32_t* prefix, uint8_t* len)
+{
+    if(strcmp(str, "default") == 0){
+        *prefix = 0;
+        *len = 0;
+        return 0;
+    }
+
+    char* slash = strchr(str, '/');
+    *len = slash != NULL ? atoi(slash + 1) : 32;
+    *prefix = ip_to_int(str);
+
+    return *len <= 32 && net_is_ipv4(str) ? 0 : -1;
+}
+
+static int route(int argc, char *argv[])
+{
+    if(argc < 2 || strcmp(argv[1], "show") == 0){
+        __route_show();
+        return 0;
+    }
+
+    if(argc < 3 || (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "del") != 0)){
+        twritef("usage: route [show]\n");
+        twritef("       route add <ip>/<len>|default [via <gateway>] [dev <interface>] [metric <n>]\n");
+        twritef("       route del <ip>/<len>|default [via <gateway>]\n");
+        return 1;
+    }
+
+    if(IS_AUTHORIZED(ADMIN_FULL_ACCESS) == 0) {
+        twritef("You are not authorized to use this command\n");
+        return 1;
+    }
+
+    uint32_t prefix;
+    uint8_t len;
+    if(__route_parse_prefix(argv[2], &prefix, &len) < 0){
+        twritef("Invalid destination %s\n", argv[2]);
+        return 1;
+    }
+
+    uint32_t gateway = 0;
+    uint32_t metric = ROUTE_METRIC_STATIC;
+    struct net_interface* interface = NULL;
+    for (int i = 3; i + 1 < argc; i += 2){
+        if(strcmp(argv[i], "via") == 0){
+            if(!net_is_ipv4(argv[i+1])){
+                twritef("Invalid gateway %s\n", argv[i+1]);
+                return 1;
+            }
+            gateway = ip_to_int(argv[i+1]);
+        } else if(strcmp(argv[i], "dev") == 0){
+            interface = net_get_iface_by_name(argv[i+1]);
+            if(interface == NULL){
+                twritef("Unknown interface %s\n", argv[i+1]);
+                return 1;
+            }
+        } else if(strcmp(argv[i], "metric") == 0){
+            metric = atoi(argv[i+1]);
+        } else {
+            twritef("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    error_t ret;
+    if(strcmp(argv[1], "add") == 0){
+        ret = route_add(prefix, len, gateway, interface, metric, ROUTE_STATIC);
+    } else {
+        ret = route_del(prefix, len, gateway);
+    }
+
+    if(ret < 0){
+        twritef("route: %s\n", error_get_string(ret));
+        return 1;
+    }
+
+    return 0;
+}
+EXPORT_KSYMBOL(route);
+
+static const char* __firewall_direction_str(firewall_direction_t direction)
+{
+    return direction == FIREWALL_ANY ? "any" : direction == FIREWALL_IN ? "in" : "out";
+}
+
+static int __firewall_parse_direction(char* str)
+{
+    if(strcmp(str, "in") == 0) return FIREWALL_IN;
+    if(strcmp(str, "out") == 0) return FIREWALL_OUT;
+    if(strcmp(str, "any") == 0) return FIREWALL_ANY;
+    return -1;
+}
+
+static int __firewall_parse_policy(char* str)
+{
+    if(strcmp(str, "accept") == 0) return FIREWALL_POLICY_ACCEPT;
+    if(strcmp(str, "drop") == 0) return FIREWALL_POLICY_DROP;
+    if(strcmp(str, "reject") == 0) return FIREWALL_POLICY_REJECT;
+    return -1;
+}
+
+static int __firewall_parse_protocol(char* str)
+{
+    if(strcmp(str, "tcp") == 0) return TCP;
+    if(strcmp(str, "udp") == 0) return UDP;
+    if(strcmp(str, "icmp") == 0) return ICMPV4;
+    return atoi(str);
+}
+
+static void __firewall_show()
+{
+    struct firewall_stats stats;
+    struct net_firewall_rule* rules = kalloc(sizeof(struct net_firewall_rule) * FIREWALL_MAX_RULES);
+    if(rules == NULL){
+        twritef("Unable to allocate firewall rules\n");
+        return;
+    }
+
+    int count = net_firewall_get_rules(rules, FIREWALL_MAX_RULES);
+    net_firewall_get_stats(&stats);
+
+    twritef("  policy in %s, out %s\n", firewall_policy_to_str(net_firewall_get_policy(FIREWALL_IN)), firewall_policy_to_str(net_firewall_get_policy(FIREWALL_OUT)));
+    twritef("  #  dir  policy  proto  source  destination  hits\n");
+    for (int i = 0; i < count; i++){
+        struct net_firewall_rule* r = &rules[i];
+        twritef("  %d  %s  %s  %d  %i/%d:%d  %i/%d:%d  %d\n", i, __firewall_direction_str(r->direction), firewall_policy_to_str(r->policy), r->protocol,
+            htonl(r->src_ip), route_mask_to_len(r->src_mask), r->src_port, htonl(r->dst_ip), route_mask_to_len(r->dst_mask), r->dst_port, r->hits);
+    }
+
+    twritef("  %d accepted, %d dropped, %d rejected, %d evaluated, %d tracked, %d connections, %d evicted\n",
+        stats.accepted, stats.dropped, stats.rejected, stats.evaluated, stats.tracked, stats.conns, stats.conns_evicted);
+
+    kfree(rules);
+}
+
+static void __firewall_conns()
+{
+    struct firewall_conn* conns = kalloc(sizeof(struct firewall_conn) * FIREWALL_CONNTRACK_SIZE);
+    if(conns == NULL){
+        twritef("Unable to allocate connection table\n");
+        return;
+    }
+
+    int count = net_firewall_get_conns(conns, FIREWALL_CONNTRACK_SIZE);
+    twritef("  proto  source  destination  state  packets  expires\n");
+    for (int i = 0; i < count; i++){
+        struct firewall_conn* c = &conns[i];
+        int expires = (int32_t)(c->expires - timer_get_tick()) / timer_ms_to_ticks(1000);
+        twritef("  %d  %i:%d  %i:%d  %s  %d  %ds\n", c->protocol, htonl(c->saddr), c->sport, htonl(c->daddr), c->dport,
+            firewall_conn_state_to_str(c->state), c->packets, expires);
+    }
+
+    kfree(conns);
+}
+
+static int firewall(int argc, char *argv[])
+{
+    if(argc < 2 || strcmp(argv[1], "show") == 0){
+        __firewall_show();
+        return 0;
+    }
+
+    if(strcmp(argv[1], "conns") == 0){
+        __firewall_conns();
+        return 0;
+    }
+
+    if(IS_AUTHORIZED(ADMIN_FULL_ACCESS) == 0) {
+        twritef("You are not authorized to use this command\n");
+        return 1;
+    }
+
+    error_t ret = -ERROR_INVALID_ARGUMENTS;
+    if(strcmp(argv[1], "flush") == 0){
+        net_firewall_flush();
+        ret = 0;
+    } else if(strcmp(argv[1], "del") == 0 && argc == 3){
+        ret = net_firewall_del_rule(atoi(argv[2]));
+    } else if(strcmp(argv[1], "policy") == 0 && argc == 4){
+        int direction = __firewall_parse_direction(argv[2]);
+        int policy = __firewall_parse_policy(argv[3]);
+        if(direction > 0 && policy >= 0){
+            ret = net_firewall_set_policy(direction, policy);
+        }
+    } else if(strcmp(argv[1], "add") == 0 && argc >= 4){
+        struct net_firewall_rule rule = {0};
+        int position = -1;
+        int direction = __firewall_parse_direction(argv[2]);
+        int policy = __firewall_parse_policy(argv[3]);
+        ret = direction > 0 && policy >= 0 ? 0 : -ERROR_INVALID_ARGUMENTS;
+        rule.direction = direction;
+        rule.policy = policy;
+
+        for (int i = 4; i + 1 < argc && ret == 0; i += 2){
+            uint32_t ip;
+            uint8_t len;
+            if(strcmp(argv[i], "proto") == 0){
+                rule.protocol = __firewall_parse_protocol(argv[i+1]);
+            } else if(strcmp(argv[i], "src") == 0 || strcmp(argv[i], "dst") == 0){
+                if(__route_parse_prefix(argv[i+1], &ip, &len) < 0){
+                    ret = -ERROR_INVALID_ARGUMENTS;
+                } else if(argv[i][0] == 's'){
+                    rule.src_ip = ip;
+                    rule.src_mask = route_len_to_mask(len);
+                } else {
+                    rule.dst_ip = ip;
+                    rule.dst_mask = route_len_to_mask(len);
+                }
+            } else if(strcmp(argv[i], "sport") == 0){
+                rule.src_port = atoi(argv[i+1]);
+            } else if(strcmp(argv[i], "dport") == 0){
+                rule.dst_port = atoi(argv[i+1]);
+            } else if(strcmp(argv[i], "at") == 0){
+                position = atoi(argv[i+1]);
+            } else {
+                ret = -ERROR_INVALID_ARGUMENTS;
+            }
+        }
+
+        if(ret == 0){
+            ret = net_firewall_add_rule(&rule, position);
+        }
+    }
+
+    if(ret == -ERROR_INVALID_ARGUMENTS){
+        twritef("usage: firewall [show|conns|flush]\n");
+        twritef("       firewall add <in|out|any> <accept|drop|reject> [proto tcp|udp|icmp] [src <ip>/<len>] [dst <ip>/<len>] [sport <n>] [dport <n>] [at <index>]\n");
+        twritef("       firewall del <index>\n");
+        twritef("       firewall policy <in|out|any> <accept|drop|reject>\n");
+        return 1;
+    }
+
+    if(ret < 0){
+        twritef("firewall: %s\n", error_get_string(ret));
+        return 1;
+    }
+
+    return 0;
+}
+EXPORT_KSYMBOL(firewall);
+
 static int conf(int argc, char *argv[])
 {
     int ret;
@@ -451,6 +998,69 @@ static int reboot(){
 }
 EXPORT_KSYMBOL(reboot);
 
+#include <syscalls.h>
+
+static void __syscalls_print_stat(const char* name, struct syscall_stat* stat)
+{
+    twritef("%s: calls %d, errors %d, avg %d, max %d cycles\n",
+        name, stat->calls, stat->errors, stat->calls ? stat->cycles / stat->calls : 0, stat->max_cycles);
+
+    twritef("  log2(cycles):");
+    for (int i = 0; i < SYSCALL_HIST_BUCKETS; i++){
+        if(stat->hist[i] == 0) continue;
+        twritef(" %d:%d", i, stat->hist[i]);
+    }
+    twritef("\n");
+}
+
+/**
+ * @brief Show or control system call statistics
+ * syscalls on [pid] enables collection, optionally per pid.
+ */
+static int syscalls(int argc, char *argv[])
+{
+    struct syscall_stat stat;
+
+    if(argc < 2) {
+        twritef("Usage: syscalls <on [pid], off, reset, list, pid <pid>>\n");
+        return 1;
+    }
+
+    if(strcmp(argv[1], "on") == 0) {
+        sys_syscall_stats(SYSCALL_STATS_ENABLE, argc > 2 && strcmp(argv[2], "pid") == 0, NULL);
+        twritef("System call statistics enabled\n");
+    } else if(strcmp(argv[1], "off") == 0) {
+        sys_syscall_stats(SYSCALL_STATS_DISABLE, 0, NULL);
+        twritef("System call statistics disabled\n");
+    } else if(strcmp(argv[1], "reset") == 0) {
+        sys_syscall_stats(SYSCALL_STATS_RESET, 0, NULL);
+    } else if(strcmp(argv[1], "list") == 0) {
+        if(!syscall_stats_enabled()){
+            twritef("Statistics are disabled, use: syscalls on\n");
+        }
+        for (int i = 0; i < SYSCALL_MAX; i++){
+            if(sys_syscall_stats(SYSCALL_STATS_GET, i, &stat) < 0 || stat.calls == 0) continue;
+            __syscalls_print_stat(syscall_to_str(i), &stat);
+        }
+    } else if(strcmp(argv[1], "pid") == 0) {
+        if(argc < 3) {
+            twritef("Usage: syscalls pid <pid>\n");
+            return 1;
+        }
+        if(sys_syscall_stats(SYSCALL_STATS_GET_PID, atoi(argv[2]), &stat) < 0){
+            twritef("Invalid pid %s\n", argv[2]);
+            return 1;
+        }
+        __syscalls_print_stat(argv[2], &stat);
+    } else {
+        twritef("Usage: syscalls <on [pid], off, reset, list, pid <pid>>\n");
+        return 1;
+    }
+
+    return 0;
+}
+EXPORT_KSYMBOL(syscalls);
+
 /* Process management */
 
 /* System management */
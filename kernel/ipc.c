@@ -4,69 +4,628 @@
  * @brief Inter process communication.
  * @version 0.1
  * @date 2024-01-10
- * 
+ *
+ * Two kinds of channels:
+ * - Copy channels, data is copied through a kernel ring buffer.
+ * - Shared memory channels, a page ring mapped into every process
+ *   using the channel. Messages are written and read in place,
+ *   the kernel is only entered to wait and to wake up a waiting receiver.
+ *   The header page is writable by userspace, so the kernel keeps its
+ *   own copy of the ring layout and checks the shared indices and
+ *   message lengths before copying.
+ *
+ * Channels are closed by the processes using them, and released when
+ * a process exits.
+ *
  * @copyright Copyright (c) 2024
- * 
+ *
  */
 
 #include <ipc.h>
 #include <memory.h>
 #include <syscalls.h>
 #include <syscall_helper.h>
+#include <scheduler.h>
+#include <pcb.h>
+#include <poll.h>
 
-#define IPC_MAX_CHANNELS 16
+#define IPC_MIN_CHANNELS 16
 #define IPC_MAX_SIZE 1024
 
-#define IPC_VALID_CHANNEL(channel) if(channel < 0 || channel >= IPC_MAX_CHANNELS || channels[channel].rbuf == NULL) {return -1;}
+#define IPC_VALID_CHANNEL(channel) if(channel < 0 || channel >= ipc_table.capacity || ipc_table.channels[channel] == NULL) {return -1;}
+#define IPC_VALID_SHM_CHANNEL(channel) IPC_VALID_CHANNEL(channel); if(ipc_table.channels[channel]->shm == NULL) {return -1;}
 
 /* handel to channel implementation */
-static struct ipc_channel channels[IPC_MAX_CHANNELS] = {0};
+static struct ipc_table {
+    struct ipc_channel** channels;
+    int capacity;
+    int used;
+} ipc_table = {
+    .channels = NULL,
+    .capacity = 0,
+    .used = 0
+};
 
-static int __ipc_alloc_channel() {
-    for (int i = 0; i < IPC_MAX_CHANNELS; i++)
-        if (!channels[i].rbuf)
+/**
+ * @brief Finds a free channel, doubles the channel table when full.
+ * @return int channel index or less than 0 on error.
+ */
+static int __ipc_alloc_channel()
+{
+    for (int i = 0; i < ipc_table.capacity; i++)
+        if (ipc_table.channels[i] == NULL)
             return i;
-    return -1;
+
+    int capacity = ipc_table.capacity == 0 ? IPC_MIN_CHANNELS : ipc_table.capacity * 2;
+    struct ipc_channel** channels = kcalloc(sizeof(struct ipc_channel*) * capacity);
+    if(channels == NULL){
+        return -ERROR_ALLOC;
+    }
+
+    if(ipc_table.channels != NULL){
+        memcpy(channels, ipc_table.channels, sizeof(struct ipc_channel*) * ipc_table.capacity);
+        kfree(ipc_table.channels);
+    }
+
+    int channel = ipc_table.capacity;
+    ipc_table.channels = channels;
+    ipc_table.capacity = capacity;
+
+    return channel;
+}
+
+/* Threads share the channels of their process. */
+static struct pcb* __ipc_owner(struct pcb* pcb)
+{
+    return pcb->is_process == PCB_THREAD && pcb->parent != NULL ? pcb->parent : pcb;
+}
+
+static struct ipc_user* __ipc_find_user(struct ipc_channel* channel, int pid)
+{
+    for (int i = 0; i < IPC_CHANNEL_USERS; i++){
+        if(channel->users[i].pid == pid) return &channel->users[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Adds a process to the users of a channel, must be called in a critical section.
+ * @return struct ipc_user* NULL if the channel has too many users.
+ */
+static struct ipc_user* __ipc_add_user(struct ipc_channel* channel, int pid)
+{
+    struct ipc_user* user = __ipc_find_user(channel, -1);
+    if(user == NULL) return NULL;
+
+    user->pid = pid;
+    user->addr = 0;
+    channel->refs++;
+    return user;
+}
+
+static struct ipc_channel* __ipc_new_channel(int* index)
+{
+    struct ipc_channel* channel = NULL;
+    int pid = __ipc_owner($process->current)->pid;
+
+    CRITICAL_SECTION({
+        *index = __ipc_alloc_channel();
+        if(*index >= 0){
+            channel = create(struct ipc_channel);
+            ipc_table.channels[*index] = channel;
+            if(channel != NULL){
+                for (int i = 0; i < IPC_CHANNEL_USERS; i++){
+                    channel->users[i].pid = -1;
+                }
+                __ipc_add_user(channel, pid);
+                waitqueue_init(&channel->wq);
+                ipc_table.used++;
+            }
+        }
+    });
+
+    return channel;
+}
+
+static int __ipc_has_data(struct ipc_channel* channel)
+{
+    if(channel->shm != NULL){
+        return !ipc_shm_empty(channel->shm);
+    }
+    return channel->rbuf->start != channel->rbuf->end;
+}
+
+static int __ipc_ready(struct ipc_channel* channel)
+{
+    return channel->closed || __ipc_has_data(channel);
+}
+
+/**
+ * @brief Tells the producer of a shared memory channel that a receiver is blocking,
+ * so a commit after the readiness check is notified.
+ * Must be called in the critical section that checked readiness.
+ */
+static void __ipc_set_waiting(struct ipc_channel* channel)
+{
+    if(channel->shm != NULL){
+        channel->shm->waiting = 1;
+        __sync_synchronize();
+    }
+}
+
+/* Readiness check of sys_ipc_wait, only marks the channel when actually blocking */
+static int __ipc_wait_ready(void* arg)
+{
+    struct ipc_channel* channel = arg;
+
+    if(__ipc_ready(channel)) return 1;
+
+    __ipc_set_waiting(channel);
+    return 0;
+}
+
+/* Wakes all processes waiting on the channel */
+static void __ipc_wake(struct ipc_channel* channel)
+{
+    waitqueue_wake(&channel->wq);
+}
+
+static void __ipc_release_channel(struct ipc_channel* channel)
+{
+    if(channel->rbuf != NULL){
+        rbuffer_free(channel->rbuf);
+    }
+    if(channel->shm != NULL){
+        kfree(channel->memory);
+    }
+    kfree(channel);
+}
+
+/**
+ * @brief Removes a channel from the table.
+ * If processes are waiting on it, the last waiter frees it.
+ */
+static void __ipc_free_channel(int index)
+{
+    struct ipc_channel* channel = ipc_table.channels[index];
+
+    ipc_table.channels[index] = NULL;
+    ipc_table.used--;
+
+    if(channel->wq.head != NULL){
+        channel->closed = 1;
+        __ipc_wake(channel);
+        return;
+    }
+
+    __ipc_release_channel(channel);
+}
+
+/**
+ * @brief Removes a user, the channel is freed with its last user.
+ * Must be called in a critical section.
+ */
+static void __ipc_drop_user(int index, struct ipc_user* user)
+{
+    struct ipc_channel* channel = ipc_table.channels[index];
+
+    user->pid = -1;
+    user->addr = 0;
+    if(--channel->refs <= 0){
+        __ipc_free_channel(index);
+    }
+}
+
+/**
+ * @brief Writes a message into a shared memory ring.
+ * Only the indices are taken from the shared header, and they are
+ * checked against the kernels copy of the ring size.
+ */
+static int __ipc_shm_send(struct ipc_channel* channel, void* data, int length)
+{
+    struct ipc_shm* shm = channel->shm;
+    uint32_t size = channel->size;
+    uint32_t total = sizeof(struct ipc_shm_msg) + IPC_SHM_ALIGN(length);
+    uint32_t head = shm->head;
+    uint32_t tail = __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE);
+    uint32_t index = head & (size - 1);
+    uint32_t contiguous = size - index;
+    struct ipc_shm_msg* msg;
+
+    if(head - tail > size || (index & 7) || total > size / 2){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    if(contiguous < total){
+        /* Pad to the end of the ring and start over. */
+        if(size - (head - tail) < contiguous + total) return -ERROR_RBUFFER_FULL;
+
+        msg = (struct ipc_shm_msg*)(channel->ring + index);
+        msg->length = contiguous - sizeof(struct ipc_shm_msg);
+        msg->flags = IPC_SHM_MSG_PAD;
+        head += contiguous;
+        index = 0;
+    } else if(size - (head - tail) < total){
+        return -ERROR_RBUFFER_FULL;
+    }
+
+    msg = (struct ipc_shm_msg*)(channel->ring + index);
+    msg->length = length;
+    msg->flags = 0;
+    memcpy(msg + 1, data, length);
+
+    __atomic_store_n(&shm->head, head + total, __ATOMIC_RELEASE);
+    return length;
+}
+
+/**
+ * @brief Reads the next message from a shared memory ring.
+ * Every message header is checked to be aligned, inside the ring and
+ * inside the published part of it before anything is copied.
+ */
+static int __ipc_shm_receive(struct ipc_channel* channel, void* data, int length)
+{
+    struct ipc_shm* shm = channel->shm;
+    uint32_t size = channel->size;
+    uint32_t tail = shm->tail;
+    uint32_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+
+    if(head - tail > size) return -ERROR_INVALID_ARGUMENTS;
+
+    while(tail != head){
+        uint32_t index = tail & (size - 1);
+        struct ipc_shm_msg* msg = (struct ipc_shm_msg*)(channel->ring + index);
+        uint32_t msg_length = msg->length;
+        uint32_t msg_flags = msg->flags;
+
+        if((index & 7) || msg_length > size - index - sizeof(struct ipc_shm_msg)){
+            return -ERROR_INVALID_ARGUMENTS;
+        }
+
+        uint32_t total = sizeof(struct ipc_shm_msg) + IPC_SHM_ALIGN(msg_length);
+        if(total > head - tail) return -ERROR_INVALID_ARGUMENTS;
+
+        if(msg_flags & IPC_SHM_MSG_PAD){
+            tail += total;
+            __atomic_store_n(&shm->tail, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if((int)msg_length > length) return -ERROR_INVALID_ARGUMENTS;
+
+        memcpy(data, msg + 1, msg_length);
+        __atomic_store_n(&shm->tail, tail + total, __ATOMIC_RELEASE);
+        return msg_length;
+    }
+
+    return -ERROR_RBUFFER_EMPTY;
 }
 
 /* userspace interface */
 int sys_ipc_open()
 {
-    int channel = __ipc_alloc_channel();
-    if (channel < 0) {
+    int index;
+    struct ipc_channel* channel = __ipc_new_channel(&index);
+    if (channel == NULL) {
         return -1;
     }
 
-    channels[channel].rbuf = rbuffer_new(IPC_MAX_SIZE);
-    return channel;
+    channel->rbuf = rbuffer_new(IPC_MAX_SIZE);
+    if(channel->rbuf == NULL){
+        CRITICAL_SECTION({
+            __ipc_free_channel(index);
+        });
+        return -1;
+    }
+
+    return index;
 }
 EXPORT_SYSCALL(SYSCALL_IPC_OPEN, sys_ipc_open);
 
+/**
+ * @brief Opens a shared memory channel.
+ * The region is one header page, the message ring (rounded down to a power of two)
+ * and xfer_pages pages used to transfer large payloads.
+ * @param pages ring pages, 0 for the default.
+ * @param xfer_pages pages reserved for page transfers.
+ * @return int channel or less than 0 on error.
+ */
+int sys_ipc_shm_open(int pages, int xfer_pages)
+{
+    int index;
+    int ring_pages = 1;
+
+    if(pages <= 0) pages = IPC_SHM_DEFAULT_PAGES;
+    if(xfer_pages < 0 || 1 + pages + xfer_pages > IPC_SHM_MAX_PAGES){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    while(ring_pages * 2 <= pages) ring_pages *= 2;
+
+    struct ipc_channel* channel = __ipc_new_channel(&index);
+    if (channel == NULL) {
+        return -ERROR_ALLOC;
+    }
+
+    channel->pages = 1 + ring_pages + xfer_pages;
+
+    /* Page aligned and physically contiguous, kthreads use it directly. */
+    channel->memory = kalloc((channel->pages + 1) * PAGE_SIZE);
+    if(channel->memory == NULL){
+        CRITICAL_SECTION({
+            __ipc_free_channel(index);
+        });
+        return -ERROR_ALLOC;
+    }
+
+    channel->shm = (struct ipc_shm*)(((uint32_t)channel->memory + PAGE_SIZE - 1) & ~PAGE_MASK);
+    memset(channel->shm, 0, PAGE_SIZE);
 
-int sys_ipc_close(int channel)
+    channel->ring = (uint8_t*)channel->shm + PAGE_SIZE;
+    channel->size = ring_pages * PAGE_SIZE;
+    channel->xfer = (1 + ring_pages) * PAGE_SIZE;
+
+    /* Layout for userspace, the kernel only uses its own copy. */
+    channel->shm->size = channel->size;
+    channel->shm->data = PAGE_SIZE;
+    channel->shm->pages = channel->pages;
+    channel->shm->xfer = channel->xfer;
+
+    return index;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_SHM_OPEN, sys_ipc_shm_open);
+
+/**
+ * @brief Maps a shared memory channel into the calling process.
+ * The caller becomes a user of the channel and has to close it.
+ * @return int address of the region in the caller, 0 on error.
+ */
+int sys_ipc_shm_map(int index)
 {
-    IPC_VALID_CHANNEL(channel);
+    struct pcb* owner = __ipc_owner($process->current);
+    struct ipc_channel* channel = NULL;
+    struct ipc_user* user = NULL;
+
+    CRITICAL_SECTION({
+        if(index >= 0 && index < ipc_table.capacity && ipc_table.channels[index] != NULL && ipc_table.channels[index]->shm != NULL){
+            channel = ipc_table.channels[index];
+            user = __ipc_find_user(channel, owner->pid);
+            if(user == NULL) user = __ipc_add_user(channel, owner->pid);
+        }
+    });
+    if(user == NULL) return 0;
+    if(user->addr != 0) return user->addr;
 
-    rbuffer_free(channels[channel].rbuf);
-    channels[channel].rbuf = NULL;
+    /* Kernel threads share the kernel directory and can use the region directly. */
+    if(owner->page_dir == kernel_page_dir){
+        user->addr = (uint32_t)channel->shm;
+    } else {
+        user->addr = (uint32_t)vmem_map_ipc(owner, (uint32_t)channel->shm, channel->pages);
+    }
+
+    return user->addr;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_SHM_MAP, sys_ipc_shm_map);
+
+/**
+ * @brief Stops using a channel, only processes that opened or mapped it can close it.
+ */
+int sys_ipc_close(int index)
+{
+    IPC_VALID_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+    struct pcb* owner = __ipc_owner($process->current);
+
+    struct ipc_user* user = __ipc_find_user(channel, owner->pid);
+    if(user == NULL){
+        return -ERROR_ACCESS_DENIED;
+    }
+
+    if(user->addr != 0 && owner->page_dir != kernel_page_dir){
+        vmem_unmap_ipc(owner, (uint32_t)channel->shm, channel->pages);
+    }
+
+    CRITICAL_SECTION({
+        __ipc_drop_user(index, user);
+    });
     return 0;
 }
 EXPORT_SYSCALL(SYSCALL_IPC_CLOSE, sys_ipc_close);
 
-int sys_ipc_send(int channel, void* data, int length)
+int sys_ipc_send(int index, void* data, int length)
 {
     ERR_ON_NULL(data);
-    IPC_VALID_CHANNEL(channel);
+    IPC_VALID_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+    int ret;
+
+    if(length < 0) return -ERROR_INVALID_ARGUMENTS;
 
-    return channels[channel].rbuf->ops->add(channels[channel].rbuf, data, length);
+    if(channel->shm != NULL){
+        ret = __ipc_shm_send(channel, data, length);
+    } else {
+        ret = channel->rbuf->ops->add(channel->rbuf, data, length);
+    }
+
+    if(ret > 0) __ipc_wake(channel);
+    return ret;
 }
 EXPORT_SYSCALL(SYSCALL_IPC_SEND, sys_ipc_send);
 
-int sys_ipc_receive(int channel, void* data, int length)
+int sys_ipc_receive(int index, void* data, int length)
 {
     ERR_ON_NULL(data);
-    IPC_VALID_CHANNEL(channel);
+    IPC_VALID_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+
+    if(length < 0) return -ERROR_INVALID_ARGUMENTS;
 
-    return channels[channel].rbuf->ops->read(channels[channel].rbuf, data, length);
+    if(channel->shm != NULL){
+        return __ipc_shm_receive(channel, data, length);
+    }
+
+    return channel->rbuf->ops->read(channel->rbuf, data, length);
 }
 EXPORT_SYSCALL(SYSCALL_IPC_RECEIVE, sys_ipc_receive);
+
+/**
+ * @brief Blocks until the channel has data.
+ * Shared memory receivers set the waiting flag so the producer knows to notify.
+ * @return int 0 when data is available, less than 0 if the channel is gone.
+ */
+int sys_ipc_wait(int index)
+{
+    IPC_VALID_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+    int ret;
+
+    waitqueue_wait(&channel->wq, __ipc_wait_ready, channel, WAITQUEUE_FOREVER);
+
+    ret = channel->closed ? -1 : 0;
+    ipc_waitqueue_release(&channel->wq);
+
+    return ret;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_WAIT, sys_ipc_wait);
+
+/**
+ * @brief Wakes processes waiting on a shared memory channel.
+ * Only needed when ipc_shm_commit reports a waiting receiver.
+ */
+int sys_ipc_notify(int index)
+{
+    IPC_VALID_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+
+    if(channel->shm != NULL) channel->shm->waiting = 0;
+    __ipc_wake(channel);
+    return 0;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_NOTIFY, sys_ipc_notify);
+
+/**
+ * @brief Readiness of a channel for poll.
+ * @return int POLLIN and POLLOUT flags, POLLERR if the channel does not exist.
+ */
+int ipc_poll(int index)
+{
+    if(index < 0 || index >= ipc_table.capacity || ipc_table.channels[index] == NULL){
+        return POLLERR;
+    }
+    struct ipc_channel* channel = ipc_table.channels[index];
+    int revents = POLLOUT;
+
+    if(__ipc_ready(channel)){
+        revents |= POLLIN;
+    }
+    return revents;
+}
+
+/**
+ * @brief Called by poll in the critical section before blocking on the channel.
+ */
+void ipc_poll_block(int index)
+{
+    if(index < 0 || index >= ipc_table.capacity || ipc_table.channels[index] == NULL){
+        return;
+    }
+    __ipc_set_waiting(ipc_table.channels[index]);
+}
+
+/**
+ * @brief Called by a waiter after leaving the channels wait queue.
+ * A channel closed while processes were waiting is freed by the last waiter,
+ * the waiting flag is cleared when no receiver is left blocking.
+ */
+void ipc_waitqueue_release(struct waitqueue* wq)
+{
+    struct ipc_channel* channel = (struct ipc_channel*)((char*)wq - offsetof(struct ipc_channel, wq));
+
+    CRITICAL_SECTION({
+        if(channel->closed && channel->wq.head == NULL){
+            __ipc_release_channel(channel);
+        } else if(channel->shm != NULL && channel->wq.head == NULL){
+            channel->shm->waiting = 0;
+        }
+    });
+}
+
+struct waitqueue* ipc_waitqueue(int index)
+{
+    if(index < 0 || index >= ipc_table.capacity || ipc_table.channels[index] == NULL){
+        return NULL;
+    }
+    return &ipc_table.channels[index]->wq;
+}
+
+/**
+ * @brief Allocates transfer pages for a large payload.
+ * The sender writes the payload to the returned offset, and sends a
+ * struct ipc_shm_pages descriptor with IPC_SHM_MSG_PAGES. The receiver
+ * reads it in place and releases the pages with sys_ipc_page_free.
+ * @return int offset into the region, less than 0 on error.
+ */
+int sys_ipc_page_alloc(int index, int pages)
+{
+    IPC_VALID_SHM_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+    int first = channel->xfer / PAGE_SIZE;
+    int offset = -ERROR_ALLOC;
+
+    if(pages <= 0) return -ERROR_INVALID_ARGUMENTS;
+
+    CRITICAL_SECTION({
+        int run = 0;
+        for (int i = first; i < channel->pages; i++){
+            run = channel->xfer_used & (1ULL << i) ? 0 : run + 1;
+            if(run < pages) continue;
+
+            for (int j = i - pages + 1; j <= i; j++){
+                channel->xfer_used |= (1ULL << j);
+            }
+            offset = (i - pages + 1) * PAGE_SIZE;
+            break;
+        }
+    });
+
+    return offset;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_PAGE_ALLOC, sys_ipc_page_alloc);
+
+int sys_ipc_page_free(int index, int offset, int pages)
+{
+    IPC_VALID_SHM_CHANNEL(index);
+    struct ipc_channel* channel = ipc_table.channels[index];
+    int first = offset / PAGE_SIZE;
+
+    if(pages <= 0 || offset < (int)channel->xfer || (offset & PAGE_MASK) || pages > channel->pages - first){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    CRITICAL_SECTION({
+        for (int i = first; i < first + pages; i++){
+            channel->xfer_used &= ~(1ULL << i);
+        }
+    });
+
+    return 0;
+}
+EXPORT_SYSCALL(SYSCALL_IPC_PAGE_FREE, sys_ipc_page_free);
+
+/**
+ * @brief Drops the channels used by an exiting process.
+ * Its mappings go away with its page directory.
+ */
+void ipc_release_process(struct pcb* pcb)
+{
+    if(pcb->is_process == PCB_THREAD) return;
+
+    CRITICAL_SECTION({
+        for (int i = 0; i < ipc_table.capacity; i++){
+            if(ipc_table.channels[i] == NULL) continue;
+
+            struct ipc_user* user = __ipc_find_user(ipc_table.channels[i], pcb->pid);
+            if(user != NULL) __ipc_drop_user(i, user);
+        }
+    });
+}
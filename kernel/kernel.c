@@ -23,6 +23,7 @@
 #include <memory.h>
 #include <net/skb.h>
 #include <net/arp.h>
+#include <net/firewall.h>
 #include <ata.h>
 #include <bitmap.h>
 #include <net/socket.h>
@@ -60,6 +61,7 @@
 #include <multiboot.h>
 #include <screen.h>
 #include <conf.h>
+#include <timepage.h>
 
 #define TEXT_COLOR 15  /* White color for text */
 #define LINE_HEIGHT 8  /* Height of each line */
@@ -136,6 +138,7 @@ void kernel(uint32_t magic)
 	/* Initilize memory map and then kernel and virtual memory */
 	memory_map_init(__kernel_context.boot_info->extended_memory_low * 1024, __kernel_context.boot_info->extended_memory_high * 64 * 1024);
 	init_memory();
+	timepage_init();
 	kernel_boot_printf("Memory initialized.");
 	
 	/* Initilize the kernel constructors */
@@ -171,6 +174,7 @@ void kernel(uint32_t magic)
 
 	/* initilize net structs */
 	net_init_arp();
+	net_init_firewall();
 	net_init_sockets();
 	net_init_dns();
 	net_init_loopback();
@@ -201,7 +205,7 @@ void kernel(uint32_t magic)
 	add_system_call(SYSCALL_YIELD, (syscall_t)&kernel_yield);
 
 	add_system_call(SYSCALL_GFX_WINDOW, (syscall_t)&gfx_new_window);
-	add_system_call(SYSCALL_GFX_GET_TIME,  (syscall_t)&get_current_time);
+	add_system_call(SYSCALL_GFX_GET_TIME,  (syscall_t)&timepage_get_time);
 	add_system_call(SYSCALL_GFX_DRAW, (syscall_t)&gfx_syscall_hook);
 	add_system_call(SYSCALL_GFX_SET_TITLE, (syscall_t)&kernel_gfx_set_title);
 	add_system_call(SYSCALL_GFX_SET_HEADER, (syscall_t)&kernel_gfx_set_header);
@@ -21,6 +21,7 @@
 #include <kutils.h>
 #include <scheduler.h>
 #include <math.h>
+#include <timepage.h>
 
 #define center_x(size) ((110/2) - ((size*8)/2))
 
@@ -55,13 +56,13 @@ void __kthread_entry kclock(int argc, char* argv[])
 
         angle_id = (0.5 * (now.hour%12 * 60 + now.minute) / 6);
         
-        get_current_time(&now);
+        timepage_get_time(&now);
 
-        if(get_time() - timestamp < 2){
+        if(timepage_get_seconds() - timestamp < 2){
             kernel_yield();
             continue;
         }
-        timestamp = get_time();
+        timestamp = timepage_get_seconds();
 
         w->draw->rect(w, 0, 0, 110, 140, 30);
 
@@ -12,6 +12,8 @@
 #include <kconfig.h>
 #include <kutils.h>
 #include <scheduler.h>
+#include <timer.h>
+#include <waitqueue.h>
 #include <serial.h>
 #include <assert.h>
 #include <kthreads.h>
@@ -26,6 +28,8 @@
 #include <net/ethernet.h>
 #include <net/ipv4.h>
 #include <net/tcp.h>
+#include <net/routing.h>
+#include <net/firewall.h>
 #include <net/icmp.h>
 #include <net/socket.h>
 #include <net/net.h>
@@ -75,26 +79,38 @@ static void __net_config_loopback()
     interface->netmask = 0xff000000;
     interface->gateway = 0x7f000001;
 
-    struct arp_content entry = {
-        .sip = ntohl(LOOPBACK_IP), /* Store IP in host byte order */
-        .smac = {0x69, 0x00, 0x00, 0x00, 0x00, 0x00}
-    };
+    uint8_t mac[6] = {0x69, 0x00, 0x00, 0x00, 0x00, 0x00};
+    net_arp_add_permanent(ntohl(LOOPBACK_IP), mac);
 
-    net_arp_add_entry(&entry);
+    route_add(interface->ip, 8, 0, interface, ROUTE_METRIC_CONNECTED, ROUTE_CONNECTED);
 }
 
-static void __net_transmit_skb(struct sk_buff* skb)
+/**
+ * @brief Hands a sk_buff to its interface.
+ * @return int -ERROR_DEVICE_BUSY if it has to be retried, the caller keeps its reference.
+ */
+static int __net_transmit_skb(struct sk_buff* skb)
 {
-    if(skb == NULL || skb->interface == NULL) return;
+    if(skb == NULL || skb->interface == NULL) return -ERROR_NULL_POINTER;
+
+    int ret = skb->interface->ops->send_skb(skb->interface, skb);
+    if(ret == -ERROR_DEVICE_BUSY){
+        return ret;
+    }
 
-    int ret = skb->interface->ops->send(skb->interface, skb->head, skb->len);
     if(ret < 0){
         warningf("Failed to send packet %d\n", ret);
-        return;
+        return ret;
     }    
    
     netd.packets++;
     netd.stats.sent++;
+    return ret;
+}
+
+static int __net_tx_has_room(void* arg)
+{
+    return netd.skb_tx_queue->size < NETD_TX_QUEUE_MAX;
 }
 
 static int net_drop_packet(struct sk_buff* skb)
@@ -117,22 +133,45 @@ int net_configure_iface(char* dev, uint32_t ip, uint32_t netmask, uint32_t gatew
     interface->gateway = ntohl(gateway);
     interface->ops->configure(interface, "eth0");
 
+    /* Replace the routes from an earlier lease, the address is in network order. */
+    route_flush(interface, ROUTE_CONNECTED | ROUTE_DHCP);
+    route_add(ntohl(ip), route_mask_to_len(interface->netmask), 0, interface, ROUTE_METRIC_CONNECTED, ROUTE_CONNECTED);
+    if(gateway != 0){
+        route_add(0, 0, interface->gateway, interface, ROUTE_METRIC_DHCP, ROUTE_DHCP);
+    }
+
     return 0;
 }
 
-void __callback net_incoming_packet(struct netdev* dev)
+/**
+ * @brief Moves one received packet from the device to the RX queue.
+ * @return int 1 if a packet was taken from the device, 0 if it had none.
+ */
+int __callback net_incoming_packet(struct netdev* dev)
 {
-    if(dev == NULL) return;
+    if(dev == NULL) return 0;
 
     struct net_interface* interface = __net_interface(dev);
-    if(interface == NULL) return;
+    if(interface == NULL) return 0;
+
+    struct sk_buff* skb;
+    if(dev->read_skb != NULL){
+        /* Driver hands up the buffer the packet was received into */
+        skb = dev->read_skb(dev);
+        if(skb == NULL) return 0;
+    } else {
+        skb = skb_alloc(dev);
+        if(skb == NULL){
+            dev->dropped++;
+            return 0;
+        }
+        skb->len = dev->read((byte_t*)skb->data, MAX_PACKET_SIZE);
+    }
 
-    struct sk_buff* skb = skb_new();
-    skb->len = dev->read((byte_t*)skb->data, MAX_PACKET_SIZE);
     if(skb->len <= 0) {
         dbgprintf("Received an empty packet.\n");
         skb_free(skb);
-        return;
+        return 1;
     }
     skb->interface = interface;
 
@@ -146,31 +185,162 @@ void __callback net_incoming_packet(struct netdev* dev)
         netd.instance->state = RUNNING;
     }
 
+    return 1;
+}
+
+/**
+ * @brief Called by drivers with RX interrupts masked, the networking
+ * thread polls the device until it is empty.
+ */
+void __callback net_schedule_poll(struct netdev* dev)
+{
+    dev->poll_scheduled = 1;
+
+    if(netd.instance != NULL && (netd.instance->state == BLOCKED || netd.instance->state == SLEEPING)){ 
+        netd.instance->state = RUNNING;
+    }
 }
 
-struct net_interface* net_get_iface(uint32_t ip)
+/**
+ * @brief Drains up to budget packets from a polled device into the RX queue.
+ * Re-enables RX interrupts when the ring is empty.
+ * @return int packets received.
+ */
+static int __net_poll_device(struct net_interface* interface, int budget)
 {
-    struct net_interface* best_match = NULL;
-    int longest_prefix_length = -1;
+    struct netdev* dev = interface->device;
+    int received = 0;
 
-    for (int i = 0; i < netd.if_count; i++) {
-        int prefix_length = 0;
-        uint32_t mask = 0x80000000; /* Start with the most significant bit */
+    dev->polls++;
+    while(received < budget){
+        struct sk_buff* skb = dev->read_skb(dev);
+        if(skb == NULL) break;
 
-        while (mask && (netd.ifs[i]->ip & mask) == (ip & mask)) {
-            prefix_length++;
-            mask >>= 1; /* Move to the next bit */
+        if(skb->len <= 0){
+            skb_free(skb);
+            continue;
         }
+        skb->interface = interface;
+
+        netd.skb_rx_queue->ops->add(netd.skb_rx_queue, skb);
+        netd.packets++;
+        netd.stats.recvd++;
+        received++;
+    }
+
+    /* Ring is empty, go back to interrupts. */
+    if(received < budget){
+        dev->poll_scheduled = 0;
+        dev->rx_irq(dev, 1);
+    }
+
+    return received;
+}
+
+static int __net_poll()
+{
+    int received = 0;
+
+    for (int i = 0; i < netd.if_count; i++){
+        struct netdev* dev = netd.ifs[i]->device;
+        if(dev == NULL || !dev->poll_scheduled || dev->rx_irq == NULL) continue;
+
+        received += __net_poll_device(netd.ifs[i], NETD_POLL_BUDGET);
+    }
+
+    return received;
+}
+
+/**
+ * @brief Called by drivers when transmit descriptors were reclaimed.
+ * Wakes the networking thread if it is waiting to retry a pending sk_buff.
+ */
+void __callback net_transmit_complete(struct netdev* dev)
+{
+    if(netd.tx_pending == NULL) return;
+
+    if(netd.instance != NULL && (netd.instance->state == BLOCKED || netd.instance->state == SLEEPING)){ 
+        netd.instance->state = RUNNING;
+    }
+}
 
-        if (prefix_length > longest_prefix_length) {
-            longest_prefix_length = prefix_length;
-            best_match = netd.ifs[i];
+/**
+ * @brief Queues work to run on the networking thread.
+ * Safe to call from interrupt context.
+ */
+void __callback net_defer(struct net_deferred* work)
+{
+    CRITICAL_SECTION({
+        if(!work->queued){
+            work->queued = 1;
+            work->next = netd.deferred;
+            netd.deferred = work;
         }
+    });
+
+    if(netd.instance != NULL && (netd.instance->state == BLOCKED || netd.instance->state == SLEEPING)){ 
+        netd.instance->state = RUNNING;
     }
+}
 
-    dbgprintf("Found interface %s for %i\n", best_match->name, ip);
+/**
+ * @brief Removes queued work, must be called before the work is freed.
+ */
+void net_defer_cancel(struct net_deferred* work)
+{
+    CRITICAL_SECTION({
+        struct net_deferred** iter = &netd.deferred;
+        while(*iter != NULL){
+            if(*iter == work){
+                *iter = work->next;
+                break;
+            }
+            iter = &(*iter)->next;
+        }
+        work->next = NULL;
+        work->queued = 0;
+    });
+}
+
+/**
+ * @brief Runs all deferred work.
+ * @return int number of work items run.
+ */
+static int __net_run_deferred()
+{
+    struct net_deferred* work;
+    int ran = 0;
 
-    return best_match;
+    while(1){
+        ENTER_CRITICAL();
+        work = netd.deferred;
+        if(work != NULL){
+            netd.deferred = work->next;
+            work->next = NULL;
+            work->queued = 0;
+        }
+        LEAVE_CRITICAL();
+
+        if(work == NULL) break;
+
+        work->fn(work->arg);
+        ran++;
+    }
+
+    return ran;
+}
+
+/**
+ * @brief Interface a destination (host order) is routed through.
+ */
+struct net_interface* net_get_iface(uint32_t ip)
+{
+    return route_lookup(ip, NULL);
+}
+
+struct net_interface* net_get_iface_by_name(char* name)
+{
+    return __net_find_interface(name);
 }
 
 
@@ -180,6 +350,7 @@ int net_iface_up(char* dev)
     if(interface == NULL) return -1;
 
     interface->state = NET_IFACE_UP;
+    route_invalidate();
     return 0;
 }
 
@@ -189,13 +360,14 @@ int net_iface_down(char* dev)
     if(interface == NULL) return -1;
 
     interface->state = NET_IFACE_DOWN;
+    route_invalidate();
     return 0;
 }
 
 int net_list_ifaces()
 {
     for (int i = 0; i < netd.if_count; i++){
-        twritef("%s: %s mtu 1500\n", netd.ifs[i]->name, netd.ifs[i]->state == NET_IFACE_UP ? "UP" : "DOWN");
+        twritef("%s: %s mtu %d\n", netd.ifs[i]->name, netd.ifs[i]->state == NET_IFACE_UP ? "UP" : "DOWN", netd.ifs[i]->mtu);
         twritef("   inet %i netmask %i\n", ntohl(netd.ifs[i]->ip), ntohl(netd.ifs[i]->netmask));
         twritef("   tx %d   rx %d\n", netd.ifs[i]->device->sent, netd.ifs[i]->device->received);
     }
@@ -221,6 +393,22 @@ int net_send_skb(struct sk_buff* skb)
         return -1;
     }
 
+    if(skb->arp_ip != 0){
+        /* Sent by the ARP cache once the next hop is resolved */
+        return net_arp_queue(skb);
+    }
+
+    if(skb->proto == IP && net_firewall_filter(skb, FIREWALL_OUT) != FIREWALL_POLICY_ACCEPT){
+        netd.stats.dropped++;
+        skb_free(skb);
+        return -ERROR_ACCESS_DENIED;
+    }
+
+    /* Backpressure, senders wait while the device is behind. */
+    if($process->current != netd.instance && !__net_tx_has_room(NULL)){
+        waitqueue_wait(&netd.tx_wq, __net_tx_has_room, NULL, WAITQUEUE_FOREVER);
+    }
+
     RETURN_ON_ERR(netd.skb_tx_queue->ops->add(netd.skb_tx_queue, skb));
     netd.packets++;
 
@@ -233,7 +421,25 @@ int net_send_skb(struct sk_buff* skb)
 
 error_t net_get_info(struct net_info* info)
 {
+    struct tcp_stats tcp;
+
     *info = netd.stats;
+
+    tcp_get_stats(&tcp);
+    info->tcp_data_segs_in = tcp.data_segs_in;
+    info->tcp_acks_out = tcp.acks_out;
+    info->tcp_acks_delayed = tcp.acks_delayed;
+
+    info->pool_hits = current_netdev.pool.hits;
+    info->pool_misses = current_netdev.pool.misses;
+    info->pool_free = current_netdev.pool.count;
+    for (int i = 0; i < netd.if_count; i++){
+        struct skb_pool* pool = &netd.ifs[i]->device->pool;
+        info->pool_hits += pool->hits;
+        info->pool_misses += pool->misses;
+        info->pool_free += pool->count;
+    }
+
     return ERROR_OK;
 }
 
@@ -246,6 +452,7 @@ static int net_handle_recieve(struct sk_buff* skb)
         /* Ethernet type is IP */
         case IP:
             if(net_ipv4_parse(skb) < 0) return net_drop_packet(skb);
+            if(net_firewall_filter(skb, FIREWALL_IN) != FIREWALL_POLICY_ACCEPT) return net_drop_packet(skb);
             switch (skb->hdr.ip->proto){
             case UDP:
                 if(net_udp_parse(skb) < 0) return net_drop_packet(skb);
@@ -278,6 +485,79 @@ static int net_handle_recieve(struct sk_buff* skb)
     return 1;
 }
 
+/**
+ * @brief Transmits up to budget sk_buffs from the TX queue.
+ * Stops early if the device is busy, the sk_buff is kept as pending.
+ * @return int sk_buffs handed to devices.
+ */
+static int __net_flush_tx(int budget)
+{
+    int sent = 0;
+
+    while(sent < budget){
+        if(netd.tx_pending == NULL){
+            if(!SKB_QUEUE_READY(netd.skb_tx_queue)) break;
+
+            netd.tx_pending = netd.skb_tx_queue->ops->remove(netd.skb_tx_queue);
+            assert(netd.tx_pending != NULL);
+        }
+
+        /* Keep the sk_buff until the device has room for it. */
+        if(__net_transmit_skb(netd.tx_pending) == -ERROR_DEVICE_BUSY) break;
+
+        skb_free(netd.tx_pending);
+        netd.tx_pending = NULL;
+        sent++;
+    }
+
+    if(sent > 0) waitqueue_wake(&netd.tx_wq);
+    return sent;
+}
+
+/* Histogram bucket for a batch, log2 of the packet count plus one */
+static inline int __net_batch_bucket(int packets)
+{
+    int bucket = 0;
+
+    while(packets > 0 && bucket < NET_BATCH_HIST - 1){
+        packets >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * @brief Parses up to budget sk_buffs from the RX queue on the networking thread.
+ * Replies produced while parsing are queued for the next TX flush.
+ * @return int sk_buffs parsed.
+ */
+static int __net_drain_rx(int budget)
+{
+    int received = 0;
+
+    while(received < budget && SKB_QUEUE_READY(netd.skb_rx_queue)){
+        struct sk_buff* skb = netd.skb_rx_queue->ops->remove(netd.skb_rx_queue);
+        if(skb == NULL) break;
+
+        net_handle_recieve(skb);
+        received++;
+    }
+
+    return received;
+}
+
+static int __net_has_work()
+{
+    if(netd.skb_tx_queue->size > 0 || netd.skb_rx_queue->size > 0 || netd.tx_pending != NULL || netd.deferred != NULL){
+        return 1;
+    }
+
+    for (int i = 0; i < netd.if_count; i++){
+        if(netd.ifs[i]->device != NULL && netd.ifs[i]->device->poll_scheduled) return 1;
+    }
+    return 0;
+}
+
 /**
  * @brief Main networking event loop.
  * 
@@ -287,6 +567,7 @@ void __kthread_entry networking_main()
     if(netd.state == NETD_UNINITIALIZED){
         netd.skb_rx_queue = skb_new_queue();
         netd.skb_tx_queue = skb_new_queue();
+        waitqueue_init(&netd.tx_wq);
     }
 
     netd.instance = $process->current;
@@ -299,43 +580,41 @@ void __kthread_entry networking_main()
         return;
     }
 
-    /* Start DHCP client */
+    /* Start DHCP client and DNS resolver */
     if(netd.if_count > 1){
         start("dhcpd", 0, NULL);
+        start("dnsd", 0, NULL);
     }
     
     //start("udp_server", 0, NULL);
     start("tcp_server", 0, NULL); 
-    int todos =0;
     while(1){
-        
-        todos = netd.skb_tx_queue->size + netd.skb_rx_queue->size;
-        /**
-         * @brief Query RX an    TX queue for netd.packets.
-         */
-        if(SKB_QUEUE_READY(netd.skb_tx_queue)){
-            dbgprintf("Sending new SKB from TX queue\n");
-            struct sk_buff* skb = netd.skb_tx_queue->ops->remove(netd.skb_tx_queue);
-            assert(skb != NULL);
-
-            __net_transmit_skb(skb);
-            skb_free(skb);
+        __net_poll();
+        __net_run_deferred();
+
+        int tx = __net_flush_tx(NETD_TX_BATCH);
+        int rx = __net_drain_rx(NETD_RX_BATCH);
+
+        if(rx > 0 || tx > 0){
+            netd.stats.batches++;
+            netd.stats.rx_batched += rx;
+            netd.stats.tx_batched += tx;
+            netd.stats.rx_batch_hist[__net_batch_bucket(rx)]++;
+            netd.stats.tx_batch_hist[__net_batch_bucket(tx)]++;
+            if(rx > netd.stats.rx_batch_max) netd.stats.rx_batch_max = rx;
+            if(tx > netd.stats.tx_batch_max) netd.stats.tx_batch_max = tx;
         }
 
-        if(SKB_QUEUE_READY(netd.skb_rx_queue)){
-            dbgprintf("Receiving new SKB from RX queue\n");
-            struct sk_buff* skb = netd.skb_rx_queue->ops->remove(netd.skb_rx_queue);
-            assert(skb != NULL);
-
-            /* Offload skb parsing to worker thread. */
-            work_queue_add(&net_handle_recieve, (void*)skb, NULL);
-            //net_handle_recieve(skb);
-        }
-
-        if(todos == 0){
+        /* Checked with interrupts off, so a wake up between the check and blocking is not lost. */
+        ENTER_CRITICAL();
+        if(!__net_has_work()){
             $process->current->state = BLOCKED;
+        } else if(netd.tx_pending != NULL && netd.skb_rx_queue->size == 0){
+            /* Wait for TX completion, the tick timeout covers a missed interrupt. */
+            waitqueue_prepare(timer_get_tick() + 1);
         }
+        LEAVE_CRITICAL();
 
         kernel_yield();
     }
-}
\ No newline at end of file
+}
@@ -40,6 +40,7 @@
 #include <net/socket.h>
 #include <net/tcp.h>
 #include <net/net.h>
+#include <timer.h>
 #include <conf.h>
 
 #include <kutils.h>
@@ -350,10 +351,37 @@ EXPORT_KSYMBOL(ths);
 		func\
 	EXPORT_KSYMBOL(name);
 
+static void __dns_stat()
+{
+	struct dns_stats stats;
+	struct dns_entry* entries = kalloc(sizeof(struct dns_entry) * DNS_CACHE_SIZE);
+	if(entries == NULL) return;
+
+	int count = dns_get_entries(entries, DNS_CACHE_SIZE);
+	dns_get_stats(&stats);
+
+	uint32_t now = timer_get_tick();
+	for (int i = 0; i < count; i++){
+		int ttl = (int32_t)(entries[i].expires - now) / timer_ms_to_ticks(1000);
+		twritef(" %s  %s  %i  ttl %d\n", entries[i].name, dns_state_to_str(entries[i].state), entries[i].ip, ttl > 0 ? ttl : 0);
+	}
+
+	twritef(" %d hits (%d negative), %d misses (%d coalesced)\n", stats.hits + stats.negative_hits, stats.negative_hits, stats.misses, stats.coalesced);
+	twritef(" %d queries, %d retransmits, %d timeouts, %d failures\n", stats.queries, stats.retransmits, stats.timeouts, stats.failures);
+	twritef(" latency avg %d ms, max %d ms\n", stats.answers > 0 ? stats.latency_total / stats.answers : 0, stats.latency_max);
+
+	kfree(entries);
+}
+
 COMMAND(dns, {
 
 	if(argc == 1){
-		twritef("usage: dns <domain>\n");
+		twritef("usage: dns <domain>\n       dns stat\n");
+		return;
+	}
+
+	if(strcmp(argv[1], "stat") == 0){
+		__dns_stat();
 		return;
 	}
 
@@ -165,13 +165,24 @@ static void sysinf_draw_net(struct window* w, struct tab* tab)
     struct net_info info;
     net_get_info(&info);
 
+    /* Acknowledgements sent per 100 data segments received */
+    int acks = info.tcp_data_segs_in > 0 ? (info.tcp_acks_out * 100) / info.tcp_data_segs_in : 0;
+    /* Packets handled per 10 batches */
+    int rx_avg = info.batches > 0 ? (info.rx_batched * 10) / info.batches : 0;
+    int tx_avg = info.batches > 0 ? (info.tx_batched * 10) / info.batches : 0;
+
     SECTION(w, 24, 48, WIDTH-48, HEIGHT/3-48, "Stats");
 
-    gfx_put_icon32(wlan_32, WIDTH/2 + 40, 45+10);
+    gfx_put_icon32(wlan_32, WIDTH - 24 - 40, 45+10);
 
     w->draw->textf(w, 30, 45+10, 0,     "TX:        %d", info.sent);
     w->draw->textf(w, 30, 45+20, 0,     "RX:        %d", info.recvd);
     w->draw->textf(w, 30, 45+30, 0,     "Dropped:   %d", info.dropped);
+    w->draw->textf(w, 30, 45+40, 0,     "SKB pool:  %d/%d", info.pool_hits, info.pool_misses);
+    w->draw->textf(w, 140, 45+10, 0,  "Batches: %d", info.batches);
+    w->draw->textf(w, 140, 45+20, 0,  "Avg RX:  %d.%d", rx_avg / 10, rx_avg % 10);
+    w->draw->textf(w, 140, 45+30, 0,  "Avg TX:  %d.%d", tx_avg / 10, tx_avg % 10);
+    w->draw->textf(w, 140, 45+40, 0,  "ACK/seg: %d.%d%d", acks / 100, (acks / 10) % 10, acks % 10);
 
     SECTION(w, 24, HEIGHT/3+10, WIDTH-48, HEIGHT/3-48, "Services");
 
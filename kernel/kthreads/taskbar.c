@@ -18,6 +18,7 @@
 #include <colors.h>
 #include <rtc.h>
 #include <timer.h>
+#include <timepage.h>
 #include <gfx/component.h>
 #include <kutils.h>
 #include <kthreads.h>
@@ -324,7 +325,7 @@ static void __kthread_entry taskbar(void)
 
         gfx_put_icon16(wlan_16, w->inner_width - (timedate_length*8) - 20, 2);
 
-        get_current_time(&time);
+        timepage_get_time(&time);
         w->draw->rect(w, w->inner_width - (timedate_length*8), 5, timedate_length*8, 10, 30);
         w->draw->textf(w, w->inner_width - (timedate_length*8), 5, COLOR_BLACK,
             "%s%d:%s%d:%s%d %s%d/%s%d/%d",
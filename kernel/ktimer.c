@@ -0,0 +1,103 @@
+/**
+ * @file ktimer.c
+ * @author Joe Bayer (joexbayer)
+ * @brief One shot timers run from the timer interrupt.
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * Pending timers are kept in a list sorted by expiry,
+ * so each tick only looks at the head of the list.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <ktimer.h>
+#include <kutils.h>
+#include <libc.h>
+
+/* Expiry comparison, handles the tick counter wrapping around */
+#define KTIMER_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
+static struct ktimer* __timers = NULL;
+
+/* Must be called with interrupts disabled */
+static void __ktimer_unlink(struct ktimer* timer)
+{
+    struct ktimer** iter = &__timers;
+
+    while(*iter != NULL){
+        if(*iter == timer){
+            *iter = timer->next;
+            break;
+        }
+        iter = &(*iter)->next;
+    }
+
+    timer->next = NULL;
+    timer->pending = 0;
+}
+
+void ktimer_init(struct ktimer* timer, void (*callback)(struct ktimer* timer), void* data)
+{
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->next = NULL;
+    timer->pending = 0;
+}
+
+/**
+ * @brief Starts the timer, or moves it if it is already pending.
+ * @param timer timer to start.
+ * @param expires timer tick to run the callback at.
+ */
+void ktimer_mod(struct ktimer* timer, uint32_t expires)
+{
+    CRITICAL_SECTION({
+        if(timer->pending){
+            __ktimer_unlink(timer);
+        }
+
+        struct ktimer** iter = &__timers;
+        while(*iter != NULL && !KTIMER_BEFORE(expires, (*iter)->expires)){
+            iter = &(*iter)->next;
+        }
+
+        timer->expires = expires;
+        timer->next = *iter;
+        timer->pending = 1;
+        *iter = timer;
+    });
+}
+
+/**
+ * @brief Stops the timer, does nothing if it is not pending.
+ */
+void ktimer_del(struct ktimer* timer)
+{
+    CRITICAL_SECTION({
+        if(timer->pending){
+            __ktimer_unlink(timer);
+        }
+    });
+}
+
+/**
+ * @brief Runs the callbacks of all expired timers.
+ * Called from the timer interrupt.
+ * @param tick current timer tick.
+ */
+void ktimer_run(uint32_t tick)
+{
+    while(__timers != NULL && !KTIMER_BEFORE(tick, __timers->expires)){
+        struct ktimer* timer = __timers;
+        __timers = timer->next;
+
+        timer->next = NULL;
+        timer->pending = 0;
+
+        /* The callback may start the timer again */
+        timer->callback(timer);
+    }
+}
@@ -11,6 +11,7 @@
 
 #include <arch/gdt.h>
 #include <pcb.h>
+#include <ipc.h>
 #include <serial.h>
 #include <memory.h>
 #include <scheduler.h>
@@ -338,6 +339,8 @@ int pcb_cleanup_routine(void* arg)
 		}
 	}
 	
+	ipc_release_process(pcb);
+
 	switch (pcb->is_process){
 	case PCB_PROCESS:
 		vmem_cleanup_process(pcb);
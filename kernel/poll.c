@@ -0,0 +1,187 @@
+/**
+ * @file poll.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Waiting for readiness on multiple sources.
+ * @version 0.1
+ * @date 2024-03-02
+ *
+ * A process polling several sockets, IPC channels or its window
+ * adds one wait queue entry per source and blocks until any
+ * of them is woken up, or the timeout passes.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <poll.h>
+#include <waitqueue.h>
+#include <scheduler.h>
+#include <syscalls.h>
+#include <syscall_helper.h>
+#include <kutils.h>
+#include <memory.h>
+#include <timer.h>
+#include <errors.h>
+#include <ipc.h>
+#include <pcb.h>
+#include <net/socket.h>
+#include <gfx/window.h>
+
+/* Ops for each pollable type */
+struct poll_source {
+    int (*poll)(int fd);
+    struct waitqueue* (*queue)(int fd);
+    void (*block)(int fd);                  /* optional, called before blocking */
+    void (*release)(struct waitqueue* wq);   /* optional, called after leaving the queue */
+};
+
+static int __poll_socket(int fd)
+{
+    struct sock* sock = sock_get(fd);
+    return sock == NULL ? POLLERR : net_sock_poll(sock);
+}
+
+static struct waitqueue* __poll_socket_queue(int fd)
+{
+    struct sock* sock = sock_get(fd);
+    return sock == NULL ? NULL : &sock->wq;
+}
+
+static int __poll_window(int fd)
+{
+    struct window* w = $process->current->gfx_window;
+    if(w == NULL) return POLLERR;
+
+    return w->events.tail != w->events.head ? POLLIN : 0;
+}
+
+static struct waitqueue* __poll_window_queue(int fd)
+{
+    struct window* w = $process->current->gfx_window;
+    return w == NULL ? NULL : &w->events.wq;
+}
+
+static struct poll_source poll_sources[] = {
+    [POLL_SOCKET] = {
+        .poll = __poll_socket,
+        .queue = __poll_socket_queue
+    },
+    [POLL_IPC] = {
+        .poll = ipc_poll,
+        .queue = ipc_waitqueue,
+        .block = ipc_poll_block,
+        .release = ipc_waitqueue_release
+    },
+    [POLL_WINDOW] = {
+        .poll = __poll_window,
+        .queue = __poll_window_queue
+    }
+};
+
+struct poll_entry {
+    struct waitqueue_entry entry;
+    struct waitqueue* wq;
+};
+
+/**
+ * @brief Updates revents for all fds.
+ * @return int number of fds with events.
+ */
+static int __poll_scan(struct pollfd* fds, int nfds)
+{
+    int ready = 0;
+
+    for (int i = 0; i < nfds; i++){
+        if(fds[i].type < POLL_SOCKET || fds[i].type > POLL_WINDOW){
+            fds[i].revents = POLLERR;
+        } else {
+            /* POLLHUP and POLLERR are always reported */
+            fds[i].revents = poll_sources[fds[i].type].poll(fds[i].fd) & (fds[i].events | POLLHUP | POLLERR);
+        }
+
+        if(fds[i].revents) ready++;
+    }
+
+    return ready;
+}
+
+/**
+ * @brief Waits until one of the fds is ready.
+ * @param fds array of fds, revents is updated.
+ * @param nfds number of fds.
+ * @param timeout ms to wait, 0 returns immediately, less than 0 waits forever.
+ * @return int number of ready fds, 0 on timeout, less than 0 on error.
+ */
+int sys_poll(struct pollfd* fds, int nfds, int timeout)
+{
+    struct poll_entry* entries = NULL;
+    uint32_t deadline = 0;
+    int ready;
+
+    ERR_ON_NULL(fds);
+    if(nfds <= 0 || nfds > POLL_MAX_FDS){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    if(timeout > 0){
+        deadline = timer_get_tick() + timer_ms_to_ticks(timeout);
+    }
+
+    while(1){
+        ENTER_CRITICAL();
+        ready = __poll_scan(fds, nfds);
+        if(ready > 0 || timeout == 0 || (deadline != 0 && (uint32_t)timer_get_tick() >= deadline)){
+            LEAVE_CRITICAL();
+            break;
+        }
+
+        /* Register on all queues once, entries stay until poll returns */
+        if(entries == NULL){
+            entries = kcalloc(sizeof(struct poll_entry) * nfds);
+            if(entries == NULL){
+                LEAVE_CRITICAL();
+                return -ERROR_ALLOC;
+            }
+
+            for (int i = 0; i < nfds; i++){
+                entries[i].wq = poll_sources[fds[i].type].queue(fds[i].fd);
+                if(entries[i].wq == NULL) continue;
+
+                entries[i].entry.pcb = $process->current;
+                waitqueue_add(entries[i].wq, &entries[i].entry);
+            }
+        }
+
+        for (int i = 0; i < nfds; i++){
+            if(entries[i].wq != NULL && poll_sources[fds[i].type].block != NULL){
+                poll_sources[fds[i].type].block(fds[i].fd);
+            }
+        }
+
+        waitqueue_prepare(deadline);
+        LEAVE_CRITICAL();
+
+        kernel_yield();
+    }
+
+    if(entries != NULL){
+        for (int i = 0; i < nfds; i++){
+            if(entries[i].wq == NULL) continue;
+
+            /* Sources without release, like sockets, may be freed while polled */
+            ENTER_CRITICAL();
+            if(poll_sources[fds[i].type].release != NULL || poll_sources[fds[i].type].queue(fds[i].fd) == entries[i].wq){
+                waitqueue_remove(entries[i].wq, &entries[i].entry);
+            }
+            LEAVE_CRITICAL();
+
+            if(poll_sources[fds[i].type].release != NULL){
+                poll_sources[fds[i].type].release(entries[i].wq);
+            }
+        }
+        kfree(entries);
+    }
+
+    return ready;
+}
+EXPORT_SYSCALL(SYSCALL_POLL, sys_poll);
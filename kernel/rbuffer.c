@@ -163,4 +163,97 @@ static error_t __ring_buffer_read(struct ring_buffer *buffer, unsigned char *dat
     });
 
     return read_length;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Creates a new single producer, single consumer ring.
+ *
+ * The size is rounded up to the next power of two so positions can be masked
+ * instead of using modulo arithmetic.
+ *
+ * @param size Minimum size of the ring in bytes.
+ * @return A pointer to the new `struct spsc_ring`, NULL on failure.
+ */
+struct spsc_ring* spsc_new(int size)
+{
+    uint32_t real_size = 1;
+    while(real_size < (uint32_t)size) real_size <<= 1;
+
+    struct spsc_ring* ring = create(struct spsc_ring);
+    if(ring == NULL) return NULL;
+
+    ring->buffer = kalloc(real_size);
+    if(ring->buffer == NULL){
+        kfree(ring);
+        return NULL;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = real_size - 1;
+
+    return ring;
+}
+
+void spsc_free(struct spsc_ring* ring)
+{
+    kfree(ring->buffer);
+    kfree(ring);
+}
+
+/**
+ * @brief Copies data into a single producer, single consumer ring.
+ *
+ * Either all `len` bytes are written or none, using at most two
+ * contiguous copies. Must only be called by the producer.
+ *
+ * @return `len` on success, -ERROR_RBUFFER_FULL if there is not enough space.
+ */
+int spsc_write(struct spsc_ring* ring, const unsigned char* data, int len)
+{
+    uint32_t chunk;
+    int written = 0;
+
+    if(len < 0 || spsc_space(ring) < (uint32_t)len){
+        return -ERROR_RBUFFER_FULL;
+    }
+
+    while(written < len){
+        chunk = len - written;
+        unsigned char* ptr = spsc_reserve(ring, &chunk);
+        memcpy(ptr, data + written, chunk);
+        spsc_commit(ring, chunk);
+        written += chunk;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Copies up to `len` bytes out of a single producer, single consumer ring.
+ *
+ * Must only be called by the consumer.
+ *
+ * @return Bytes read, -ERROR_RBUFFER_EMPTY if the ring is empty.
+ */
+int spsc_read(struct spsc_ring* ring, unsigned char* data, int len)
+{
+    uint32_t chunk;
+    int read = 0;
+
+    if(spsc_used(ring) == 0){
+        return -ERROR_RBUFFER_EMPTY;
+    }
+
+    while(read < len){
+        unsigned char* ptr = spsc_peek(ring, &chunk);
+        if(ptr == NULL) break;
+
+        if(chunk > (uint32_t)(len - read)) chunk = len - read;
+        memcpy(data + read, ptr, chunk);
+        spsc_consume(ring, chunk);
+        read += chunk;
+    }
+
+    return read;
+}
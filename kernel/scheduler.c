@@ -245,10 +245,10 @@ static error_t sched_round_robin(struct scheduler* sched)
         case SLEEPING:{
                 /**
                  * @brief When a pcb is sleeping, we need to know if we should wake it up.
-                 * If the pcb's sleep time is less than the current tick we can wake it up
-                 * and schedule it as running, else it will be put at the end of the queue.
+                 * If the pcb's sleep time has passed we can wake it up and schedule it
+                 * as running, else it will be put at the end of the queue.
                  */
-                if(next->sleep < timer_get_tick()){
+                if((int32_t)(timer_get_tick() - next->sleep) >= 0){
                     next->state = RUNNING;
                     break;
                 }
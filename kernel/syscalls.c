@@ -17,15 +17,184 @@
 #include <syscall_helper.h>
 #include <assert.h>
 #include <keyboard.h>
+#include <libc.h>
 
-syscall_t syscall[255];
+syscall_t syscall[SYSCALL_MAX];
+
+/**
+ * @brief System call statistics.
+ * Only touched when enabled, system_call() checks
+ * the enabled flag once and takes the fast path otherwise.
+ */
+static struct syscall_stats {
+	volatile int enabled;
+	int per_pid;
+	struct syscall_stat index[SYSCALL_MAX];
+	struct syscall_stat pid[MAX_NUM_OF_PCBS];
+} __syscall_stats = {0};
+
+static const char* syscall_names[] = {
+	[SYSCALL_ALLOC] = "alloc",
+	[SYSCALL_SCRPUT] = "scrput",
+	[SYSCALL_PRTPUT] = "prtput",
+	[SYSCALL_EXIT] = "exit",
+	[SYSCALL_SLEEP] = "sleep",
+	[SYSCALL_GFX_WINDOW] = "gfx_window",
+	[SYSCALL_GFX_PUT_CHAR] = "gfx_put_char",
+	[SYSCALL_GFX_GET_TIME] = "gfx_get_time",
+	[SYSCALL_GFX_DRAW] = "gfx_draw",
+	[SYSCALL_GFX_SET_TITLE] = "gfx_set_title",
+	[SYSCALL_OPEN] = "open",
+	[SYSCALL_READ] = "read",
+	[SYSCALL_WRITE] = "write",
+	[SYSCALL_MALLOC] = "malloc",
+	[SYSCALL_FREE] = "free",
+	[SYSCALL_CLOSE] = "close",
+	[SYSCALL_GFX_SET_HEADER] = "gfx_set_header",
+	[SYSCALL_NET_SOCK_CLOSE] = "sock_close",
+	[SYSCALL_NET_SOCK_BIND] = "sock_bind",
+	[SYSCALL_NET_SOCK_ACCEPT] = "sock_accept",
+	[SYSCALL_NET_SOCK_CONNECT] = "sock_connect",
+	[SYSCALL_NET_SOCK_LISTEN] = "sock_listen",
+	[SYSCALL_NET_SOCK_RECV] = "sock_recv",
+	[SYSCALL_NET_SOCK_RECVFROM] = "sock_recvfrom",
+	[SYSCALL_NET_SOCK_RECV_TIMEOUT] = "sock_recv_timeout",
+	[SYSCALL_NET_SOCK_SEND] = "sock_send",
+	[SYSCALL_NET_SOCK_SENDTO] = "sock_sendto",
+	[SYSCALL_NET_SOCK_SOCKET] = "sock_socket",
+	[SYSCALL_NET_DNS_LOOKUP] = "dns_lookup",
+	[SYSCALL_IPC_OPEN] = "ipc_open",
+	[SYSCALL_IPC_CLOSE] = "ipc_close",
+	[SYSCALL_IPC_SEND] = "ipc_send",
+	[SYSCALL_IPC_RECEIVE] = "ipc_receive",
+	[SYSCALL_CREATE_THREAD] = "create_thread",
+	[SYSCALL_YIELD] = "yield",
+	[SYSCALL_JOIN_THREAD] = "join_thread",
+	[SYSCALL_AWAIT_PROCESS] = "await_process",
+	[SYSCALL_SYSTEM] = "system",
+	[SYSCALL_SCREEN_PUT] = "screen_put",
+	[SYSCALL_SCREEN_GET] = "screen_get",
+	[SYSCALL_SET_CURSOR] = "set_cursor",
+	[SYSCALL_STATS] = "stats",
+	[SYSCALL_IPC_SHM_OPEN] = "ipc_shm_open",
+	[SYSCALL_IPC_SHM_MAP] = "ipc_shm_map",
+	[SYSCALL_IPC_WAIT] = "ipc_wait",
+	[SYSCALL_IPC_NOTIFY] = "ipc_notify",
+	[SYSCALL_IPC_PAGE_ALLOC] = "ipc_page_alloc",
+	[SYSCALL_IPC_PAGE_FREE] = "ipc_page_free",
+	[SYSCALL_POLL] = "poll",
+	[SYSCALL_NET_SOCK_SETOPT] = "sock_setopt",
+	[SYSCALL_NET_SOCK_GETOPT] = "sock_getopt"
+};
+
+const char* syscall_to_str(int index)
+{
+	if(index < 0 || index >= (int)ARRAY_SIZE(syscall_names) || syscall_names[index] == NULL) return "unknown";
+
+	return syscall_names[index];
+}
 
 void add_system_call(int index, syscall_t fn)
 {	
-	assert(index < 255);
+	assert(index < SYSCALL_MAX);
 	syscall[index] = fn;
 }
 
+static inline void __syscall_stat_add(struct syscall_stat* stat, uint32_t cycles, int ret)
+{
+	int bucket = cycles == 0 ? 0 : 31 - __builtin_clz(cycles);
+	if(bucket >= SYSCALL_HIST_BUCKETS){
+		bucket = SYSCALL_HIST_BUCKETS - 1;
+	}
+
+	stat->calls++;
+	stat->hist[bucket]++;
+	stat->cycles = stat->cycles + cycles < stat->cycles ? MAX_UINT32_T : stat->cycles + cycles;
+	if(cycles > stat->max_cycles){
+		stat->max_cycles = cycles;
+	}
+	if(ret < 0){
+		stat->errors++;
+	}
+}
+
+/**
+ * @brief Runs a system call and records its latency.
+ * Cycles are measured with rdtsc and clamped to 32 bits.
+ */
+static int __system_call_traced(int index, syscall_t fn, int arg1, int arg2, int arg3)
+{
+	pid_t pid = $process->current->pid;
+	unsigned long long start = rdtsc();
+
+	int ret = fn(arg1, arg2, arg3);
+
+	unsigned long long diff = rdtsc() - start;
+	uint32_t cycles = diff > MAX_UINT32_T ? MAX_UINT32_T : (uint32_t)diff;
+
+	/* System calls run with interrupts enabled, another process may be updating the same counters */
+	CRITICAL_SECTION({
+		__syscall_stat_add(&__syscall_stats.index[index], cycles, ret);
+		if(__syscall_stats.per_pid && pid >= 0 && pid < MAX_NUM_OF_PCBS){
+			__syscall_stat_add(&__syscall_stats.pid[pid], cycles, ret);
+		}
+	});
+
+	return ret;
+}
+
+int syscall_stats_enabled()
+{
+	return __syscall_stats.enabled;
+}
+
+/**
+ * @brief Reads or controls the system call statistics.
+ * @param op syscall_stats_op_t operation
+ * @param index system call index, pid or per pid flag depending on op.
+ * @param stat output buffer for the GET operations.
+ * @return int 0 on success, less than 0 on error.
+ */
+int sys_syscall_stats(int op, int index, struct syscall_stat* stat)
+{
+	switch (op){
+	case SYSCALL_STATS_GET:
+		ERR_ON_NULL(stat);
+		if(index < 0 || index >= SYSCALL_MAX) return -ERROR_INDEX;
+
+		CRITICAL_SECTION({
+			memcpy(stat, &__syscall_stats.index[index], sizeof(struct syscall_stat));
+		});
+		break;
+	case SYSCALL_STATS_GET_PID:
+		ERR_ON_NULL(stat);
+		if(index < 0 || index >= MAX_NUM_OF_PCBS) return -ERROR_INDEX;
+
+		CRITICAL_SECTION({
+			memcpy(stat, &__syscall_stats.pid[index], sizeof(struct syscall_stat));
+		});
+		break;
+	case SYSCALL_STATS_ENABLE:
+		__syscall_stats.per_pid = index;
+		__syscall_stats.enabled = 1;
+		break;
+	case SYSCALL_STATS_DISABLE:
+		__syscall_stats.enabled = 0;
+		break;
+	case SYSCALL_STATS_RESET:
+		CRITICAL_SECTION({
+			memset(__syscall_stats.index, 0, sizeof(__syscall_stats.index));
+			memset(__syscall_stats.pid, 0, sizeof(__syscall_stats.pid));
+		});
+		break;
+	default:
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	return ERROR_OK;
+}
+EXPORT_SYSCALL(SYSCALL_STATS, sys_syscall_stats);
+
 int sys_create_thread(void (*entry)(), void* arg, byte_t flags)
 {
 	return pcb_create_thread($process->current, entry, arg, flags);
@@ -69,7 +238,9 @@ EXPORT_SYSCALL(SYSCALL_SET_CURSOR, sys_scr_set_cursor);
 int system_call(int index, int arg1, int arg2, int arg3)
 {	
 	/* Call system call function based on index. */
-	if(index < 0 || index > 255){
+	int ret;
+
+	if(index < 0 || index >= SYSCALL_MAX){
 		return -1;
 	}
 	
@@ -77,7 +248,11 @@ int system_call(int index, int arg1, int arg2, int arg3)
 	LEAVE_CRITICAL();
 
 	syscall_t fn = syscall[index];
-	int ret = fn(arg1, arg2, arg3);
+	if(unlikely(__syscall_stats.enabled)){
+		ret = __system_call_traced(index, fn, arg1, arg2, arg3);
+	} else {
+		ret = fn(arg1, arg2, arg3);
+	}
 	EOI(48);
 
 	/* Enter critical section again */
@@ -0,0 +1,155 @@
+/**
+ * @file timepage.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Shared read-only time page.
+ * @version 0.1
+ * @date 2024-03-02
+ *
+ * The kernel keeps the tick count, TSC calibration and a cached
+ * wall clock in a page mapped read-only into every process.
+ * Userspace and the windowserver read the time from it
+ * instead of reading the CMOS RTC through port I/O.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <timepage.h>
+#include <memory.h>
+#include <kutils.h>
+#include <libc.h>
+#include <rtc.h>
+#include <timer.h>
+#include <serial.h>
+
+/* Calibrate the TSC over this many ms, keeps the cycle delta inside 32 bits. */
+#define TIMEPAGE_CALIBRATION_MS 100
+
+static struct time_page* __time_page = NULL;
+static unsigned long long __tsc_start = 0;
+
+#define TIMEPAGE_WRITE(page, code_block)\
+    do {\
+        (page)->seq++;\
+        __asm__ volatile ("" ::: "memory");\
+        code_block\
+        __asm__ volatile ("" ::: "memory");\
+        (page)->seq++;\
+    } while (0)
+
+static void __timepage_sync_wall(struct time_page* page)
+{
+    get_current_time(&page->wall);
+    page->wall_seconds = TIME_TO_INT(&page->wall);
+    page->wall_tick = page->ticks;
+}
+
+/**
+ * @brief Advances the cached wall clock by one second.
+ * Resyncs with the RTC every hour, which also handles date changes.
+ */
+static void __timepage_advance_wall(struct time_page* page)
+{
+    page->wall_tick = page->ticks;
+    page->wall_seconds++;
+
+    if(++page->wall.second < 60) return;
+    page->wall.second = 0;
+
+    if(++page->wall.minute < 60) return;
+
+    __timepage_sync_wall(page);
+}
+
+/**
+ * @brief Allocates the time page and maps it into the kernel directory.
+ * Must be called before any processes are created.
+ */
+void timepage_init()
+{
+    __time_page = (struct time_page*) vmem_map_shared_page(VMEM_TIME_PAGE);
+    __time_page->seq = 0;
+    __time_page->hz = 0;
+
+    dbgprintf("[TIME] Time page mapped at 0x%x\n", VMEM_TIME_PAGE);
+}
+
+/**
+ * @brief Starts updating the time page.
+ * Called when the timer is initialized.
+ * @param hz timer frequency.
+ */
+void timepage_start(uint32_t hz)
+{
+    if(__time_page == NULL) return;
+
+    TIMEPAGE_WRITE(__time_page, {
+        __time_page->ticks = 0;
+        __time_page->tsc_per_us = 0;
+        __timepage_sync_wall(__time_page);
+        __tsc_start = rdtsc();
+        __time_page->tsc_tick = (uint32_t) __tsc_start;
+        __time_page->hz = hz;
+    });
+}
+
+/**
+ * @brief Updates the time page, called from the timer interrupt.
+ */
+void timepage_tick()
+{
+    struct time_page* page = __time_page;
+    if(page == NULL || page->hz == 0) return;
+
+    unsigned long long tsc = rdtsc();
+
+    TIMEPAGE_WRITE(page, {
+        page->ticks++;
+        page->tsc_tick = (uint32_t) tsc;
+
+        if(page->tsc_per_us == 0 && page->ticks == (page->hz * TIMEPAGE_CALIBRATION_MS) / 1000){
+            page->tsc_per_us = (uint32_t)(tsc - __tsc_start) / (TIMEPAGE_CALIBRATION_MS * 1000);
+        }
+
+        if(page->ticks - page->wall_tick >= page->hz){
+            __timepage_advance_wall(page);
+        }
+    });
+}
+
+/**
+ * @brief Copies the cached wall clock.
+ * Falls back to the RTC until the timer is started.
+ * @param time output time.
+ * @return int 1 like get_current_time.
+ */
+int timepage_get_time(struct time* time)
+{
+    uint32_t seq;
+
+    if(__time_page == NULL || __time_page->hz == 0){
+        return get_current_time(time);
+    }
+
+    do {
+        seq = __time_page->seq;
+        __asm__ volatile ("" ::: "memory");
+        *time = __time_page->wall;
+        __asm__ volatile ("" ::: "memory");
+    } while ((seq & 1) || seq != __time_page->seq);
+
+    return 1;
+}
+
+/**
+ * @brief Cached replacement for get_time()
+ * @return int seconds since midnight.
+ */
+int timepage_get_seconds()
+{
+    if(__time_page == NULL || __time_page->hz == 0){
+        return get_time();
+    }
+
+    return __time_page->wall_seconds;
+}
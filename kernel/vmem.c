@@ -770,6 +770,15 @@ void vmem_cleanup_process(struct pcb* pcb)
 
 	dbgprintf("[Memory] Cleaning up allocations from pcb [DONE].\n");
 
+	/**
+	 * Free the IPC table, the shared pages are owned by the IPC channels.
+	 */
+	uint32_t ipc_table = (uint32_t)pcb->page_dir[DIRECTORY_INDEX(VMEM_IPC)] & ~PAGE_MASK;
+	if(ipc_table != 0){
+		vmem_default->ops->free(vmem_default, (void*) ipc_table);
+		freed_pages++;
+	}
+
 	/**
 	 * Lastly free directory.
 	 */
@@ -854,6 +863,93 @@ void vmem_map_driver_region(uint32_t addr, int size)
 	return;
 }
 
+/**
+ * @brief Maps a single page read-only for userspace in the kernel directory.
+ * Processes copy the kernel directory, so the page becomes visible in all of them.
+ * Has to be called before any processes are created.
+ * @param vaddr Virtual address to map the page at, owns the whole 4MB table.
+ * @return uint32_t* physical (identity mapped) address of the page, writable by the kernel.
+ */
+uint32_t* vmem_map_shared_page(uint32_t vaddr)
+{
+	uint32_t* table = vmem_manager->ops->alloc(vmem_manager);
+	uint32_t* page = vmem_manager->ops->alloc(vmem_manager);
+	memset(table, 0, PAGE_SIZE);
+	memset(page, 0, PAGE_SIZE);
+
+	/* No READ_WRITE bit, userspace can only read the page. */
+	table[TABLE_INDEX(vaddr)] = (((uint32_t) page) & ~PAGE_MASK) | USER | PRESENT;
+	vmem_add_table(kernel_page_dir, vaddr, table, USER);
+
+	dbgprintf("[mmap] Shared page 0x%x mapped at 0x%x\n", page, vaddr);
+	return page;
+}
+
+/**
+ * @brief Maps physically contiguous pages into the IPC window of a process.
+ * The IPC table is allocated on first use and freed with the process.
+ * @param pcb Process to map into, not one of its threads.
+ * @param paddr Physical (identity mapped) address of the first page.
+ * @param num Number of pages.
+ * @return void* virtual address of the mapping, NULL if the window is full.
+ */
+void* vmem_map_ipc(struct pcb* pcb, uint32_t paddr, int num)
+{
+	uint32_t* table = vmem_get_page_table(pcb, VMEM_IPC);
+	if(table == NULL){
+		table = vmem_default->ops->alloc(vmem_default);
+		memset(table, 0, PAGE_SIZE);
+		vmem_add_table(pcb->page_dir, VMEM_IPC, table, USER);
+
+		/* Threads copied the directory when they were created, give them the table too. */
+		for (int i = 0; i < MAX_NUM_OF_PCBS; i++){
+			struct pcb* thread = pcb_get_by_pid(i);
+			if(thread->is_process == PCB_THREAD && thread->parent == pcb && thread->state != STOPPED){
+				vmem_add_table(thread->page_dir, VMEM_IPC, table, USER);
+			}
+		}
+	}
+
+	/* Find a free run of num pages */
+	int run = 0;
+	for (int i = 0; i < 1024; i++){
+		run = table[i] == 0 ? run + 1 : 0;
+		if(run < num) continue;
+
+		uint32_t vaddr = VMEM_IPC + (i - num + 1) * PAGE_SIZE;
+		for (int j = 0; j < num; j++){
+			vmem_map(table, vaddr + j*PAGE_SIZE, paddr + j*PAGE_SIZE, USER);
+		}
+		dbgprintf("[mmap] IPC 0x%x mapped at 0x%x (%d pages)\n", paddr, vaddr, num);
+		return (void*) vaddr;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Removes a mapping created by vmem_map_ipc.
+ * @param pcb Process to unmap from.
+ * @param paddr Physical address of the first page.
+ * @param num Number of pages.
+ */
+void vmem_unmap_ipc(struct pcb* pcb, uint32_t paddr, int num)
+{
+	uint32_t* table = vmem_get_page_table(pcb, VMEM_IPC);
+	if(table == NULL) return;
+
+	for (int i = 0; i < 1024; i++){
+		if((table[i] & ~PAGE_MASK) != paddr) continue;
+
+		for (int j = 0; j < num && i + j < 1024; j++){
+			uint32_t vaddr = VMEM_IPC + (i + j) * PAGE_SIZE;
+			vmem_unmap(table, vaddr);
+			__asm__ volatile ("invlpg (%0)" :: "r" (vaddr) : "memory");
+		}
+		return;
+	}
+}
+
 int vmem_total_usage()
 {
 	int used_pages = vmem_default->used_pages + vmem_manager->used_pages;
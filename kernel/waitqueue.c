@@ -0,0 +1,155 @@
+/**
+ * @file waitqueue.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Wait queues for blocking on events.
+ * @version 0.1
+ * @date 2024-03-02
+ *
+ * Replaces yield-spinning loops, a waiting process is BLOCKED
+ * (or SLEEPING with a deadline) until a producer wakes the queue.
+ * Timeouts are handled by the scheduler through the sleep deadline.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <waitqueue.h>
+#include <scheduler.h>
+#include <kutils.h>
+#include <timer.h>
+#include <errors.h>
+#include <pcb.h>
+
+void waitqueue_init(struct waitqueue* wq)
+{
+    wq->head = NULL;
+}
+
+void waitqueue_add(struct waitqueue* wq, struct waitqueue_entry* entry)
+{
+    CRITICAL_SECTION({
+        entry->wq = wq;
+        entry->next = wq->head;
+        wq->head = entry;
+    });
+}
+
+/**
+ * @brief Removes an entry, does not touch the queue if it was detached.
+ */
+void waitqueue_remove(struct waitqueue* wq, struct waitqueue_entry* entry)
+{
+    ENTER_CRITICAL();
+    if(entry->wq != wq){
+        LEAVE_CRITICAL();
+        return;
+    }
+
+    struct waitqueue_entry** iter = &wq->head;
+    while(*iter != NULL){
+        if(*iter == entry){
+            *iter = entry->next;
+            break;
+        }
+        iter = &(*iter)->next;
+    }
+    entry->wq = NULL;
+    entry->next = NULL;
+    LEAVE_CRITICAL();
+}
+
+/**
+ * @brief Wakes and unlinks all waiters, for queues that are about to be freed.
+ * Waiters see their entry as removed and must not use the queue again.
+ */
+void waitqueue_detach(struct waitqueue* wq)
+{
+    CRITICAL_SECTION({
+        struct waitqueue_entry* iter = wq->head;
+        while(iter != NULL){
+            struct waitqueue_entry* next = iter->next;
+            if(iter->pcb->state == BLOCKED || iter->pcb->state == SLEEPING){
+                iter->pcb->state = RUNNING;
+            }
+            iter->wq = NULL;
+            iter->next = NULL;
+            iter = next;
+        }
+        wq->head = NULL;
+    });
+}
+
+/**
+ * @brief Wakes all processes waiting on the queue.
+ * Entries are left in the queue, waiters remove their own entries.
+ */
+void waitqueue_wake(struct waitqueue* wq)
+{
+    CRITICAL_SECTION({
+        for (struct waitqueue_entry* iter = wq->head; iter != NULL; iter = iter->next){
+            if(iter->pcb->state == BLOCKED || iter->pcb->state == SLEEPING){
+                iter->pcb->state = RUNNING;
+            }
+        }
+    });
+}
+
+/**
+ * @brief Marks the current process as waiting, the next kernel_yield() blocks it
+ * until a wait queue wakes it or the deadline tick passes.
+ * Call inside the critical section that checked the condition, so a wake up is not lost.
+ * @param deadline timer tick, 0 blocks without timeout.
+ */
+void waitqueue_prepare(uint32_t deadline)
+{
+    if(deadline != 0){
+        $process->current->sleep = deadline;
+        $process->current->state = SLEEPING;
+    } else {
+        $process->current->state = BLOCKED;
+    }
+}
+
+/**
+ * @brief Waits on a single queue until ready() returns true.
+ * @param wq queue to wait on.
+ * @param ready condition checked after every wake up.
+ * @param arg argument to ready.
+ * @param ticks timeout in timer ticks, WAITQUEUE_FOREVER to block without timeout.
+ * @return int 0 when ready, -ERROR_TIMEOUT on timeout, -ERROR_INVALID_ARGUMENTS if the queue was detached.
+ */
+int waitqueue_wait(struct waitqueue* wq, int (*ready)(void* arg), void* arg, int ticks)
+{
+    struct waitqueue_entry entry = {
+        .pcb = $process->current,
+        .next = NULL
+    };
+    uint32_t deadline = ticks < 0 ? 0 : timer_get_tick() + ticks;
+    int ret = 0;
+
+    waitqueue_add(wq, &entry);
+    while(1){
+        ENTER_CRITICAL();
+        if(entry.wq == NULL){
+            /* queue was detached, its owner is gone */
+            LEAVE_CRITICAL();
+            return -ERROR_INVALID_ARGUMENTS;
+        }
+        if(ready(arg)){
+            LEAVE_CRITICAL();
+            break;
+        }
+        if(deadline != 0 && (uint32_t)timer_get_tick() >= deadline){
+            LEAVE_CRITICAL();
+            ret = -ERROR_TIMEOUT;
+            break;
+        }
+        waitqueue_prepare(deadline);
+        LEAVE_CRITICAL();
+
+        kernel_yield();
+    }
+    waitqueue_remove(wq, &entry);
+
+    return ret;
+}
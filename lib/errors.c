@@ -38,7 +38,11 @@ static char* error_string[] = {
     "Window not found.",
     "Window operations are corrupted.",
     "Out of memory.",
-    "Access denied."
+    "Access denied.",
+    "Operation timed out.",
+    "Device is busy.",
+    "Host not found.",
+    "No route to host."
 };
 
 char* error_get_string(error_t err)
@@ -108,6 +108,28 @@ int socket(int domain, int type, int protocol)
     return invoke_syscall(SYSCALL_NET_SOCK_SOCKET, domain, type, protocol);
 }
 
+int setsockopt(int socket, int level, int option_name, const void *option_value, socklen_t option_len)
+{
+    struct net_sockopt opt = {
+        .level = level,
+        .name = option_name,
+        .value = (void*) option_value,
+        .length = &option_len
+    };
+    return invoke_syscall(SYSCALL_NET_SOCK_SETOPT, socket, (int)&opt, 0);
+}
+
+int getsockopt(int socket, int level, int option_name, void *option_value, socklen_t *option_len)
+{
+    struct net_sockopt opt = {
+        .level = level,
+        .name = option_name,
+        .value = option_value,
+        .length = option_len
+    };
+    return invoke_syscall(SYSCALL_NET_SOCK_GETOPT, socket, (int)&opt, 0);
+}
+
 int gethostname(char *name)
 {
     return invoke_syscall(SYSCALL_NET_DNS_LOOKUP, (int)name, 0, 0);
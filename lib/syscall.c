@@ -19,6 +19,7 @@ extern "C"
 #include <stdint.h>
 #include <libc.h>
 #include <rtc.h>
+#include <timepage.h>
 
 int invoke_syscall(int i, int arg1, int arg2, int arg3)
 {
@@ -63,9 +64,89 @@ void gfx_create_window(int width, int height, int flags)
     }
 }
 
+static const volatile struct time_page* __time_page = (const volatile struct time_page*) VMEM_TIME_PAGE;
+
+/**
+ * @brief Takes a consistent snapshot of the shared time page.
+ * @return int 0 on success, -1 if the kernel has not started the page yet.
+ */
+static int __time_page_read(struct time_page* page)
+{
+    uint32_t seq;
+
+    do {
+        seq = __time_page->seq;
+        __asm__ volatile ("" ::: "memory");
+        *page = *(const struct time_page*)__time_page;
+        __asm__ volatile ("" ::: "memory");
+    } while ((seq & 1) || seq != __time_page->seq);
+
+    return page->hz == 0 ? -1 : 0;
+}
+
+/* Days since 1970-01-01, RTC years are relative to 2000. */
+static uint32_t __time_days(const struct time* time)
+{
+    uint32_t year = 2000 + time->year;
+    uint32_t month = time->month;
+    if(month <= 2){
+        year--;
+        month += 12;
+    }
+    return 365*year + year/4 - year/100 + year/400 + (153*(month - 3) + 2)/5 + time->day - 719469;
+}
+
 int get_current_time(struct time* time)
 {
-    return invoke_syscall(SYSCALL_GFX_GET_TIME, (int)time, 0, 0);
+    struct time_page page;
+    if(__time_page_read(&page) < 0){
+        return invoke_syscall(SYSCALL_GFX_GET_TIME, (int)time, 0, 0);
+    }
+
+    *time = page.wall;
+    return 1;
+}
+
+unsigned int time_ticks()
+{
+    return __time_page->ticks;
+}
+
+/**
+ * @brief Reads the time without trapping into the kernel.
+ * CLOCK_MONOTONIC is time since the timer started, refined with the TSC.
+ * CLOCK_REALTIME is seconds since 1970 from the cached RTC time.
+ * @return int 0 on success, -1 on error.
+ */
+int clock_gettime(int clock, struct timespec* ts)
+{
+    struct time_page page;
+    uint32_t ns_per_tick, ns;
+
+    if(ts == NULL || __time_page_read(&page) < 0) return -1;
+
+    ns_per_tick = 1000000000 / page.hz;
+    switch (clock){
+    case CLOCK_MONOTONIC:
+        ts->tv_sec = page.ticks / page.hz;
+        ns = (page.ticks % page.hz) * ns_per_tick;
+        if(page.tsc_per_us != 0){
+            uint32_t delta = ((uint32_t) rdtsc() - page.tsc_tick) / page.tsc_per_us * 1000;
+            ns += delta < ns_per_tick ? delta : ns_per_tick - 1;
+        }
+        break;
+    case CLOCK_REALTIME:
+        ts->tv_sec = __time_days(&page.wall)*86400 + page.wall_seconds;
+        ns = (page.ticks - page.wall_tick) * ns_per_tick;
+        break;
+    default:
+        return -1;
+    }
+
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+
+    return 0;
 }
 int gfx_draw_syscall(int option, void* data, int flags)
 {
@@ -123,6 +204,66 @@ int system(const char* command)
     return invoke_syscall(SYSCALL_SYSTEM, (int)command, 0, 0);
 }
 
+int ipc_open()
+{
+    return invoke_syscall(SYSCALL_IPC_OPEN, 0, 0, 0);
+}
+
+int ipc_shm_open(int pages, int xfer_pages)
+{
+    return invoke_syscall(SYSCALL_IPC_SHM_OPEN, pages, xfer_pages, 0);
+}
+
+struct ipc_shm* ipc_shm_map(int channel)
+{
+    return (struct ipc_shm*)invoke_syscall(SYSCALL_IPC_SHM_MAP, channel, 0, 0);
+}
+
+int ipc_close(int channel)
+{
+    return invoke_syscall(SYSCALL_IPC_CLOSE, channel, 0, 0);
+}
+
+int ipc_send(int channel, void* data, int length)
+{
+    return invoke_syscall(SYSCALL_IPC_SEND, channel, (int)data, length);
+}
+
+int ipc_receive(int channel, void* data, int length)
+{
+    return invoke_syscall(SYSCALL_IPC_RECEIVE, channel, (int)data, length);
+}
+
+int ipc_wait(int channel)
+{
+    return invoke_syscall(SYSCALL_IPC_WAIT, channel, 0, 0);
+}
+
+int ipc_notify(int channel)
+{
+    return invoke_syscall(SYSCALL_IPC_NOTIFY, channel, 0, 0);
+}
+
+int ipc_page_alloc(int channel, int pages)
+{
+    return invoke_syscall(SYSCALL_IPC_PAGE_ALLOC, channel, pages, 0);
+}
+
+int ipc_page_free(int channel, int offset, int pages)
+{
+    return invoke_syscall(SYSCALL_IPC_PAGE_FREE, channel, offset, pages);
+}
+
+int poll(struct pollfd* fds, int nfds, int timeout)
+{
+    return invoke_syscall(SYSCALL_POLL, (int)fds, nfds, timeout);
+}
+
+int syscall_stats(int op, int index, struct syscall_stat* stat)
+{
+    return invoke_syscall(SYSCALL_STATS, op, index, (int)stat);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -80,7 +80,7 @@ error_t sys_kernel_recvfrom(socket_t socket, struct net_buffer *net_buffer, stru
     if(sock == NULL)
         return -ERROR_INVALID_SOCKET;
 
-    return kernel_recvfrom(sock, net_buffer->buffer, net_buffer->length, net_buffer->flags, address, 0);
+    return kernel_recvfrom(sock, net_buffer->buffer, net_buffer->length, net_buffer->flags, address, address_len);
 }
 EXPORT_SYSCALL(SYSCALL_NET_SOCK_RECVFROM, sys_kernel_recvfrom);
 
@@ -123,6 +123,26 @@ socket_t sys_socket_create(int domain, int type, int protocol)
 }
 EXPORT_SYSCALL(SYSCALL_NET_SOCK_SOCKET, sys_socket_create);
 
+error_t sys_kernel_setsockopt(socket_t socket, struct net_sockopt* opt)
+{
+    struct sock* sock = sock_get(socket);
+    if(sock == NULL || opt == NULL || opt->length == NULL)
+        return -ERROR_INVALID_SOCKET;
+
+    return kernel_setsockopt(sock, opt->level, opt->name, opt->value, *opt->length);
+}
+EXPORT_SYSCALL(SYSCALL_NET_SOCK_SETOPT, sys_kernel_setsockopt);
+
+error_t sys_kernel_getsockopt(socket_t socket, struct net_sockopt* opt)
+{
+    struct sock* sock = sock_get(socket);
+    if(sock == NULL || opt == NULL)
+        return -ERROR_INVALID_SOCKET;
+
+    return kernel_getsockopt(sock, opt->level, opt->name, opt->value, opt->length);
+}
+EXPORT_SYSCALL(SYSCALL_NET_SOCK_GETOPT, sys_kernel_getsockopt);
+
 void sys_kernel_sock_close(socket_t socket)
 {
     struct sock* sock = sock_get(socket);
@@ -14,98 +14,450 @@
 #include <net/net.h>
 #include <terminal.h>
 #include <serial.h>
+#include <timer.h>
+#include <ktimer.h>
+#include <errors.h>
+#include <net/deferred.h>
 
 #ifndef KDEBUG_NET_ARP
 #undef dbgprintf
 #define dbgprintf(...)
 #endif
 
-#define MAX_ARP_ENTRIES 25
+/**
+ * Neighbour cache, hashed on the IP in network order.
+ * Entries go from INCOMPLETE to REACHABLE when a reply arrives and
+ * become STALE after ARP_REACHABLE_MS. Stale entries are still used,
+ * but are probed again when used and removed when nobody answers.
+ * Packets to a neighbour without a MAC wait on its entry and are
+ * sent when the reply arrives.
+ */
+static struct arp_cache {
+	struct arp_entry entries[ARP_CACHE_SIZE];
+	struct arp_entry* hash[ARP_HASH_SIZE];
+	struct arp_stats stats;
+
+	struct ktimer timer;
+	struct net_deferred work;
+} arp_cache;
+
+#define ARP_HASH(ip) (((ip) ^ ((ip) >> 8) ^ ((ip) >> 16) ^ ((ip) >> 24)) & (ARP_HASH_SIZE - 1))
+#define ARP_SINCE(tick) ((uint32_t)timer_get_tick() - (tick))
+#define ARP_RESOLVED(entry) ((entry)->state >= ARP_REACHABLE)
+
+const char* arp_state_to_str(arp_state_t state)
+{
+	switch (state){
+	case ARP_INCOMPLETE: return "incomplete";
+	case ARP_REACHABLE: return "reachable";
+	case ARP_STALE: return "stale";
+	case ARP_PERMANENT: return "permanent";
+	default: return "free";
+	}
+}
+
+static struct arp_entry* __arp_lookup(uint32_t ip)
+{
+	struct arp_entry* entry = arp_cache.hash[ARP_HASH(ip)];
+	while(entry != NULL && entry->sip != ip){
+		entry = entry->next;
+	}
+	return entry;
+}
+
+static void __arp_unhash(struct arp_entry* entry)
+{
+	struct arp_entry** link = &arp_cache.hash[ARP_HASH(entry->sip)];
+	while(*link != NULL && *link != entry){
+		link = &(*link)->next;
+	}
+	if(*link != NULL) *link = entry->next;
+
+	entry->state = ARP_FREE;
+	entry->sip = 0;
+	entry->next = NULL;
+}
+
+/**
+ * @brief Takes a free entry, or evicts the least recently used resolved one.
+ * Must be called in a critical section.
+ */
+static struct arp_entry* __arp_alloc(uint32_t ip)
+{
+	struct arp_entry* victim = NULL;
+
+	for (int i = 0; i < ARP_CACHE_SIZE; i++){
+		struct arp_entry* entry = &arp_cache.entries[i];
+		if(entry->state == ARP_FREE){
+			victim = entry;
+			break;
+		}
+		if((entry->state == ARP_REACHABLE || entry->state == ARP_STALE) && (victim == NULL || (int32_t)(entry->used - victim->used) < 0)){
+			victim = entry;
+		}
+	}
+	if(victim == NULL) return NULL;
+
+	if(victim->state != ARP_FREE){
+		arp_cache.stats.evictions++;
+		__arp_unhash(victim);
+	}
 
-static struct arp_entry arp_entry_table[MAX_ARP_ENTRIES];
+	memset(victim, 0, sizeof(struct arp_entry));
+	victim->sip = ip;
+	victim->used = timer_get_tick();
+	victim->next = arp_cache.hash[ARP_HASH(ip)];
+	arp_cache.hash[ARP_HASH(ip)] = victim;
 
-static void arp_list()
+	return victim;
+}
+
+/* The aging timer runs while there are entries that are not permanent. */
+static void __arp_timer_arm()
+{
+	if(!arp_cache.timer.pending){
+		ktimer_mod(&arp_cache.timer, timer_get_tick() + timer_ms_to_ticks(ARP_TIMER_MS));
+	}
+}
+
+/**
+ * @brief Fills in the destination MAC of packets that waited for a reply and sends them.
+ */
+static void __arp_flush(struct sk_buff* queue, uint8_t* mac)
 {
-	dbgprintf("ARP Table:\n");
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++){
-		if(arp_entry_table[i].sip != 0){
-			dbgprintf("IP: %i MAC: %x %x %x %x %x %x\n", arp_entry_table[i].sip, arp_entry_table[i].smac[0], arp_entry_table[i].smac[1], arp_entry_table[i].smac[2], arp_entry_table[i].smac[3], arp_entry_table[i].smac[4], arp_entry_table[i].smac[5]);
+	while(queue != NULL){
+		struct sk_buff* skb = queue;
+		queue = skb->next;
+		skb->next = NULL;
+
+		memcpy(skb->hdr.eth->dmac, mac, 6);
+		skb->arp_ip = 0;
+		net_send_skb(skb);
+	}
+}
+
+static void __arp_drop(struct sk_buff* queue)
+{
+	while(queue != NULL){
+		struct sk_buff* skb = queue;
+		queue = skb->next;
+		skb->next = NULL;
+		skb_free(skb);
+	}
+}
+
+/**
+ * @brief Ages the cache, retries and expires requests and probes stale entries in use.
+ * Runs on the networking thread, requests are sent after leaving the critical section.
+ */
+static void __arp_age(void* arg)
+{
+	struct {
+		uint32_t ip;
+		struct net_interface* interface;
+	} probes[ARP_PROBE_BATCH];
+	struct sk_buff* dropped = NULL;
+	int count = 0;
+	int active = 0;
+
+	ENTER_CRITICAL();
+	for (int i = 0; i < ARP_CACHE_SIZE; i++){
+		struct arp_entry* entry = &arp_cache.entries[i];
+		int probe = 0;
+
+		switch (entry->state){
+		case ARP_INCOMPLETE:
+			probe = ARP_SINCE(entry->probed) >= (uint32_t)timer_ms_to_ticks(ARP_RETRANS_MS);
+			break;
+		case ARP_REACHABLE:
+			if(ARP_SINCE(entry->confirmed) >= (uint32_t)timer_ms_to_ticks(ARP_REACHABLE_MS)){
+				entry->state = ARP_STALE;
+				entry->probes = 0;
+			}
+			break;
+		case ARP_STALE:
+			if(ARP_SINCE(entry->used) >= (uint32_t)timer_ms_to_ticks(ARP_GC_MS)){
+				__arp_unhash(entry);
+				break;
+			}
+			/* Used since it went stale, check that the neighbour is still there */
+			probe = (int32_t)(entry->used - entry->confirmed) >= timer_ms_to_ticks(ARP_REACHABLE_MS)
+				&& ARP_SINCE(entry->probed) >= (uint32_t)timer_ms_to_ticks(ARP_RETRANS_MS);
+			break;
+		default:
+			break;
 		}
+
+		if(probe && entry->probes >= ARP_MAX_PROBES){
+			/* Nobody answered, packets waiting for it are lost */
+			while(entry->queue != NULL){
+				struct sk_buff* skb = entry->queue;
+				entry->queue = skb->next;
+				skb->next = dropped;
+				dropped = skb;
+				arp_cache.stats.dropped++;
+			}
+			__arp_unhash(entry);
+			continue;
+		}
+
+		if(probe && count < ARP_PROBE_BATCH && entry->interface != NULL){
+			entry->probes++;
+			entry->probed = timer_get_tick();
+			probes[count].ip = entry->sip;
+			probes[count].interface = entry->interface;
+			count++;
+		}
+
+		if(entry->state != ARP_FREE && entry->state != ARP_PERMANENT) active++;
+	}
+
+	if(active > 0){
+		__arp_timer_arm();
+	}
+	LEAVE_CRITICAL();
+
+	__arp_drop(dropped);
+	for (int i = 0; i < count; i++){
+		net_arp_request(probes[i].interface, probes[i].ip);
 	}
 }
 
+static void __arp_timer_expired(struct ktimer* timer)
+{
+	net_defer(&arp_cache.work);
+}
+
+/**
+ * @brief Adds a entry that never expires, like broadcast and loopback.
+ * @param ip IP in network order.
+ * @param mac MAC of the neighbour.
+ * @return int 1 if added, 0 if the cache is full.
+ */
+int net_arp_add_permanent(uint32_t ip, uint8_t* mac)
+{
+	struct arp_entry* entry;
+
+	CRITICAL_SECTION({
+		entry = __arp_lookup(ip);
+		if(entry == NULL){
+			entry = __arp_alloc(ip);
+		}
+		if(entry != NULL){
+			memcpy(entry->smac, mac, 6);
+			entry->state = ARP_PERMANENT;
+		}
+	});
+
+	return entry != NULL;
+}
+
 void net_init_arp()
 {
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++)
-		arp_entry_table[i].sip = 0;
+	memset(&arp_cache, 0, sizeof(arp_cache));
+	ktimer_init(&arp_cache.timer, __arp_timer_expired, NULL);
+	NET_DEFERRED_INIT(&arp_cache.work, __arp_age, NULL);
 
 	/*  Add broadcast arp entry */
 	uint8_t broadcast_mac[6] = {255, 255, 255, 255, 255, 255};
-	memcpy(&arp_entry_table[0].smac, &broadcast_mac, 6);
-	arp_entry_table[0].sip = BROADCAST_IP;
+	net_arp_add_permanent(BROADCAST_IP, broadcast_mac);
 }
 
 /**
  * @brief Adds a arp request / response to the arp cache.
+ * Updates the entry for the IP, packets waiting for it are sent.
  * 
- * @param arp ARP content packet.
- * @return int 
+ * @param arp ARP content packet, IP in network order.
+ * @return int 1 if the entry was added or updated, 0 if the cache is full.
  */
 int net_arp_add_entry(struct arp_content* arp)
 {
+	struct sk_buff* queue = NULL;
+	struct arp_entry* entry;
+	int added = 0;
+
 	dbgprintf("Adding %i to arp entries\n", arp->sip);
-	/* Check if ARP entry already exists. */
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++)
-		if(memcmp((uint8_t*)&arp->smac, (uint8_t*)&arp_entry_table[i].smac, 6) == 0)
-			return 1;
-
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++){
-		if(arp_entry_table[i].sip == 0){
-			arp_entry_table[i].sip = arp->sip;
-			memcpy(&arp_entry_table[i].smac, &arp->smac, 6);
-			dbgprintf("Added APR entry.\n");
-			return 1;
+
+	CRITICAL_SECTION({
+		entry = __arp_lookup(arp->sip);
+		if(entry == NULL){
+			entry = __arp_alloc(arp->sip);
 		}
+
+		if(entry != NULL && entry->state != ARP_PERMANENT){
+			memcpy(entry->smac, arp->smac, 6);
+			entry->state = ARP_REACHABLE;
+			entry->probes = 0;
+			entry->confirmed = timer_get_tick();
+
+			queue = entry->queue;
+			entry->queue = NULL;
+			entry->queued = 0;
+			__arp_timer_arm();
+		}
+		added = entry != NULL;
+	});
+
+	if(queue != NULL){
+		__arp_flush(queue, arp->smac);
 	}
 
-	return 0;
+	return added;
 }
 
 /**
  * @brief Finds a APR entry in the cache based on the IP
  * Result is copied to given MAC pointer.
  * 
- * @param ip IP to search for
+ * @param ip IP to search for, network order.
  * @param mac buffer to copy MAC into.
- * @return int 
+ * @return int 1 if found, -1 if the neighbour is not resolved.
  */
 int net_arp_find_entry(uint32_t ip, uint8_t* mac)
 {
-	arp_list();
-	for (int i = 0; i < MAX_ARP_ENTRIES; i++){
-		if(arp_entry_table[i].sip == ip){
-			memcpy(mac, arp_entry_table[i].smac, 6);
-			return 1;
+	struct arp_entry* entry;
+	int found = -1;
+
+	CRITICAL_SECTION({
+		entry = __arp_lookup(ip);
+		if(entry != NULL && ARP_RESOLVED(entry)){
+			memcpy(mac, entry->smac, 6);
+			entry->used = timer_get_tick();
+			arp_cache.stats.hits++;
+			found = 1;
+		} else {
+			arp_cache.stats.misses++;
+		}
+	});
+
+	if(found < 0){
+		dbgprintf("Warning: Could not find arp for %i\n", ip);
+	}
+	return found;
+}
+
+/**
+ * @brief Sends a packet whose next hop was not resolved when the header was added.
+ * The packet waits on the neighbour entry until the reply arrives, the first
+ * packet to an unknown neighbour sends the request.
+ * Takes ownership of the skb like net_send_skb.
+ * @param skb packet with skb->arp_ip set.
+ * @return int 0 on success, less than 0 if the packet was dropped.
+ */
+int net_arp_queue(struct sk_buff* skb)
+{
+	struct sk_buff* dropped = NULL;
+	struct arp_entry* entry;
+	uint32_t ip = skb->arp_ip;
+	struct net_interface* interface = skb->interface;	/* the skb belongs to the queue once queued */
+	uint8_t mac[6];
+	int request = 0;
+	int resolved = 0;
+
+	ENTER_CRITICAL();
+	entry = __arp_lookup(ip);
+	if(entry == NULL){
+		entry = __arp_alloc(ip);
+		if(entry == NULL){
+			arp_cache.stats.dropped++;
+			LEAVE_CRITICAL();
+			skb_free(skb);
+			return -ERROR_ALLOC;
 		}
+		entry->state = ARP_INCOMPLETE;
+		entry->interface = interface;
+		entry->probes = 1;
+		entry->probed = timer_get_tick();
+		request = 1;
+		__arp_timer_arm();
 	}
-	dbgprintf("Warning: Could not find arp for %i\n", ip);
-	return -1;
+
+	if(ARP_RESOLVED(entry)){
+		/* Resolved after the header was added */
+		memcpy(mac, entry->smac, 6);
+		entry->used = timer_get_tick();
+		resolved = 1;
+	} else {
+		if(entry->queued >= ARP_QUEUE_MAX){
+			/* Keep the newest packets, the oldest is most likely retransmitted anyway */
+			dropped = entry->queue;
+			entry->queue = dropped->next;
+			dropped->next = NULL;
+			entry->queued--;
+			arp_cache.stats.dropped++;
+		}
+
+		skb->next = NULL;
+		if(entry->queue == NULL){
+			entry->queue = skb;
+		} else {
+			struct sk_buff* tail = entry->queue;
+			while(tail->next != NULL) tail = tail->next;
+			tail->next = skb;
+		}
+		entry->queued++;
+		arp_cache.stats.queued++;
+	}
+	LEAVE_CRITICAL();
+
+	if(dropped != NULL){
+		skb_free(dropped);
+	}
+
+	if(resolved){
+		memcpy(skb->hdr.eth->dmac, mac, 6);
+		skb->arp_ip = 0;
+		return net_send_skb(skb);
+	}
+
+	if(request){
+		net_arp_request(interface, ip);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Copies the used entries of the cache.
+ * @return int number of entries copied.
+ */
+int net_arp_get_entries(struct arp_entry* entries, int max)
+{
+	int count = 0;
+
+	CRITICAL_SECTION({
+		for (int i = 0; i < ARP_CACHE_SIZE && count < max; i++){
+			if(arp_cache.entries[i].state == ARP_FREE) continue;
+			entries[count++] = arp_cache.entries[i];
+		}
+	});
+
+	return count;
+}
+
+void net_arp_get_stats(struct arp_stats* stats)
+{
+	*stats = arp_cache.stats;
 }
 
 /**
  * @brief Helper method that adds ethernet header and send ARP packet.
  * 
+ * @param interface interface to send on.
  * @param content ARP content struct
  * @param hdr ARP header
- * @param skb buffer to send.
+ * @param eth_ip IP whose MAC is used as the ethernet destination.
  */
-static void __net_arp_send(struct arp_content* content, struct arp_header* hdr)
+static void __net_arp_send(struct net_interface* interface, struct arp_content* content, struct arp_header* hdr, uint32_t eth_ip)
 {
 	struct sk_buff* skb = skb_new();
+	if(skb == NULL) return;
 
 	skb->proto = ARP;
-	int ret = net_ethernet_add_header(skb, content->dip);
-	if(ret <= 0){
+	skb->interface = interface;
+	int ret = net_ethernet_add_header(skb, eth_ip);
+	if(ret < 0 || skb->arp_ip != 0){
+		skb_free(skb);
 		return;
 	}
 
@@ -127,9 +479,10 @@ static void __net_arp_send(struct arp_content* content, struct arp_header* hdr)
 /**
  * @brief Create a ARP response packet based on request content.
  * 
+ * @param interface interface the request was received on.
  * @param content APR request content.
  */
-void net_arp_respond(struct arp_content* content)
+void net_arp_respond(struct net_interface* interface, struct arp_content* content)
 {
 	if(dhcp_get_ip() == -1)
 		return;
@@ -142,16 +495,19 @@ void net_arp_respond(struct arp_content* content)
 	content->dip = content->sip;
 	content->sip = dhcp_get_ip();
 
-	__net_arp_send(content, &a_hdr);
+	arp_cache.stats.replies++;
+	__net_arp_send(interface, content, &a_hdr, content->dip);
 }
 
 /**
- * @brief Create a ARP request packet and send it.
+ * @brief Create a ARP request for a IP and broadcast it.
  * 
+ * @param interface interface the neighbour is on.
+ * @param ip IP to resolve, network order.
  */
-void net_net_arp_request()
+void net_arp_request(struct net_interface* interface, uint32_t ip)
 {
-	if(dhcp_get_ip() == -1)
+	if(interface == NULL || dhcp_get_ip() == -1)
 		return;
 
 	struct arp_header a_hdr;
@@ -159,14 +515,13 @@ void net_net_arp_request()
 
 	ARP_FILL_HEADER(a_hdr, ARP_REQUEST);
 
-	uint8_t broadcast_mac[6] = {255, 255, 255, 255, 255, 255};
-
-	a_content.dip = BROADCAST_IP;
-	memcpy(a_content.smac, current_netdev.mac, 6);
+	a_content.dip = ntohl(ip);
+	memcpy(a_content.smac, interface->device->mac, 6);
 	a_content.sip = dhcp_get_ip();
-	memcpy(a_content.dmac, broadcast_mac, 6);
+	memset(a_content.dmac, 0, 6);
 
-	__net_arp_send(&a_content, &a_hdr);
+	arp_cache.stats.requests++;
+	__net_arp_send(interface, &a_content, &a_hdr, BROADCAST_IP);
 }
 
 /**
@@ -193,10 +548,10 @@ int8_t arp_parse(struct sk_buff* skb)
 	switch (a_hdr->opcode){
 	case ARP_REQUEST:
 
-		net_arp_respond(arp_content);
+		net_arp_respond(skb->interface, arp_content);
 		break;
 	case ARP_REPLY:
-		/* Signal ARP reply was recieved, check for waiting SKBs*/
+		/* Waiting packets were sent when the entry was updated */
 		break;
 	
 	default:
@@ -0,0 +1,143 @@
+/**
+ * @file checksum.c
+ * @author Joe Bayer (joexbayer)
+ * @brief Internet checksum.
+ * @version 0.1
+ * @date 2024-03-02
+ *
+ * Shared checksum routines for IPv4, ICMP, UDP and TCP.
+ * The data is summed 32 bits at a time into a 64 bit accumulator,
+ * so carries are only folded once at the end. Since 2^16 is 1 modulo
+ * 0xFFFF, the folded sum is the same as summing 16 bit words.
+ * The main loops handle 32 bytes per iteration.
+ *
+ * The copy variant sums the data while copying it, so payloads that
+ * are copied into a packet are only read once.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <net/checksum.h>
+#include <net/utils.h>
+
+/* x86 allows unaligned loads, buffers can start at any address. */
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) csum_u32;
+typedef uint16_t __attribute__((__may_alias__, __aligned__(1))) csum_u16;
+
+static inline uint32_t __csum_fold64(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+/* Adds the last 0 - 3 bytes, an odd last byte is padded with zero. */
+static inline uint64_t __csum_tail(uint64_t sum, const uint8_t* data, int len)
+{
+    if(len & 2){
+        sum += *(const csum_u16*)data;
+        data += 2;
+    }
+    if(len & 1){
+        sum += *data;
+    }
+    return sum;
+}
+
+/**
+ * @brief Sums a buffer into a partial checksum.
+ * @param buf data to sum.
+ * @param len length in bytes.
+ * @param sum partial sum to add to, 0 to start.
+ * @return uint32_t unfolded partial sum.
+ */
+uint32_t csum_partial(const void* buf, int len, uint32_t sum)
+{
+    const csum_u32* data = buf;
+    uint64_t acc = sum;
+
+    while(len >= 32){
+        acc += data[0];
+        acc += data[1];
+        acc += data[2];
+        acc += data[3];
+        acc += data[4];
+        acc += data[5];
+        acc += data[6];
+        acc += data[7];
+        data += 8;
+        len -= 32;
+    }
+
+    while(len >= 4){
+        acc += *data++;
+        len -= 4;
+    }
+
+    return __csum_fold64(__csum_tail(acc, (const uint8_t*)data, len));
+}
+
+/**
+ * @brief Copies a buffer and sums it in the same pass.
+ * @param dst destination, must not overlap src.
+ * @param src data to copy and sum.
+ * @param len length in bytes.
+ * @param sum partial sum to add to, 0 to start.
+ * @return uint32_t unfolded partial sum of the copied data.
+ */
+uint32_t csum_partial_copy(void* dst, const void* src, int len, uint32_t sum)
+{
+    const csum_u32* from = src;
+    csum_u32* to = dst;
+    uint64_t acc = sum;
+    uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+    while(len >= 32){
+        w0 = from[0]; w1 = from[1]; w2 = from[2]; w3 = from[3];
+        w4 = from[4]; w5 = from[5]; w6 = from[6]; w7 = from[7];
+
+        to[0] = w0; to[1] = w1; to[2] = w2; to[3] = w3;
+        to[4] = w4; to[5] = w5; to[6] = w6; to[7] = w7;
+
+        acc += w0; acc += w1; acc += w2; acc += w3;
+        acc += w4; acc += w5; acc += w6; acc += w7;
+
+        from += 8;
+        to += 8;
+        len -= 32;
+    }
+
+    while(len >= 4){
+        w0 = *from++;
+        *to++ = w0;
+        acc += w0;
+        len -= 4;
+    }
+
+    for (int i = 0; i < len; i++){
+        ((uint8_t*)to)[i] = ((const uint8_t*)from)[i];
+    }
+
+    return __csum_fold64(__csum_tail(acc, (const uint8_t*)from, len));
+}
+
+/**
+ * @brief Partial sum of the UDP and TCP pseudo header.
+ * @param saddr source address in network order.
+ * @param daddr destination address in network order.
+ * @param proto IP protocol number.
+ * @param len transport length in host order.
+ * @return uint32_t unfolded partial sum.
+ */
+uint32_t csum_pseudo(uint32_t saddr, uint32_t daddr, uint8_t proto, uint16_t len)
+{
+    uint64_t acc = 0;
+
+    acc += saddr;
+    acc += daddr;
+    acc += htons(proto);
+    acc += htons(len);
+
+    return __csum_fold64(acc);
+}
@@ -4,9 +4,19 @@
  * @brief Domain Name System implementation.
  * @version 0.1
  * @date 2022-07-16
- * 
+ *
+ * Lookups are answered from a hashed cache that honors the TTL of
+ * the answer, names that do not exist are cached as negative entries.
+ * A lookup for a name that is already being queried waits for the same
+ * answer instead of sending its own query.
+ *
+ * Queries are sent by the caller, answers are received and matched
+ * by the dnsd thread, which also retransmits and times out queries.
+ * Queries use random ids, and an answer is only accepted from the
+ * server it was sent to and if it echoes the question.
+ *
  * @copyright Copyright (c) 2022
- * 
+ *
  */
 #include <net/dns.h>
 #include <net/dhcp.h>
@@ -16,159 +26,577 @@
 #include <serial.h>
 #include <syscalls.h>
 #include <syscall_helper.h>
+#include <kthreads.h>
+#include <waitqueue.h>
+#include <memory.h>
+#include <timer.h>
+#include <errors.h>
 
 #include <libc.h>
 
 #define DNS_PORT 53
 
-static struct dns_cache __dns_cache[DNS_CACHE_ENTRIES];
-static mutex_t __dns_mutex;
+static struct dns_resolver {
+    struct dns_entry* entries;
+    struct dns_entry* hash[DNS_HASH_SIZE];
+    struct dns_stats stats;
 
-void net_init_dns();
-int gethostname(char* hostname);
+    struct sock* sock;
+
+    struct waitqueue wq;    /* synchronous lookups */
+} resolver;
+
+#define DNS_EXPIRED(entry) ((int32_t)((entry)->expires - (uint32_t)timer_get_tick()) <= 0)
+#define DNS_TICKS_TO_MS(ticks) (((ticks) * 1000) / timer_ms_to_ticks(1000))
 
 void net_init_dns()
 {
-    /* Set DNS cache to be "empty". */
-    for (int i = 0; i < DNS_CACHE_ENTRIES; i++){
-        __dns_cache[i].ip = 0;
+    memset(&resolver, 0, sizeof(resolver));
+    resolver.entries = kcalloc(sizeof(struct dns_entry) * DNS_CACHE_SIZE);
+    waitqueue_init(&resolver.wq);
+}
+
+const char* dns_state_to_str(dns_state_t state)
+{
+    switch (state){
+    case DNS_PENDING: return "pending";
+    case DNS_RESOLVED: return "resolved";
+    case DNS_NEGATIVE: return "nxdomain";
+    default: return "free";
     }
+}
 
-    mutex_init(&__dns_mutex);
+/* FNV-1a, names are stored in lower case */
+static uint32_t __dns_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    while(*name){
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash & (DNS_HASH_SIZE - 1);
 }
 
-static void __dns_name_compresion(uint8_t* request, char* host) 
+/**
+ * @brief Copies a hostname in lower case without a trailing dot.
+ * @return int length, less than 0 if the name is empty or too long.
+ */
+static int __dns_normalize(char* out, const char* name)
 {
-    int lock = 0;
-    host[strlen(host)] = '.';
+    int len = 0;
 
-    for(int i = 0 ; i < strlen(host); i++) {
-        if(host[i]=='.') {
-            *request++ = i-lock;
-            for(;lock<i;lock++) {
-                *request++=host[lock];
-            }
-            lock++; //or lock=i+1;
-        }
+    while(name[len] != '\0'){
+        if(len >= DNS_NAME_MAX - 1) return -ERROR_INVALID_ARGUMENTS;
+
+        char c = name[len];
+        out[len++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
     }
-    *request++ = '\0';
+    if(len > 0 && out[len-1] == '.') len--;
+    out[len] = '\0';
+
+    return len > 0 ? len : -ERROR_INVALID_ARGUMENTS;
 }
 
-static void __dns_add_cache(char* hostname, uint32_t ip)
+/**
+ * @brief Encodes a dotted name as DNS labels.
+ * @return int bytes written, including the terminating zero label.
+ */
+static int __dns_encode_name(uint8_t* out, const char* name)
 {
-    for (int i = 0; i < DNS_CACHE_ENTRIES; i++){
-        if(__dns_cache[i].ip == 0){
-            memcpy(__dns_cache[i].name, hostname, strlen(hostname));
-            __dns_cache[i].ip = ip;
-            return;
-        }
+    int written = 0;
+
+    while(*name){
+        int label = 0;
+        while(name[label] != '\0' && name[label] != '.') label++;
+
+        out[written++] = label;
+        memcpy(&out[written], name, label);
+        written += label;
+
+        name += label;
+        if(*name == '.') name++;
     }
+    out[written++] = 0;
+
+    return written;
 }
 
-/* returns -1 on error */
-int gethostname(char* hostname)
+static struct dns_entry* __dns_lookup(const char* name)
 {
+    struct dns_entry* entry = resolver.hash[__dns_hash(name)];
+    while(entry != NULL && strcmp(entry->name, name) != 0){
+        entry = entry->next;
+    }
+    return entry;
+}
 
-    if(dhcp_get_state() == DHCP_STOPPED){
-        dbgprintf("[DNS] Unable to resolve hostname. No IP.");
-        return -1;
+static void __dns_unhash(struct dns_entry* entry)
+{
+    struct dns_entry** link = &resolver.hash[__dns_hash(entry->name)];
+    while(*link != NULL && *link != entry){
+        link = &(*link)->next;
     }
+    if(*link != NULL) *link = entry->next;
+
+    entry->state = DNS_FREE;
+    entry->next = NULL;
+}
+
+/**
+ * @brief Takes a free entry, otherwise the answer that expires first is evicted.
+ * Entries with a query in flight are never evicted.
+ * Must be called in a critical section.
+ */
+static struct dns_entry* __dns_alloc(const char* name)
+{
+    struct dns_entry* victim = NULL;
 
-    /* Check for cache first. */
-    for (int i = 0; i < DNS_CACHE_ENTRIES; i++)
-        if(memcmp((uint8_t*) &__dns_cache[i].name,(uint8_t*) hostname, strlen(hostname)) == 0){
-            dbgprintf("[DNS] (%s at %i) (cache)\n", hostname, __dns_cache[i].ip);
-            return __dns_cache[i].ip;
+    for (int i = 0; i < DNS_CACHE_SIZE; i++){
+        struct dns_entry* entry = &resolver.entries[i];
+        if(entry->state == DNS_FREE){
+            victim = entry;
+            break;
+        }
+        if(entry->state != DNS_PENDING && (victim == NULL || (int32_t)(entry->expires - victim->expires) < 0)){
+            victim = entry;
         }
+    }
+    if(victim == NULL) return NULL;
 
-    dbgprintf("[DNS] query for (%s)\n", hostname);
-    
-    char hostname_save[40];
-    memcpy(hostname_save, hostname, strlen(hostname)+1);
-    //acquire(&__dns_mutex);
+    if(victim->state != DNS_FREE){
+        __dns_unhash(victim);
+    }
 
-    struct sock* __dns_socket = kernel_socket_create(AF_INET, SOCK_DGRAM, 0);
+    memset(victim, 0, sizeof(struct dns_entry));
+    strcpy(victim->name, name);
+    victim->next = resolver.hash[__dns_hash(name)];
+    resolver.hash[__dns_hash(name)] = victim;
 
-    uint8_t buf[2048]; /* Can be replaced with alloc. */
-    struct dns_header* request;
-    struct dns_question* request_question;
+    return victim;
+}
 
-    request = (struct dns_header*) &buf;
-    DNS_REQUEST(request);
+/**
+ * @brief Random non-zero id that no other query in flight uses.
+ * Must be called in a critical section.
+ */
+static uint16_t __dns_new_id()
+{
+    uint16_t id;
+    int used;
 
-    /* Move pointer past header */
-    uint8_t* question =(uint8_t*)&buf[sizeof(struct dns_header)];
-    __dns_name_compresion(question, hostname);
-    request_question =(struct dns_question*) &buf[sizeof(struct dns_header) + (strlen((const char*)question) + 1)];
- 
-    request_question->qtype = htons(DNS_T_A); //type of the query , A , MX , CNAME , NS etc
-    request_question->qclass = htons(1);
+    do {
+        id = (uint16_t)(((rand() & 0xFF) << 8) | (rand() & 0xFF));
+        used = id == 0;
+        for (int i = 0; i < DNS_CACHE_SIZE && !used; i++){
+            used = resolver.entries[i].state == DNS_PENDING && resolver.entries[i].id == id;
+        }
+    } while(used);
 
+    return id;
+}
+
+static int __dns_send_query(const char* name, uint16_t id)
+{
+    uint8_t buf[sizeof(struct dns_header) + DNS_NAME_MAX + 2 + sizeof(struct dns_question)];
+    struct dns_header* request = (struct dns_header*) buf;
+    struct dns_question question = {
+        .qtype = htons(DNS_T_A),
+        .qclass = htons(1)
+    };
     struct sockaddr_in dest;
+    int size;
+
+    DNS_REQUEST(request);
+    request->id = id;
+
+    size = sizeof(struct dns_header);
+    size += __dns_encode_name(&buf[size], name);
+    memcpy(&buf[size], &question, sizeof(struct dns_question));
+    size += sizeof(struct dns_question);
+
     dest.sin_family = AF_INET;
     dest.sin_port = htons(DNS_PORT);
     dest.sin_addr.s_addr = htonl(dhcp_get_dns());
 
-    int question_size = sizeof(struct dns_header) + (strlen((const char*)question)+1) + sizeof(struct dns_question);
- 
-    kernel_sendto(__dns_socket, (char*)buf, question_size, 0, (struct sockaddr*)&dest, sizeof(dest));
-    int ret = kernel_recv(__dns_socket, buf, 2048, 0);
-    if(ret <= 0){
-        dbgprintf("Failed DNS lookup\n");
-        kernel_sock_close(__dns_socket);
-        return -1;
+    dbgprintf("[DNS] query for (%s) id %d\n", name, id);
+    return kernel_sendto(resolver.sock, (char*)buf, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+}
+
+/**
+ * @brief Completes all requests waiting on a entry.
+ * Called outside of critical sections with the list taken from the entry.
+ */
+static void __dns_complete(struct dns_request* waiters, int status, uint32_t ip)
+{
+    while(waiters != NULL){
+        struct dns_request* request = waiters;
+        waiters = request->next;
+        request->next = NULL;
+
+        request->ip = ip;
+        request->status = status;
+        if(request->callback != NULL){
+            request->callback(request);
+        }
     }
-    
-    struct dns_answer* answer;
-    int last_length = 0;
-
-    dbgprintf("[DNS] %i bytes received\n", ret);
-
-    struct dns_header* dns = (struct dns_header*) &buf;
-    for (int i = 0; i < dns->ans_count; i++){
-        int next = (sizeof(struct dns_answer)*i) + last_length;
-        answer = (struct dns_answer*) &buf[question_size+next];
-        last_length = ntohs(answer->data_len);
-        
-        if(answer->type != ntohs(DNS_T_A))
-            continue;
-
-        uint32_t result;
-        switch (ntohs(answer->data_len)){
-        case 4:
-            result = *((uint32_t*) &buf[question_size+12+next]);
-            break;
-        
-        default:
-            result = 0;
+
+    waitqueue_wake(&resolver.wq);
+}
+
+/**
+ * @brief Starts a lookup, answered from the cache when possible.
+ * @param request request to fill in, must stay valid until it completes.
+ * @param hostname name to resolve.
+ * @param callback optional, called on the resolver thread when the answer arrives.
+ * @param arg stored in the request for the callback.
+ * @return int 0 if answered from the cache, DNS_REQUEST_PENDING if the
+ * answer is pending, less than 0 on error.
+ */
+int dns_resolve(struct dns_request* request, const char* hostname, void (*callback)(struct dns_request* request), void* arg)
+{
+    struct dns_entry* entry;
+    uint16_t id = 0;
+    int ret;
+
+    ERR_ON_NULL(request);
+    ERR_ON_NULL(hostname);
+
+    memset(request, 0, sizeof(struct dns_request));
+    request->callback = callback;
+    request->arg = arg;
+    ret = __dns_normalize(request->name, hostname);
+    if(ret < 0) return ret;
+
+    if(resolver.entries == NULL || resolver.sock == NULL || dhcp_get_state() == DHCP_STOPPED){
+        dbgprintf("[DNS] Unable to resolve hostname. No IP.");
+        return -ERROR_INVALID_SOCKET;
+    }
+
+    ENTER_CRITICAL();
+    entry = __dns_lookup(request->name);
+    if(entry != NULL && entry->state != DNS_PENDING && DNS_EXPIRED(entry)){
+        /* Expired answers are queried again in place */
+        entry->state = DNS_FREE;
+    }
+
+    if(entry != NULL && (entry->state == DNS_RESOLVED || entry->state == DNS_NEGATIVE)){
+        if(entry->state == DNS_RESOLVED){
+            resolver.stats.hits++;
+            request->ip = entry->ip;
+            request->status = 0;
+        } else {
+            resolver.stats.negative_hits++;
+            request->status = -ERROR_HOST_NOT_FOUND;
+        }
+        LEAVE_CRITICAL();
+        return request->status;
+    }
+
+    resolver.stats.misses++;
+    if(entry != NULL && entry->state == DNS_PENDING){
+        resolver.stats.coalesced++;
+    } else {
+        if(entry == NULL){
+            entry = __dns_alloc(request->name);
+            if(entry == NULL){
+                LEAVE_CRITICAL();
+                return -ERROR_ALLOC;
+            }
+        }
+        entry->state = DNS_PENDING;
+        entry->id = __dns_new_id();
+        entry->retries = 0;
+        entry->started = timer_get_tick();
+        entry->sent = entry->started;
+        id = entry->id;
+        resolver.stats.queries++;
+    }
+
+    request->status = DNS_REQUEST_PENDING;
+    request->next = entry->waiters;
+    entry->waiters = request;
+    LEAVE_CRITICAL();
+
+    if(id != 0){
+        __dns_send_query(request->name, id);
+    }
+
+    return DNS_REQUEST_PENDING;
+}
+
+/**
+ * @brief Status of a request started with dns_resolve.
+ */
+int dns_request_poll(struct dns_request* request)
+{
+    return request->status;
+}
+
+/**
+ * @brief Stops waiting for a pending request, the query itself is not cancelled.
+ */
+void dns_request_cancel(struct dns_request* request)
+{
+    CRITICAL_SECTION({
+        if(request->status == DNS_REQUEST_PENDING){
+            struct dns_entry* entry = __dns_lookup(request->name);
+            struct dns_request** link = entry != NULL ? &entry->waiters : NULL;
+            while(link != NULL && *link != NULL && *link != request){
+                link = &(*link)->next;
+            }
+            if(link != NULL && *link != NULL) *link = request->next;
+
+            request->next = NULL;
+            request->status = -ERROR_TIMEOUT;
+        }
+    });
+}
+
+static int __dns_skip_name(uint8_t* msg, int len, int offset)
+{
+    while(offset < len){
+        uint8_t label = msg[offset];
+        if(label == 0) return offset + 1;
+        if((label & 0xC0) == 0xC0) return offset + 2;
+        offset += label + 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Decodes the question name of a answer, without compression.
+ * @param out buffer of DNS_NAME_MAX bytes, the name in lower case.
+ * @return int offset after the name, less than 0 if it is malformed.
+ */
+static int __dns_decode_name(uint8_t* msg, int len, int offset, char* out)
+{
+    int written = 0;
+
+    while(offset < len && msg[offset] != 0){
+        uint8_t label = msg[offset++];
+        if((label & 0xC0) != 0 || offset + label > len || written + label + 1 >= DNS_NAME_MAX) return -1;
+
+        if(written > 0) out[written++] = '.';
+        for (int i = 0; i < label; i++){
+            char c = msg[offset++];
+            out[written++] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+    }
+    if(offset >= len) return -1;
+
+    out[written] = '\0';
+    return offset + 1;
+}
+
+/**
+ * @brief Parses a answer and completes the matching query.
+ * The answer has to echo the single question that was asked.
+ * The first A record is used, NXDOMAIN and answers without A records are cached as negative.
+ */
+static void __dns_handle_response(uint8_t* msg, int len)
+{
+    struct dns_header* hdr = (struct dns_header*) msg;
+    struct dns_request* waiters = NULL;
+    struct dns_entry* entry = NULL;
+    uint32_t ip = 0, ttl = DNS_NEGATIVE_TTL;
+    int found = 0, status, offset;
+    char name[DNS_NAME_MAX];
+
+    if(len < (int)sizeof(struct dns_header) || !hdr->qr || ntohs(hdr->q_count) != 1) return;
+
+    offset = __dns_decode_name(msg, len, sizeof(struct dns_header), name);
+    if(offset < 0 || offset + (int)sizeof(struct dns_question) > len) return;
+
+    struct dns_question* question = (struct dns_question*) &msg[offset];
+    if(question->qtype != htons(DNS_T_A) || question->qclass != htons(1)) return;
+    offset += sizeof(struct dns_question);
+
+    for (int i = 0; i < ntohs(hdr->ans_count) && offset > 0 && !found; i++){
+        offset = __dns_skip_name(msg, len, offset);
+        if(offset < 0 || offset + 10 > len) break;
+
+        uint16_t type = (msg[offset] << 8) | msg[offset+1];
+        uint16_t class = (msg[offset+2] << 8) | msg[offset+3];
+        uint32_t record_ttl = ((uint32_t)msg[offset+4] << 24) | (msg[offset+5] << 16) | (msg[offset+6] << 8) | msg[offset+7];
+        uint16_t rdlen = (msg[offset+8] << 8) | msg[offset+9];
+        offset += 10;
+        if(offset + rdlen > len) break;
+
+        if(type == DNS_T_A && class == 1 && rdlen == 4){
+            memcpy(&ip, &msg[offset], 4);
+            ttl = record_ttl;
+            found = 1;
+        }
+        offset += rdlen;
+    }
+
+    if(found){
+        status = 0;
+        if(ttl < DNS_TTL_MIN) ttl = DNS_TTL_MIN;
+        if(ttl > DNS_TTL_MAX) ttl = DNS_TTL_MAX;
+    } else if(hdr->rcode == 0 || hdr->rcode == DNS_RCODE_NXDOMAIN){
+        status = -ERROR_HOST_NOT_FOUND;
+    } else {
+        /* Server failure, nothing is cached */
+        status = -ERROR_UNKNOWN;
+    }
+
+    ENTER_CRITICAL();
+    for (int i = 0; i < DNS_CACHE_SIZE; i++){
+        if(resolver.entries[i].state == DNS_PENDING && resolver.entries[i].id == hdr->id && strcmp(resolver.entries[i].name, name) == 0){
+            entry = &resolver.entries[i];
             break;
         }
+    }
+
+    if(entry != NULL){
+        uint32_t latency = DNS_TICKS_TO_MS((uint32_t)timer_get_tick() - entry->started);
+        resolver.stats.answers++;
+        resolver.stats.latency_total += latency;
+        if(latency > resolver.stats.latency_max) resolver.stats.latency_max = latency;
 
-        dbgprintf("[DNS]: %x name\n", ntohs(answer->name));
-        dbgprintf("[DNS]: %x type\n",  ntohs(answer->type));
-        dbgprintf("[DNS]: %x _class\n",ntohs(answer->_class));
-        dbgprintf("[DNS]: %x ttl\n", ntohl(answer->ttl));
-        dbgprintf("[DNS]: %x len\n", ntohs(answer->data_len));
+        waiters = entry->waiters;
+        entry->waiters = NULL;
 
-        if(result <= 0){
-            dbgprintf("[DNS] Unable to resolve hostname.");
-            //release(&__dns_mutex);
-            kernel_sock_close(__dns_socket);
-            return -1;
+        if(status == -ERROR_UNKNOWN){
+            resolver.stats.failures++;
+            __dns_unhash(entry);
+        } else {
+            entry->state = found ? DNS_RESOLVED : DNS_NEGATIVE;
+            entry->ip = ip;
+            entry->expires = timer_get_tick() + timer_ms_to_ticks(ttl * 1000);
         }
+        dbgprintf("[DNS] (%s at %i) ttl %d, %d ms\n", entry->name, ip, ttl, latency);
+    }
+    LEAVE_CRITICAL();
 
-        dbgprintf("[DNS] (%s at %i)\n", hostname, result);
+    if(entry != NULL){
+        __dns_complete(waiters, status, ip);
+    }
+}
 
-        __dns_add_cache(hostname_save, result);
+/**
+ * @brief Retransmits queries that were not answered and fails those out of retries.
+ */
+static void __dns_retransmit()
+{
+    struct dns_request* failed = NULL;
+    char name[DNS_NAME_MAX];
+    uint16_t id;
+
+    for (int i = 0; i < DNS_CACHE_SIZE; i++){
+        struct dns_entry* entry = &resolver.entries[i];
+        id = 0;
+
+        ENTER_CRITICAL();
+        if(entry->state == DNS_PENDING && (uint32_t)timer_get_tick() - entry->sent >= (uint32_t)timer_ms_to_ticks(DNS_RETRANS_MS)){
+            if(entry->retries >= DNS_RETRIES){
+                /* Timeouts are not cached, the next lookup queries again */
+                resolver.stats.timeouts++;
+                failed = entry->waiters;
+                entry->waiters = NULL;
+                __dns_unhash(entry);
+            } else {
+                entry->retries++;
+                entry->sent = timer_get_tick();
+                resolver.stats.retransmits++;
+                strcpy(name, entry->name);
+                id = entry->id;
+            }
+        }
+        LEAVE_CRITICAL();
+
+        if(failed != NULL){
+            __dns_complete(failed, -ERROR_TIMEOUT, 0);
+            failed = NULL;
+        }
+        if(id != 0){
+            __dns_send_query(name, id);
+        }
+    }
+}
+
+/**
+ * @brief Resolver thread, receives answers and retransmits queries.
+ */
+void __kthread_entry dnsd()
+{
+    uint8_t buf[DNS_MSG_MAX];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    int ret;
+
+    if(resolver.sock != NULL || resolver.entries == NULL) return;
+
+    struct sock* sock = kernel_socket_create(AF_INET, SOCK_DGRAM, 0);
+    if(sock == NULL){
+        dbgprintf("[DNS] Unable to create resolver socket\n");
+        return;
+    }
+    net_sock_bind(sock, 0, INADDR_ANY);
+    resolver.sock = sock;
+
+    while(1){
+        if(net_sock_wait_data(sock, 1, timer_ms_to_ticks(DNS_TICK_MS)) == 0){
+            ret = kernel_recvfrom(sock, buf, DNS_MSG_MAX, 0, (struct sockaddr*)&from, &from_len);
+
+            /* Only the server the queries were sent to is listened to */
+            if(ret > 0 && from.sin_addr.s_addr == htonl(dhcp_get_dns()) && from.sin_port == htons(DNS_PORT)){
+                __dns_handle_response(buf, ret);
+            }
+        }
+
+        __dns_retransmit();
+    }
+}
+EXPORT_KTHREAD(dnsd);
+
+/**
+ * @brief Copies the used entries of the cache.
+ * @return int number of entries copied.
+ */
+int dns_get_entries(struct dns_entry* entries, int max)
+{
+    int count = 0;
+
+    if(resolver.entries == NULL) return 0;
+
+    CRITICAL_SECTION({
+        for (int i = 0; i < DNS_CACHE_SIZE && count < max; i++){
+            if(resolver.entries[i].state == DNS_FREE) continue;
+            entries[count++] = resolver.entries[i];
+        }
+    });
+
+    return count;
+}
 
-        kernel_sock_close(__dns_socket);
+void dns_get_stats(struct dns_stats* stats)
+{
+    *stats = resolver.stats;
+}
 
-        //release(&__dns_mutex);
+static int __dns_request_done(void* arg)
+{
+    return ((struct dns_request*) arg)->status != DNS_REQUEST_PENDING;
+}
 
-        dbgprintf("[DNS] (%s at %i) (new)\n", hostname, result);
+/* returns -1 on error */
+int gethostname(char* hostname)
+{
+    struct dns_request request;
 
-        return result;
+    int ret = dns_resolve(&request, hostname, NULL, NULL);
+    if(ret == DNS_REQUEST_PENDING){
+        waitqueue_wait(&resolver.wq, __dns_request_done, &request, WAITQUEUE_FOREVER);
+        ret = request.status;
     }
-    return 0;
+
+    if(ret < 0){
+        dbgprintf("[DNS] Unable to resolve %s: %d\n", hostname, ret);
+        return -1;
+    }
+
+    return request.ip;
 }
-EXPORT_SYSCALL(SYSCALL_NET_DNS_LOOKUP, gethostname);
\ No newline at end of file
+EXPORT_SYSCALL(SYSCALL_NET_DNS_LOOKUP, gethostname);
@@ -30,11 +30,16 @@ int net_ethernet_add_header(struct sk_buff* skb, uint32_t ip)
         .ethertype = htons(skb->proto)
     };
 
+    /* The destination is filled in by the ARP cache when the packet is sent */
     int ret = net_arp_find_entry(ntohl(ip), (uint8_t*)&e_hdr.dmac);
-    if(ret < 0) return ret;
+    if(ret < 0){
+        memset(&e_hdr.dmac, 0, 6);
+        skb->arp_ip = ntohl(ip);
+    }
 
     memcpy(&e_hdr.smac, skb->interface->device->mac, 6);
     memcpy(skb->data, &e_hdr, ETHER_HDR_LENGTH);
+    skb->hdr.eth = (struct ethernet_header*) skb->data;
     skb->data += ETHER_HDR_LENGTH;
 
     //net_ethernet_print(&e_hdr);
@@ -2,52 +2,777 @@
  * @file firewall.c
  * @author Joe Bayer (joexbayer)
  * @brief Firewall implementation.
- * @version 0.1
+ * @version 0.2
  * @date 2024-01-10
- * 
+ *
+ * Packets are filtered on receive, after the IP header is parsed, and
+ * on transmit, before they are queued for the device.
+ *
+ * Rules are compiled into a decision table per direction and protocol.
+ * Rules with a destination port are hashed on the port, rules without
+ * one are kept on a wildcard list. Both lists are in rule order, so a
+ * packet is only matched against the rules for its port and the
+ * wildcards, merged by rule number until the first match.
+ *
+ * Accepted packets create a tracked connection. Later packets of the
+ * same flow, in either direction, are accepted without looking at the
+ * rules, which also lets replies in when the input policy is drop.
+ *
+ * Rejected incoming packets are answered with a TCP RST or an ICMP
+ * port unreachable. These answers and other control replies, TCP RSTs
+ * and ICMP errors, are not tracked.
+ *
  * @copyright Copyright (c) 2024
- * 
+ *
  */
 
 #include <stdint.h>
 #include <net/net.h>
 #include <net/ethernet.h>
 #include <net/arp.h>
+#include <net/ipv4.h>
+#include <net/tcp.h>
+#include <net/udp.h>
+#include <net/icmp.h>
+#include <net/checksum.h>
+#include <net/skb.h>
+#include <net/utils.h>
+#include <net/firewall.h>
 
 #include <memory.h>
+#include <kutils.h>
+#include <timer.h>
+#include <libc.h>
+#include <math.h>
+#include <serial.h>
 
-typedef enum __firewall_policy_t {
-    FIREWALL_POLICY_ACCEPT,
-    FIREWALL_POLICY_DROP,
-    FIREWALL_POLICY_REJECT,
-} firewall_policy_t;
+#ifndef KDEBUG_NET_FIREWALL
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
 
-struct net_firewall_rule {
-    firewall_policy_t policy;
-    
-    uint32_t src_ip;
-    uint32_t src_mask;
+/* Protocols with their own decision table */
+enum {
+    FIREWALL_CLASS_TCP,
+    FIREWALL_CLASS_UDP,
+    FIREWALL_CLASS_ICMP,
+    FIREWALL_CLASS_OTHER,
+    FIREWALL_CLASSES
+};
 
-    uint32_t dst_ip;
-    uint32_t dst_mask;
+#define FIREWALL_DIRECTIONS 2
+#define FIREWALL_END        -1
+
+struct firewall_match {
+    int16_t rule;
+    int16_t next;
+};
 
-    uint16_t src_port;
-    uint16_t dst_port;
+struct firewall_chain {
+    int16_t ports[FIREWALL_PORT_HASH];
+    int16_t wildcard;
+};
+
+struct firewall_program {
+    struct firewall_chain chains[FIREWALL_DIRECTIONS][FIREWALL_CLASSES];
+    struct firewall_match matches[FIREWALL_MAX_RULES * FIREWALL_DIRECTIONS * FIREWALL_CLASSES];
+};
+
+/* Fields of a packet the rules look at, in host order */
+struct firewall_tuple {
+    uint32_t saddr;
+    uint32_t daddr;
+    uint16_t sport;
+    uint16_t dport;
     uint8_t protocol;
+    uint8_t closing;
+    uint8_t untracked;  /* TCP RST or ICMP error, does not start a flow */
 };
 
 struct net_firewall {
     struct net_firewall_rule* rules;
     int num_rules;
+
+    firewall_policy_t policy[FIREWALL_DIRECTIONS];
+    struct firewall_program* program;
+
+    struct firewall_conn* conns;
+    struct firewall_conn* conn_hash[FIREWALL_CONNTRACK_HASH];
+
+    struct firewall_stats stats;
 };
 
+static struct net_firewall* firewall = NULL;
+
+#define FIREWALL_PORT_HASH_FN(port) (((port) ^ ((port) >> 4) ^ ((port) >> 8)) & (FIREWALL_PORT_HASH - 1))
+#define FIREWALL_DIR_INDEX(direction) ((direction) == FIREWALL_IN ? 0 : 1)
+#define FIREWALL_EXPIRED(conn, now) ((int32_t)((now) - (conn)->expires) >= 0)
+
+const char* firewall_policy_to_str(firewall_policy_t policy)
+{
+    switch (policy){
+    case FIREWALL_POLICY_ACCEPT: return "accept";
+    case FIREWALL_POLICY_DROP: return "drop";
+    case FIREWALL_POLICY_REJECT: return "reject";
+    default: return "unknown";
+    }
+}
+
+const char* firewall_conn_state_to_str(firewall_conn_state_t state)
+{
+    switch (state){
+    case FIREWALL_CONN_NEW: return "new";
+    case FIREWALL_CONN_ESTABLISHED: return "established";
+    case FIREWALL_CONN_CLOSING: return "closing";
+    default: return "free";
+    }
+}
+
+static inline int __firewall_class(uint8_t protocol)
+{
+    switch (protocol){
+    case TCP: return FIREWALL_CLASS_TCP;
+    case UDP: return FIREWALL_CLASS_UDP;
+    case ICMPV4: return FIREWALL_CLASS_ICMP;
+    default: return FIREWALL_CLASS_OTHER;
+    }
+}
+
+/* Rules with ports only apply to TCP and UDP. */
+static int __firewall_rule_applies(struct net_firewall_rule* rule, int class)
+{
+    if(rule->protocol != 0 && __firewall_class(rule->protocol) != class) return 0;
+    if((rule->src_port != 0 || rule->dst_port != 0) && class != FIREWALL_CLASS_TCP && class != FIREWALL_CLASS_UDP) return 0;
+    return 1;
+}
+
+static inline int __firewall_rule_match(struct net_firewall_rule* rule, struct firewall_tuple* tuple)
+{
+    return (tuple->saddr & rule->src_mask) == rule->src_ip
+        && (tuple->daddr & rule->dst_mask) == rule->dst_ip
+        && (rule->src_port == 0 || rule->src_port == tuple->sport)
+        && (rule->dst_port == 0 || rule->dst_port == tuple->dport)
+        && (rule->protocol == 0 || rule->protocol == tuple->protocol);
+}
+
+/**
+ * @brief Builds the decision tables for the current rules.
+ * Rules are added in reverse and pushed on the front of the lists,
+ * which leaves every list sorted by rule number.
+ */
+static void __firewall_compile(struct firewall_program* program, struct net_firewall_rule* rules, int count)
+{
+    int matches = 0;
+
+    for (int dir = 0; dir < FIREWALL_DIRECTIONS; dir++){
+        for (int class = 0; class < FIREWALL_CLASSES; class++){
+            struct firewall_chain* chain = &program->chains[dir][class];
+            for (int i = 0; i < FIREWALL_PORT_HASH; i++){
+                chain->ports[i] = FIREWALL_END;
+            }
+            chain->wildcard = FIREWALL_END;
+        }
+    }
+
+    for (int i = count - 1; i >= 0; i--){
+        struct net_firewall_rule* rule = &rules[i];
+
+        for (int dir = 0; dir < FIREWALL_DIRECTIONS; dir++){
+            if(!(rule->direction & (1 << dir))) continue;
+
+            for (int class = 0; class < FIREWALL_CLASSES; class++){
+                if(!__firewall_rule_applies(rule, class)) continue;
+
+                struct firewall_chain* chain = &program->chains[dir][class];
+                int16_t* head = rule->dst_port != 0 ? &chain->ports[FIREWALL_PORT_HASH_FN(rule->dst_port)] : &chain->wildcard;
+
+                program->matches[matches].rule = i;
+                program->matches[matches].next = *head;
+                *head = matches++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief First rule matching the packet, must be called in a critical section.
+ */
+static struct net_firewall_rule* __firewall_match(int dir, struct firewall_tuple* tuple)
+{
+    struct firewall_program* program = firewall->program;
+    struct firewall_chain* chain = &program->chains[dir][__firewall_class(tuple->protocol)];
+
+    int16_t exact = chain->ports[FIREWALL_PORT_HASH_FN(tuple->dport)];
+    int16_t wildcard = chain->wildcard;
+
+    while(exact != FIREWALL_END || wildcard != FIREWALL_END){
+        int16_t* next;
+        if(wildcard == FIREWALL_END || (exact != FIREWALL_END && program->matches[exact].rule < program->matches[wildcard].rule)){
+            next = &exact;
+        } else {
+            next = &wildcard;
+        }
+
+        struct net_firewall_rule* rule = &firewall->rules[program->matches[*next].rule];
+        *next = program->matches[*next].next;
+
+        if(__firewall_rule_match(rule, tuple)) return rule;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Reads the addresses, ports and TCP flags of a packet.
+ * Received IP headers are already in host order, sent ones are not.
+ */
+static void __firewall_tuple(struct sk_buff* skb, firewall_direction_t direction, struct firewall_tuple* tuple)
+{
+    struct ip_header* ip = skb->hdr.ip;
+    uint8_t* transport = (uint8_t*)ip + ip->ihl * 4;
+
+    tuple->saddr = direction == FIREWALL_IN ? ip->saddr : ntohl(ip->saddr);
+    tuple->daddr = direction == FIREWALL_IN ? ip->daddr : ntohl(ip->daddr);
+    tuple->protocol = ip->proto;
+    tuple->sport = 0;
+    tuple->dport = 0;
+    tuple->closing = 0;
+    tuple->untracked = 0;
+
+    switch (ip->proto){
+    case TCP:{
+            struct tcp_header* tcp = (struct tcp_header*) transport;
+            tuple->sport = ntohs(tcp->source);
+            tuple->dport = ntohs(tcp->dest);
+            tuple->closing = tcp->fin || tcp->rst;
+            tuple->untracked = tcp->rst;
+        }
+        break;
+    case ICMPV4:
+        /* Only echo requests and replies are flows */
+        tuple->untracked = transport[0] != ICMP_V4_ECHO && transport[0] != ICMP_REPLY;
+        break;
+    case UDP:{
+            struct udp_header* udp = (struct udp_header*) transport;
+            tuple->sport = ntohs(udp->srcport);
+            tuple->dport = ntohs(udp->destport);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Symmetric, both directions of a flow hash to the same bucket. */
+static inline int __firewall_conn_hash(struct firewall_tuple* tuple)
+{
+    uint32_t hash = tuple->saddr ^ tuple->daddr ^ tuple->sport ^ tuple->dport ^ tuple->protocol;
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    return hash & (FIREWALL_CONNTRACK_HASH - 1);
+}
+
+static void __firewall_conn_unhash(struct firewall_conn* conn)
+{
+    struct firewall_tuple tuple = {
+        .saddr = conn->saddr,
+        .daddr = conn->daddr,
+        .sport = conn->sport,
+        .dport = conn->dport,
+        .protocol = conn->protocol
+    };
+
+    struct firewall_conn** link = &firewall->conn_hash[__firewall_conn_hash(&tuple)];
+    while(*link != NULL && *link != conn){
+        link = &(*link)->next;
+    }
+    if(*link != NULL) *link = conn->next;
+
+    conn->state = FIREWALL_CONN_FREE;
+    conn->next = NULL;
+    firewall->stats.conns--;
+}
+
+/**
+ * @brief Finds the flow of a packet, expired flows are removed on the way.
+ * @param reply set if the packet goes in the opposite direction of the flow.
+ */
+static struct firewall_conn* __firewall_conn_lookup(struct firewall_tuple* tuple, uint32_t now, int* reply)
+{
+    struct firewall_conn* conn = firewall->conn_hash[__firewall_conn_hash(tuple)];
+
+    while(conn != NULL){
+        struct firewall_conn* next = conn->next;
+
+        if(FIREWALL_EXPIRED(conn, now)){
+            __firewall_conn_unhash(conn);
+        } else if(conn->protocol == tuple->protocol){
+            if(conn->saddr == tuple->saddr && conn->daddr == tuple->daddr && conn->sport == tuple->sport && conn->dport == tuple->dport){
+                *reply = 0;
+                return conn;
+            }
+            if(conn->saddr == tuple->daddr && conn->daddr == tuple->saddr && conn->sport == tuple->dport && conn->dport == tuple->sport){
+                *reply = 1;
+                return conn;
+            }
+        }
+
+        conn = next;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Tracks a new flow, evicting the one closest to expiring if the table is full.
+ */
+static struct firewall_conn* __firewall_conn_create(struct firewall_tuple* tuple, firewall_direction_t direction, uint32_t now)
+{
+    struct firewall_conn* victim = NULL;
+
+    for (int i = 0; i < FIREWALL_CONNTRACK_SIZE; i++){
+        struct firewall_conn* conn = &firewall->conns[i];
+        if(conn->state == FIREWALL_CONN_FREE){
+            victim = conn;
+            break;
+        }
+        if(victim == NULL || (int32_t)(conn->expires - victim->expires) < 0){
+            victim = conn;
+        }
+    }
+
+    if(victim->state != FIREWALL_CONN_FREE){
+        if(!FIREWALL_EXPIRED(victim, now)) firewall->stats.conns_evicted++;
+        __firewall_conn_unhash(victim);
+    }
+
+    int hash = __firewall_conn_hash(tuple);
+    memset(victim, 0, sizeof(struct firewall_conn));
+    victim->saddr = tuple->saddr;
+    victim->daddr = tuple->daddr;
+    victim->sport = tuple->sport;
+    victim->dport = tuple->dport;
+    victim->protocol = tuple->protocol;
+    victim->direction = direction;
+    victim->state = FIREWALL_CONN_NEW;
+    victim->next = firewall->conn_hash[hash];
+    firewall->conn_hash[hash] = victim;
+    firewall->stats.conns++;
+
+    return victim;
+}
+
+static void __firewall_conn_update(struct firewall_conn* conn, struct firewall_tuple* tuple, int reply, uint32_t now)
+{
+    int timeout;
+
+    if(reply && conn->state == FIREWALL_CONN_NEW){
+        conn->state = FIREWALL_CONN_ESTABLISHED;
+    }
+    if(tuple->closing){
+        conn->state = FIREWALL_CONN_CLOSING;
+    }
+
+    switch (conn->state){
+    case FIREWALL_CONN_ESTABLISHED:
+        timeout = conn->protocol == TCP ? FIREWALL_TIMEOUT_TCP_MS : conn->protocol == ICMPV4 ? FIREWALL_TIMEOUT_ICMP_MS : FIREWALL_TIMEOUT_UDP_MS;
+        break;
+    case FIREWALL_CONN_CLOSING:
+        timeout = FIREWALL_TIMEOUT_CLOSING_MS;
+        break;
+    default:
+        timeout = conn->protocol == ICMPV4 ? FIREWALL_TIMEOUT_ICMP_MS : FIREWALL_TIMEOUT_NEW_MS;
+        break;
+    }
+
+    conn->packets++;
+    conn->expires = now + timer_ms_to_ticks(timeout);
+}
+
+/**
+ * @brief Resets a rejected TCP segment, RFC 793 section 3.4.
+ * @param ip received IP header in host order, the TCP header follows it.
+ */
+static void __firewall_reject_tcp(struct ip_header* ip)
+{
+    struct tcp_header* in = (struct tcp_header*)((uint8_t*)ip + ip->ihl * 4);
+    struct tcp_header* out;
+    struct sk_buff* skb;
+    uint32_t sum;
+
+    if(in->rst) return;
+
+    skb = skb_new();
+    if(skb == NULL) return;
+
+    if(net_ipv4_add_header(skb, ip->saddr, TCP, sizeof(struct tcp_header)) < 0){
+        skb_free(skb);
+        return;
+    }
+
+    out = (struct tcp_header*) skb->data;
+    memset(out, 0, sizeof(struct tcp_header));
+    out->source = in->dest;
+    out->dest = in->source;
+    out->doff = sizeof(struct tcp_header) / 4;
+    out->rst = 1;
+
+    /* Without an acknowledgement the RST acknowledges the segment instead */
+    if(in->ack){
+        out->seq = in->ack_seq;
+    } else {
+        uint32_t len = ip->len - ip->ihl * 4 - in->doff * 4;
+        out->ack_seq = htonl(ntohl(in->seq) + len + in->syn + in->fin);
+        out->ack = 1;
+    }
+
+    sum = csum_pseudo(skb->hdr.ip->saddr, skb->hdr.ip->daddr, TCP, sizeof(struct tcp_header));
+    out->check = csum_fold(csum_partial(out, sizeof(struct tcp_header), sum));
+
+    skb->len += sizeof(struct tcp_header);
+    skb->data += sizeof(struct tcp_header);
+
+    net_send_skb(skb);
+}
+
+/**
+ * @brief Answers a rejected packet with an ICMP port unreachable, RFC 792.
+ * The message quotes the IP header and the first 8 bytes of the payload.
+ * @param ip received IP header in host order.
+ */
+static void __firewall_reject_icmp(struct ip_header* ip)
+{
+    int hdr_len = ip->ihl * 4;
+    int quote = ip->len > hdr_len ? MIN(ip->len - hdr_len, 8) : 0;
+    int length = sizeof(struct icmp) + hdr_len + quote;
+    struct ip_header* copy;
+    struct icmp* icmp;
+    struct sk_buff* skb;
+
+    skb = skb_new();
+    if(skb == NULL) return;
+
+    if(net_ipv4_add_header(skb, ip->saddr, ICMPV4, length) < 0){
+        skb_free(skb);
+        return;
+    }
+
+    icmp = (struct icmp*) skb->data;
+    memset(icmp, 0, sizeof(struct icmp));
+    icmp->type = ICMP_DEST_UNREACHABLE;
+    icmp->code = ICMP_PORT_UNREACHABLE;
+
+    /* The received header was converted to host order when it was parsed */
+    copy = (struct ip_header*)(skb->data + sizeof(struct icmp));
+    memcpy(copy, ip, hdr_len + quote);
+    copy->saddr = htonl(ip->saddr);
+    copy->daddr = htonl(ip->daddr);
+    copy->len = htons(ip->len);
+    copy->id = htons(ip->id);
+
+    icmp->csum = checksum(icmp, length, 0);
+
+    skb->len += length;
+    skb->data += length;
+
+    net_send_skb(skb);
+}
+
+/**
+ * @brief Answers a rejected incoming packet.
+ * ICMP errors, RSTs and broadcasts are never answered (RFC 1122 3.2.2).
+ */
+static void __firewall_reject(struct sk_buff* skb)
+{
+    struct ip_header* ip = skb->hdr.ip;
+    uint8_t* transport = (uint8_t*)ip + ip->ihl * 4;
+
+    if(ip->daddr == BROADCAST_IP) return;
+
+    switch (ip->proto){
+    case TCP:
+        __firewall_reject_tcp(ip);
+        break;
+    case ICMPV4:
+        if(transport[0] != ICMP_V4_ECHO) return;
+        __firewall_reject_icmp(ip);
+        break;
+    default:
+        __firewall_reject_icmp(ip);
+        break;
+    }
+}
+
+/**
+ * @brief Decides what to do with an IPv4 packet.
+ * @param skb packet with skb->hdr.ip set, the transport header has to follow it.
+ * @param direction FIREWALL_IN for received packets, FIREWALL_OUT for sent packets.
+ * @return firewall_policy_t FIREWALL_POLICY_ACCEPT if the packet may pass.
+ */
+firewall_policy_t net_firewall_filter(struct sk_buff* skb, firewall_direction_t direction)
+{
+    struct firewall_tuple tuple;
+    firewall_policy_t policy;
+    int reply;
+
+    if(firewall == NULL || skb->hdr.ip == NULL) return FIREWALL_POLICY_ACCEPT;
+
+    /* Loopback traffic is always accepted. */
+    if(skb->interface != NULL && strncmp(skb->interface->name, "lo", 2) == 0) return FIREWALL_POLICY_ACCEPT;
+
+    __firewall_tuple(skb, direction, &tuple);
+
+    ENTER_CRITICAL();
+    uint32_t now = timer_get_tick();
+
+    struct firewall_conn* conn = __firewall_conn_lookup(&tuple, now, &reply);
+    if(conn != NULL){
+        __firewall_conn_update(conn, &tuple, reply, now);
+        firewall->stats.tracked++;
+        policy = FIREWALL_POLICY_ACCEPT;
+    } else {
+        struct net_firewall_rule* rule = __firewall_match(FIREWALL_DIR_INDEX(direction), &tuple);
+        if(rule != NULL){
+            rule->hits++;
+            policy = rule->policy;
+        } else {
+            policy = firewall->policy[FIREWALL_DIR_INDEX(direction)];
+        }
+        firewall->stats.evaluated++;
+
+        if(policy == FIREWALL_POLICY_ACCEPT && !tuple.untracked){
+            conn = __firewall_conn_create(&tuple, direction, now);
+            __firewall_conn_update(conn, &tuple, 0, now);
+        }
+    }
+
+    switch (policy){
+    case FIREWALL_POLICY_ACCEPT: firewall->stats.accepted++; break;
+    case FIREWALL_POLICY_DROP: firewall->stats.dropped++; break;
+    default: firewall->stats.rejected++; break;
+    }
+    LEAVE_CRITICAL();
+
+    if(policy != FIREWALL_POLICY_ACCEPT){
+        dbgprintf("[FIREWALL] %s %d %i:%d -> %i:%d\n", firewall_policy_to_str(policy), tuple.protocol,
+            htonl(tuple.saddr), tuple.sport, htonl(tuple.daddr), tuple.dport);
+    }
+
+    if(policy == FIREWALL_POLICY_REJECT && direction == FIREWALL_IN){
+        __firewall_reject(skb);
+    }
+
+    return policy;
+}
+
+/**
+ * @brief Recompiles the rules after they changed, must be called in a critical section.
+ * The old program is returned so it can be freed after leaving it.
+ */
+static struct firewall_program* __firewall_commit(struct firewall_program* program)
+{
+    struct firewall_program* old = firewall->program;
+
+    __firewall_compile(program, firewall->rules, firewall->num_rules);
+    firewall->program = program;
+
+    return old;
+}
+
+/**
+ * @brief Adds a rule.
+ * @param rule rule to add, masks are applied to the addresses.
+ * @param position index to insert at, -1 to append.
+ * @return error_t 0 on success, -ERROR_INDEX if there is no room.
+ */
+error_t net_firewall_add_rule(struct net_firewall_rule* rule, int position)
+{
+    ERR_ON_NULL(firewall);
+    ERR_ON_NULL(rule);
+
+    if(rule->policy > FIREWALL_POLICY_REJECT || !(rule->direction & FIREWALL_ANY)){
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+
+    struct firewall_program* program = kalloc(sizeof(struct firewall_program));
+    if(program == NULL) return -ERROR_ALLOC;
+
+    ENTER_CRITICAL();
+    if(firewall->num_rules >= FIREWALL_MAX_RULES){
+        LEAVE_CRITICAL();
+        kfree(program);
+        return -ERROR_INDEX;
+    }
+
+    if(position < 0 || position > firewall->num_rules){
+        position = firewall->num_rules;
+    }
+
+    for (int i = firewall->num_rules; i > position; i--){
+        firewall->rules[i] = firewall->rules[i-1];
+    }
+
+    struct net_firewall_rule* new = &firewall->rules[position];
+    *new = *rule;
+    new->src_ip &= new->src_mask;
+    new->dst_ip &= new->dst_mask;
+    new->hits = 0;
+    firewall->num_rules++;
+
+    program = __firewall_commit(program);
+    LEAVE_CRITICAL();
+
+    kfree(program);
+    return 0;
+}
+
+/**
+ * @brief Removes the rule at index.
+ */
+error_t net_firewall_del_rule(int index)
+{
+    ERR_ON_NULL(firewall);
+
+    struct firewall_program* program = kalloc(sizeof(struct firewall_program));
+    if(program == NULL) return -ERROR_ALLOC;
+
+    ENTER_CRITICAL();
+    if(index < 0 || index >= firewall->num_rules){
+        LEAVE_CRITICAL();
+        kfree(program);
+        return -ERROR_INDEX;
+    }
+
+    for (int i = index; i < firewall->num_rules - 1; i++){
+        firewall->rules[i] = firewall->rules[i+1];
+    }
+    firewall->num_rules--;
+
+    program = __firewall_commit(program);
+    LEAVE_CRITICAL();
+
+    kfree(program);
+    return 0;
+}
+
+/**
+ * @brief Removes all rules and tracked connections.
+ */
+void net_firewall_flush()
+{
+    if(firewall == NULL) return;
+
+    struct firewall_program* program = kalloc(sizeof(struct firewall_program));
+    if(program == NULL) return;
+
+    ENTER_CRITICAL();
+    firewall->num_rules = 0;
+    program = __firewall_commit(program);
+
+    memset(firewall->conns, 0, sizeof(struct firewall_conn) * FIREWALL_CONNTRACK_SIZE);
+    memset(firewall->conn_hash, 0, sizeof(firewall->conn_hash));
+    firewall->stats.conns = 0;
+    LEAVE_CRITICAL();
+
+    kfree(program);
+}
+
+/**
+ * @brief Sets the policy for packets no rule matches.
+ */
+error_t net_firewall_set_policy(firewall_direction_t direction, firewall_policy_t policy)
+{
+    ERR_ON_NULL(firewall);
+    if(policy > FIREWALL_POLICY_REJECT || !(direction & FIREWALL_ANY)) return -ERROR_INVALID_ARGUMENTS;
+
+    CRITICAL_SECTION({
+        if(direction & FIREWALL_IN) firewall->policy[FIREWALL_DIR_INDEX(FIREWALL_IN)] = policy;
+        if(direction & FIREWALL_OUT) firewall->policy[FIREWALL_DIR_INDEX(FIREWALL_OUT)] = policy;
+    });
+
+    return 0;
+}
+
+firewall_policy_t net_firewall_get_policy(firewall_direction_t direction)
+{
+    if(firewall == NULL) return FIREWALL_POLICY_ACCEPT;
+    return firewall->policy[FIREWALL_DIR_INDEX(direction)];
+}
+
+int net_firewall_get_rules(struct net_firewall_rule* rules, int max)
+{
+    int count = 0;
+    if(firewall == NULL) return 0;
+
+    CRITICAL_SECTION({
+        for (int i = 0; i < firewall->num_rules && count < max; i++){
+            rules[count++] = firewall->rules[i];
+        }
+    });
+
+    return count;
+}
+
+int net_firewall_get_conns(struct firewall_conn* conns, int max)
+{
+    int count = 0;
+    if(firewall == NULL) return 0;
+
+    CRITICAL_SECTION({
+        uint32_t now = timer_get_tick();
+        for (int i = 0; i < FIREWALL_CONNTRACK_SIZE && count < max; i++){
+            struct firewall_conn* conn = &firewall->conns[i];
+            if(conn->state == FIREWALL_CONN_FREE || FIREWALL_EXPIRED(conn, now)) continue;
+
+            conns[count] = *conn;
+            conns[count].next = NULL;
+            count++;
+        }
+    });
+
+    return count;
+}
+
+void net_firewall_get_stats(struct firewall_stats* stats)
+{
+    if(firewall == NULL){
+        memset(stats, 0, sizeof(struct firewall_stats));
+        return;
+    }
+
+    CRITICAL_SECTION({
+        *stats = firewall->stats;
+    });
+}
+
 struct net_firewall* net_firewall_create()
 {
     struct net_firewall* fw = create(struct net_firewall);
     if(fw == NULL) return NULL;
 
-    fw->rules = NULL;
+    fw->rules = kcalloc(sizeof(struct net_firewall_rule) * FIREWALL_MAX_RULES);
+    fw->conns = kcalloc(sizeof(struct firewall_conn) * FIREWALL_CONNTRACK_SIZE);
+    fw->program = kalloc(sizeof(struct firewall_program));
+    if(fw->rules == NULL || fw->conns == NULL || fw->program == NULL){
+        if(fw->rules != NULL) kfree(fw->rules);
+        if(fw->conns != NULL) kfree(fw->conns);
+        if(fw->program != NULL) kfree(fw->program);
+        kfree(fw);
+        return NULL;
+    }
+
     fw->num_rules = 0;
+    fw->policy[FIREWALL_DIR_INDEX(FIREWALL_IN)] = FIREWALL_POLICY_ACCEPT;
+    fw->policy[FIREWALL_DIR_INDEX(FIREWALL_OUT)] = FIREWALL_POLICY_ACCEPT;
+    __firewall_compile(fw->program, fw->rules, 0);
 
     return fw;
 }
+
+void net_init_firewall()
+{
+    firewall = net_firewall_create();
+    if(firewall == NULL){
+        warningf("Unable to create firewall, packets are not filtered.\n");
+    }
+}
@@ -14,33 +14,44 @@
 #include <serial.h>
 #include <net/skb.h>
 #include <net/dns.h>
+#include <net/checksum.h>
 
+/**
+ * @brief Answers an echo request with an echo reply, RFC 792.
+ * The reply carries the requests identifier, sequence number and data,
+ * only the type changes, so the checksum is updated instead of recomputed.
+ * @param skb parsed ICMP packet, the header in host order.
+ */
 void net_icmp_handle(struct sk_buff* skb)
 {
+    int length = skb->hdr.ip->len - skb->hdr.ip->ihl*4;
+    struct icmp* reply;
+    uint16_t old;
+
     if(skb->hdr.icmp->type != ICMP_V4_ECHO)
         return;
-    dbgprintf("Ping reply from %i: icmp_seq= %d ttl=64\n", skb->hdr.ip->saddr, skb->hdr.icmp->sequence/256);
-
-    skb->hdr.icmp->type = ICMP_REPLY;
-    skb->hdr.icmp->csum = 0;
-    skb->hdr.icmp->csum = checksum(skb->hdr.icmp, skb->len, 0);
-
-    struct icmp response;
-    memcpy(&response, &skb->hdr.icmp, sizeof(struct icmp));
+    dbgprintf("Echo request from %i: icmp_seq=%d\n", skb->hdr.ip->saddr, skb->hdr.icmp->sequence);
 
     struct sk_buff* _skb = skb_new();
+    if(_skb == NULL) return;
 
-    if(net_ipv4_add_header(_skb, skb->hdr.ip->saddr, ICMPV4, sizeof(struct icmp)) < 0){
+    if(net_ipv4_add_header(_skb, skb->hdr.ip->saddr, ICMPV4, length) < 0){
         skb_free(_skb);
-	    return;
+        return;
     }
 
-    memcpy(_skb->data, &response, sizeof(struct icmp));
+    reply = (struct icmp*) _skb->data;
+    memcpy(reply, skb->hdr.icmp, length);
+    ICMP_NTOHS(reply);
 
-	_skb->len += sizeof(struct icmp);
-	_skb->data += sizeof(struct icmp);
-	
-	net_send_skb(_skb);
+    old = *(uint16_t*) reply;
+    reply->type = ICMP_REPLY;
+    reply->csum = csum_replace2(reply->csum, old, *(uint16_t*) reply);
+
+    _skb->len += length;
+    _skb->data += length;
+
+    net_send_skb(_skb);
 }  
 
 int net_icmp_response()
@@ -96,11 +107,16 @@ void ping(char* hostname)
 int net_icmp_parse(struct sk_buff* skb)
 {
     struct icmp* icmp_hdr = (struct icmp * ) skb->data;
+    int length = skb->hdr.ip->len - skb->hdr.ip->ihl*4;
+    if(length < (int)sizeof(struct icmp) || skb->data + length > skb->end){
+        return -1;
+    }
+
     skb->hdr.icmp = icmp_hdr;
     skb->data = skb->data + sizeof(struct icmp);
 
-    // calculate checksum, should be 0.
-    uint16_t csum_icmp = checksum(icmp_hdr, skb->len, 0);
+    // calculate checksum over the whole message, should be 0.
+    uint16_t csum_icmp = checksum(icmp_hdr, length, 0);
     if( 0 != csum_icmp){
         return -1;
     }
@@ -17,6 +17,7 @@
 #include <memory.h>
 
 static int __iface_send(struct net_interface* interface, void* buffer, uint32_t size);
+static int __iface_send_skb(struct net_interface* interface, struct sk_buff* skb);
 static int __iface_recieve(struct net_interface* interface, void* buffer, uint32_t size);
 static int __iface_assign(struct net_interface* interface, uint32_t ip);
 static int __iface_attach(struct net_interface* interface, struct netdev* device);
@@ -27,6 +28,7 @@ static int __iface_configure(struct net_interface* interface, char* name);
 
 static struct net_interface_ops default_iface_ops = {
     .send = __iface_send,
+    .send_skb = __iface_send_skb,
     .recieve = __iface_recieve,
     .assign = __iface_assign,
     .attach = __iface_attach,
@@ -48,6 +50,16 @@ int net_register_netdev(char* name, struct netdev* device)
         return -1;
     }
 
+    /* Drivers may size their own pool, e.g for RX rings. */
+    if(device->pool.size == 0){
+        skb_pool_init(&device->pool, NETDEV_SKB_POOL_SIZE);
+    }
+
+    /* skb_new() allocates from current_netdev before a interface is chosen. */
+    if(current_netdev.pool.size == 0){
+        skb_pool_init(&current_netdev.pool, NETDEV_SKB_POOL_SIZE);
+    }
+
     interface->ops->attach(interface, device);
     interface->ops->assign(interface, 0);
     interface->ops->set_gateway(interface, 0);
@@ -71,6 +83,7 @@ struct net_interface* net_interface_create()
     interface->ip = 0;
     interface->netmask = 0;
     interface->gateway = 0;
+    interface->mtu = ETHERNET_MTU;
     interface->ops = &default_iface_ops;
 
     return interface;
@@ -86,6 +99,30 @@ static int __iface_send(struct net_interface* interface, void* buffer, uint32_t
     return interface->device->write(buffer, size);
 }
 
+/**
+ * @brief Sends a sk_buff, without copying if the device supports it.
+ * The callers reference is not consumed.
+ * @return int bytes sent, -ERROR_DEVICE_BUSY if the device can not take it yet.
+ */
+static int __iface_send_skb(struct net_interface* interface, struct sk_buff* skb)
+{
+    int ret;
+
+    if(interface->device == NULL) {
+        return -1;
+    }
+
+    if(interface->device->write_skb != NULL){
+        ret = interface->device->write_skb(interface->device, skb);
+    } else {
+        if(skb_linearize(skb) < 0) return -1;
+        ret = interface->device->write((char*)skb->head, skb->len);
+    }
+
+    if(ret >= 0) interface->device->sent++;
+    return ret;
+}
+
 static int __iface_recieve(struct net_interface* interface, void* buffer, uint32_t size)
 {
     if(interface->device == NULL) {
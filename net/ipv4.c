@@ -58,11 +58,11 @@ int net_ipv4_print(struct ip_header* hdr)
 int net_ipv4_add_header(struct sk_buff* skb, uint32_t ip, uint8_t proto, uint32_t length)
 {
     /* Setup interface */
-    uint32_t next_hop = route(ip);
-    struct net_interface* iface = net_get_iface(next_hop);
+    uint32_t next_hop;
+    struct net_interface* iface = route_lookup(ip, &next_hop);
     if(NULL == iface){
-        dbgprintf("No interface found for %d\n", next_hop);
-        return -1;
+        dbgprintf("No route to %i\n", htonl(ip));
+        return -ERROR_NO_ROUTE;
     }
     skb->interface = iface;
 
@@ -151,9 +151,8 @@ int net_ipv4_parse(struct sk_buff* skb)
         return -1; /* Currently only accept broadcast packets. */
     }
 
-    char mac[6];
-    int arp = net_arp_find_entry(hdr->saddr, (uint8_t*)&mac);
-    if(arp < 0){
+    /* Learn the MAC of neighbours on the same network, remote hosts are reached through the gateway. */
+    if(route_is_onlink(skb->interface, hdr->saddr)){
         struct arp_content content = {
             .sip = ntohl(hdr->saddr)
         };
@@ -16,6 +16,7 @@
 #include <assert.h>
 #include <scheduler.h>
 #include <errors.h>
+#include <timer.h>
 
 /**
  * @brief Binds a IP and Port to a socket, mainly used for the server side.
@@ -27,7 +28,7 @@
  */
 error_t kernel_bind(struct sock* socket, const struct sockaddr *address, socklen_t address_len)
 {
-    if(socket->socket > NET_NUMBER_OF_SOCKETS)
+    if(socket == NULL || socket->socket >= NET_SOCKETS_MAX)
         return -ERROR_INVALID_SOCKET;
     
     /*Cast sockaddr back to sockaddr_in. Cast originally to comply with linux implementation.*/
@@ -50,7 +51,20 @@ error_t kernel_bind(struct sock* socket, const struct sockaddr *address, socklen
  */ 
 error_t kernel_recvfrom(struct sock* socket, void *buffer, int length, int flags, struct sockaddr *address, socklen_t *address_len)
 {
-    return 0;
+    struct sockaddr_in from = {0};
+    int read;
+
+    if(socket->type != SOCK_DGRAM){
+        return kernel_recv(socket, buffer, length, flags);
+    }
+
+    read = net_sock_read_from(socket, buffer, length, &from);
+    if(read >= 0 && address != NULL){
+        memcpy(address, &from, sizeof(struct sockaddr_in));
+        if(address_len != NULL) *address_len = sizeof(struct sockaddr_in);
+    }
+
+    return read;
 }
 
 /**
@@ -78,22 +92,25 @@ error_t kernel_recv(struct sock* socket, void *buffer, int length, int flags)
     dbgprintf(" %d reading from socket ...\n");
     read = net_sock_read(socket, buffer, length);
 
-    dbgprintf("Socket %d recv %d\n", socket->socket, read);
+    /* The socket may have been freed while the read blocked */
+    dbgprintf("Socket recv %d\n", read);
 
     return read;
 }
 
 error_t kernel_recv_timeout(struct sock* socket, void *buffer, int length, int flags, int timeout)
 {
-    int time_start = get_time();
-
-    int read = -1;
-    while(read == -1){
-        if(get_time() - time_start > timeout+3)return 0;
+    int ret = net_sock_wait_data(socket, length, timer_ms_to_ticks(timeout*1000));
+    if(ret == -ERROR_TIMEOUT){
+        return 0;
+    }
 
+    /* Freed while waiting */
+    if(ret < 0){
+        return -1;
     }
 
-    return read;
+    return kernel_recv(socket, buffer, length, flags);
 
 }
 
@@ -113,14 +130,15 @@ error_t kernel_connect(struct sock* socket, const struct sockaddr *address, sock
     memcpy(sptr, addr, sizeof(struct sockaddr_in));
 
     socket->tcp->state = TCP_SYN_SENT;
+    net_sock_hash(socket);
     tcp_connect(socket);
 
     dbgprintf(" [%d] Connecting...\n", socket);
-    /* block or spin */
+    /* block or spin, a lost SYN is resent with backoff in the meantime */
 
-    int time_start = get_time();
+    int time_start = timer_get_tick();
     while(socket->tcp->state != TCP_ESTABLISHED){
-        if(get_time() - time_start > 2){
+        if(socket->tcp->state != TCP_SYN_SENT || timer_get_tick() - time_start > timer_ms_to_ticks(TCP_CONNECT_TIMEOUT_MS)){
             dbgprintf(" [%d] Connection timed out\n", socket);
             return -1;
         }
@@ -146,7 +164,7 @@ error_t kernel_connect(struct sock* socket, const struct sockaddr *address, sock
 error_t kernel_sendto(struct sock* socket, const void *message, int length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
 {
     /* Flags are ignored... for now. */
-    if(socket->socket > NET_NUMBER_OF_SOCKETS){
+    if(socket->socket >= NET_SOCKETS_MAX){
         return -ERROR_INVALID_SOCKET;
     }
 
@@ -178,14 +196,14 @@ error_t kernel_sendto(struct sock* socket, const void *message, int length, int
 }
 
 /**
- * @brief Creates a new socket.
- * Creates new socket and prepares it for remote sender.
- * New socket inherits domain, type and protocol from parent socket.
- * @see net_sock_accept 
+ * @brief Accepts a connection on a listening socket.
+ * Connections are set up by the networking thread when their handshake
+ * completes, accept takes the oldest one from the accept queue.
+ * @see tcp_accept_connection
  * @warning Is blocking and assumes socket to be TCP
- * @param domain Domain of socket.
- * @param type Type of socket.
- * @param protocol Protocol of socket.
+ * @param socket listening socket.
+ * @param address filled with the address of the peer if not NULL.
+ * @param address_len length of address.
  * @return struct sock*, NULL if failed.
  */
 struct sock* kernel_accept(struct sock* socket, struct sockaddr *address, socklen_t *address_len)
@@ -194,22 +212,17 @@ struct sock* kernel_accept(struct sock* socket, struct sockaddr *address, sockle
     if(socket->tcp == NULL){
         return NULL;
     }
-    
-    /* Create new TCP socket? */
-    struct sock* new_socket = kernel_socket_create(socket->domain, socket->type, socket->protocol);
+
+    /* Wait for a new connection. */
+    struct sock* new_socket = net_sock_accept(socket);
     if(new_socket == NULL){
         return NULL;
     }
-    socket->accept_sock = new_socket;
-   
-
-    /* Wait for a new connection. */
-    net_sock_accept(socket, socket->accept_sock);
 
     /* Copy address of sender to address. */
     if(address != NULL){
         struct sockaddr_in* addr = (struct sockaddr_in*) address;
-        memcpy(addr, &socket->accept_sock->recv_addr, sizeof(struct sockaddr_in));
+        memcpy(addr, &new_socket->recv_addr, sizeof(struct sockaddr_in));
     }
 
     return new_socket;
@@ -217,39 +230,79 @@ struct sock* kernel_accept(struct sock* socket, struct sockaddr *address, sockle
 
 error_t kernel_listen(struct sock* socket, int backlog)
 {
+    int ret;
+
     tcp_new_connection(socket, 0, socket->bound_port);
-    return tcp_set_listening(socket, backlog);
+    ret = tcp_set_listening(socket, backlog);
+    net_sock_hash(socket);
+
+    return ret;
 }
 
-error_t kernel_send(struct sock* socket, void *message, int length, int flags)
+/**
+ * @brief Sets a socket option, SOL_SOCKET and IPPROTO_TCP options are supported.
+ * @return error_t 0 on success, less than 0 on error.
+ */
+error_t kernel_setsockopt(struct sock* socket, int level, int name, const void* value, socklen_t length)
 {
-    /* for the time being, only send messages under 1500 bytes */
-    if(length > 1400){
-        return -ERROR_MSS_SIZE;
+    if(socket == NULL) return -ERROR_INVALID_SOCKET;
+    if(value == NULL || length < sizeof(int)) return -ERROR_INVALID_ARGUMENTS;
+
+    if(level == IPPROTO_TCP){
+        return tcp_setsockopt(socket, name, *(const int*) value);
+    }
+    if(level != SOL_SOCKET) return -ERROR_INVALID_ARGUMENTS;
+
+    switch (name){
+    case SO_RCVBUF:
+        return net_sock_set_rcvbuf(socket, *(const int*) value);
+    default:
+        return -ERROR_INVALID_ARGUMENTS;
     }
+}
 
-    if(socket == NULL || (socket->tcp == NULL && socket->tcp->state == TCP_CLOSED)){
+/**
+ * @brief Reads a socket option, length is updated with the size written.
+ * @return error_t 0 on success, less than 0 on error.
+ */
+error_t kernel_getsockopt(struct sock* socket, int level, int name, void* value, socklen_t* length)
+{
+    if(socket == NULL) return -ERROR_INVALID_SOCKET;
+    if(value == NULL || length == NULL || *length < sizeof(int)) return -ERROR_INVALID_ARGUMENTS;
+
+    if(level == IPPROTO_TCP){
+        *length = sizeof(int);
+        return tcp_getsockopt(socket, name, (int*) value);
+    }
+    if(level != SOL_SOCKET) return -ERROR_INVALID_ARGUMENTS;
+
+    switch (name){
+    case SO_RCVBUF:
+        *(int*) value = socket->rcvbuf;
+        *length = sizeof(int);
+        return 0;
+    default:
+        return -ERROR_INVALID_ARGUMENTS;
+    }
+}
+
+error_t kernel_send(struct sock* socket, void *message, int length, int flags)
+{
+    if(socket == NULL || socket->tcp == NULL || socket->tcp->state == TCP_CLOSED){
         return -ERROR_INVALID_SOCKET;
     }
 
-    /**
-     * This should not be done by the process calling this function. 
-     * Instead by another process, perhaps the worker thread.
-     * Or simply start a async function. The original thread should simply 
-     * block / spin and be notified when data has been sent.
-     * 
-     * Currently we only accept tiny messages so this is not needed yet...
-     */
-    WAIT(!net_sock_is_established(socket));
+    WAIT(socket->tcp->state == TCP_SYN_SENT || socket->tcp->state == TCP_SYN_RCVD);
     
-    /* TODO: if message was bigger than 1400, send 1400 at a time, simple stop and wait. */
     dbgprintf(" [%d] Sending %d bytes\n", socket->socket, length);
-    socket->tcp->state = TCP_WAIT_ACK;
-    tcp_send_segment(socket, message, length, 1);
 
-    /* Move this into tcp_send_segment */
-    //WAIT(net_sock_awaiting_ack(socket));
+    /* Buffered by tcp_send and sent by the networking thread, blocks only while the send buffer is full. */
+    int ret = tcp_send(socket, message, length);
+    if(ret < 0){
+        return ret;
+    }
 
-    /* Split into smaller "messages" of needed. */
-    return length;
+    socket->tx += ret;
+
+    return ret;
 }
\ No newline at end of file
@@ -2,23 +2,452 @@
  * @file routing.c
  * @author Joe Bayer (joexbayer)
  * @brief Routing for internal networking.
- * @version 0.1
+ * @version 0.2
  * @date 2024-01-10
- * 
+ *
+ * Routes are kept in a path compressed binary trie keyed on the prefix,
+ * so a lookup only visits the nodes where prefixes branch and the last
+ * node with routes on the path is the longest match. Routes with the
+ * same prefix hang off the same node, sorted by metric.
+ *
+ * Connected routes are added when an interface is configured, so
+ * hosts on any attached network are reached directly. Everything else
+ * goes through the gateway of the longest matching route, usually the
+ * default route learned by DHCP.
+ *
+ * Recent destinations are kept in a small direct mapped cache. Any
+ * change to the table bumps the generation, which invalidates it.
+ *
  * @copyright Copyright (c) 2024
- * 
+ *
  */
 
 #include <net/routing.h>
+#include <net/interface.h>
 #include <net/dhcp.h>
 #include <net/utils.h>
 #include <net/net.h>
+#include <memory.h>
+#include <kutils.h>
+#include <errors.h>
+#include <serial.h>
 
-uint32_t route(uint32_t destination)
+#ifndef KDEBUG_NET_ROUTING
+#undef dbgprintf
+#define dbgprintf(...)
+#endif
+
+struct route_node {
+    uint32_t key;
+    uint8_t len;
+    struct route* routes;
+    struct route_node* child[2];
+};
+
+struct route_cache_entry {
+    uint32_t destination;
+    uint32_t generation;
+    struct route* route;
+};
+
+static struct routing_table {
+    struct route_node* root;
+    struct route_cache_entry cache[ROUTE_CACHE_SIZE];
+    uint32_t generation;
+    struct route_stats stats;
+} routing = {
+    .root = NULL,
+    .generation = 1
+};
+
+#define ROUTE_BIT(key, i) (((key) >> (31 - (i))) & 1)
+#define ROUTE_CACHE_HASH(ip) (((ip) ^ ((ip) >> 8) ^ ((ip) >> 16) ^ ((ip) >> 24)) & (ROUTE_CACHE_SIZE - 1))
+
+uint32_t route_len_to_mask(uint8_t len)
+{
+    return len == 0 ? 0 : 0xFFFFFFFF << (32 - len);
+}
+
+/* Number of leading ones in a netmask. */
+uint8_t route_mask_to_len(uint32_t mask)
+{
+    return mask == 0xFFFFFFFF ? 32 : __builtin_clz(~mask);
+}
+
+/* Length of the common prefix of a and b, at most max bits. */
+static inline int __route_common(uint32_t a, uint32_t b, int max)
+{
+    uint32_t diff = a ^ b;
+    int len = diff == 0 ? 32 : __builtin_clz(diff);
+    return len < max ? len : max;
+}
+
+static struct route_node* __route_node_take(struct route_node** spare, uint32_t key, uint8_t len)
+{
+    struct route_node* node = spare[0] != NULL ? spare[0] : spare[1];
+    if(node == spare[0]) spare[0] = NULL; else spare[1] = NULL;
+
+    node->key = key & route_len_to_mask(len);
+    node->len = len;
+    node->routes = NULL;
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+
+    routing.stats.nodes++;
+    return node;
+}
+
+/**
+ * @brief Finds the node for key/len, inserting it if needed.
+ * Inserting takes at most two of the spare nodes, one if an existing
+ * node has to be split and one for the new prefix.
+ * Must be called in a critical section.
+ */
+static struct route_node* __route_node_insert(uint32_t key, uint8_t len, struct route_node** spare)
+{
+    struct route_node** slot = &routing.root;
+
+    while(*slot != NULL){
+        struct route_node* node = *slot;
+        int common = __route_common(key, node->key, len < node->len ? len : node->len);
+
+        if(common == node->len){
+            if(node->len == len) return node;
+            slot = &node->child[ROUTE_BIT(key, node->len)];
+            continue;
+        }
+
+        /* The prefixes diverge inside this node, split it. */
+        struct route_node* split = __route_node_take(spare, key, common);
+        split->child[ROUTE_BIT(node->key, common)] = node;
+        *slot = split;
+        if(common == len) return split;
+
+        struct route_node* leaf = __route_node_take(spare, key, len);
+        split->child[ROUTE_BIT(key, common)] = leaf;
+        return leaf;
+    }
+
+    *slot = __route_node_take(spare, key, len);
+    return *slot;
+}
+
+/* First route on the list with an interface that is up. */
+static inline struct route* __route_usable(struct route* route)
+{
+    while(route != NULL && route->interface->state != NET_IFACE_UP){
+        route = route->next;
+    }
+    return route;
+}
+
+/**
+ * @brief Longest prefix match, must be called in a critical section.
+ */
+static struct route* __route_match(uint32_t destination)
 {
+    struct route* best = NULL;
+    struct route_node* node = routing.root;
+
+    while(node != NULL && (destination & route_len_to_mask(node->len)) == node->key){
+        struct route* route = __route_usable(node->routes);
+        if(route != NULL) best = route;
+
+        if(node->len == 32) break;
+        node = node->child[ROUTE_BIT(destination, node->len)];
+    }
+
+    return best;
+}
+
+/**
+ * @brief Finds the interface and next hop for a destination.
+ * @param destination IP in host order, the loopback address is also accepted in network order.
+ * @param next_hop set to the next hop in host order, can be NULL.
+ * @return struct net_interface* NULL if there is no route.
+ */
+struct net_interface* route_lookup(uint32_t destination, uint32_t* next_hop)
+{
+    struct net_interface* interface = NULL;
+    uint32_t hop = 0;
+
+    /* Loopback sockets pass the address in network order. */
     if(destination == htonl(LOOPBACK_IP)){
-        return LOOPBACK_IP;
+        destination = LOOPBACK_IP;
+    }
+
+    ENTER_CRITICAL();
+    routing.stats.lookups++;
+
+    struct route_cache_entry* cached = &routing.cache[ROUTE_CACHE_HASH(destination)];
+    struct route* route;
+    if(cached->generation == routing.generation && cached->destination == destination){
+        route = cached->route;
+        routing.stats.cache_hits++;
+    } else {
+        route = __route_match(destination);
+        if(route != NULL){
+            cached->destination = destination;
+            cached->generation = routing.generation;
+            cached->route = route;
+        }
+    }
+
+    if(route != NULL){
+        route->uses++;
+        interface = route->interface;
+        hop = route->flags & ROUTE_GATEWAY ? route->gateway : destination;
+    } else {
+        routing.stats.unreachable++;
+    }
+    LEAVE_CRITICAL();
+
+    if(next_hop != NULL) *next_hop = hop;
+
+    dbgprintf("Routing %i via %i (%s)\n", htonl(destination), htonl(hop), interface != NULL ? interface->name : "unreachable");
+    return interface;
+}
+
+/**
+ * @brief Checks if ip (host order) is on a network directly attached to interface.
+ */
+int route_is_onlink(struct net_interface* interface, uint32_t ip)
+{
+    int onlink;
+
+    ENTER_CRITICAL();
+    struct route* route = __route_match(ip);
+    onlink = route != NULL && route->interface == interface && !(route->flags & ROUTE_GATEWAY);
+    LEAVE_CRITICAL();
+
+    return onlink;
+}
+
+/**
+ * @brief Adds a route, or updates the metric of an existing one.
+ * @param prefix network in host order.
+ * @param len prefix length, 0 - 32.
+ * @param gateway next hop in host order, 0 for directly connected networks.
+ * @param interface outgoing interface, NULL to use the one the gateway is reached through.
+ * @param metric lower is preferred between routes to the same prefix.
+ * @param flags ROUTE_CONNECTED, ROUTE_STATIC or ROUTE_DHCP.
+ * @return error_t 0 on success, -ERROR_NO_ROUTE if the gateway is not on a connected network.
+ */
+error_t route_add(uint32_t prefix, uint8_t len, uint32_t gateway, struct net_interface* interface, uint32_t metric, uint8_t flags)
+{
+    if(len > 32) return -ERROR_INVALID_ARGUMENTS;
+
+    if(gateway != 0){
+        flags |= ROUTE_GATEWAY;
+        if(interface == NULL){
+            uint32_t hop;
+            interface = route_lookup(gateway, &hop);
+            if(interface == NULL || hop != gateway) return -ERROR_NO_ROUTE;
+        }
     }
-    dbgprintf("Routing %i to %i\n", destination, dhcp_get_gw());
-    return htonl(dhcp_get_gw());
-}
\ No newline at end of file
+    if(interface == NULL) return -ERROR_INVALID_ARGUMENTS;
+
+    struct route* new = kalloc(sizeof(struct route));
+    struct route_node* spare[2] = {kalloc(sizeof(struct route_node)), kalloc(sizeof(struct route_node))};
+    if(new == NULL || spare[0] == NULL || spare[1] == NULL){
+        if(new != NULL) kfree(new);
+        if(spare[0] != NULL) kfree(spare[0]);
+        if(spare[1] != NULL) kfree(spare[1]);
+        return -ERROR_ALLOC;
+    }
+
+    new->prefix = prefix & route_len_to_mask(len);
+    new->len = len;
+    new->gateway = gateway;
+    new->interface = interface;
+    new->metric = metric;
+    new->flags = flags;
+    new->uses = 0;
+    new->next = NULL;
+
+    struct route* old = NULL;
+    error_t ret = 0;
+
+    ENTER_CRITICAL();
+    if(routing.stats.routes >= ROUTE_MAX){
+        ret = -ERROR_INDEX;
+    } else {
+        struct route_node* node = __route_node_insert(new->prefix, len, spare);
+
+        /* Same gateway and interface replaces the old route. */
+        struct route** link = &node->routes;
+        while(*link != NULL){
+            if((*link)->gateway == gateway && (*link)->interface == interface){
+                old = *link;
+                *link = old->next;
+                new->uses = old->uses;
+                routing.stats.routes--;
+                break;
+            }
+            link = &(*link)->next;
+        }
+
+        link = &node->routes;
+        while(*link != NULL && (*link)->metric <= metric){
+            link = &(*link)->next;
+        }
+        new->next = *link;
+        *link = new;
+
+        routing.stats.routes++;
+        routing.generation++;
+        new = NULL;
+    }
+    LEAVE_CRITICAL();
+
+    if(old != NULL) kfree(old);
+    if(new != NULL) kfree(new);
+    if(spare[0] != NULL) kfree(spare[0]);
+    if(spare[1] != NULL) kfree(spare[1]);
+
+    dbgprintf("Added route %i/%d via %i dev %s\n", htonl(prefix), len, htonl(gateway), interface->name);
+    return ret;
+}
+
+/**
+ * @brief Removes the first route to prefix/len matching gateway and interface.
+ * A gateway of 0 or a NULL interface matches any.
+ */
+static error_t __route_del(uint32_t prefix, uint8_t len, uint32_t gateway, struct net_interface* interface)
+{
+    struct route_node** path[33];
+    struct route_node* unused[33];
+    struct route* removed = NULL;
+    int depth = 0;
+    int freed = 0;
+
+    if(len > 32) return -ERROR_INVALID_ARGUMENTS;
+    prefix &= route_len_to_mask(len);
+
+    ENTER_CRITICAL();
+    struct route_node** slot = &routing.root;
+    while(*slot != NULL){
+        struct route_node* node = *slot;
+        if(node->len > len || (prefix & route_len_to_mask(node->len)) != node->key) break;
+
+        path[depth++] = slot;
+        if(node->len == len) break;
+        slot = &node->child[ROUTE_BIT(prefix, node->len)];
+    }
+
+    if(depth > 0 && (*path[depth-1])->len == len){
+        struct route** link = &(*path[depth-1])->routes;
+        while(*link != NULL && ((gateway != 0 && (*link)->gateway != gateway) || (interface != NULL && (*link)->interface != interface))){
+            link = &(*link)->next;
+        }
+        if(*link != NULL){
+            removed = *link;
+            *link = removed->next;
+            routing.stats.routes--;
+            routing.generation++;
+        }
+    }
+
+    /* Nodes without routes are only needed where the trie branches. */
+    while(removed != NULL && depth > 0){
+        struct route_node* node = *path[--depth];
+        if(node->routes != NULL || (node->child[0] != NULL && node->child[1] != NULL)) break;
+
+        *path[depth] = node->child[0] != NULL ? node->child[0] : node->child[1];
+        unused[freed++] = node;
+        routing.stats.nodes--;
+    }
+    LEAVE_CRITICAL();
+
+    for (int i = 0; i < freed; i++){
+        kfree(unused[i]);
+    }
+
+    if(removed == NULL) return -ERROR_NO_ROUTE;
+
+    dbgprintf("Removed route %i/%d via %i\n", htonl(prefix), len, htonl(removed->gateway));
+    kfree(removed);
+    return 0;
+}
+
+/**
+ * @brief Removes a route.
+ * @param prefix network in host order.
+ * @param len prefix length.
+ * @param gateway gateway of the route to remove, 0 to remove the preferred one.
+ * @return error_t 0 on success, -ERROR_NO_ROUTE if there is no such route.
+ */
+error_t route_del(uint32_t prefix, uint8_t len, uint32_t gateway)
+{
+    return __route_del(prefix, len, gateway, NULL);
+}
+
+static int __route_collect(struct route_node* node, struct route* routes, int count, int max)
+{
+    if(node == NULL) return count;
+
+    for (struct route* route = node->routes; route != NULL && count < max; route = route->next){
+        routes[count++] = *route;
+    }
+
+    count = __route_collect(node->child[0], routes, count, max);
+    return __route_collect(node->child[1], routes, count, max);
+}
+
+/**
+ * @brief Copies the routes ordered by prefix.
+ * @return int number of routes copied.
+ */
+int route_get_entries(struct route* routes, int max)
+{
+    int count;
+
+    ENTER_CRITICAL();
+    count = __route_collect(routing.root, routes, 0, max);
+    LEAVE_CRITICAL();
+
+    for (int i = 0; i < count; i++){
+        routes[i].next = NULL;
+    }
+    return count;
+}
+
+/**
+ * @brief Removes the routes of an interface.
+ * @param interface interface to remove routes for.
+ * @param flags only remove routes with one of these flags.
+ * @return int number of routes removed.
+ */
+int route_flush(struct net_interface* interface, uint8_t flags)
+{
+    struct route* routes = kalloc(sizeof(struct route) * ROUTE_MAX);
+    if(routes == NULL) return -ERROR_ALLOC;
+
+    int removed = 0;
+    int count = route_get_entries(routes, ROUTE_MAX);
+    for (int i = 0; i < count; i++){
+        if(routes[i].interface != interface || !(routes[i].flags & flags)) continue;
+        if(__route_del(routes[i].prefix, routes[i].len, routes[i].gateway, interface) == 0) removed++;
+    }
+
+    kfree(routes);
+    return removed;
+}
+
+/**
+ * @brief Drops all cached lookups, used when an interface goes up or down.
+ * Routes over a down interface are skipped by lookups, so the cache must not keep them.
+ */
+void route_invalidate()
+{
+    CRITICAL_SECTION({
+        routing.generation++;
+    });
+}
+
+void route_get_stats(struct route_stats* stats)
+{
+    CRITICAL_SECTION({
+        *stats = routing.stats;
+    });
+}
@@ -13,6 +13,7 @@
 #include <serial.h>
 #include <sync.h>
 #include <assert.h>
+#include <kutils.h>
 
 static int __skb_queue_add(struct skb_queue* skb_queue, struct sk_buff* skb);
 static struct sk_buff* __skb_queue_remove(struct skb_queue* skb_queue);
@@ -94,36 +95,250 @@ static struct sk_buff* __skb_queue_remove(struct skb_queue* skb_queue)
 	return next;
 }
 
-void skb_free(struct sk_buff* skb)
+/**
+ * @brief Allocates a sk_buff and its data buffer outside of the pool.
+ */
+static struct sk_buff* __skb_alloc_new()
+{
+	struct sk_buff* skb = create(struct sk_buff);
+	if(skb == NULL) return NULL;
+
+	skb->buffer = kalloc(SKB_HEADROOM + SKB_DATA_SIZE);
+	if(skb->buffer == NULL){
+		kfree(skb);
+		return NULL;
+	}
+
+	return skb;
+}
+
+/**
+ * @brief Preallocates size sk_buffs into the pool.
+ * @return int number of preallocated sk_buffs.
+ */
+int skb_pool_init(struct skb_pool* pool, int size)
+{
+	pool->free = NULL;
+	pool->count = 0;
+	pool->size = size;
+	pool->hits = 0;
+	pool->misses = 0;
+
+	for (int i = 0; i < size; i++){
+		struct sk_buff* skb = __skb_alloc_new();
+		if(skb == NULL) break;
+
+		skb->pool = pool;
+		skb->next = pool->free;
+		pool->free = skb;
+		pool->count++;
+	}
+
+	dbgprintf("[SKB] Preallocated %d sk_buffs\n", pool->count);
+
+	return pool->count;
+}
+
+/**
+ * @brief Returns a sk_buff to its pool, or frees it if the pool is full.
+ */
+static void __skb_release(struct sk_buff* skb)
 {
-	FREE_SKB(skb);
+	struct skb_pool* pool = skb->pool;
+	int pooled = 0;
+
+	if(pool != NULL){
+		CRITICAL_SECTION({
+			if(pool->count < pool->size){
+				skb->next = pool->free;
+				pool->free = skb;
+				pool->count++;
+				pooled = 1;
+			}
+		});
+	}
+	if(pooled) return;
+
+	kfree(skb->buffer);
 	kfree(skb);
 }
 
+/**
+ * @brief Drops a reference to the sk_buff, the last reference returns it to its pool.
+ * Clones release their reference on the sk_buff owning the buffer.
+ */
+void skb_free(struct sk_buff* skb)
+{
+	int refs;
+
+	CRITICAL_SECTION({
+		refs = --skb->refs;
+	});
+	if(refs > 0) return;
+
+	if(skb->frag.owner != NULL){
+		skb_free(skb->frag.owner);
+	}
+
+	if(skb->shared != NULL){
+		struct sk_buff* owner = skb->shared;
+		kfree(skb);
+		skb_free(owner);
+		return;
+	}
+
+	__skb_release(skb);
+}
+
+/**
+ * @brief Allocates a sk_buff from the devices pool.
+ * The data buffer is not cleared, protocols write every header field they send.
+ * @param dev device whose pool is used.
+ * @return struct sk_buff* or NULL if out of memory.
+ */
+struct sk_buff* skb_alloc(struct netdev* dev)
+{
+	struct skb_pool* pool = &dev->pool;
+	struct sk_buff* skb = NULL;
+
+	CRITICAL_SECTION({
+		skb = pool->free;
+		if(skb != NULL){
+			pool->free = skb->next;
+			pool->count--;
+			pool->hits++;
+		} else {
+			pool->misses++;
+		}
+	});
+
+	if(skb == NULL){
+		skb = __skb_alloc_new();
+		if(skb == NULL) return NULL;
+
+		/* Allocated on a miss, returned to the pool if there is room. */
+		skb->pool = pool->size > 0 ? pool : NULL;
+	}
+
+	uint8_t* buffer = skb->buffer;
+	struct skb_pool* owner = skb->pool;
+
+	memset(skb, 0, sizeof(struct sk_buff));
+	skb->buffer = buffer;
+	skb->pool = owner;
+	skb->refs = 1;
+	skb->netdevice = dev;
+	ALLOCATE_SKB(skb);
+
+	return skb;
+}
+
 struct sk_buff* skb_new()
 {
-	struct sk_buff* new = (struct sk_buff*) kalloc(sizeof(struct sk_buff));
-	if(new == NULL) return NULL;
+	return skb_alloc(&current_netdev);
+}
 
-	memset(new, 0, sizeof(struct sk_buff));
-	new->netdevice = &current_netdev;
-	ALLOCATE_SKB(new);
+/**
+ * @brief Takes an additional reference, the sk_buff is freed when all references are dropped.
+ */
+struct sk_buff* skb_get(struct sk_buff* skb)
+{
+	CRITICAL_SECTION({
+		skb->refs++;
+	});
+	return skb;
+}
 
-	return new;
+/**
+ * @brief Creates a new sk_buff sharing the data buffer.
+ * The clone has its own queue link and header pointers, so the same
+ * segment can be on a retransmit queue and a send queue at once.
+ * @param skb sk_buff to clone.
+ * @return struct sk_buff* clone or NULL if out of memory.
+ */
+struct sk_buff* skb_clone(struct sk_buff* skb)
+{
+	struct sk_buff* clone = create(struct sk_buff);
+	if(clone == NULL) return NULL;
+
+	memcpy(clone, skb, sizeof(struct sk_buff));
+	clone->next = NULL;
+	clone->pool = NULL;
+	clone->refs = 1;
+	clone->shared = skb->shared != NULL ? skb->shared : skb;
+	skb_get(clone->shared);
+	if(clone->frag.owner != NULL) skb_get(clone->frag.owner);
+
+	return clone;
+}
+
+/**
+ * @brief Copies the payload fragment into the buffer after the headers.
+ * Used by devices that can not transmit from multiple buffers.
+ * @return int 0 on success, less than 0 if it does not fit.
+ */
+int skb_linearize(struct sk_buff* skb)
+{
+	if(skb->frag.len == 0) return 0;
+
+	if(skb->head + skb->len + skb->frag.len > skb->end){
+		return -ERROR_INDEX;
+	}
+
+	memcpy(skb->head + skb->len, skb->frag.data, skb->frag.len);
+	skb->len += skb->frag.len;
+	skb->frag.data = NULL;
+	skb->frag.len = 0;
+
+	if(skb->frag.owner != NULL){
+		skb_free(skb->frag.owner);
+		skb->frag.owner = NULL;
+	}
+
+	return 0;
 }
 
 /**
  * @brief Consumes the current skb, making the original pointer invalid but preserving data pointer.
- * Assures exclusive access to sk buffer.
+ * Assures exclusive access to sk buffer, a shared buffer is copied.
  * @param skb skb to consume
  * @return struct sk_buff* new skb
  */
 struct sk_buff* skb_consume(struct sk_buff* skb)
 {
-	struct sk_buff* new = create(struct sk_buff);
+	if(skb->refs == 1 && skb->shared == NULL) return skb;
+
+	struct sk_buff* new = skb_alloc(skb->netdevice);
+	if(new == NULL) return NULL;
+
+	uint8_t* buffer = new->buffer;
+	struct skb_pool* pool = new->pool;
 
+	memcpy(buffer, skb->buffer, SKB_HEADROOM + SKB_DATA_SIZE);
 	memcpy(new, skb, sizeof(struct sk_buff));
-	kfree(skb);
+
+	/* Rebase all pointers onto the copied buffer */
+	#define SKB_REBASE(ptr) if((ptr) != NULL) (ptr) = (void*)(buffer + ((uint8_t*)(ptr) - skb->buffer))
+	SKB_REBASE(new->head);
+	SKB_REBASE(new->tail);
+	SKB_REBASE(new->data);
+	SKB_REBASE(new->end);
+	SKB_REBASE(new->hdr.eth);
+	SKB_REBASE(new->hdr.arp);
+	SKB_REBASE(new->hdr.ip);
+	SKB_REBASE(new->hdr.udp);
+	SKB_REBASE(new->hdr.tcp);
+	SKB_REBASE(new->hdr.icmp);
+	#undef SKB_REBASE
+
+	new->next = NULL;
+	new->buffer = buffer;
+	new->pool = pool;
+	new->shared = NULL;
+	new->refs = 1;
+	if(new->frag.owner != NULL) skb_get(new->frag.owner);
+
+	skb_free(skb);
 
 	return new;
-}
\ No newline at end of file
+}
@@ -16,17 +16,43 @@
 #include <bitmap.h>
 #include <libc.h>
 #include <timer.h>
+#include <poll.h>
 #include <assert.h>
 #include <scheduler.h>
 #include <errors.h>
+#include <math.h>
 
 #include <serial.h>
 
 static struct sock** socket_table;
+static int socket_table_size;
 static int total_sockets;
 static bitmap_t port_map;
 static bitmap_t socket_map;
 
+/**
+ * Demultiplexing tables, sockets are chained through sock->hash_next.
+ * A socket is in at most one table: connected and accepted TCP sockets by
+ * their 4-tuple, listening TCP sockets and UDP sockets by their local port.
+ */
+static struct sock_hash {
+    struct sock* tcp[NET_SOCK_HASH_SIZE];
+    struct sock* listen[NET_SOCK_PORT_HASH_SIZE];
+    struct sock* udp[NET_SOCK_PORT_HASH_SIZE];
+}* sock_hash;
+
+/* Multiplicative hashing, ports and addresses are in network order */
+static inline uint32_t __sock_hash_connection(uint16_t lport, uint32_t rip, uint16_t rport)
+{
+    uint32_t h = (rip ^ (((uint32_t)lport << 16) | rport)) * 2654435761u;
+    return (h ^ (h >> 16)) & (NET_SOCK_HASH_SIZE - 1);
+}
+
+static inline uint32_t __sock_hash_port(uint16_t port)
+{
+    return (((uint32_t)port * 2654435761u) >> 16) & (NET_SOCK_PORT_HASH_SIZE - 1);
+}
+
 static const char* socket_type_str[] = {
     "SOCK",
     "SOCK_UDP",
@@ -79,6 +105,57 @@ void net_sock_bind(struct sock* socket, unsigned short port, unsigned int ip)
 {
     socket->bound_ip = ip;
     socket->bound_port = port == 0 ? __get_free_port() : port;
+
+    /* Datagram sockets can receive once bound, streams are hashed on listen, connect or accept */
+    if(socket->type == SOCK_DGRAM){
+        net_sock_hash(socket);
+    }
+}
+
+/**
+ * @brief Adds a socket to the table incoming packets are matched against.
+ * Listening TCP sockets and UDP sockets are found by their local port,
+ * other TCP sockets by local port, remote ip and remote port, which must be set.
+ * A socket already hashed is moved.
+ */
+void net_sock_hash(struct sock* sock)
+{
+    struct sock** bucket;
+
+    if(sock->type == SOCK_DGRAM){
+        bucket = &sock_hash->udp[__sock_hash_port(sock->bound_port)];
+    } else if(sock->tcp != NULL && sock->tcp->state == TCP_LISTEN){
+        bucket = &sock_hash->listen[__sock_hash_port(sock->bound_port)];
+    } else {
+        bucket = &sock_hash->tcp[__sock_hash_connection(sock->bound_port, sock->recv_addr.sin_addr.s_addr, sock->recv_addr.sin_port)];
+    }
+
+    net_sock_unhash(sock);
+
+    CRITICAL_SECTION({
+        sock->hash_next = *bucket;
+        sock->hash_bucket = bucket;
+        *bucket = sock;
+    });
+}
+
+/**
+ * @brief Removes a socket from its demultiplexing table.
+ */
+void net_sock_unhash(struct sock* sock)
+{
+    struct sock** iter;
+
+    CRITICAL_SECTION({
+        for (iter = sock->hash_bucket; iter != NULL && *iter != NULL; iter = &(*iter)->hash_next){
+            if(*iter != sock) continue;
+
+            *iter = sock->hash_next;
+            break;
+        }
+        sock->hash_next = NULL;
+        sock->hash_bucket = NULL;
+    });
 }
 
 /* Currently deprecated */
@@ -95,7 +172,7 @@ int net_get_sockets(struct sockets* sockets)
 {
     struct sockets _sockets = {
         .sockets = socket_table,
-        .total_sockets = NET_NUMBER_OF_SOCKETS 
+        .total_sockets = socket_table_size
     };
 
     *sockets = _sockets;
@@ -103,14 +180,126 @@ int net_get_sockets(struct sockets* sockets)
     return ERROR_OK;
 }
 
+struct __sock_wait {
+    struct sock* sock;
+    unsigned int length;
+};
+
+static inline error_t net_sock_add_data_segment(struct sock* sock, struct sk_buff* skb);
+
+static int __net_sock_readable(void* arg)
+{
+    struct __sock_wait* wait = arg;
+    return net_sock_data_ready(wait->sock, wait->length);
+}
+
+/**
+ * @brief Copies queued stream data to the reader.
+ * Segments are read directly from their skbs, partially read
+ * segments stay queued with their data pointer advanced.
+ * @return int bytes copied.
+ */
+static int __net_sock_read_stream(struct sock* sock, uint8_t* buffer, unsigned int length)
+{
+    struct sk_buff* skb;
+    uint32_t copied = 0;
+    uint32_t size;
+
+    LOCK(sock, {
+        while(copied < length && (skb = sock->skb_queue->_head) != NULL){
+            size = MIN(length - copied, skb->data_len);
+            memcpy(buffer + copied, skb->data, size);
+
+            skb->data += size;
+            skb->data_len -= size;
+            copied += size;
+
+            if(skb->data_len == 0){
+                sock->skb_queue->ops->remove(sock->skb_queue);
+                skb_free(skb);
+            }
+        }
+        sock->recvd -= copied;
+    });
+
+    dbgprintf("[SOCK] Received %d from stream socket %d\n", copied, sock);
+
+    return copied;
+}
+
+/**
+ * @brief Blocks until the socket has data or is closed.
+ * @param ticks timeout in timer ticks, WAITQUEUE_FOREVER for no timeout.
+ * @return error_t 0 when ready, -ERROR_TIMEOUT on timeout, less than 0 if the socket was freed.
+ */
+error_t net_sock_wait_data(struct sock* sock, unsigned int length, int ticks)
+{
+    struct __sock_wait wait = {
+        .sock = sock,
+        .length = length
+    };
+
+    return waitqueue_wait(&sock->wq, __net_sock_readable, &wait, ticks);
+}
+
+/**
+ * @brief Readiness of a socket for poll.
+ * @return int mask of POLLIN, POLLOUT and POLLHUP.
+ */
+int net_sock_poll(struct sock* sock)
+{
+    int mask = POLLOUT;
+
+    if(sock->data_ready == -1){
+        return POLLIN | POLLHUP;
+    }
+
+    if(sock->data_ready == 1 || sock->recvd > 0){
+        mask |= POLLIN;
+    }
+
+    /* Listening sockets are readable when a connection can be accepted. */
+    if(sock->tcp != NULL && sock->tcp->state == TCP_LISTEN && sock->backlog.count > 0){
+        mask |= POLLIN;
+    }
+
+    return mask;
+}
+
+/**
+ * @brief Reads from a socket, blocks until data is available.
+ * Stream sockets return as soon as any bytes are queued, queued data
+ * is still returned after the peer closed the connection.
+ * @return error_t bytes read, -1 if the socket is closed.
+ */
 error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length)
 {
+    return net_sock_read_from(sock, buffer, length, NULL);
+}
+
+/**
+ * @brief Reads from a socket like net_sock_read.
+ * @param from optional, set to the sender of a datagram.
+ */
+error_t net_sock_read_from(struct sock* sock, uint8_t* buffer, unsigned int length, struct sockaddr_in* from)
+{
+    int copied;
+
 	dbgprintf(" [SOCK] Waiting for data... %d\n", sock);
-	/* Should be blocking */
-    while(!net_sock_data_ready(sock, length)){
-        sock->waiting = $process->current;
-        $process->current->state = BLOCKED;
-	    kernel_yield();
+    /* The socket was closed and freed while waiting */
+    if(net_sock_wait_data(sock, length, WAITQUEUE_FOREVER) < 0){
+        return -1;
+    }
+
+    if(sock->tcp != NULL){
+        if(sock->recvd == 0 && sock->data_ready == -1){
+            dbgprintf(" [SOCK] Socket closed!\n");
+            return -1;
+        }
+
+        copied = __net_sock_read_stream(sock, buffer, length);
+        tcp_read_done(sock, copied);
+        return copied;
     }
     
     if(sock->data_ready == -1){
@@ -126,16 +315,25 @@ error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length)
 
     LOCK(sock, {
         to_read = length > sock->recvd ? sock->recvd : length;
-        int ret = sock->recv_buffer->ops->read(sock->recv_buffer, buffer, to_read);
+        int ret = spsc_read(sock->recv_buffer, buffer, to_read);
         if(ret != to_read){
             dbgprintf("[SOCK] Read from recv buffer not equal to return value!\n");
             break;
         }
         sock->recvd -= to_read;
+        if(from != NULL) *from = sock->recv_from;
         
-        if(sock->recvd == 0)
+        if(sock->recvd == 0){
             sock->data_ready = 0;
 
+            /* Datagrams that arrived while this one was unread are moved in now */
+            struct sk_buff* queued_skb = SKB_QUEUE_READY(sock->skb_queue) ? sock->skb_queue->ops->remove(sock->skb_queue) : NULL;
+            if(queued_skb != NULL){
+                net_sock_add_data_segment(sock, queued_skb);
+                skb_free(queued_skb);
+            }
+        }
+
         dbgprintf("[SOCK] Received %d from socket %d\n", to_read, sock);
     });
   
@@ -144,7 +342,7 @@ error_t net_sock_read(struct sock* sock, uint8_t* buffer, unsigned int length)
 
 struct sock* sock_get(socket_t id)
 {
-    if(id > NET_NUMBER_OF_SOCKETS)
+    if(id >= socket_table_size)
         return NULL;
 
     return socket_table[id];
@@ -154,31 +352,33 @@ static inline error_t net_sock_add_data_segment(struct sock* sock, struct sk_buf
 {
     ASSERT_LOCKED(sock);
 
-    int ret = sock->recv_buffer->ops->add(sock->recv_buffer, skb->data, skb->data_len);
+    int ret = spsc_write(sock->recv_buffer, skb->data, skb->data_len);
     if(ret < 0){
         dbgprintf("[TCP] recv ring buffer is full!\n");
         return -ret;
     }
     sock->recvd += skb->data_len;
-    sock->data_ready = sock->tcp == NULL ? 1 : skb->hdr.tcp->psh;
+    sock->data_ready = 1;
 
-    if(sock->waiting->state == BLOCKED){
-        /* need to clear waiting before setting it to run */
-        volatile struct pcb* pcb = sock->waiting;
-        sock->waiting = NULL;
-        pcb->state = RUNNING;
+    /* Addresses are in the order sendto takes them */
+    if(sock->type == SOCK_DGRAM){
+        sock->recv_from.sin_family = AF_INET;
+        sock->recv_from.sin_addr.s_addr = skb->hdr.ip->saddr;
+        sock->recv_from.sin_port = htons(skb->hdr.udp->srcport);
     }
 
+    waitqueue_wake(&sock->wq);
+
     sock->rx += skb->data_len;
 
     return ERROR_OK;
 }
 
 /**
- * @brief This function adds a new network packet to a socket. 
- * Function to add new data to the sockets ring buffer. Both used for UDP and TCP sockets,
- * important to notice: only 1 "packet" can be in the ring buffer at a time. Meaning
- * either one UDP packet or as many TCP packets till the psh flag is set.
+ * @brief This function adds a new datagram to a socket. 
+ * Function to add new data to the sockets ring buffer, used for UDP sockets,
+ * important to notice: only 1 "packet" can be in the ring buffer at a time.
+ * Stream sockets use net_sock_add_stream.
  * The function returns an error code if the operation fails.
  * @param sock A pointer to the socket structure to add the new packet to.
  * @param skb A pointer to the new network packet to be added to the socket's queue.
@@ -214,6 +414,62 @@ error_t net_sock_add_data(struct sock* sock, struct sk_buff* skb)
 }
 
 
+/**
+ * @brief Queues in order stream data for the reader.
+ * The skb is kept until its data has been read, so data is
+ * copied once, from the skb to the readers buffer. Data that fits
+ * behind the last queued segment is appended to it instead, so small
+ * segments do not each hold a full buffer.
+ * @param sock stream socket.
+ * @param skb segment with data at skb->data, consumed.
+ */
+void net_sock_add_stream(struct sock* sock, struct sk_buff* skb)
+{
+    struct sk_buff* tail;
+    int merged = 0;
+
+    LOCK(sock, {
+        tail = sock->skb_queue->_head != NULL ? sock->skb_queue->_tail : NULL;
+        if(tail != NULL && tail->shared == NULL && tail->refs == 1
+            && tail->data + tail->data_len + skb->data_len <= tail->end){
+            memcpy(tail->data + tail->data_len, skb->data, skb->data_len);
+            tail->data_len += skb->data_len;
+            merged = 1;
+        } else {
+            sock->skb_queue->ops->add(sock->skb_queue, skb);
+        }
+        sock->recvd += skb->data_len;
+        sock->rx += skb->data_len;
+    });
+
+    if(merged) skb_free(skb);
+
+    /* Readers are woken for any amount of data */
+    waitqueue_wake(&sock->wq);
+}
+
+/**
+ * @brief Free space in a stream sockets receive buffer, the window to advertise.
+ */
+uint32_t net_sock_rcvbuf_space(struct sock* sock)
+{
+    return sock->rcvbuf > sock->recvd ? sock->rcvbuf - sock->recvd : 0;
+}
+
+/**
+ * @brief Sets the receive buffer size (SO_RCVBUF), disables auto tuning.
+ * @return error_t 0 on success, less than 0 if the size is invalid.
+ */
+error_t net_sock_set_rcvbuf(struct sock* sock, int size)
+{
+    if(size <= 0) return -ERROR_INVALID_ARGUMENTS;
+
+    sock->rcvbuf = MIN(MAX((uint32_t)size, NET_SOCK_RCVBUF_MIN), NET_SOCK_RCVBUF_MAX);
+    sock->rcvbuf_locked = 1;
+
+    return ERROR_OK;
+}
+
 int get_total_sockets()
 {
     return total_sockets;
@@ -226,74 +482,63 @@ error_t net_sock_is_established(struct sock* sk)
     return sk->tcp->state == TCP_ESTABLISHED;
 }
 
-/* returns true if socket is waiting for an ack */
-error_t net_sock_awaiting_ack(struct sock* sk)
-{
-    assert(sk->tcp != NULL);
-    return sk->tcp->state == TCP_WAIT_ACK;
-}
-
 error_t net_sock_data_ready(struct sock* sk, unsigned int length)
 {
     assert(sk != NULL);
+
+    /* Streams are readable as soon as any bytes arrived */
+    if(sk->tcp != NULL){
+        return sk->recvd > 0 || sk->data_ready == -1;
+    }
+
 	return sk->data_ready == 1 || sk->recvd >= length || sk->data_ready == -1;
 }
 
 struct sock* sock_find_listen_tcp(uint16_t d_port)
 {
-    for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){   
-        if(socket_table[i] == NULL || socket_table[i]->tcp == NULL)
-            continue;
+    struct sock* sk;
 
-        if(socket_table[i]->bound_port == d_port &&  socket_table[i]->tcp->state == TCP_LISTEN)
-            return socket_table[i];
-    }
+    CRITICAL_SECTION({
+        for (sk = sock_hash->listen[__sock_hash_port(d_port)]; sk != NULL; sk = sk->hash_next){
+            if(sk->bound_port == d_port && sk->tcp->state == TCP_LISTEN) break;
+        }
+    });
 
-    return NULL;
+    return sk;
 }
 
 
+/**
+ * @brief Finds the socket an incoming TCP segment belongs to.
+ * An existing connection is preferred, otherwise a socket listening on the port.
+ * @param s_port source port of the segment, network order.
+ * @param d_port destination port of the segment, network order.
+ * @param ip source address of the segment.
+ * @return struct sock* socket, NULL if no socket matches.
+ */
 struct sock* net_sock_find_tcp(uint16_t s_port, uint16_t d_port, uint32_t ip)
 {
-    dbgprintf("[TCP] Looking for socket destintation %d: source %d\n", htons(d_port), htons(s_port));
-    struct sock* _sk = NULL; /* save listen socket incase no established connection is found. */
-
-    for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){
-        if(socket_table[i] == NULL || socket_table[i]->tcp == NULL)
-            continue;
-
-       dbgprintf("[TCP] %s (%i:%d %i:%d) %s\n",
-            socket_table[i]->owner->name,
-            ntohl(socket_table[i]->recv_addr.sin_addr.s_addr), htons(socket_table[i]->recv_addr.sin_port),
-            htons(socket_table[i]->bound_ip), htons(socket_table[i]->bound_port),
-            tcp_state_to_str(socket_table[i]->tcp->state)); 
-    }
-    
-    for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){
-        if(socket_table[i] == NULL || socket_table[i]->tcp == NULL)
-            continue;
-
-        
-        if(socket_table[i]->bound_port == d_port && (socket_table[i]->tcp->state == TCP_LISTEN || socket_table[i]->tcp->state == TCP_SYN_RCVD)){
-            _sk = socket_table[i];
+    struct sock* sk;
+
+    CRITICAL_SECTION({
+        for (sk = sock_hash->tcp[__sock_hash_connection(d_port, htonl(ip), s_port)]; sk != NULL; sk = sk->hash_next){
+            /* Connections created for a SYN are hashed before their handshake state is set up */
+            if(sk->bound_port == d_port && sk->recv_addr.sin_port == s_port
+                && ntohl(sk->recv_addr.sin_addr.s_addr) == ip
+                && sk->tcp->state != TCP_PREPARE) break;
         }
 
-        if(socket_table[i]->bound_port == d_port && socket_table[i]->recv_addr.sin_port == s_port
-            && socket_table[i]->tcp->state != TCP_LISTEN
-            && socket_table[i]->tcp->state != TCP_SYN_RCVD
-            && socket_table[i]->tcp->state != TCP_PREPARE
-            && ntohl(socket_table[i]->recv_addr.sin_addr.s_addr) == ip
-            //&& (socket_table[i]->tcp->state == TCP_ESTABLISHED || socket_table[i]->tcp->state == TCP_SYN_SENT)
-            ){
-                dbgprintf("[TCP] Found socket %d\n", i);
-                return socket_table[i];
+        if(sk == NULL){
+            for (sk = sock_hash->listen[__sock_hash_port(d_port)]; sk != NULL; sk = sk->hash_next){
+                if(sk->bound_port == d_port && sk->tcp->state == TCP_LISTEN) break;
             }
-    }
+        }
+    });
 
-    if(_sk != NULL){
-        dbgprintf("[TCP] Found socket %d\n", _sk->socket);
+    if(sk != NULL){
+        dbgprintf("[TCP] Found socket %d for destination %d, source %d\n", sk->socket, ntohs(d_port), ntohs(s_port));
     }
-    return _sk;
+    return sk;
 }
 
 int net_prepare_tcp_sock(struct sock* sock, uint16_t port, struct sockaddr_in* addr)
@@ -310,40 +555,47 @@ int net_prepare_tcp_sock(struct sock* sock, uint16_t port, struct sockaddr_in* a
         return -1;
     }
     sock->tcp->state = TCP_PREPARE;
+    net_sock_hash(sock);
 
     dbgprintf("[TCP] Preparing socket %d\n", sock->socket);
 
     return 0;
 }
 
-int net_sock_accept(struct sock* sock, struct sock* new)
+struct sock* net_sock_accept(struct sock* sock)
 {
-    return tcp_accept_connection(sock, new);
+    return tcp_accept_connection(sock);
 }
 
 struct sock* net_socket_find_udp(uint32_t ip, uint16_t port) 
 {   
-    /* Interate over sockets and add packet if socket exists with matching port and IP */
-    for (int i = 0; i < NET_NUMBER_OF_SOCKETS; i++){
-        if(socket_table[i] == NULL)
-            continue;
+    struct sock* sk;
 
-        if(socket_table[i]->bound_port == htons(port) && (socket_table[i]->bound_ip == ip || socket_table[i]->bound_ip == INADDR_ANY)) {
-            return socket_table[i];
+    CRITICAL_SECTION({
+        for (sk = sock_hash->udp[__sock_hash_port(htons(port))]; sk != NULL; sk = sk->hash_next){
+            if(sk->bound_port == htons(port) && (sk->bound_ip == ip || sk->bound_ip == INADDR_ANY)) break;
         }
-    }
-    return NULL;
+    });
+
+    return sk;
 }
 
-void kernel_sock_shutdown(struct sock* socket, int how)
+/**
+ * @brief Closes the sending side of a stream socket, waits for the peer to close.
+ * @return error_t 0 on success, less than 0 if the socket was freed while waiting.
+ */
+error_t kernel_sock_shutdown(struct sock* socket, int how)
 {
     if(socket->type == SOCK_STREAM && socket->tcp != NULL && socket->tcp->state != TCP_CLOSED){
-        tcp_close_connection(socket);
+        return tcp_close_connection(socket);
     }
+
+    return ERROR_OK;
 }
 
 void kernel_sock_cleanup(struct sock* socket)
 {
+    net_sock_unhash(socket);
     tcp_free_connection(socket);
 
     while(SKB_QUEUE_READY(socket->skb_queue)){
@@ -352,12 +604,15 @@ void kernel_sock_cleanup(struct sock* socket)
     }
 
     skb_free_queue(socket->skb_queue);
-    rbuffer_free(socket->recv_buffer);
+    if(socket->recv_buffer != NULL) spsc_free(socket->recv_buffer);
 
+    CRITICAL_SECTION({
+        unset_bitmap(socket_map, (int)socket->socket);
+        socket_table[socket->socket] = NULL;
+        /* Pollers and readers must not stay linked to the freed queue */
+        waitqueue_detach(&socket->wq);
+    });
     kfree((void*) socket);
-    unset_bitmap(socket_map, (int)socket->socket);
-
-    socket_table[socket->socket] = NULL;
 
     total_sockets--;
 }
@@ -366,11 +621,49 @@ void kernel_sock_close(struct sock* socket)
 {
     dbgprintf("Closing socket...\n");
 
-    kernel_sock_shutdown(socket, 0);
+    /* Freed by another thread while the close waited */
+    if(kernel_sock_shutdown(socket, 0) < 0){
+        return;
+    }
 
     kernel_sock_cleanup(socket);
 }
 
+/**
+ * @brief Doubles the socket table, called with interrupts disabled.
+ * The old table is not freed, net_get_sockets hands it out to
+ * readers that may still use it. At most a table of each size is kept.
+ * @return error_t 0 on success, less than 0 if the table is at its limit.
+ */
+static error_t __net_sock_grow()
+{
+    int size = socket_table_size * 2;
+    struct sock** table;
+    bitmap_t map;
+
+    if(size > NET_SOCKETS_MAX) return -ERROR_ALLOC;
+
+    table = kcalloc(size * sizeof(struct sock*));
+    map = create_bitmap(size);
+    if(table == NULL || map == NULL){
+        if(table != NULL) kfree(table);
+        if(map != NULL) destroy_bitmap(map);
+        return -ERROR_ALLOC;
+    }
+
+    memcpy(table, socket_table, socket_table_size * sizeof(struct sock*));
+    memcpy(map, socket_map, get_bitmap_size(socket_table_size));
+    destroy_bitmap(socket_map);
+
+    socket_table = table;
+    socket_map = map;
+    socket_table_size = size;
+
+    dbgprintf("[NET] Socket table grown to %d entries\n", size);
+
+    return ERROR_OK;
+}
+
 /**
  * @brief Creates a socket and allocates a struct sock representation.
  * Needed for the network stack to forward data to correct socket.
@@ -385,8 +678,10 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
     /* Should be a lock? */
     ENTER_CRITICAL();
 
-    //int current = get_free_bitmap(socket_map, NET_NUMBER_OF_SOCKETS);
-    int current = get_free_bitmap(socket_map, NET_NUMBER_OF_SOCKETS);
+    int current = get_free_bitmap(socket_map, socket_table_size);
+    if(current == -1 && __net_sock_grow() == ERROR_OK){
+        current = get_free_bitmap(socket_map, socket_table_size);
+    }
     if(current == -1){
         warningf("Unable to create socket, no free sockets!\n");
         LEAVE_CRITICAL();
@@ -407,14 +702,15 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
     socket_table[current]->rx = 0;
     socket_table[current]->tx = 0;
 
-    socket_table[current]->recv_buffer = rbuffer_new(NET_MAX_BUFFER_SIZE);
+    /* Streams queue their segments, only datagrams need the ring */
+    socket_table[current]->recv_buffer = type == SOCK_STREAM ? NULL : spsc_new(NET_MAX_BUFFER_SIZE);
 	socket_table[current]->data_ready = 0;
 	socket_table[current]->recvd = 0;
+    socket_table[current]->rcvbuf = NET_SOCK_RCVBUF_DEFAULT;
 
     socket_table[current]->skb_queue = skb_new_queue();
 
-    socket_table[current]->waiting = NULL;
-    socket_table[current]->accept_sock = NULL;
+    waitqueue_init(&socket_table[current]->wq);
 
     socket_table[current]->owner = $process->current;
 
@@ -431,8 +727,10 @@ struct sock* kernel_socket_create(int domain, int type, int protocol)
 
 void net_init_sockets()
 {
-    socket_table = (struct sock**) kalloc(NET_NUMBER_OF_SOCKETS * sizeof(void*));
+    socket_table = (struct sock**) kcalloc(NET_NUMBER_OF_SOCKETS * sizeof(void*));
+    socket_table_size = NET_NUMBER_OF_SOCKETS;
     port_map = create_bitmap(NET_NUMBER_OF_DYMANIC_PORTS);
     socket_map = create_bitmap(NET_NUMBER_OF_SOCKETS);
     total_sockets = 0;
+    sock_hash = create(struct sock_hash);
 }
\ No newline at end of file
@@ -16,23 +16,41 @@
 #include <net/skb.h>
 #include <net/dhcp.h>
 #include <net/net.h>
+#include <net/checksum.h>
 #include <assert.h>
 #include <serial.h>
 #include <scheduler.h>
 #include <errors.h>
+#include <timer.h>
+#include <math.h>
 
-#define TCB_MAX 32
+#define TCB_MAX NET_SOCKETS_MAX
+
+static void __tcp_rto_expired(struct ktimer* timer);
+static void __tcp_retransmit_timeout(void* arg);
+static void __tcp_delack_expired(struct ktimer* timer);
+static void __tcp_delack_timeout(void* arg);
+static void __tcp_output_work(void* arg);
+static void __tcp_output(struct sock* sock, int probe);
+int tcp_send_ack(struct sock* sock);
+int tcp_send_fin(struct sock* sock);
 
 /** new implementation **/
 
 static struct tcp_manager {
-	struct tcb* tcbs[TCB_MAX];
+	struct tcb** tcbs;
 	int tcb_count;
+	struct tcp_stats stats;
+	int syn_backlog;	/* SYN queue limit of every listener */
 } tcp_manager = {0};
 
 int tcb_init()
 {
 	memset(&tcp_manager, 0, sizeof(struct tcp_manager));
+	tcp_manager.syn_backlog = TCP_SYN_BACKLOG_DEFAULT;
+	tcp_manager.tcbs = kcalloc(TCB_MAX * sizeof(struct tcb*));
+	ERR_ON_NULL(tcp_manager.tcbs);
+
 	return ERROR_OK;
 }
 
@@ -43,12 +61,19 @@ int tcb_init()
  */
 struct tcb* tcb_new()
 {
+	struct tcb* tcb = NULL;
+
+	if(tcp_manager.tcbs == NULL && tcb_init() < 0){
+		dbgprintf("[TCP] Failed to allocate TCB table!\n");
+		goto tcb_new_error;
+	}
+
 	if(tcp_manager.tcb_count >= TCB_MAX){
 		dbgprintf("[TCP] Max number of TCBs reached!\n");
 		goto tcb_new_error;
 	}
 
-	struct tcb* tcb = create(struct tcb); 
+	tcb = create(struct tcb); 
 	if(tcb == NULL){
 		dbgprintf("[TCP] Failed to allocate TCB!\n");
 		goto tcb_new_error;
@@ -56,13 +81,7 @@ struct tcb* tcb_new()
 
 	memset(tcb, 0, sizeof(struct tcb));
 
-	tcb->rbuf = rbuffer_new(1024);
-	if(tcb->rbuf == NULL){
-		dbgprintf("[TCP] Failed to allocate receive buffer!\n");
-		goto tcb_new_error;
-	}
-
-	tcb->sbuf = rbuffer_new(1024);
+	tcb->sbuf = spsc_new(TCP_SNDBUF_SIZE);
 	if(tcb->sbuf == NULL){
 		dbgprintf("[TCP] Failed to allocate send buffer!\n");
 		goto tcb_new_error;
@@ -73,6 +92,13 @@ struct tcb* tcb_new()
 		dbgprintf("[TCP] Failed to allocate retransmit queue!\n");
 		goto tcb_new_error;
 	}
+	ktimer_init(&tcb->rto_timer, __tcp_rto_expired, tcb);
+	NET_DEFERRED_INIT(&tcb->rto_work, __tcp_retransmit_timeout, tcb);
+	tcb->rto = timer_ms_to_ticks(TCP_RTO_INITIAL_MS);
+	ktimer_init(&tcb->delack_timer, __tcp_delack_expired, tcb);
+	NET_DEFERRED_INIT(&tcb->delack_work, __tcp_delack_timeout, tcb);
+	NET_DEFERRED_INIT(&tcb->output_work, __tcp_output_work, tcb);
+
 	/* register in manager */
 	tcp_manager.tcbs[tcp_manager.tcb_count++] = tcb;
 
@@ -81,33 +107,69 @@ struct tcb* tcb_new()
 	return tcb;
 
 tcb_new_error:
-	if(tcb != NULL) kfree(tcb);
-	if(tcb != NULL && tcb->rbuf != NULL) rbuffer_free(tcb->rbuf);
-	if(tcb != NULL && tcb->sbuf != NULL) rbuffer_free(tcb->sbuf);
+	if(tcb != NULL && tcb->sbuf != NULL) spsc_free(tcb->sbuf);
 	if(tcb != NULL && tcb->retransmit != NULL) skb_free_queue(tcb->retransmit);
+	if(tcb != NULL) kfree(tcb);
 	return NULL;
 }
 
+/**
+ * @brief Frees a TCB and all segments still waiting for an acknowledgement.
+ */
+void tcb_free(struct tcb* tcb)
+{
+	struct sk_buff* skb;
+
+	ktimer_del(&tcb->rto_timer);
+	net_defer_cancel(&tcb->rto_work);
+	ktimer_del(&tcb->delack_timer);
+	net_defer_cancel(&tcb->delack_work);
+	net_defer_cancel(&tcb->output_work);
 
-#define IS_TCP_SOCKET(sock) (sock->type == SOCK_STREAM && sock->tcp != NULL)
+	for (int i = 0; i < tcp_manager.tcb_count; i++){
+		if(tcp_manager.tcbs[i] != tcb) continue;
+
+		tcp_manager.tcbs[i] = tcp_manager.tcbs[--tcp_manager.tcb_count];
+		tcp_manager.tcbs[tcp_manager.tcb_count] = NULL;
+		break;
+	}
 
-#define TCP_BLOCK(sock)\
-	sock->waiting = $process->current;\
-	$process->current->state = BLOCKED;\
-	kernel_yield();
+	while((skb = tcb->retransmit->ops->remove(tcb->retransmit)) != NULL){
+		skb_free(skb);
+	}
 
-#define TCP_UNBLOCK(sock)\
-	if(sock->waiting != NULL){\
-		sock->waiting->state = RUNNING;\
-		sock->waiting = NULL;\
+	while((skb = tcb->ooo) != NULL){
+		tcb->ooo = skb->next;
+		skb_free(skb);
 	}
 
+	skb_free_queue(tcb->retransmit);
+	spsc_free(tcb->sbuf);
+	kfree(tcb);
+}
+
+#define IS_TCP_SOCKET(sock) (sock->type == SOCK_STREAM && sock->tcp != NULL)
+
+#define TCP_UNBLOCK(sock) waitqueue_wake(&(sock)->wq)
+
+/* Data can be sent until the application closed the connection, also after the peers FIN */
+static inline int __tcp_can_send(struct sock* sock)
+{
+	return sock->tcp->state == TCP_ESTABLISHED || sock->tcp->state == TCP_CLOSE_WAIT;
+}
+
+/* Used as waitqueue condition, called with interrupts disabled. */
+static int __tcp_accept_ready(void* arg)
+{
+	struct sock* sock = arg;
+	return sock->backlog.count > 0 || sock->tcp == NULL || sock->tcp->state != TCP_LISTEN;
+}
+
 
 static const char* tcp_state_str[] = {
 	"TCP_CREATED",
 	"TCP_CLOSED",
 	"TCP_LISTEN",
-	"TCP_WAIT_ACK",
 	"TCP_SYN_RCVD",
 	"TCP_SYN_SENT",
 	"TCP_ESTABLISHED",
@@ -117,10 +179,11 @@ static const char* tcp_state_str[] = {
 	"TCP_TIME_WAIT",
 	"TCP_CLOSE_WAIT",
 	"TCP_LAST_ACK",
-	"TCP_PREPARE"
+	"TCP_PREPARE",
+	"TCP_CLOSE_WAIT2"
 };
 char* tcp_state_to_str(tcp_state_t state){
-	if(state > TCP_PREPARE) return "UNKNOWN";
+	if(state > TCP_CLOSE_WAIT2) return "UNKNOWN";
 	if(state < TCP_CREATED) return "UNKNOWN";
 	
 	return (char*)tcp_state_str[state];
@@ -140,17 +203,91 @@ int tcp_new_connection(struct sock* sock, uint16_t dst_port, uint16_t src_port)
 	ERR_ON_NULL(sock->tcp);
 
 	memset(sock->tcp, 0, sizeof(struct tcp_connection));
+
+	sock->tcp->tcb = tcb_new();
+	if(sock->tcp->tcb == NULL){
+		kfree(sock->tcp);
+		sock->tcp = NULL;
+		return -ERROR_ALLOC;
+	}
+
 	sock->tcp->dport = dst_port;
 	sock->tcp->sport = src_port;
 	sock->tcp->state = TCP_CREATED;
-	sock->tcp->sequence = 1;
+	sock->tcp->tcpi_snd_mss = TCP_DEFAULT_MSS;
+	sock->tcp->tcpi_rcv_mss = TCP_DEFAULT_MSS;
+
+	sock->tcp->tcb->sock = sock;
+	sock->tcp->tcb->dport = dst_port;
+	sock->tcp->tcb->sport = src_port;
+	tcp_cong_init(sock->tcp->tcb, TCP_DEFAULT_MSS);
 
 	return ERROR_OK;
 }
 
+/**
+ * @brief Initial send sequence number, RFC 6528.
+ * A clock advancing every 4 microseconds plus a keyed hash of the peers
+ * address and the ports. There is no TIME_WAIT, a new connection on the
+ * same addresses and ports starts ahead of the sequence numbers the old
+ * one used, so its delayed segments do not fall in the new window.
+ * The secret makes the number hard to guess for hosts off the path.
+ */
+static uint32_t __tcp_iss(struct sock* sock)
+{
+	static uint32_t secret = 0;
+	uint32_t hash;
+
+	while(secret == 0){
+		secret = ((uint32_t)rand() << 17) ^ ((uint32_t)rand() << 8) ^ (uint32_t)rand();
+	}
+
+	hash = (sock->recv_addr.sin_addr.s_addr ^ secret) * 2654435761u;
+	hash = (hash ^ (((uint32_t)sock->bound_port << 16) | sock->recv_addr.sin_port)) * 2654435761u;
+	hash ^= (hash >> 16) ^ secret;
+
+	return hash + (uint32_t)timer_get_tick() * (250000 / timer_ms_to_ticks(1000));
+}
+
+/**
+ * @brief Closes the connections queued on a listener that were never accepted.
+ */
+static void __tcp_listen_flush(struct sock* sock)
+{
+	struct sock* syn;
+	struct sock* established;
+	struct sock* child;
+
+	CRITICAL_SECTION({
+		syn = sock->backlog.syn_queue;
+		established = sock->backlog.accept_head;
+		sock->backlog.syn_queue = NULL;
+		sock->backlog.accept_head = NULL;
+		sock->backlog.accept_tail = NULL;
+		sock->backlog.syn_count = 0;
+		sock->backlog.count = 0;
+	});
+
+	while((child = syn) != NULL || (child = established) != NULL){
+		if(child == syn) syn = child->queue_next;
+		else established = child->queue_next;
+
+		child->parent = NULL;
+		kernel_sock_cleanup(child);
+	}
+}
+
 int tcp_free_connection(struct sock* sock)
 {
-	/* TODO: check for active connections */
+	if(sock->tcp == NULL) return ERROR_OK;
+
+	if(sock->tcp->state == TCP_LISTEN){
+		sock->tcp->state = TCP_CLOSED;
+		TCP_UNBLOCK(sock);
+		__tcp_listen_flush(sock);
+	}
+
+	tcb_free(sock->tcp->tcb);
 	kfree(sock->tcp);
 	sock->tcp = NULL;
 
@@ -164,54 +301,259 @@ inline int tcp_is_listening(struct sock* sock)
 
 inline int tcp_set_listening(struct sock* sock, int backlog)
 {
-	/* create backlog queue, I do not check if there already is a queue... */
-	sock->backlog.queue = skb_new_queue();
-	ERR_ON_NULL(sock->backlog.queue);
-
-	sock->backlog.size = backlog;
-	sock->backlog.count = 0;
+	memset((void*) &sock->backlog, 0, sizeof(sock->backlog));
+	sock->backlog.size = MIN(MAX(backlog, 1), TCP_BACKLOG_MAX);
 
 	sock->tcp->state = TCP_LISTEN;
 
 	return 1;
 }
 
-uint16_t tcp_calculate_checksum(uint32_t src_ip, uint32_t dest_ip, unsigned short *data, int size)
-{
-    register unsigned long sum = 0;
-    unsigned short tcpLen = size;
-    struct tcp_header *tcphdrp = (struct tcp_header*)(data);
-
-    /* the source ip */
-    sum += (src_ip>>16)&0xFFFF;
-    sum += (src_ip)&0xFFFF;
-    /* the dest ip */
-    sum += (dest_ip>>16)&0xFFFF;
-    sum += (dest_ip)&0xFFFF;
-    /* protocol and reserved: 6 */
-    sum += htons(TCP);
-    /* the length  */
-    sum += htons(tcpLen);
- 
-    /* add the IP payload */
-    /* initialize checksum to 0 */
-    tcphdrp->check = 0;
-    while (tcpLen > 1) {
-        sum += * data++;
-        tcpLen -= 2;
-    }
-    /* if any bytes left, pad the bytes and add */
-    if(tcpLen > 0) {
-        sum += ((*data)&htons(0xFF00));
-    }
-      /* Fold 32-bit sum to 16 bits: add carrier to result */
-      while (sum>>16) {
-          sum = (sum & 0xffff) + (sum >> 16);
-      }
-      sum = ~sum;
-
-	return sum;
+/**
+ * @brief Sets the SYN queue limit of all listeners.
+ * @return int 0 on success, less than 0 if size is out of range.
+ */
+int tcp_set_syn_backlog(int size)
+{
+	if(size <= 0 || size > TCP_SYN_BACKLOG_MAX) return -ERROR_INVALID_ARGUMENTS;
+
+	if(tcp_manager.tcbs == NULL) tcb_init();
+	tcp_manager.syn_backlog = size;
+
+	return ERROR_OK;
+}
+
+int tcp_get_syn_backlog()
+{
+	return tcp_manager.syn_backlog > 0 ? tcp_manager.syn_backlog : TCP_SYN_BACKLOG_DEFAULT;
+}
+
+/**
+ * @brief MSS for the interface the peer is reached through.
+ */
+static uint16_t __tcp_mss(struct sock* sock)
+{
+	struct net_interface* interface = net_get_iface(ntohl(sock->recv_addr.sin_addr.s_addr));
+	if(interface == NULL) return TCP_DEFAULT_MSS;
+
+	return interface->mtu - TCP_IP_HEADERS;
+}
+
+/**
+ * @brief Smallest window scale that can advertise the whole receive buffer,
+ * including what auto tuning may grow it to.
+ */
+static uint8_t __tcp_wscale(struct sock* sock)
+{
+	uint32_t space = sock->rcvbuf_locked ? sock->rcvbuf : NET_SOCK_RCVBUF_MAX;
+	uint8_t shift = 0;
+
+	while((space >> shift) > 0xFFFF && shift < TCP_WSCALE_MAX) shift++;
+	return shift;
+}
+
+/**
+ * @brief Window to advertise, the free space in the receive buffer.
+ * Windows in SYN segments are never scaled.
+ */
+static uint16_t __tcp_window(struct sock* sock, int syn)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t space = net_sock_rcvbuf_space(sock);
+	uint8_t shift = !syn && (tcb->options & TCP_OPTION_WSCALE) ? tcb->rcv_wscale : 0;
+
+	space = MIN(space >> shift, 0xFFFF);
+
+	/* Remembered to decide when a window update is worth sending */
+	tcb->rcv_wnd = space << shift;
+	return space;
+}
+
+static inline uint8_t* __tcp_put32(uint8_t* opt, uint32_t value)
+{
+	*opt++ = value >> 24;
+	*opt++ = value >> 16;
+	*opt++ = value >> 8;
+	*opt++ = value;
+	return opt;
+}
+
+static inline uint32_t __tcp_get32(uint8_t* opt)
+{
+	return (opt[0] << 24) | (opt[1] << 16) | (opt[2] << 8) | opt[3];
+}
+
+/**
+ * @brief Writes the options for an outgoing segment.
+ * SYNs offer MSS, window scaling, timestamps and SACK, a SYN ACK only answers
+ * with the options the peer offered. Later segments carry timestamps if agreed on,
+ * acknowledgements without data carry SACK blocks while data is missing.
+ * @param sock socket sending the segment.
+ * @param hdr outgoing header, flags are set.
+ * @param buffer at least TCP_OPT_MAX_LEN bytes.
+ * @param len payload length, SACK blocks are only sent without payload to stay within the MSS.
+ * @return int length of the options, a multiple of 4.
+ */
+static int __tcp_write_options(struct sock* sock, struct tcp_header* hdr, uint8_t* buffer, uint32_t len)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	struct tcp_sack_block sack[TCP_SACK_MAX_BLOCKS];
+	uint8_t* opt = buffer;
+	int offer = hdr->syn && !hdr->ack;
+	int count = 0;
+
+	if(hdr->syn){
+		*opt++ = TCP_OPT_MSS;
+		*opt++ = 4;
+		*opt++ = sock->tcp->tcpi_rcv_mss >> 8;
+		*opt++ = sock->tcp->tcpi_rcv_mss & 0xFF;
+
+		if(offer || (tcb->options & TCP_OPTION_WSCALE)){
+			*opt++ = TCP_OPT_NOP;
+			*opt++ = TCP_OPT_WSCALE;
+			*opt++ = 3;
+			*opt++ = tcb->rcv_wscale;
+		}
+
+		if(offer || (tcb->options & TCP_OPTION_SACK)){
+			*opt++ = TCP_OPT_NOP;
+			*opt++ = TCP_OPT_NOP;
+			*opt++ = TCP_OPT_SACK_PERM;
+			*opt++ = 2;
+		}
+	}
+
+	if(offer || (tcb->options & TCP_OPTION_TIMESTAMPS)){
+		*opt++ = TCP_OPT_NOP;
+		*opt++ = TCP_OPT_NOP;
+		*opt++ = TCP_OPT_TIMESTAMP;
+		*opt++ = 10;
+		opt = __tcp_put32(opt, timer_get_tick());
+		opt = __tcp_put32(opt, tcb->ts_recent);
+	}
+
+	if(!hdr->syn && len == 0 && (tcb->options & TCP_OPTION_SACK)){
+		/* Blocks are updated by the networking thread */
+		CRITICAL_SECTION({
+			count = tcb->sack_count;
+			memcpy(sack, tcb->sack, sizeof(struct tcp_sack_block) * count);
+		});
+		count = MIN(count, (TCP_OPT_MAX_LEN - (opt - buffer) - 4) / 8);
+	}
+
+	if(count > 0){
+		*opt++ = TCP_OPT_NOP;
+		*opt++ = TCP_OPT_NOP;
+		*opt++ = TCP_OPT_SACK;
+		*opt++ = 2 + count * 8;
+		for (int i = 0; i < count; i++){
+			opt = __tcp_put32(opt, sack[i].start);
+			opt = __tcp_put32(opt, sack[i].end);
+		}
+	}
+
+	return opt - buffer;
+}
+
+/**
+ * @brief Parses the options of an incoming segment, unknown options are skipped.
+ * @param hdr incoming header, in network order.
+ * @param opts parsed options.
+ */
+static void __tcp_parse_options(struct tcp_header* hdr, struct tcp_options* opts)
+{
+	uint8_t* opt = (uint8_t*)(hdr + 1);
+	int len = hdr->doff*4 - sizeof(struct tcp_header);
+
+	memset(opts, 0, sizeof(struct tcp_options));
+
+	while(len > 0){
+		if(opt[0] == TCP_OPT_END) break;
+		if(opt[0] == TCP_OPT_NOP){
+			opt++;
+			len--;
+			continue;
+		}
+
+		/* Malformed option length, ignore the rest */
+		if(len < 2 || opt[1] < 2 || opt[1] > len) break;
+
+		switch (opt[0]){
+		case TCP_OPT_MSS:
+			if(opt[1] != 4) break;
+			opts->mss = (opt[2] << 8) | opt[3];
+			opts->flags |= TCP_OPTION_MSS;
+			break;
+		case TCP_OPT_WSCALE:
+			if(opt[1] != 3) break;
+			opts->wscale = MIN(opt[2], TCP_WSCALE_MAX);
+			opts->flags |= TCP_OPTION_WSCALE;
+			break;
+		case TCP_OPT_TIMESTAMP:
+			if(opt[1] != 10) break;
+			opts->ts_val = __tcp_get32(opt + 2);
+			opts->ts_ecr = __tcp_get32(opt + 6);
+			opts->flags |= TCP_OPTION_TIMESTAMPS;
+			break;
+		case TCP_OPT_SACK_PERM:
+			if(opt[1] != 2) break;
+			opts->flags |= TCP_OPTION_SACK;
+			break;
+		case TCP_OPT_SACK:
+			if((opt[1] - 2) % 8 != 0) break;
+			for (int i = 0; i < (opt[1] - 2) / 8 && opts->sack_count < TCP_SACK_MAX_BLOCKS; i++){
+				opts->sack[opts->sack_count].start = __tcp_get32(opt + 2 + i * 8);
+				opts->sack[opts->sack_count].end = __tcp_get32(opt + 6 + i * 8);
+				opts->sack_count++;
+			}
+			break;
+		default:
+			break;
+		}
+
+		len -= opt[1];
+		opt += opt[1];
+	}
+}
+
+/**
+ * @brief Applies the options of a SYN or SYN ACK.
+ * Window scaling, timestamps and SACK are only used if both sides sent them.
+ */
+static void __tcp_negotiate(struct sock* sock, struct tcp_options* opts)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	uint16_t mss = opts->flags & TCP_OPTION_MSS ? opts->mss : TCP_DEFAULT_MSS;
+
+	sock->tcp->tcpi_rcv_mss = __tcp_mss(sock);
+	sock->tcp->tcpi_snd_mss = MIN(mss, sock->tcp->tcpi_rcv_mss);
+
+	tcb->options = 0;
+	if(opts->flags & TCP_OPTION_WSCALE){
+		tcb->options |= TCP_OPTION_WSCALE;
+		tcb->snd_wscale = opts->wscale;
+		tcb->rcv_wscale = __tcp_wscale(sock);
+	} else {
+		tcb->snd_wscale = 0;
+		tcb->rcv_wscale = 0;
+	}
+
+	if(opts->flags & TCP_OPTION_TIMESTAMPS){
+		tcb->options |= TCP_OPTION_TIMESTAMPS;
+		tcb->ts_recent = opts->ts_val;
+
+		/* Every segment carries the option, leave room for it */
+		sock->tcp->tcpi_snd_mss -= TCP_OPT_TIMESTAMP_LEN;
+	}
+
+	if(opts->flags & TCP_OPTION_SACK){
+		tcb->options |= TCP_OPTION_SACK;
+	}
+
+	dbgprintf("[TCP] Negotiated mss %d, wscale %d/%d, timestamps %d, sack %d\n", sock->tcp->tcpi_snd_mss,
+		tcb->snd_wscale, tcb->rcv_wscale, (tcb->options & TCP_OPTION_TIMESTAMPS) != 0, (tcb->options & TCP_OPTION_SACK) != 0);
 }
+
 /**
  * @brief Sends a TCP segment.
  * Function sends given data as a TCP segment.
@@ -225,31 +567,54 @@ uint16_t tcp_calculate_checksum(uint32_t src_ip, uint32_t dest_ip, unsigned shor
  */
 static int __tcp_send(struct sock* sock, struct tcp_header* hdr, struct sk_buff* skb, uint8_t* data, uint32_t len)
 {
+	uint8_t options[TCP_OPT_MAX_LEN];
+	uint32_t sum;
+	int hdr_len;
 	int ret;
 
-	if(net_ipv4_add_header(skb, sock->recv_addr.sin_addr.s_addr, TCP, sizeof(struct tcp_header)+len) < 0){
+	/* Options, data offset and window are filled in for every segment */
+	hdr_len = sizeof(struct tcp_header) + __tcp_write_options(sock, hdr, options, len);
+	hdr->doff = hdr_len / 4;
+	hdr->window = __tcp_window(sock, hdr->syn);
+	if(hdr->ack){
+		/* Data and control segments carry the acknowledgement, nothing is left to delay */
+		sock->tcp->tcb->rcv_acked = hdr->ack_seq;
+	}
+
+	if(net_ipv4_add_header(skb, sock->recv_addr.sin_addr.s_addr, TCP, hdr_len+len) < 0){
 		skb_free(skb);
 		return -1;
 	}
 	TCP_HTONS(hdr);
 
 	memcpy(skb->data, hdr, sizeof(struct tcp_header));
+	memcpy(skb->data + sizeof(struct tcp_header), options, hdr_len - sizeof(struct tcp_header));
 	hdr = (struct tcp_header*) skb->data;
 
-	skb->len += sizeof(struct tcp_header);
-	skb->data += sizeof(struct tcp_header);
-
-	if(len > 0){
-		memcpy(skb->data, data, len);
-		skb->len += len;
-		skb->data += len;
-	}
+	skb->len += hdr_len;
+	skb->data += hdr_len;
 
 	/**
-	 * @brief TCP header checksum is calculated over the pseudo header and the TCP header.
+	 * @brief TCP header checksum is calculated over the pseudo header, the TCP header and the payload.
 	 * This pseudo header contains the Source Address, the Destination Address, the Protocol, and TCP length.
+	 * The header length is a multiple of 4, so the payload sum can be added on its own.
 	 */
-	hdr->check = tcp_calculate_checksum(skb->hdr.ip->daddr, skb->hdr.ip->saddr, (unsigned short*)hdr, sizeof(struct tcp_header)+len);
+	hdr->check = 0;
+	sum = csum_pseudo(skb->hdr.ip->saddr, skb->hdr.ip->daddr, TCP, hdr_len+len);
+	sum = csum_partial(hdr, hdr_len, sum);
+
+	/* Payload in kernel memory is sent from where it is, by a separate descriptor. */
+	if(len > 0 && IS_IDENTITY_MAPPED(data, len)){
+		skb->frag.data = data;
+		skb->frag.len = len;
+		sum = csum_partial(data, len, sum);
+	} else if(len > 0){
+		/* Copied payloads are summed while copying */
+		sum = csum_partial_copy(skb->data, data, len, sum);
+		skb->len += len;
+		skb->data += len;
+	}
+	hdr->check = csum_fold(sum);
 
 	ret = net_send_skb(skb);
 	if(ret < 0){
@@ -261,295 +626,1222 @@ static int __tcp_send(struct sock* sock, struct tcp_header* hdr, struct sk_buff*
 }
 
 /**
- * @brief Sends a TCP segment.
- * Function sends given data as a TCP segment. Creates a SKB and fills in the header
- * before sending it to the network daemon.
+ * @brief Transmits a segment from the retransmission queue.
+ * The payload is sent directly from the queued segment, which stays
+ * referenced until the device is done with it.
  * @param sock generic socket to send from.
- * @param data given data to send.
- * @param len length of data
- * @param push if set to 1, the PSH flag will be set.
- * @return int 0 on success, -1 on failure.
+ * @param seg queued segment.
+ * @return int 0 on success, less than 0 on failure.
  */
-int tcp_send_segment(struct sock* sock, uint8_t* data, uint32_t len, uint8_t push)
+static int __tcp_transmit(struct sock* sock, struct sk_buff* seg)
 {
-	uint8_t retries;
-	uint32_t timeout;
-	int seq = sock->tcp->sequence;
-	int ack = sock->tcp->acknowledgement;
 	struct sk_buff* skb;
+	struct tcp_header hdr = {
+		.source = sock->bound_port,
+		.dest = sock->recv_addr.sin_port,
+		.seq = seg->seg.seq,
+		.ack_seq = sock->tcp->tcb->rcv_nxt,
+		/* Nothing to acknowledge before the peers SYN arrived */
+		.ack = sock->tcp->state != TCP_SYN_SENT,
+		.psh = seg->seg.push,
+		.syn = seg->seg.syn,
+		.fin = seg->seg.fin
+	};
 
-	dbgprintf("[TCP] Sending segment with size %d, seq: %d (%d after)\n", len, sock->tcp->sequence, sock->tcp->sequence+len);
+	skb = skb_new();
+	ERR_ON_NULL(skb);
 
-	sock->tcp->sequence += len;
+	skb->frag.owner = skb_get(seg);
 
-	/**
-	 * @brief This is where we need to check if packet is lost.
-	 * @see https://github.com/joexbayer/RetrOS-32/issues/30
-	 * TODO: check if packet is lost.
-	 * Simples solution is to just wait for an ACK, if we dont get one, resend the packet.
-	 * Need a timer to resend the packet.
-	 * 
-	 * Problem is that we "lose" the skb after it is transmitted, keep a copy?
-	 */
-	retries = 0;
-
-	do {
-		struct tcp_header hdr = {
-			.source = sock->bound_port,
-			.dest = sock->recv_addr.sin_port,
-			.window = 1500,
-			.seq = seq,
-			.ack_seq = ack,
-			.doff = 0x05,
-			.ack = 1,
-			.psh = push
-		};
-
-		skb = skb_new();
-		ERR_ON_NULL(skb);
-
-		/* Send segment, __tcp_send consumes skb */
-		__tcp_send(sock, &hdr, skb, data, len);
-
-		/* Wait for ACK */
-		timeout = get_time() + 1;
-
-		/* check if ack was receiver for timeout seconds. */
-		while((uint32_t)get_time() < timeout){
-			kernel_yield();
-			if(!net_sock_awaiting_ack(sock)) return ERROR_OK;
-		}
-		dbgprintf("[TCP] Timeout for %d\n", htonl(hdr.seq));
-	} while (retries++ < 3);
-
-	dbgprintf("[TCP] Failed to send segment\n");
-	return -1;
+	/* __tcp_send consumes skb */
+	return __tcp_send(sock, &hdr, skb, seg->head, seg->len);
 }
 
-int tcp_accept_connection(struct sock* sock, struct sock* new)
+/**
+ * @brief Places a segment on the retransmission queue and transmits it.
+ * @param sock generic socket to send from.
+ * @param seg segment with len bytes of payload at head and seg.push set,
+ * or a SYN or FIN without payload.
+ * @return int 0 on success, less than 0 on failure.
+ */
+static int __tcp_send_segment(struct sock* sock, struct sk_buff* seg)
 {
-    if(sock->tcp == NULL || sock->tcp->state != TCP_LISTEN){
-		dbgprintf("[TCP] Socket %d is not listening\n", sock);
-        return -1;
-     }
-
-    while(sock->backlog.count == 0){
-		dbgprintf("[TCP] Socket %d is listening but backlog is empty\n", sock);
-		TCP_BLOCK(sock);
-	}
-
-	struct sk_buff* skb = sock->backlog.queue->ops->remove(sock->backlog.queue);
-	ERR_ON_NULL(skb);
-	sock->backlog.count--;
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t len = seg->len;
 
-	struct tcp_header* hdr = (struct tcp_header*) skb->hdr.tcp;
+	LOCK(sock, {
+		seg->seg.seq = tcb->snd_nxt;
+		seg->seg.end_seq = tcb->snd_nxt + len + seg->seg.syn + seg->seg.fin;
+		seg->seg.sent = timer_get_tick();
+		tcb->snd_nxt = seg->seg.end_seq;
 
-	/**
-	 * @brief This assumes that sock has a valid recv_addr. 
-	 */
-	net_prepare_tcp_sock(new, sock->bound_port, &sock->recv_addr);
+		tcb->retransmit->ops->add(tcb->retransmit, seg);
 
-	new->tcp->state = TCP_ESTABLISHED;
-	new->tcp->acknowledgement = htonl(hdr->seq);
-	new->tcp->sequence = hdr->ack_seq;
-	sock->accept_sock = NULL;
+		/* RFC 6298 5.1, start the timer if it is not running */
+		if(!tcb->rto_timer.pending){
+			ktimer_mod(&tcb->rto_timer, timer_get_tick() + tcb->rto);
+		}
+	});
 
-	memset(&sock->recv_addr, 0, sizeof(struct sockaddr_in));
-	
-	skb_free(skb);
+	dbgprintf("[TCP] Sending segment with size %d, seq: %d (%d after)\n", len, seg->seg.seq, seg->seg.end_seq);
 
-	return ERROR_OK; 
+	return __tcp_transmit(sock, seg);
 }
 
-int tcp_send_ack(struct sock* sock, struct tcp_header* tcp, int len)
+/**
+ * @brief Resends the oldest unacknowledged segment.
+ * @return int 0 on success, less than 0 if there was nothing to resend.
+ */
+static int __tcp_retransmit(struct sock* sock)
 {
-	struct sk_buff* skb = skb_new();
-	assert(skb != NULL);
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sk_buff* seg = NULL;
+	int ret;
 
-	struct tcp_header hdr = {
-		.source = tcp->dest,
-		.dest = tcp->source,
-		.window = 1500,
-		.seq = htonl(tcp->ack_seq),
-		.ack_seq = htonl(tcp->seq)+len,
-		.doff = 0x05,
-		.ack = 1
-	};
+	/* Hold a reference, the segment can be acknowledged while it is resent */
+	LOCK(sock, {
+		seg = tcb->retransmit->_head;
+		if(seg != NULL){
+			seg->seg.retransmitted = 1;
+			tcb->high_rxt = seg->seg.end_seq;
+			skb_get(seg);
+		}
+	});
+	if(seg == NULL) return -1;
 
-	sock->tcp->sequence = htonl(tcp->ack_seq);
-	sock->tcp->acknowledgement = htonl(tcp->seq)+len;
+	dbgprintf("[TCP] Retransmitting seq %d (%d bytes)\n", seg->seg.seq, seg->len);
 
-	dbgprintf("[TCP] Sending ack for %d (seq: %d, ack: %d)\n", htonl(tcp->seq)+len, htonl(tcp->ack_seq), htonl(tcp->seq)+1);
+	sock->tcp->retransmits++;
+	ret = __tcp_transmit(sock, seg);
+	skb_free(seg);
 
-	__tcp_send(sock, &hdr, skb, NULL, 0);
-	return ERROR_OK;
+	return ret;
 }
 
-/* Currently deprecated */
-int tcp_read(struct sock* sock, uint8_t* buffer, unsigned int length)
+/**
+ * @brief Resends the holes the SACK scoreboard shows as lost, RFC 6675 NextSeg().
+ * Unacknowledged segments below the highest SACKed segment are lost, each is
+ * resent once per recovery while the data in the network fits the congestion window.
+ * @param sock socket to resend on.
+ * @param force resend the first hole regardless of the window, for fast
+ * retransmit and partial acknowledgements.
+ */
+static void __tcp_sack_retransmit(struct sock* sock, int force)
 {
-	/*
-	dbgprintf(" [TCP] Waiting for data... %d\n", sock);
-	// Should be blocking 
-	WAIT(!net_sock_data_ready(sock, length));
-
-	int to_read = length > sock->tcp->recvd ? sock->tcp->recvd : length;
-	int ret = sock->tcp->recv_buffer->ops->read(sock->tcp->recv_buffer, buffer, to_read);
-	if(ret != to_read){
-		dbgprintf("[TCP] Read from recv buffer not equal to return value!\n");
-	}
-	sock->tcp->recvd -= to_read;
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sk_buff* seg;
+	struct sk_buff* iter;
+	uint32_t pipe;
+
+	while(1){
+		seg = NULL;
+		LOCK(sock, {
+			pipe = tcb->snd_nxt - tcb->snd_una - tcb->sacked_out - tcb->lost_out;
+
+			for (iter = tcb->retransmit->_head; iter != NULL; iter = iter->next){
+				if(iter->seg.sacked || TCP_SEQ_LT(iter->seg.seq, tcb->high_rxt)) continue;
+
+				if(force || (TCP_SEQ_LEQ(iter->seg.end_seq, tcb->high_sacked) && pipe + iter->len <= tcb->cwnd)){
+					seg = iter;
+				}
+				break;
+			}
 
-	dbgprintf("[TCP] Received %d from socket %d\n", to_read, sock);
+			if(seg != NULL){
+				if(TCP_SEQ_LEQ(seg->seg.end_seq, tcb->high_sacked)){
+					tcb->lost_out -= MIN(tcb->lost_out, (uint32_t)seg->len);
+				}
+				tcb->high_rxt = seg->seg.end_seq;
+				seg->seg.retransmitted = 1;
+				skb_get(seg);
+			}
+		});
+		if(seg == NULL) break;
 
-	return to_read;
-	*/
+		dbgprintf("[TCP] SACK retransmitting seq %d (%d bytes)\n", seg->seg.seq, seg->len);
 
-	return -1;
+		sock->tcp->retransmits++;
+		__tcp_transmit(sock, seg);
+		skb_free(seg);
+		force = 0;
+	}
 }
 
-/* Currently deprecated */
-int tcp_recv_segment(struct sock* sock, struct tcp_header* tcp, struct sk_buff* skb)
+/**
+ * @brief Updates the SACK scoreboard from the blocks of an acknowledgement.
+ * Must be called with the socket locked.
+ */
+static void __tcp_sack_scoreboard(struct tcb* tcb, struct tcp_options* opts)
 {
-	/* TODO: if data_ready == 1 wait for it to be cleared. 
-
-	int ret = sock->tcp->recv_buffer->ops->add(sock->tcp->recv_buffer, skb->data, skb->data_len);
-	if(ret < 0){
-		dbgprintf("[TCP] recv ring buffer is full!\n");
-		return ret;
-	}
-	sock->tcp->recvd += skb->data_len;
-	sock->tcp->data_ready = tcp->psh;
+	struct sk_buff* seg;
 
-	dbgprintf("[TCP] Added segment to socket %d (ready: %d)\n", sock, sock->tcp->data_ready);
-
-	tcp_send_ack(sock, tcp, skb->data_len);
-	return ERROR_OK;
-	*/
+	if(TCP_SEQ_LT(tcb->high_sacked, tcb->snd_una)) tcb->high_sacked = tcb->snd_una;
+	if(TCP_SEQ_LT(tcb->high_rxt, tcb->snd_una)) tcb->high_rxt = tcb->snd_una;
 
-	return -1;
-}
+	for (int i = 0; i < opts->sack_count; i++){
+		struct tcp_sack_block* block = &opts->sack[i];
 
+		/* Blocks below SND.UNA are duplicates, beyond SND.NXT are bogus */
+		if(TCP_SEQ_LEQ(block->end, tcb->snd_una) || TCP_SEQ_GT(block->end, tcb->snd_nxt)) continue;
 
-int tcp_connect(struct sock* sock)
-{
-	struct sk_buff* skb = skb_new();
-	assert(skb != NULL);
+		for (seg = tcb->retransmit->_head; seg != NULL; seg = seg->next){
+			if(seg->seg.sacked || TCP_SEQ_LT(seg->seg.seq, block->start)) continue;
+			if(TCP_SEQ_GT(seg->seg.end_seq, block->end)) break;
 
-	struct tcp_header hdr = {
-		.source = sock->bound_port,
-		.dest = sock->recv_addr.sin_port,
-		.window = 1500,
-		.seq = sock->tcp->sequence,
-		.ack_seq = 0,
-		.doff = 0x05,
-		.syn = 1
-	};
+			seg->seg.sacked = 1;
+			tcb->sacked_out += seg->len;
+			if(TCP_SEQ_GT(seg->seg.end_seq, tcb->high_sacked)) tcb->high_sacked = seg->seg.end_seq;
+		}
+	}
 
-	__tcp_send(sock, &hdr, skb, NULL, 0);
-	return ERROR_OK;
-}
+	/* Holes below the highest SACKed segment have left the network */
+	tcb->lost_out = 0;
+	if(tcb->ca_state != TCP_CA_RECOVERY) return;
 
-int tcp_send_syn(struct sock* sock, uint16_t dst_port, uint16_t src_port)
-{
-	
-	return ERROR_OK;
+	for (seg = tcb->retransmit->_head; seg != NULL && TCP_SEQ_LEQ(seg->seg.end_seq, tcb->high_sacked); seg = seg->next){
+		if(!seg->seg.sacked && TCP_SEQ_GEQ(seg->seg.seq, tcb->high_rxt)) tcb->lost_out += seg->len;
+	}
 }
 
-int tcp_recv_ack(struct sock* sock, struct tcp_header* tcp)
+/**
+ * @brief Forgets all SACK information, RFC 2018 section 8.
+ * The receiver may discard SACKed data, after a timeout everything is resent.
+ * Must be called with the socket locked.
+ */
+static void __tcp_sack_clear(struct tcb* tcb)
 {
-	dbgprintf("[TCP] Incoming TCP ack expected %d got %d\n", sock->tcp->sequence, htonl(tcp->ack_seq));
-	if(sock->tcp->sequence == htonl(tcp->ack_seq)){
-		dbgprintf("[TCP] Correct sequence acked\n");
-		sock->tcp->acknowledgement = htonl(tcp->seq);
-		sock->tcp->state = TCP_ESTABLISHED;
+	for (struct sk_buff* seg = tcb->retransmit->_head; seg != NULL; seg = seg->next){
+		seg->seg.sacked = 0;
 	}
-	
-	return ERROR_OK;
+
+	tcb->sacked_out = 0;
+	tcb->lost_out = 0;
+	tcb->high_sacked = tcb->snd_una;
 }
 
-int tcp_recv_fin(struct sock* sock, struct tcp_header* tcp)
+/* Timer callback, runs in the timer interrupt. */
+static void __tcp_rto_expired(struct ktimer* timer)
 {
-	/* send fin/ack -> close socket*/
-	return -1;
+	struct tcb* tcb = timer->data;
+	net_defer(&tcb->rto_work);
 }
 
-
-int tcp_recv_syn(struct sock* sock, struct tcp_header* tcp)
+/**
+ * @brief Retransmission timeout, runs on the networking thread.
+ * Resends the oldest segment and doubles the timeout (RFC 6298 5.4 - 5.6),
+ * the connection is dropped after TCP_MAX_RETRIES timeouts without progress.
+ */
+static void __tcp_retransmit_timeout(void* arg)
 {
-	int ret;
-	struct sk_buff* skb;
-	/* send syn ack & more*/
-	struct tcp_header hdr = {
-		.source = sock->bound_port,
-		.dest = sock->recv_addr.sin_port,
-		.window = 1500,
-		.seq = sock->tcp->sequence,
-		.ack_seq = htonl(tcp->seq)+1,
-		.doff = 0x05,
-		.syn = 1,
-		.ack = 1
-	};
+	struct tcb* tcb = arg;
+	struct sock* sock = tcb->sock;
 
-	if (sock->tcp->state != TCP_LISTEN){
-		dbgprintf("[TCP] Socket %d is not listening\n", sock);
-		return -1;
+	/* Everything was acknowledged while the work was queued, or the window is closed */
+	if(!SKB_QUEUE_READY(tcb->retransmit)){
+		if(__tcp_can_send(sock)) __tcp_output(sock, 1);
+		return;
 	}
 
- 	skb = skb_new();
-	ERR_ON_NULL(skb);
-
-	ret = __tcp_send(sock, &hdr, skb, NULL, 0);
-	if(ret < 0){
-		dbgprintf("[TCP] Failed to send syn ack\n");
-		return -1;
+	if(sock->tcp->retries >= TCP_MAX_RETRIES){
+		dbgprintf("[TCP] Socket %d: no acknowledgement after %d retries, dropping connection\n", sock->socket, TCP_MAX_RETRIES);
+		sock->tcp->state = TCP_CLOSED;
+		sock->data_ready = -1;
+		TCP_UNBLOCK(sock);
+		return;
 	}
+	sock->tcp->retries++;
 
-	/* update states */
-	sock->tcp->sequence += 1;  /* Increment by 1 as the SYN flag consumes a sequence number */
-    sock->tcp->acknowledgement = htonl(tcp->seq) + 1;
-	sock->tcp->state = TCP_SYN_RCVD;
-
-	/* store information from remote in recv_addr */
-	sock->recv_addr.sin_port = tcp->source;
+	LOCK(sock, {
+		tcp_cong_on_timeout(tcb, sock->tcp->tcpi_snd_mss);
+		__tcp_sack_clear(tcb);
+	});
+	tcb->rto = MIN(tcb->rto * 2, (uint32_t)timer_ms_to_ticks(TCP_RTO_MAX_MS));
+	__tcp_retransmit(sock);
 
-	return ERROR_OK;
+	ktimer_mod(&tcb->rto_timer, timer_get_tick() + tcb->rto);
 }
 
-int tcp_send_fin(struct sock* sock)
+/**
+ * @brief Updates SRTT, RTTVAR and RTO with a new round trip time sample.
+ * RFC 6298 section 2, with the fixed point scaling from Jacobson's paper.
+ * @param tcb connection the sample is for.
+ * @param rtt round trip time in ticks.
+ */
+static void __tcp_rtt_sample(struct tcb* tcb, uint32_t rtt)
 {
-	struct sk_buff* skb = skb_new();
-	assert(skb != NULL);
-
-	struct tcp_header hdr = {
-		.source = sock->bound_port,
-		.dest = sock->recv_addr.sin_port,
-		.window = 1500,
-		.seq = sock->tcp->sequence,
-		.ack_seq = sock->tcp->acknowledgement,
-		.doff = 0x05,
-		.ack = 1,
-		.fin = 1
-	};
-
-	sock->tcp->sequence += 1;
-
-	dbgprintf("[TCP] Sending fin for %d\n", sock->socket);
+	int32_t err;
+	uint32_t rto;
+
+	if(rtt == 0) rtt = 1;
+
+	if(tcb->srtt == 0){
+		/* First measurement, SRTT = R, RTTVAR = R/2 */
+		tcb->srtt = rtt << 3;
+		tcb->rttvar = rtt << 1;
+	} else {
+		/* SRTT = 7/8 SRTT + 1/8 R */
+		err = rtt - (tcb->srtt >> 3);
+		tcb->srtt += err;
+
+		/* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R| */
+		if(err < 0) err = -err;
+		err -= tcb->rttvar >> 2;
+		tcb->rttvar += err;
+	}
 
-	__tcp_send(sock, &hdr, skb, NULL, 0);
-	return ERROR_OK;
+	/* RTO = SRTT + max(G, 4 * RTTVAR), rttvar is already scaled by 4 */
+	rto = (tcb->srtt >> 3) + (tcb->rttvar > 1 ? tcb->rttvar : 1);
+	rto = MAX(rto, (uint32_t)timer_ms_to_ticks(TCP_RTO_MIN_MS));
+	tcb->rto = MIN(rto, (uint32_t)timer_ms_to_ticks(TCP_RTO_MAX_MS));
 }
 
-int tcp_close_connection(struct sock* sock)
+/**
+ * @brief Processes the acknowledgement and window of an incoming segment.
+ * Acknowledgements are cumulative, every segment ending before the
+ * acknowledged sequence number is removed from the retransmission queue.
+ * Round trip times are measured from the echoed timestamp when timestamps are used.
+ * Duplicate and new acknowledgements drive congestion control, see tcp_cong.c.
+ * @param sock socket the segment belongs to.
+ * @param hdr incoming TCP header, in network order.
+ * @param opts options of the segment.
+ * @param len payload length of the segment.
+ */
+static void tcp_recv_ack(struct sock* sock, struct tcp_header* hdr, struct tcp_options* opts, uint32_t len)
 {
-	sock->tcp->state = TCP_CLOSE_WAIT;
-	tcp_send_fin(sock);
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t seq = ntohl(hdr->seq);
+	uint32_t ack = ntohl(hdr->ack_seq);
+	uint32_t window = ntohs(hdr->window) << tcb->snd_wscale;
+	uint32_t mss = sock->tcp->tcpi_snd_mss;
+	struct sk_buff* seg;
+	uint32_t sent = 0;
+	int retransmit = 0;
+	int acked = 0;
+
+	if(TCP_SEQ_GT(ack, tcb->snd_nxt)){
+		dbgprintf("[TCP] Ack %d for data not yet sent (next %d)\n", ack, tcb->snd_nxt);
+		return;
+	}
 
-	WAIT(!(sock->tcp->state == TCP_CLOSED));
+	LOCK(sock, {
+		/* RFC 5681 section 2, a duplicate carries no data and does not move the window */
+		if(ack == tcb->snd_una && len == 0 && window == tcb->snd_wnd && SKB_QUEUE_READY(tcb->retransmit)){
+			retransmit = tcp_cong_on_dupack(tcb, mss);
+		}
+
+		/* Only newer segments update the window, RFC 793 SND.WL1 / SND.WL2 */
+		if(TCP_SEQ_LT(tcb->snd_wl1, seq) || (tcb->snd_wl1 == seq && TCP_SEQ_LEQ(tcb->snd_wl2, ack))){
+			tcb->snd_wnd = window;
+			tcb->snd_wl1 = seq;
+			tcb->snd_wl2 = ack;
+		}
+
+		if(TCP_SEQ_GT(ack, tcb->snd_una)){
+			retransmit = tcp_cong_on_ack(tcb, ack, ack - tcb->snd_una, mss);
+			tcb->snd_una = ack;
+			sock->tcp->retries = 0;
+
+			while((seg = tcb->retransmit->_head) != NULL && TCP_SEQ_LEQ(seg->seg.end_seq, ack)){
+				tcb->retransmit->ops->remove(tcb->retransmit);
+				if(seg->seg.sacked) tcb->sacked_out -= seg->len;
+
+				/* Karn's algorithm, retransmitted segments give ambiguous samples */
+				sent = seg->seg.retransmitted ? 0 : seg->seg.sent;
+				skb_free(seg);
+				acked++;
+			}
+
+			if((tcb->options & TCP_OPTION_TIMESTAMPS) && (opts->flags & TCP_OPTION_TIMESTAMPS) && opts->ts_ecr != 0){
+				/* RFC 7323 RTTM, also valid for retransmitted segments */
+				__tcp_rtt_sample(tcb, timer_get_tick() - opts->ts_ecr);
+			} else if(sent != 0){
+				__tcp_rtt_sample(tcb, timer_get_tick() - sent);
+			}
+
+			/* RFC 6298 5.2 and 5.3 */
+			if(SKB_QUEUE_READY(tcb->retransmit)){
+				ktimer_mod(&tcb->rto_timer, timer_get_tick() + tcb->rto);
+			} else {
+				ktimer_del(&tcb->rto_timer);
+			}
+		}
+
+		if(tcb->options & TCP_OPTION_SACK){
+			__tcp_sack_scoreboard(tcb, opts);
+		}
+	});
+
+	dbgprintf("[TCP] Ack %d, %d segments acknowledged, window %d, cwnd %d, sacked %d\n", ack, acked, tcb->snd_wnd, tcb->cwnd, tcb->sacked_out);
+
+	/* Fast retransmit, or the next holes during recovery */
+	if((tcb->options & TCP_OPTION_SACK) && (retransmit || tcb->ca_state == TCP_CA_RECOVERY)){
+		__tcp_sack_retransmit(sock, retransmit);
+	} else if(retransmit){
+		__tcp_retransmit(sock);
+	}
+
+	/* Send what the opened window and the acknowledged data allow */
+	__tcp_output(sock, 0);
+
+	/* Wake up processes waiting for everything to be acknowledged */
+	TCP_UNBLOCK(sock);
+}
+
+/**
+ * @brief Checks if a segment of size bytes fits in the send and congestion window.
+ */
+static int __tcp_window_room(struct sock* sock, uint32_t size)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	/* SACKed and lost segments are no longer in the network, RFC 6675 pipe */
+	uint32_t in_flight = tcb->snd_nxt - tcb->snd_una - tcb->sacked_out - tcb->lost_out;
+
+	if(tcb->retransmit->size >= TCP_RETRANSMIT_QUEUE_MAX) return 0;
+
+	return in_flight + size <= MIN(tcb->snd_wnd, tcb->cwnd);
+}
+
+/* Used as waitqueue condition, called with interrupts disabled. */
+static int __tcp_sndbuf_open(void* arg)
+{
+	struct sock* sock = arg;
+	return !__tcp_can_send(sock) || spsc_space(sock->tcp->tcb->sbuf) > 0;
+}
+
+/**
+ * @brief Builds segments from the send buffer and sends them.
+ * Runs on the networking thread, the only reader of the send buffer.
+ * Full segments are sent while the peers window and the congestion window allow.
+ * A smaller segment is held back while the socket is corked, or while data
+ * is unacknowledged unless TCP_NODELAY is set (Nagle, RFC 1122 4.2.3.4).
+ * @param sock socket to send on.
+ * @param probe send one segment even if the window is closed, zero window probe.
+ */
+static void __tcp_output(struct sock* sock, int probe)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t mss = sock->tcp->tcpi_snd_mss;
+	uint32_t unsent, size;
+	struct sk_buff* seg;
+	int blocked = 0;
+	int sent = 0;
+
+	while(__tcp_can_send(sock) && (unsent = spsc_used(tcb->sbuf)) > 0){
+		size = MIN(MIN(unsent, mss), SKB_DATA_SIZE);
+
+		if(size < mss && !probe){
+			if(sock->tcp->cork) break;
+			if(!sock->tcp->nodelay && tcb->snd_una != tcb->snd_nxt) break;
+		}
+
+		if(!probe && !__tcp_window_room(sock, size)){
+			blocked = 1;
+			break;
+		}
+
+		seg = skb_new();
+		if(seg == NULL) break;
+
+		spsc_read(tcb->sbuf, seg->head, size);
+		seg->len = size;
+		seg->seg.push = size == unsent;
+
+		__tcp_send_segment(sock, seg);
+		probe = 0;
+		sent++;
+	}
+
+	/* The peer closed its window with nothing in flight, probe it when the timer expires */
+	if(blocked && tcb->snd_una == tcb->snd_nxt && !tcb->rto_timer.pending){
+		ktimer_mod(&tcb->rto_timer, timer_get_tick() + tcb->rto);
+	}
+
+	/* Wake up senders waiting for buffer space */
+	if(sent > 0) TCP_UNBLOCK(sock);
+
+	/* Closed by the application, the FIN follows once everything was sent and acknowledged */
+	if(tcb->fin_pending && __tcp_can_send(sock) && spsc_used(tcb->sbuf) == 0 && tcb->snd_una == tcb->snd_nxt){
+		if(tcp_send_fin(sock) == ERROR_OK){
+			tcb->fin_pending = 0;
+			sock->tcp->state = sock->tcp->state == TCP_ESTABLISHED ? TCP_FIN_WAIT : TCP_LAST_ACK;
+		}
+	}
+}
+
+static void __tcp_output_work(void* arg)
+{
+	struct tcb* tcb = arg;
+	__tcp_output(tcb->sock, 0);
+}
+
+static int __tcp_closed(void* arg)
+{
+	struct sock* sock = arg;
+	return sock->tcp->state == TCP_CLOSED;
+}
+
+/**
+ * @brief Sends data over an established connection.
+ * Data is copied into the send buffer and sent by the networking thread,
+ * returns once all data is buffered. Blocks only while the buffer is full.
+ * @param sock generic socket to send from.
+ * @param data given data to send.
+ * @param len length of data.
+ * @return int bytes buffered, less than 0 on failure.
+ */
+int tcp_send(struct sock* sock, uint8_t* data, uint32_t len)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t sent = 0;
+	uint32_t size;
+
+	while(sent < len){
+		/* The socket was closed and freed while waiting */
+		if(waitqueue_wait(&sock->wq, __tcp_sndbuf_open, sock, WAITQUEUE_FOREVER) < 0){
+			return -ERROR_INVALID_SOCKET;
+		}
+		if(!__tcp_can_send(sock)){
+			return sent > 0 ? (int)sent : -ERROR_INVALID_SOCKET;
+		}
+
+		size = MIN(len - sent, spsc_space(tcb->sbuf));
+		spsc_write(tcb->sbuf, data + sent, size);
+		sent += size;
+
+		net_defer(&tcb->output_work);
+	}
+
+	return sent;
+}
+
+/**
+ * @brief Sets a IPPROTO_TCP level socket option.
+ * Clearing TCP_CORK or setting TCP_NODELAY sends what is buffered.
+ * @return error_t 0 on success, less than 0 on error.
+ */
+error_t tcp_setsockopt(struct sock* sock, int name, int value)
+{
+	if(sock->tcp == NULL) return -ERROR_INVALID_SOCKET;
+
+	switch (name){
+	case TCP_NODELAY:
+		sock->tcp->nodelay = value != 0;
+		break;
+	case TCP_CORK:
+		sock->tcp->cork = value != 0;
+		break;
+	default:
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	net_defer(&sock->tcp->tcb->output_work);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Reads a IPPROTO_TCP level socket option.
+ * @return error_t 0 on success, less than 0 on error.
+ */
+error_t tcp_getsockopt(struct sock* sock, int name, int* value)
+{
+	if(sock->tcp == NULL) return -ERROR_INVALID_SOCKET;
+
+	switch (name){
+	case TCP_NODELAY:
+		*value = sock->tcp->nodelay;
+		return ERROR_OK;
+	case TCP_CORK:
+		*value = sock->tcp->cork;
+		return ERROR_OK;
+	default:
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+}
+
+/**
+ * @brief Fills in connection statistics.
+ * @return int 0 on success, less than 0 if sock is not a TCP socket.
+ */
+int tcp_get_info(struct sock* sock, struct tcp_info* info)
+{
+	if(sock == NULL || sock->tcp == NULL) return -ERROR_INVALID_SOCKET;
+
+	struct tcb* tcb = sock->tcp->tcb;
+	int ticks = timer_ms_to_ticks(1000);
+
+	info->tcpi_rtt = ((tcb->srtt >> 3) * 1000) / ticks;
+	info->tcpi_rttvar = ((tcb->rttvar >> 2) * 1000) / ticks;
+	info->tcpi_rto = (tcb->rto * 1000) / ticks;
+	info->tcpi_retransmits = sock->tcp->retransmits;
+	info->tcpi_snd_mss = sock->tcp->tcpi_snd_mss;
+	info->tcpi_snd_wnd = tcb->snd_wnd;
+	info->tcpi_unacked = tcb->retransmit->size;
+	info->tcpi_snd_cwnd = tcb->cwnd;
+	info->tcpi_snd_ssthresh = tcb->ssthresh;
+	info->tcpi_ca_state = tcb->ca_state;
+	info->tcpi_cong = tcb->cong->name;
+	info->tcpi_sacked = tcb->sacked_out;
+	info->tcpi_ooo = tcb->ooo_count;
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Copies the counters kept over all connections.
+ */
+void tcp_get_stats(struct tcp_stats* stats)
+{
+	*stats = tcp_manager.stats;
+}
+
+/**
+ * @brief Called after the application read from the receive queue.
+ * The buffer is doubled when the application reads more than half of it
+ * within a round trip, the window limited the sender (dynamic right sizing).
+ * A window update is sent once the window opened by an MSS or half the buffer,
+ * smaller updates are not worth a segment (RFC 1122 4.2.3.3).
+ * @param sock stream socket that was read.
+ * @param copied bytes read.
+ */
+void tcp_read_done(struct sock* sock, uint32_t copied)
+{
+	struct tcb* tcb;
+	uint32_t now = timer_get_tick();
+	uint32_t round;
+
+	if(sock->tcp == NULL || sock->tcp->state != TCP_ESTABLISHED) return;
+	tcb = sock->tcp->tcb;
+
+	if(!sock->rcvbuf_locked){
+		/* One round trip, or the initial timeout before the first sample */
+		round = tcb->srtt != 0 ? MAX(tcb->srtt >> 3, 1) : tcb->rto;
+
+		sock->rcvbuf_tune.copied += copied;
+		if(now - sock->rcvbuf_tune.start >= round){
+			if(sock->rcvbuf_tune.copied * 2 >= sock->rcvbuf && sock->rcvbuf < NET_SOCK_RCVBUF_MAX){
+				sock->rcvbuf = MIN(sock->rcvbuf * 2, NET_SOCK_RCVBUF_MAX);
+				dbgprintf("[TCP] Socket %d receive buffer grown to %d\n", sock->socket, sock->rcvbuf);
+			}
+
+			sock->rcvbuf_tune.copied = 0;
+			sock->rcvbuf_tune.start = now;
+		}
+	}
+
+	if(net_sock_rcvbuf_space(sock) >= tcb->rcv_wnd + MIN(sock->rcvbuf / 2, sock->tcp->tcpi_rcv_mss)){
+		tcp_send_ack(sock);
+	}
+}
+
+/**
+ * @brief Takes the oldest established connection from a listener.
+ * Blocks while the accept queue is empty, the connection was already
+ * set up by the networking thread when the handshake completed.
+ * @param sock listening socket.
+ * @return struct sock* connected socket, NULL if sock is not or no longer listening.
+ */
+struct sock* tcp_accept_connection(struct sock* sock)
+{
+	struct sock* child = NULL;
+
+	while(child == NULL){
+		if(sock->tcp == NULL || sock->tcp->state != TCP_LISTEN){
+			dbgprintf("[TCP] Socket %d is not listening\n", sock->socket);
+			return NULL;
+		}
+
+		/* The listener was closed and freed while waiting */
+		if(waitqueue_wait(&sock->wq, __tcp_accept_ready, sock, WAITQUEUE_FOREVER) < 0){
+			return NULL;
+		}
+
+		CRITICAL_SECTION({
+			child = sock->backlog.accept_head;
+			if(child != NULL){
+				sock->backlog.accept_head = child->queue_next;
+				if(sock->backlog.accept_head == NULL) sock->backlog.accept_tail = NULL;
+				sock->backlog.count--;
+
+				child->queue_next = NULL;
+				child->parent = NULL;
+			}
+		});
+	}
+
+	child->owner = $process->current;
+	return child;
+}
+
+/**
+ * @brief Sends a bare acknowledgement for everything received so far.
+ */
+int tcp_send_ack(struct sock* sock)
+{
+	struct sk_buff* skb = skb_new();
+	ERR_ON_NULL(skb);
+
+	struct tcp_header hdr = {
+		.source = sock->bound_port,
+		.dest = sock->recv_addr.sin_port,
+		.seq = sock->tcp->tcb->snd_nxt,
+		.ack_seq = sock->tcp->tcb->rcv_nxt,
+		.ack = 1
+	};
+
+	dbgprintf("[TCP] Sending ack for %d (seq: %d)\n", hdr.ack_seq, hdr.seq);
+	tcp_manager.stats.acks_out++;
+
+	__tcp_send(sock, &hdr, skb, NULL, 0);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Sends the SYN of an active open.
+ * The SYN is queued for retransmission like data, it is resent with
+ * backoff until the SYN ACK arrives or the connection is dropped.
+ * @return int 0 on success, less than 0 on failure.
+ */
+int tcp_connect(struct sock* sock)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sk_buff* seg = skb_new();
+	ERR_ON_NULL(seg);
+
+	sock->tcp->tcpi_rcv_mss = __tcp_mss(sock);
+	tcb->rcv_wscale = __tcp_wscale(sock);
+
+	tcb->iss = __tcp_iss(sock);
+	tcb->snd_una = tcb->iss;
+	tcb->snd_nxt = tcb->iss;
+
+	seg->len = 0;
+	seg->seg.syn = 1;
+
+	__tcp_send_segment(sock, seg);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Takes the acknowledged SYN off the retransmission queue.
+ * The round trip time is sampled unless the SYN was resent.
+ */
+static void __tcp_syn_acked(struct sock* sock)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sk_buff* seg;
+
+	LOCK(sock, {
+		while((seg = tcb->retransmit->ops->remove(tcb->retransmit)) != NULL){
+			if(!seg->seg.retransmitted) __tcp_rtt_sample(tcb, timer_get_tick() - seg->seg.sent);
+			skb_free(seg);
+		}
+		ktimer_del(&tcb->rto_timer);
+	});
+	sock->tcp->retries = 0;
+}
+
+/**
+ * @brief Sends the SYN ACK of a connection in the handshake, also used to resend it.
+ */
+static int __tcp_send_synack(struct sock* sock)
+{
+	struct sk_buff* skb;
+	struct tcp_header hdr = {
+		.source = sock->bound_port,
+		.dest = sock->recv_addr.sin_port,
+		.seq = sock->tcp->tcb->iss,
+		.ack_seq = sock->tcp->tcb->rcv_nxt,
+		.syn = 1,
+		.ack = 1
+	};
+
+	skb = skb_new();
+	ERR_ON_NULL(skb);
+
+	if(__tcp_send(sock, &hdr, skb, NULL, 0) < 0){
+		dbgprintf("[TCP] Failed to send syn ack\n");
+		return -1;
+	}
 
 	return ERROR_OK;
 }
 
+/**
+ * @brief Answers a SYN on a new connection created for it by the listener.
+ * @param sock connection in TCP_PREPARE, options already negotiated.
+ * @param tcp header of the SYN.
+ * @return int 0 on success, less than 0 on failure.
+ */
+int tcp_recv_syn(struct sock* sock, struct tcp_header* tcp)
+{
+	if (sock->tcp->state != TCP_PREPARE){
+		dbgprintf("[TCP] Socket %d is not waiting for a SYN\n", sock->socket);
+		return -1;
+	}
+
+	sock->tcp->tcb->irs = ntohl(tcp->seq);
+	sock->tcp->tcb->rcv_nxt = ntohl(tcp->seq) + 1;
+	sock->tcp->tcb->iss = __tcp_iss(sock);
+	sock->tcp->tcb->snd_una = sock->tcp->tcb->iss;
+	sock->tcp->syn_received = timer_get_tick();
+
+	if(__tcp_send_synack(sock) < 0) return -1;
+
+	/* The SYN flag consumes a sequence number */
+	sock->tcp->tcb->snd_nxt = sock->tcp->tcb->iss + 1;
+	sock->tcp->state = TCP_SYN_RCVD;
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Drops handshakes that did not complete in time from a listeners SYN queue.
+ * Runs on the networking thread, which is the only one adding to the SYN queue.
+ */
+static void __tcp_synq_expire(struct sock* listener)
+{
+	uint32_t now = timer_get_tick();
+	uint32_t timeout = timer_ms_to_ticks(TCP_SYN_RCVD_TIMEOUT_MS);
+	struct sock* expired = NULL;
+	struct sock** iter;
+	struct sock* child;
+
+	CRITICAL_SECTION({
+		iter = (struct sock**) &listener->backlog.syn_queue;
+		while(*iter != NULL){
+			child = *iter;
+			if(now - child->tcp->syn_received < timeout){
+				iter = &child->queue_next;
+				continue;
+			}
+
+			*iter = child->queue_next;
+			listener->backlog.syn_count--;
+			child->queue_next = expired;
+			expired = child;
+		}
+	});
+
+	while((child = expired) != NULL){
+		expired = child->queue_next;
+		dbgprintf("[TCP] Handshake with %i:%d timed out\n", ntohl(child->recv_addr.sin_addr.s_addr), ntohs(child->recv_addr.sin_port));
+
+		child->parent = NULL;
+		kernel_sock_cleanup(child);
+	}
+}
+
+/**
+ * @brief Handles a SYN on a listening socket.
+ * A new socket is created for the connection and placed on the listeners
+ * SYN queue, the listener itself never leaves TCP_LISTEN. SYNs are dropped
+ * while the SYN queue or the accept queue is full.
+ * @return int 0 on success, less than 0 if the SYN was dropped.
+ */
+static int __tcp_listen_syn(struct sock* listener, struct sk_buff* skb, struct tcp_options* opts)
+{
+	struct tcp_header* hdr = skb->hdr.tcp;
+	struct sockaddr_in addr;
+	struct sock* child;
+
+	if(listener->backlog.syn_count >= tcp_get_syn_backlog()){
+		__tcp_synq_expire(listener);
+	}
+
+	if(listener->backlog.syn_count >= tcp_get_syn_backlog() || listener->backlog.count >= listener->backlog.size){
+		dbgprintf("[TCP] Listen queue of socket %d is full, dropping SYN\n", listener->socket);
+		listener->backlog.syn_overflows++;
+		return -1;
+	}
+
+	child = kernel_socket_create(listener->domain, listener->type, listener->protocol);
+	if(child == NULL) return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = hdr->source;
+	addr.sin_addr.s_addr = skb->hdr.ip->saddr;
+	if(net_prepare_tcp_sock(child, listener->bound_port, &addr) < 0){
+		kernel_sock_cleanup(child);
+		return -1;
+	}
+
+	/* Options set on the listener apply to its connections */
+	child->rcvbuf = listener->rcvbuf;
+	child->rcvbuf_locked = listener->rcvbuf_locked;
+	child->tcp->nodelay = listener->tcp->nodelay;
+
+	__tcp_negotiate(child, opts);
+	if(tcp_recv_syn(child, hdr) < 0){
+		kernel_sock_cleanup(child);
+		return -1;
+	}
+
+	CRITICAL_SECTION({
+		child->parent = listener;
+		child->queue_next = listener->backlog.syn_queue;
+		listener->backlog.syn_queue = child;
+		listener->backlog.syn_count++;
+	});
+
+	dbgprintf("[TCP] Socket %d received SYN from %i:%d\n", listener->socket, ntohl(addr.sin_addr.s_addr), ntohs(addr.sin_port));
+
+	return ERROR_OK;
+}
+
+/**
+ * @brief Completes the handshake of a connection on a listeners SYN queue.
+ * The connection is established and moved to the accept queue, if the
+ * accept queue is full the ACK is dropped and the connection stays in the SYN queue.
+ * @return int 0 on success, less than 0 if the ACK was dropped.
+ */
+static int __tcp_synq_complete(struct sock* sock, struct tcp_header* hdr)
+{
+	struct sock* listener = sock->parent;
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sock** iter;
+
+	if(listener == NULL) return -1;
+
+	if(listener->backlog.count >= listener->backlog.size){
+		dbgprintf("[TCP] Accept queue of socket %d is full\n", listener->socket);
+		listener->backlog.accept_overflows++;
+		return -1;
+	}
+
+	tcb->snd_una = ntohl(hdr->ack_seq);
+	tcb->snd_wnd = ntohs(hdr->window) << tcb->snd_wscale;
+	tcb->snd_wl1 = ntohl(hdr->seq);
+	tcb->snd_wl2 = ntohl(hdr->ack_seq);
+	tcb->rcv_acked = tcb->rcv_nxt;
+	tcb->quickack = TCP_QUICKACK_SEGMENTS;
+	tcp_cong_init(tcb, sock->tcp->tcpi_snd_mss);
+	sock->tcp->state = TCP_ESTABLISHED;
+
+	CRITICAL_SECTION({
+		for (iter = (struct sock**) &listener->backlog.syn_queue; *iter != NULL; iter = &(*iter)->queue_next){
+			if(*iter != sock) continue;
+
+			*iter = sock->queue_next;
+			listener->backlog.syn_count--;
+			break;
+		}
+
+		sock->queue_next = NULL;
+		if(listener->backlog.accept_tail != NULL){
+			listener->backlog.accept_tail->queue_next = sock;
+		} else {
+			listener->backlog.accept_head = sock;
+		}
+		listener->backlog.accept_tail = sock;
+		listener->backlog.count++;
+	});
+
+	dbgprintf("[TCP] Socket %d established, %d waiting for accept\n", sock->socket, listener->backlog.count);
+
+	TCP_UNBLOCK(listener);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Sends a FIN, queued for retransmission like data.
+ * @return int 0 once the FIN is queued, less than 0 if it could not be allocated.
+ */
+int tcp_send_fin(struct sock* sock)
+{
+	struct sk_buff* seg = skb_new();
+	ERR_ON_NULL(seg);
+
+	seg->len = 0;
+	seg->seg.fin = 1;
+
+	dbgprintf("[TCP] Sending fin for %d\n", sock->socket);
+
+	/* A failed transmission is covered by the retransmission timer */
+	__tcp_send_segment(sock, seg);
+	return ERROR_OK;
+}
+
+/**
+ * @brief Closes the sending side, the networking thread sends the FIN
+ * after all buffered data was sent and acknowledged.
+ * Returns when the connection is closed in both directions or dropped,
+ * after TCP_CLOSE_TIMEOUT_MS it is given up.
+ * @return int 0 when closed, less than 0 if the socket was freed while waiting.
+ */
+int tcp_close_connection(struct sock* sock)
+{
+	int ret;
+
+	if(!__tcp_can_send(sock)) return ERROR_OK;
+
+	sock->tcp->cork = 0;
+	sock->tcp->tcb->fin_pending = 1;
+	net_defer(&sock->tcp->tcb->output_work);
+
+	ret = waitqueue_wait(&sock->wq, __tcp_closed, sock, timer_ms_to_ticks(TCP_CLOSE_TIMEOUT_MS));
+	if(ret == -ERROR_TIMEOUT){
+		dbgprintf("[TCP] Socket %d: close timed out in %s\n", sock->socket, tcp_state_to_str(sock->tcp->state));
+		sock->tcp->state = TCP_CLOSED;
+	}
+
+	/* Freed by another thread while waiting */
+	return ret == -ERROR_TIMEOUT ? ERROR_OK : ret;
+}
+
+/* Drops len bytes from the front of a received segment */
+static inline void __tcp_trim(struct sk_buff* skb, uint32_t len)
+{
+	skb->data += len;
+	skb->data_len -= len;
+	skb->seg.seq += len;
+}
+
+/* Drops len bytes from the end of a received segment */
+static inline void __tcp_trim_tail(struct sk_buff* skb, uint32_t len)
+{
+	skb->data_len -= len;
+	skb->seg.end_seq -= len;
+}
+
+/**
+ * @brief Rebuilds the SACK blocks reported to the peer from the out-of-order queue.
+ * Adjacent segments are merged, the block with the most recent segment
+ * is reported first (RFC 2018 section 4).
+ */
+static void __tcp_sack_update(struct tcb* tcb)
+{
+	struct tcp_sack_block blocks[TCP_OOO_MAX];
+	struct sk_buff* skb = tcb->ooo;
+	int count = 0;
+	int first = 0;
+
+	while(skb != NULL && count < TCP_OOO_MAX){
+		blocks[count].start = skb->seg.seq;
+		blocks[count].end = skb->seg.end_seq;
+
+		for (skb = skb->next; skb != NULL && TCP_SEQ_LEQ(skb->seg.seq, blocks[count].end); skb = skb->next){
+			if(TCP_SEQ_GT(skb->seg.end_seq, blocks[count].end)) blocks[count].end = skb->seg.end_seq;
+		}
+
+		if(TCP_SEQ_GEQ(tcb->sack_last, blocks[count].start) && TCP_SEQ_LT(tcb->sack_last, blocks[count].end)){
+			first = count;
+		}
+		count++;
+	}
+
+	CRITICAL_SECTION({
+		tcb->sack_count = MIN(count, TCP_SACK_MAX_BLOCKS);
+		if(count > 0) tcb->sack[0] = blocks[first];
+
+		for (int i = 0, j = 1; i < count && j < TCP_SACK_MAX_BLOCKS; i++){
+			if(i != first) tcb->sack[j++] = blocks[i];
+		}
+	});
+}
+
+/**
+ * @brief Keeps a segment that arrived ahead of RCV.NXT for reassembly.
+ * The queue is sorted by sequence number, segments already covered
+ * by queued data are not kept.
+ * @return int 1 if the segment was queued, 0 if the caller should free it.
+ */
+static int __tcp_ooo_queue(struct tcb* tcb, struct sk_buff* skb)
+{
+	struct sk_buff** iter = &tcb->ooo;
+
+	if(tcb->ooo_count >= TCP_OOO_MAX) return 0;
+
+	while(*iter != NULL && TCP_SEQ_LEQ((*iter)->seg.seq, skb->seg.seq)){
+		if(TCP_SEQ_GEQ((*iter)->seg.end_seq, skb->seg.end_seq)) return 0;
+		iter = &(*iter)->next;
+	}
+
+	skb->next = *iter;
+	*iter = skb;
+	tcb->ooo_count++;
+
+	return 1;
+}
+
+/**
+ * @brief Delivers queued segments the gap before them was filled for.
+ */
+static void __tcp_ooo_drain(struct sock* sock)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	struct sk_buff* skb;
+
+	while((skb = tcb->ooo) != NULL && TCP_SEQ_LEQ(skb->seg.seq, tcb->rcv_nxt)){
+		tcb->ooo = skb->next;
+		skb->next = NULL;
+		tcb->ooo_count--;
+
+		if(TCP_SEQ_LEQ(skb->seg.end_seq, tcb->rcv_nxt)){
+			skb_free(skb);
+			continue;
+		}
+
+		__tcp_trim(skb, tcb->rcv_nxt - skb->seg.seq);
+		tcb->rcv_nxt = skb->seg.end_seq;
+
+		net_sock_add_stream(sock, skb);
+	}
+
+	__tcp_sack_update(tcb);
+}
+
+/* Timer callback, runs in the timer interrupt. */
+static void __tcp_delack_expired(struct ktimer* timer)
+{
+	struct tcb* tcb = timer->data;
+	net_defer(&tcb->delack_work);
+}
+
+/**
+ * @brief Delayed acknowledgement timeout, runs on the networking thread.
+ * Nothing is sent if a segment carried the acknowledgement in the meantime.
+ */
+static void __tcp_delack_timeout(void* arg)
+{
+	struct tcb* tcb = arg;
+
+	if(tcb->rcv_acked == tcb->rcv_nxt) return;
+
+	tcp_manager.stats.acks_delayed++;
+	tcp_send_ack(tcb->sock);
+}
+
+/**
+ * @brief Acknowledges received data, immediately or delayed.
+ * @param sock socket data was received on.
+ * @param now acknowledge immediately, used for out-of-order and duplicate data.
+ */
+static void __tcp_ack_schedule(struct sock* sock, int now)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+
+	if(tcb->quickack > 0){
+		tcb->quickack--;
+		now = 1;
+	}
+
+	if(now || tcb->rcv_nxt - tcb->rcv_acked >= TCP_DELACK_SEGMENTS * sock->tcp->tcpi_rcv_mss){
+		tcp_send_ack(sock);
+		return;
+	}
+
+	if(!tcb->delack_timer.pending){
+		ktimer_mod(&tcb->delack_timer, timer_get_tick() + timer_ms_to_ticks(TCP_DELACK_MS));
+	}
+}
+
+/**
+ * @brief Processes the payload of a segment on an established connection.
+ * In order data is delivered together with any queued segments it
+ * connects to, data ahead of RCV.NXT is queued for reassembly and
+ * reported to the sender with SACK blocks. Out-of-order data and data
+ * filling a gap is acknowledged immediately, in order data is delayed.
+ * Data beyond the free space of the receive buffer is dropped.
+ * @param sock socket the segment belongs to.
+ * @param skb segment with data, consumed.
+ */
+static void tcp_recv_data(struct sock* sock, struct sk_buff* skb)
+{
+	struct tcb* tcb = sock->tcp->tcb;
+	uint32_t window_end;
+	int filled;
+
+	tcp_manager.stats.data_segs_in++;
+
+	skb->seg.seq = ntohl(skb->hdr.tcp->seq);
+	skb->seg.end_seq = skb->seg.seq + skb->data_len;
+
+	/* Outside the window, the sender resends it once the reader made room, RFC 793 3.3 */
+	window_end = tcb->rcv_nxt + net_sock_rcvbuf_space(sock);
+	if(TCP_SEQ_GEQ(skb->seg.seq, window_end)){
+		dbgprintf("[TCP] Segment %d beyond window end %d\n", skb->seg.seq, window_end);
+		__tcp_ack_schedule(sock, 1);
+		skb_free(skb);
+		return;
+	}
+
+	if(TCP_SEQ_GT(skb->seg.end_seq, window_end)){
+		__tcp_trim_tail(skb, skb->seg.end_seq - window_end);
+	}
+
+	if(TCP_SEQ_GT(skb->seg.seq, tcb->rcv_nxt)){
+		dbgprintf("[TCP] Out-of-order segment %d, expected %d\n", skb->seg.seq, tcb->rcv_nxt);
+
+		if(__tcp_ooo_queue(tcb, skb)){
+			tcb->sack_last = skb->seg.seq;
+			__tcp_sack_update(tcb);
+		} else {
+			skb_free(skb);
+		}
+
+		/* Duplicate acknowledgement so the sender can fast retransmit, RFC 5681 4.2 */
+		__tcp_ack_schedule(sock, 1);
+		return;
+	}
+
+	/* Already received, the acknowledgement was probably lost */
+	if(TCP_SEQ_LEQ(skb->seg.end_seq, tcb->rcv_nxt)){
+		__tcp_ack_schedule(sock, 1);
+		skb_free(skb);
+		return;
+	}
+
+	__tcp_trim(skb, tcb->rcv_nxt - skb->seg.seq);
+	tcb->rcv_nxt = skb->seg.end_seq;
+
+	net_sock_add_stream(sock, skb);
+
+	/* The sender is in recovery and waits for the gap to be acknowledged */
+	filled = tcb->ooo != NULL;
+	if(filled) __tcp_ooo_drain(sock);
+
+	__tcp_ack_schedule(sock, filled);
+}
+
+/**
+ * @brief Processes a FIN segment, its payload is delivered first.
+ * The FIN is only accepted once all data before it was received,
+ * otherwise the segment is acknowledged so the peer resends it.
+ * @param sock socket the segment belongs to.
+ * @param skb segment with the FIN set, consumed.
+ * @return int 1 if the FIN was accepted, 0 if not.
+ */
+static int __tcp_recv_fin(struct sock* sock, struct sk_buff* skb, struct tcp_options* opts)
+{
+	struct tcp_header* hdr = skb->hdr.tcp;
+	uint32_t data_len = skb->data_len;
+	uint32_t fin_seq = ntohl(hdr->seq) + data_len;
+
+	dbgprintf("[TCP] Socket %d received fin at %d\n", sock->socket, fin_seq);
+	tcp_recv_ack(sock, hdr, opts, data_len + 1);
+
+	if(data_len > 0){
+		tcp_recv_data(sock, skb);
+	} else {
+		skb_free(skb);
+	}
+
+	if(fin_seq != sock->tcp->tcb->rcv_nxt){
+		dbgprintf("[TCP] FIN at %d out of order, expected %d\n", fin_seq, sock->tcp->tcb->rcv_nxt);
+		/* Out-of-order data was acknowledged by tcp_recv_data */
+		if(data_len == 0) tcp_send_ack(sock);
+		return 0;
+	}
+
+	sock->tcp->tcb->rcv_nxt = fin_seq + 1;
+	tcp_send_ack(sock);
+
+	/* No more data will arrive, readers get what is queued and then end of stream */
+	sock->data_ready = -1;
+	TCP_UNBLOCK(sock);
+	return 1;
+}
+
 int tcp_parse(struct sk_buff* skb)
 {
 	/* Look if there is an active TCP connection, if not look for accept. */
@@ -565,142 +1857,144 @@ int tcp_parse(struct sk_buff* skb)
 		return -1;
 	}
 
+	struct tcp_options opts;
+	__tcp_parse_options(hdr, &opts);
+
 	dbgprintf("[TCP] Incoming TCP packet: %d syn, %d ack, %d fin %d push\n", hdr->syn, hdr->ack, hdr->fin, hdr->psh);
 
 	switch (sk->tcp->state){
 	case TCP_LISTEN:
 		if(hdr->syn == 1 && hdr->ack == 0){
+			if(__tcp_listen_syn(sk, skb, &opts) < 0) return -1;
 
-			if(sk->backlog.count == sk->backlog.size){
-				dbgprintf("[TCP] Backlog is full, dropping packet\n");
-				return -1;
-			}
-
-			/**
-			 * @brief Store the remote address in recv_addr of
-			 * listening socket. This will be overwritten for each
-			 * new accepted socket.
-			 * This is techinically bad as we access IP in TCP.
-			 */
-			sk->recv_addr.sin_port = hdr->source;
-			sk->recv_addr.sin_addr.s_addr = skb->hdr.ip->saddr;
-
-			dbgprintf("Socket %d received syn for %d\n", sk, hdr->seq);
-
-			return tcp_recv_syn(sk, hdr);
+			skb_free(skb);
+			return ERROR_OK;
 		}
 		break;
 	case TCP_SYN_RCVD:
-		if(hdr->syn == 0 && hdr->ack == 1){
-			/**
-			 * @brief Add to backlog 
-			 * 
-			 */
-			if(sk->backlog.count < sk->backlog.size){
-				sk->backlog.queue->ops->add(sk->backlog.queue, skb);
-				sk->backlog.count++;
+		/* Our SYN ACK was lost and the peer resent its SYN */
+		if(hdr->syn == 1 && hdr->ack == 0){
+			__tcp_send_synack(sk);
+			skb_free(skb);
+			return ERROR_OK;
+		}
+
+		if(hdr->syn == 0 && hdr->ack == 1 && ntohl(hdr->ack_seq) == sk->tcp->tcb->snd_nxt){
+			if(__tcp_synq_complete(sk, hdr) < 0) return -1;
+
+			if((sk->tcp->tcb->options & TCP_OPTION_TIMESTAMPS) && (opts.flags & TCP_OPTION_TIMESTAMPS)){
+				sk->tcp->tcb->ts_recent = opts.ts_val;
 			}
 
-			dbgprintf("Received ACK for SYN (%d)\n", sk->socket);
-			sk->tcp->state = TCP_LISTEN;
+			/* The ACK may already carry data */
+			if(skb->data_len > 0 && hdr->fin == 0){
+				tcp_recv_data(sk, skb);
+				return ERROR_OK;
+			}
 
-			TCP_UNBLOCK(sk);
+			skb_free(skb);
 			return ERROR_OK;
 		}
 		break;
 	
 	case TCP_SYN_SENT:
 		if(hdr->syn == 1 && hdr->ack == 1){
-			tcp_send_ack(sk, hdr, 1);
+			if(ntohl(hdr->ack_seq) != sk->tcp->tcb->snd_nxt){
+				dbgprintf("[TCP] SYN ACK acknowledges %d, expected %d\n", ntohl(hdr->ack_seq), sk->tcp->tcb->snd_nxt);
+				return -1;
+			}
+
+			__tcp_negotiate(sk, &opts);
+			__tcp_syn_acked(sk);
+
+			sk->tcp->tcb->snd_una = ntohl(hdr->ack_seq);
+			sk->tcp->tcb->snd_wnd = ntohs(hdr->window);
+			sk->tcp->tcb->snd_wl1 = ntohl(hdr->seq);
+			sk->tcp->tcb->snd_wl2 = ntohl(hdr->ack_seq);
+			sk->tcp->tcb->rcv_nxt = ntohl(hdr->seq) + 1;
+			sk->tcp->tcb->quickack = TCP_QUICKACK_SEGMENTS;
+			tcp_cong_init(sk->tcp->tcb, sk->tcp->tcpi_snd_mss);
+			tcp_send_ack(sk);
 			sk->tcp->state = TCP_ESTABLISHED;
+			TCP_UNBLOCK(sk);
 
 			dbgprintf("Socket %d set to established\n", sk);
 			skb_free(skb);
 			return ERROR_OK;
 		}
 		break;
-	case TCP_WAIT_ACK:
-		if(hdr->syn == 0 && hdr->ack == 1){
-			
-			/* check if i get a already acked retransmit */
-			if(sk->tcp->sequence > htonl(hdr->ack_seq)){
-				dbgprintf("[TCP] Received ack for already acked packet %d - %d\n", htonl(hdr->ack_seq), sk->tcp->acknowledgement);
+	case TCP_ESTABLISHED:
+		/* Remember the timestamp to echo, RFC 7323 section 4.3 */
+		if((sk->tcp->tcb->options & TCP_OPTION_TIMESTAMPS) && (opts.flags & TCP_OPTION_TIMESTAMPS)
+			&& TCP_SEQ_LEQ(ntohl(hdr->seq), sk->tcp->tcb->rcv_nxt)){
+			sk->tcp->tcb->ts_recent = opts.ts_val;
+		}
+
+		if(hdr->syn == 0 && hdr->ack == 1 && hdr->fin == 0){
+			tcp_recv_ack(sk, hdr, &opts, skb->data_len);
+
+			/* Pure acknowledgements are not acknowledged */
+			if(skb->data_len == 0){
 				skb_free(skb);
 				return ERROR_OK;
 			}
 
-			dbgprintf("Socket %d received ack for %d\n", sk, htonl(hdr->ack_seq));
-			tcp_recv_ack(sk, hdr);
-			skb_free(skb);
+			dbgprintf("Socket %d received data for %d\n", sk, htonl(hdr->ack_seq));
+			tcp_recv_data(sk, skb);
+			return ERROR_OK;
+		}
+
+		if(hdr->fin == 1 && hdr->ack == 1){
+			/* The application may still send, the FIN is sent when it closes */
+			if(__tcp_recv_fin(sk, skb, &opts)){
+				sk->tcp->state = TCP_CLOSE_WAIT;
+			}
 			return ERROR_OK;
 		}
 		break;
-	case TCP_ESTABLISHED:
+	case TCP_FIN_WAIT:
+	case TCP_FIN_WAIT_2:
+		/* Our side is closed, the peer may still send data */
 		if(hdr->syn == 0 && hdr->ack == 1 && hdr->fin == 0){
-			dbgprintf("Socket %d received data for %d\n", sk, htonl(hdr->ack_seq));
-			/**
-			 * @brief This is where we should check if the packet is in order.
-			 * @see https://github.com/joexbayer/RetrOS-32/issues/34
-			 * TODO: check if packet is in order.
-			 * Probably need to check if the sequence number is equal to the expected sequence number.
-			 * If not, we should probably drop the packet and wait for the correct one. 
-			 * (We should probably also send a NACK to the sender)
-			 * 
-			 * We will not buffer packets for now, but we should probably do that in the future.
-			 * sock->tcp->sequence == htonl(tcp->seq)
-			 */
-			if (sk->tcp->acknowledgement != htonl(hdr->seq)) {
-				dbgprintf("[TCP] Out-of-order packet received. Expected seq: %d, received seq: %d\n",sk->tcp->acknowledgement, htonl(hdr->seq));
-				return -1;
+			tcp_recv_ack(sk, hdr, &opts, skb->data_len);
+			if(sk->tcp->state == TCP_FIN_WAIT && sk->tcp->tcb->snd_una == sk->tcp->tcb->snd_nxt){
+				sk->tcp->state = TCP_FIN_WAIT_2;
 			}
 
-			tcp_send_ack(sk, hdr, skb->data_len);
-
-			int ret = net_sock_add_data(sk, skb);
-			if(ret == 0)
+			if(skb->data_len > 0){
+				tcp_recv_data(sk, skb);
+			} else {
 				skb_free(skb);
+			}
 			return ERROR_OK;
 		}
 
 		if(hdr->fin == 1 && hdr->ack == 1){
-			dbgprintf("Socket %d received fin for %d\n", sk, htonl(hdr->ack_seq));
-			tcp_send_ack(sk, hdr, 1);
-
-			/**
-			 * @brief Wait if data still needs to be sent.
-			 * If we receive a fin/ack, we ack it but only send
-			 * a fin if we have no more data to send.
-			 */
-			tcp_send_fin(sk);
-			sk->tcp->state = TCP_CLOSE_WAIT2;
-			skb_free(skb);
+			if(__tcp_recv_fin(sk, skb, &opts)){
+				/* Simultaneous close if our FIN is not acknowledged yet */
+				sk->tcp->state = sk->tcp->tcb->snd_una == sk->tcp->tcb->snd_nxt ? TCP_CLOSED : TCP_CLOSING;
+				TCP_UNBLOCK(sk);
+			}
 			return ERROR_OK;
 		}
 		break;
-	case TCP_FIN_WAIT:
-		if(hdr->fin == 1 && hdr->ack == 1){
-			/* Connection succesfully closed */
-			tcp_send_ack(sk, hdr, 1);
-			sk->tcp->state = TCP_CLOSED;
-		}
-		break;
 	case TCP_CLOSE_WAIT:
-		if(hdr->fin == 0 && hdr->ack == 1){	
-			sk->tcp->state = TCP_FIN_WAIT;
-		}
-		break;
-	case TCP_CLOSE_WAIT2:
-		if(hdr->fin == 0 && hdr->ack == 1){	
-			sk->tcp->state = TCP_CLOSED;
-
-			if(sk->waiting != NULL){
-				sk->waiting->state = RUNNING;
-				sk->waiting = NULL;
-				sk->data_ready = -1;
-			}
+	case TCP_CLOSING:
+	case TCP_LAST_ACK:
+		if(hdr->syn == 0 && hdr->ack == 1){
+			tcp_recv_ack(sk, hdr, &opts, skb->data_len + hdr->fin);
+
+			/* A resent FIN, our acknowledgement of it was lost */
+			if(hdr->fin == 1) tcp_send_ack(sk);
 
+			if(sk->tcp->state != TCP_CLOSE_WAIT && sk->tcp->tcb->snd_una == sk->tcp->tcb->snd_nxt){
+				sk->tcp->state = TCP_CLOSED;
+				TCP_UNBLOCK(sk);
+			}
+			skb_free(skb);
+			return ERROR_OK;
 		}
-		break;	
+		break;
 	default:
 		break;
 	}
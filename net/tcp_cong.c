@@ -0,0 +1,249 @@
+/**
+ * @file tcp_cong.c
+ * @author Joe Bayer (joexbayer)
+ * @brief TCP congestion control.
+ * @version 0.1
+ * @date 2024-03-09
+ *
+ * Slow start, congestion avoidance, fast retransmit and fast recovery.
+ * Recovery follows NewReno (RFC 6582), partial acknowledgements resend
+ * the next missing segment without leaving recovery. With SACK the data
+ * in the network is known (RFC 6675), so the window is not inflated
+ * by duplicate acknowledgements.
+ * Algorithms only provide window growth and reduction, so others
+ * like CUBIC can be registered next to NewReno.
+ *
+ * @see https://www.rfc-editor.org/rfc/rfc5681
+ * @see https://www.rfc-editor.org/rfc/rfc6582
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <net/tcp.h>
+#include <net/tcp_cong.h>
+#include <serial.h>
+#include <errors.h>
+#include <math.h>
+#include <libc.h>
+
+static void __newreno_cong_avoid(struct tcb* tcb, uint32_t acked, uint32_t mss)
+{
+	if(tcb->cwnd < tcb->ssthresh){
+		/* Slow start, at most one MSS per acknowledgement */
+		tcb->cwnd += MIN(acked, mss);
+		return;
+	}
+
+	/* Congestion avoidance, about one MSS per round trip */
+	tcb->cwnd += MAX(1, (mss * mss) / tcb->cwnd);
+}
+
+static uint32_t __newreno_ssthresh(struct tcb* tcb, uint32_t mss)
+{
+	uint32_t flight = tcb->snd_nxt - tcb->snd_una;
+	return MAX(flight / 2, 2 * mss);
+}
+
+static struct tcp_congestion_ops tcp_newreno = {
+	.name = "newreno",
+	.cong_avoid = __newreno_cong_avoid,
+	.ssthresh = __newreno_ssthresh
+};
+
+static struct tcp_congestion_ops* __algorithms[TCP_CONGESTION_MAX] = {
+	&tcp_newreno
+};
+static struct tcp_congestion_ops* __default = &tcp_newreno;
+
+static const char* tcp_ca_state_str[] = {
+	"open",
+	"recovery",
+	"loss"
+};
+
+char* tcp_ca_state_to_str(tcp_ca_state_t state)
+{
+	if(state > TCP_CA_LOSS) return "unknown";
+	return (char*)tcp_ca_state_str[state];
+}
+
+/**
+ * @brief Makes an algorithm available to new connections.
+ * @return int 0 on success, less than 0 if there is no room or the name is taken.
+ */
+int tcp_congestion_register(struct tcp_congestion_ops* ops)
+{
+	if(ops == NULL || ops->cong_avoid == NULL || ops->ssthresh == NULL){
+		return -ERROR_INVALID_ARGUMENTS;
+	}
+
+	if(tcp_congestion_find(ops->name) != NULL) return -ERROR_INVALID_ARGUMENTS;
+
+	for (int i = 0; i < TCP_CONGESTION_MAX; i++){
+		if(__algorithms[i] != NULL) continue;
+
+		__algorithms[i] = ops;
+		return ERROR_OK;
+	}
+
+	return -ERROR_INDEX;
+}
+
+struct tcp_congestion_ops* tcp_congestion_find(char* name)
+{
+	for (int i = 0; i < TCP_CONGESTION_MAX; i++){
+		if(__algorithms[i] != NULL && strcmp(__algorithms[i]->name, name) == 0) return __algorithms[i];
+	}
+	return NULL;
+}
+
+struct tcp_congestion_ops* tcp_congestion_default()
+{
+	return __default;
+}
+
+/**
+ * @brief Selects the algorithm used by new connections.
+ * @return int 0 on success, less than 0 if the algorithm is unknown.
+ */
+int tcp_congestion_set_default(char* name)
+{
+	struct tcp_congestion_ops* ops = tcp_congestion_find(name);
+	if(ops == NULL) return -ERROR_INVALID_ARGUMENTS;
+
+	__default = ops;
+	return ERROR_OK;
+}
+
+/**
+ * @brief Names of all registered algorithms.
+ * @return int number of names written.
+ */
+int tcp_congestion_list(char** names, int max)
+{
+	int count = 0;
+	for (int i = 0; i < TCP_CONGESTION_MAX && count < max; i++){
+		if(__algorithms[i] != NULL) names[count++] = __algorithms[i]->name;
+	}
+	return count;
+}
+
+static void __tcp_cong_set_state(struct tcb* tcb, tcp_ca_state_t state)
+{
+	if(tcb->ca_state == state) return;
+
+	dbgprintf("[TCP] Congestion state %s -> %s (cwnd %d, ssthresh %d)\n",
+		tcp_ca_state_to_str(tcb->ca_state), tcp_ca_state_to_str(state), tcb->cwnd, tcb->ssthresh);
+
+	tcb->ca_state = state;
+	if(tcb->cong->set_state != NULL) tcb->cong->set_state(tcb, state);
+}
+
+/**
+ * @brief Sets up congestion control once the MSS is known.
+ */
+void tcp_cong_init(struct tcb* tcb, uint32_t mss)
+{
+	tcb->cong = tcp_congestion_default();
+	tcb->cwnd = TCP_INIT_CWND(mss);
+	tcb->ssthresh = TCP_INFINITE_SSTHRESH;
+	tcb->dupacks = 0;
+	tcb->recover = tcb->snd_una;
+	tcb->ca_state = TCP_CA_OPEN;
+
+	if(tcb->cong->init != NULL) tcb->cong->init(tcb, mss);
+}
+
+/**
+ * @brief New data was acknowledged, SND.UNA is already advanced.
+ * @param ack acknowledgement number.
+ * @param acked bytes newly acknowledged.
+ * @return int 1 if the segment at SND.UNA has to be resent.
+ */
+int tcp_cong_on_ack(struct tcb* tcb, uint32_t ack, uint32_t acked, uint32_t mss)
+{
+	uint32_t flight = tcb->snd_nxt - ack;
+
+	tcb->dupacks = 0;
+
+	switch (tcb->ca_state){
+	case TCP_CA_RECOVERY:
+		if(TCP_SEQ_GEQ(ack, tcb->recover)){
+			/* Full acknowledgement, deflate the window (RFC 6582 3.2 step 3) */
+			tcb->cwnd = MIN(tcb->ssthresh, MAX(flight, mss) + mss);
+			__tcp_cong_set_state(tcb, TCP_CA_OPEN);
+			return 0;
+		}
+
+		/* Partial acknowledgement, resend the next hole and deflate by the amount acknowledged */
+		if(tcb->options & TCP_OPTION_SACK) return 1;
+
+		tcb->cwnd = tcb->cwnd > acked ? tcb->cwnd - acked : 0;
+		if(acked >= mss) tcb->cwnd += mss;
+		tcb->cwnd = MAX(tcb->cwnd, mss);
+		return 1;
+
+	case TCP_CA_LOSS:
+		tcb->cong->cong_avoid(tcb, acked, mss);
+		if(TCP_SEQ_GEQ(ack, tcb->recover)){
+			__tcp_cong_set_state(tcb, TCP_CA_OPEN);
+			return 0;
+		}
+
+		/* Everything sent before the timeout is suspect, resend the next segment */
+		return 1;
+
+	default:
+		tcb->cong->cong_avoid(tcb, acked, mss);
+		return 0;
+	}
+}
+
+/**
+ * @brief Duplicate acknowledgement, no new data acknowledged and data is outstanding.
+ * @return int 1 if the segment at SND.UNA has to be resent (fast retransmit).
+ */
+int tcp_cong_on_dupack(struct tcb* tcb, uint32_t mss)
+{
+	switch (tcb->ca_state){
+	case TCP_CA_RECOVERY:
+		/* Each duplicate means a segment left the network */
+		if(!(tcb->options & TCP_OPTION_SACK)) tcb->cwnd += mss;
+		return 0;
+	case TCP_CA_LOSS:
+		return 0;
+	default:
+		break;
+	}
+
+	if(++tcb->dupacks < TCP_DUPACK_THRESHOLD) return 0;
+
+	/* Only one fast retransmit per window of data (RFC 6582 3.2 step 2) */
+	if(!TCP_SEQ_GT(tcb->snd_una, tcb->recover) && tcb->recover != tcb->snd_una) return 0;
+
+	tcb->ssthresh = tcb->cong->ssthresh(tcb, mss);
+	tcb->cwnd = tcb->ssthresh;
+	if(!(tcb->options & TCP_OPTION_SACK)) tcb->cwnd += TCP_DUPACK_THRESHOLD * mss;
+	tcb->recover = tcb->snd_nxt;
+	tcb->high_rxt = tcb->snd_una;
+	__tcp_cong_set_state(tcb, TCP_CA_RECOVERY);
+
+	return 1;
+}
+
+/**
+ * @brief Retransmission timeout, restart from a window of one segment.
+ */
+void tcp_cong_on_timeout(struct tcb* tcb, uint32_t mss)
+{
+	/* Repeated timeouts for the same data do not reduce the threshold again */
+	if(tcb->ca_state != TCP_CA_LOSS){
+		tcb->ssthresh = tcb->cong->ssthresh(tcb, mss);
+	}
+
+	tcb->cwnd = mss;
+	tcb->dupacks = 0;
+	tcb->recover = tcb->snd_nxt;
+	tcb->high_rxt = tcb->snd_una;
+	__tcp_cong_set_state(tcb, TCP_CA_LOSS);
+}
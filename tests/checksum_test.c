@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mocks.h>
+#include <net/checksum.h>
+#include <net/utils.h>
+
+#define BUFFER_SIZE 2048
+#define BENCH_SIZE 1460
+#define BENCH_ROUNDS 200000
+
+/* Straight RFC 1071 reference, one 16 bit word at a time. */
+static uint16_t reference_checksum(const uint8_t* data, int len, uint32_t sum)
+{
+    while(len > 1){
+        sum += data[0] | (data[1] << 8);
+        data += 2;
+        len -= 2;
+    }
+    if(len > 0){
+        sum += data[0];
+    }
+
+    while(sum >> 16){
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static double elapsed_ms(clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char const *argv[])
+{
+    static uint8_t buffer[BUFFER_SIZE + 8];
+    static uint8_t copy[BUFFER_SIZE + 8];
+    volatile uint32_t sink = 0;
+    int ok;
+
+    srand(1234);
+    for (int i = 0; i < (int)sizeof(buffer); i++){
+        buffer[i] = rand() & 0xFF;
+    }
+
+    /* All lengths, at every alignment */
+    ok = 1;
+    for (int offset = 0; offset < 4; offset++){
+        for (int len = 0; len <= 256; len++){
+            if(csum_fold(csum_partial(buffer + offset, len, 0)) != reference_checksum(buffer + offset, len, 0)){
+                ok = 0;
+            }
+        }
+    }
+    testprintf(ok, "csum_partial() - Matches RFC 1071 for lengths 0-256 at all alignments");
+
+    ok = 1;
+    for (int i = 0; i < 1000; i++){
+        int offset = rand() % 8;
+        int len = rand() % BUFFER_SIZE;
+        if(csum_fold(csum_partial(buffer + offset, len, 0)) != reference_checksum(buffer + offset, len, 0)){
+            ok = 0;
+        }
+    }
+    testprintf(ok, "csum_partial() - Matches RFC 1071 for random lengths");
+
+    /* Worst case for carries */
+    memset(copy, 0xFF, sizeof(copy));
+    testprintf(csum_fold(csum_partial(copy, BUFFER_SIZE + 1, 0xFFFFFFFF)) == reference_checksum(copy, BUFFER_SIZE + 1, 0xFFFF),
+        "csum_partial() - Carries from all ones are folded");
+
+    ok = 1;
+    for (int i = 0; i < 1000; i++){
+        int offset = rand() % 8;
+        int len = rand() % BUFFER_SIZE;
+        memset(copy, 0, sizeof(copy));
+        uint32_t sum = csum_partial_copy(copy + (i % 4), buffer + offset, len, 0);
+        if(csum_fold(sum) != reference_checksum(buffer + offset, len, 0) || memcmp(copy + (i % 4), buffer + offset, len) != 0){
+            ok = 0;
+        }
+        if(copy[(i % 4) + len] != 0){
+            ok = 0;
+        }
+    }
+    testprintf(ok, "csum_partial_copy() - Copies exactly len bytes and matches the checksum");
+
+    /* Partial sums of even length fragments combine */
+    uint32_t first = csum_partial(buffer, 40, 0);
+    uint32_t second = csum_partial(buffer + 40, 1000, 0);
+    testprintf(csum_fold(csum_add(first, second)) == reference_checksum(buffer, 1040, 0), "csum_add() - Combines partial sums");
+    testprintf(csum_fold(csum_partial(buffer + 40, 1000, first)) == reference_checksum(buffer, 1040, 0), "csum_partial() - Continues from a partial sum");
+
+    /* Pseudo header against the byte layout from RFC 793 */
+    uint8_t pseudo[12] = {10, 0, 2, 15, 10, 0, 2, 2, 0, 6, 0x05, 0xDC};
+    uint32_t saddr, daddr;
+    memcpy(&saddr, pseudo, 4);
+    memcpy(&daddr, pseudo + 4, 4);
+    testprintf(csum_fold(csum_pseudo(saddr, daddr, 6, 1500)) == reference_checksum(pseudo, sizeof(pseudo), 0), "csum_pseudo() - Matches the pseudo header layout");
+
+    /* A packet with a correct checksum sums to zero */
+    uint8_t packet[64];
+    memcpy(packet, buffer, sizeof(packet));
+    packet[10] = packet[11] = 0;
+    uint16_t check = csum_fold(csum_partial(packet, sizeof(packet), 0));
+    memcpy(packet + 10, &check, 2);
+    testprintf(checksum(packet, sizeof(packet), 0) == 0, "checksum() - Verifies to zero");
+
+    /* Incremental updates match a full recalculation */
+    ok = 1;
+    for (int i = 0; i < 1000; i++){
+        uint16_t old, new = rand() & 0xFFFF;
+        int field = (rand() % 16) * 2;
+        if(field == 10) field = 12;
+
+        memcpy(&old, packet + field, 2);
+        memcpy(packet + field, &new, 2);
+        memcpy(&check, packet + 10, 2);
+        check = csum_replace2(check, old, new);
+        memcpy(packet + 10, &check, 2);
+
+        if(checksum(packet, sizeof(packet), 0) != 0){
+            ok = 0;
+        }
+    }
+    testprintf(ok, "csum_replace2() - Matches a full recalculation");
+
+    /* Throughput, a full sized TCP payload */
+    clock_t start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++){
+        sink += reference_checksum(buffer + (i & 3), BENCH_SIZE, 0);
+    }
+    double reference_ms = elapsed_ms(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++){
+        sink += csum_partial(buffer + (i & 3), BENCH_SIZE, 0);
+    }
+    double partial_ms = elapsed_ms(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++){
+        memcpy(copy, buffer + (i & 3), BENCH_SIZE);
+        sink += reference_checksum(copy, BENCH_SIZE, 0);
+    }
+    double separate_ms = elapsed_ms(start);
+
+    start = clock();
+    for (int i = 0; i < BENCH_ROUNDS; i++){
+        sink += csum_partial_copy(copy, buffer + (i & 3), BENCH_SIZE, 0);
+    }
+    double fused_ms = elapsed_ms(start);
+
+    double mbytes = (double)BENCH_SIZE * BENCH_ROUNDS / (1024 * 1024);
+    fprintf(stderr, "%d x %d bytes:\n", BENCH_ROUNDS, BENCH_SIZE);
+    fprintf(stderr, "  RFC 1071 loop:       %8.1f ms %8.1f MB/s\n", reference_ms, mbytes * 1000 / reference_ms);
+    fprintf(stderr, "  csum_partial:        %8.1f ms %8.1f MB/s\n", partial_ms, mbytes * 1000 / partial_ms);
+    fprintf(stderr, "  memcpy + RFC 1071:   %8.1f ms %8.1f MB/s\n", separate_ms, mbytes * 1000 / separate_ms);
+    fprintf(stderr, "  csum_partial_copy:   %8.1f ms %8.1f MB/s\n", fused_ms, mbytes * 1000 / fused_ms);
+
+    test_summary();
+
+    return 0;
+}